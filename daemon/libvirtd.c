@@ -48,6 +48,7 @@
 #include "remote_driver.h"
 #include "viralloc.h"
 #include "virconf.h"
+#include "virnetdevlinkcache.h"
 #include "virnetlink.h"
 #include "virnetserver.h"
 #include "remote.h"
@@ -1490,7 +1491,8 @@ int main(int argc, char **argv) {
 
 #if defined(__linux__) && defined(NETLINK_ROUTE)
     /* Register the netlink event service for NETLINK_ROUTE */
-    if (virNetlinkEventServiceStart(NETLINK_ROUTE, 0) < 0) {
+    if (virNetlinkEventServiceStart(NETLINK_ROUTE, 0) < 0 ||
+        virNetDevLinkCacheStart() < 0) {
         ret = VIR_DAEMON_ERR_NETWORK;
         goto cleanup;
     }
@@ -71,6 +71,11 @@ typedef enum {
     VIR_STORAGE_POOL_DELETE_ZEROED = 1 << 0,  /* Clear all data to zeros (slow) */
 } virStoragePoolDeleteFlags;
 
+typedef enum {
+    VIR_STORAGE_POOL_REFRESH_LIST_ONLY = 1 << 0, /* Only enumerate volumes, leave
+                                                    details for later lookups */
+} virStoragePoolRefreshFlags;
+
 typedef struct _virStoragePoolInfo virStoragePoolInfo;
 
 struct _virStoragePoolInfo {
@@ -306,6 +311,7 @@ const char*             virStorageVolGetKey             (virStorageVolPtr vol);
 
 typedef enum {
     VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA = 1 << 0,
+    VIR_STORAGE_VOL_CREATE_BACKGROUND = 1 << 1, /* allocate in a background job */
 } virStorageVolCreateFlags;
 
 virStorageVolPtr        virStorageVolCreateXML          (virStoragePoolPtr pool,
@@ -352,6 +358,80 @@ int                     virStorageVolResize             (virStorageVolPtr vol,
                                                          unsigned long long capacity,
                                                          unsigned int flags);
 
+/**
+ * virStorageVolJobType:
+ *
+ * Describes the long running operations which can be tracked
+ * with virStorageVolGetJobInfo().
+ */
+typedef enum {
+    VIR_STORAGE_VOL_JOB_TYPE_UNKNOWN = 0, /* Placeholder */
+
+    VIR_STORAGE_VOL_JOB_TYPE_WIPE = 1,
+    /* virStorageVolWipe or virStorageVolWipePattern */
+
+    VIR_STORAGE_VOL_JOB_TYPE_BUILD = 2,
+    /* virStorageVolCreateXML with VIR_STORAGE_VOL_CREATE_BACKGROUND */
+
+# ifdef VIR_ENUM_SENTINELS
+    VIR_STORAGE_VOL_JOB_TYPE_LAST
+# endif
+} virStorageVolJobType;
+
+typedef struct _virStorageVolJobInfo virStorageVolJobInfo;
+struct _virStorageVolJobInfo {
+    int type; /* virStorageVolJobType */
+    unsigned long long bandwidth; /* bytes/s, 0 if unlimited */
+
+    /*
+     * @cur indicates how many bytes have been processed so far and will be
+     * between 0 and @end.  To approximate progress, divide @cur by @end.
+     */
+    unsigned long long cur;
+    unsigned long long end;
+};
+typedef virStorageVolJobInfo *virStorageVolJobInfoPtr;
+
+int                     virStorageVolGetJobInfo         (virStorageVolPtr vol,
+                                                         virStorageVolJobInfoPtr info,
+                                                         unsigned int flags);
+int                     virStorageVolJobSetSpeed        (virStorageVolPtr vol,
+                                                         unsigned long long bandwidth,
+                                                         unsigned int flags);
+int                     virStorageVolJobAbort           (virStorageVolPtr vol,
+                                                         unsigned int flags);
+
+/**
+ * virStoragePoolJobType:
+ *
+ * Describes the pool level operation in progress, as reported by
+ * virStoragePoolGetJobInfo().
+ */
+typedef enum {
+    VIR_STORAGE_POOL_JOB_NONE = 0,    /* No job running */
+    VIR_STORAGE_POOL_JOB_START = 1,   /* Pool is being started */
+    VIR_STORAGE_POOL_JOB_BUILD = 2,   /* Pool is being built */
+    VIR_STORAGE_POOL_JOB_REFRESH = 3, /* Volumes are being rescanned */
+    VIR_STORAGE_POOL_JOB_DESTROY = 4, /* Pool is being stopped */
+    VIR_STORAGE_POOL_JOB_DELETE = 5,  /* Pool is being deleted */
+
+# ifdef VIR_ENUM_SENTINELS
+    VIR_STORAGE_POOL_JOB_LAST
+# endif
+} virStoragePoolJobType;
+
+typedef struct _virStoragePoolJobInfo virStoragePoolJobInfo;
+struct _virStoragePoolJobInfo {
+    int type; /* virStoragePoolJobType */
+    unsigned long long timeElapsed; /* ms since the job started */
+    unsigned int volJobs; /* volumes being allocated, copied or wiped */
+};
+typedef virStoragePoolJobInfo *virStoragePoolJobInfoPtr;
+
+int                     virStoragePoolGetJobInfo        (virStoragePoolPtr pool,
+                                                         virStoragePoolJobInfoPtr info,
+                                                         unsigned int flags);
+
 int virStoragePoolIsActive(virStoragePoolPtr pool);
 int virStoragePoolIsPersistent(virStoragePoolPtr pool);
 
@@ -2955,6 +2955,7 @@ virNWFilterInstFiltersOnAllVMs(void)
         .opaque = virNWFilterDomainFWUpdateOpaque,
         .step = STEP_APPLY_CURRENT,
         .skipInterfaces = NULL, /* not needed */
+        .filtername = NULL,
     };
 
     for (i = 0; i < nCallbackDriver; i++)
@@ -2964,8 +2965,12 @@ virNWFilterInstFiltersOnAllVMs(void)
     return 0;
 }
 
+/*
+ * Rebuilds the rules of the interfaces referencing the filter
+ * @filtername, which is about to be updated or removed.
+ */
 static int
-virNWFilterTriggerVMFilterRebuild(void)
+virNWFilterTriggerVMFilterRebuild(const char *filtername)
 {
     size_t i;
     int ret = 0;
@@ -2973,6 +2978,7 @@ virNWFilterTriggerVMFilterRebuild(void)
         .opaque = virNWFilterDomainFWUpdateOpaque,
         .step = STEP_APPLY_NEW,
         .skipInterfaces = virHashCreate(0, NULL),
+        .filtername = filtername,
     };
 
     if (!cb.skipInterfaces)
@@ -3011,7 +3017,7 @@ virNWFilterTestUnassignDef(virNWFilterObjPtr nwfilter)
 
     nwfilter->wantRemoved = 1;
     /* trigger the update on VMs referencing the filter */
-    if (virNWFilterTriggerVMFilterRebuild())
+    if (virNWFilterTriggerVMFilterRebuild(nwfilter->def->name))
         rc = -1;
 
     nwfilter->wantRemoved = 0;
@@ -3097,7 +3103,7 @@ virNWFilterObjAssignDef(virNWFilterObjListPtr nwfilters,
 
         nwfilter->newDef = def;
         /* trigger the update on VMs referencing the filter */
-        if (virNWFilterTriggerVMFilterRebuild()) {
+        if (virNWFilterTriggerVMFilterRebuild(def->name)) {
             nwfilter->newDef = NULL;
             virNWFilterObjUnlock(nwfilter);
             return NULL;
@@ -588,6 +588,7 @@ struct domUpdateCBStruct {
     void *opaque;
     UpdateStep step;
     virHashTablePtr skipInterfaces;
+    const char *filtername; /* the changed filter, NULL if unknown */
 };
 
 
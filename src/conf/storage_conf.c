@@ -1756,7 +1756,8 @@ virStoragePoolObjAssignDef(virStoragePoolObjListPtr pools,
     virStoragePoolObjPtr pool;
 
     if ((pool = virStoragePoolObjFindByName(pools, def->name))) {
-        if (!virStoragePoolObjIsActive(pool)) {
+        if (!virStoragePoolObjIsActive(pool) &&
+            pool->job == VIR_STORAGE_POOL_JOB_NONE) {
             virStoragePoolDefFree(pool->def);
             pool->def = def;
         } else {
@@ -2039,6 +2040,12 @@ virStoragePoolObjIsDuplicate(virStoragePoolObjListPtr pools,
                                pool->def->name);
                 goto cleanup;
             }
+            if (pool->job != VIR_STORAGE_POOL_JOB_NONE) {
+                virReportError(VIR_ERR_OPERATION_INVALID,
+                               _("pool '%s' is busy"),
+                               pool->def->name);
+                goto cleanup;
+            }
         }
 
         ret = 1;
@@ -57,6 +57,10 @@ struct _virStorageVolSource {
 };
 
 
+/* Defined by the storage driver, see storage_backend.h */
+typedef struct _virStorageVolJob virStorageVolJob;
+typedef virStorageVolJob *virStorageVolJobPtr;
+
 typedef struct _virStorageVolDef virStorageVolDef;
 typedef virStorageVolDef *virStorageVolDefPtr;
 struct _virStorageVolDef {
@@ -67,6 +71,9 @@ struct _virStorageVolDef {
     bool building;
     unsigned int in_use;
 
+    virStorageVolJobPtr job; /* long running operation, if any */
+    unsigned long long jobBandwidth; /* bytes/s limit for the next job */
+
     virStorageVolSource source;
     virStorageSource target;
 };
@@ -267,6 +274,11 @@ struct _virStoragePoolObj {
     int autostart;
     unsigned int asyncjobs;
 
+    /* Pool level operation in progress, during which the pool lock may
+     * be dropped. While set, @def is only replaced through @newDef. */
+    int job; /* virStoragePoolJobType */
+    unsigned long long jobStarted; /* ms since epoch */
+
     virStoragePoolDefPtr def;
     virStoragePoolDefPtr newDef;
 
@@ -291,6 +303,12 @@ struct _virStorageDriverState {
     char *configDir;
     char *autostartDir;
     bool privileged;
+
+    /* Background volume builds still running. Guarded by buildLock
+     * rather than lock, as it's updated with a pool locked */
+    virMutex buildLock;
+    virCond buildCond;
+    size_t buildThreads;
 };
 
 typedef struct _virStoragePoolSourceList virStoragePoolSourceList;
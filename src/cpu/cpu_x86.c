@@ -32,7 +32,9 @@
 #include "cpu_x86.h"
 #include "virbuffer.h"
 #include "virendian.h"
+#include "virhash.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_CPU
 
@@ -44,6 +46,16 @@ static const virCPUx86CPUID cpuidNull = { 0, 0, 0, 0, 0 };
 
 static const virArch archs[] = { VIR_ARCH_I686, VIR_ARCH_X86_64 };
 
+/* Dense view of CPUID data limited to the leaves the CPU map knows about.
+ * Each leaf takes two words (eax:ebx and ecx:edx) at a position fixed when
+ * the map is loaded, so that set operations are plain loops over an array
+ * rather than leaf lookups, which compilers easily turn into vector code. */
+#define X86_BITMAP_LEAVES 16
+
+struct x86_bitmap {
+    uint64_t words[2 * X86_BITMAP_LEAVES];
+};
+
 struct x86_vendor {
     char *name;
     virCPUx86CPUID cpuid;
@@ -54,6 +66,7 @@ struct x86_vendor {
 struct x86_feature {
     char *name;
     virCPUx86Data *data;
+    struct x86_bitmap bits;     /* only valid for features in the map */
 
     struct x86_feature *next;
 };
@@ -81,6 +94,7 @@ struct x86_model {
     char *name;
     const struct x86_vendor *vendor;
     virCPUx86Data *data;
+    struct x86_bitmap bits;     /* only valid for models in the map */
 
     struct x86_model *next;
 };
@@ -90,6 +104,14 @@ struct x86_map {
     struct x86_feature *features;
     struct x86_model *models;
     struct x86_feature *migrate_blockers;
+
+    /* name -> struct x86_feature/x86_model, owned by the lists above */
+    virHashTablePtr featureIndex;
+    virHashTablePtr modelIndex;
+
+    /* CPUID functions stored in struct x86_bitmap */
+    uint32_t leaves[X86_BITMAP_LEAVES];
+    size_t nleaves;
 };
 
 static struct x86_map* virCPUx86Map;
@@ -97,6 +119,24 @@ int virCPUx86MapOnceInit(void);
 VIR_ONCE_GLOBAL_INIT(virCPUx86Map);
 
 
+/* Comparing and decoding CPUs only depends on the input and the CPU map,
+ * which never changes once loaded, while the same CPUs keep being compared
+ * over and over again (e.g., on every incoming migration). Results are
+ * therefore memoized, the caches are simply flushed once they get full. */
+#define X86_CACHE_MAX 512
+
+struct x86_compare_result {
+    virCPUCompareResult ret;
+    char *message;
+    virArch arch;
+    virCPUx86Data *guest;       /* only if guest data was requested */
+};
+
+static virMutex x86CacheLock;
+static virHashTablePtr x86CompareCache;
+static virHashTablePtr x86DecodeCache;
+
+
 enum compare_result {
     SUBSET,
     EQUAL,
@@ -387,6 +427,79 @@ x86DataIsSubset(const virCPUx86Data *data,
 }
 
 
+static void
+x86BitmapFromData(const struct x86_map *map,
+                  const virCPUx86Data *data,
+                  struct x86_bitmap *bits)
+{
+    size_t i;
+
+    memset(bits, 0, sizeof(*bits));
+
+    for (i = 0; i < map->nleaves; i++) {
+        const virCPUx86CPUID *cpuid;
+
+        if (!(cpuid = x86DataCpuid(data, map->leaves[i])))
+            continue;
+
+        bits->words[2 * i] = ((uint64_t) cpuid->eax << 32) | cpuid->ebx;
+        bits->words[2 * i + 1] = ((uint64_t) cpuid->ecx << 32) | cpuid->edx;
+    }
+}
+
+
+/* dst = bits1 & ~bits2 */
+static void
+x86BitmapAndNot(struct x86_bitmap *dst,
+                const struct x86_bitmap *bits1,
+                const struct x86_bitmap *bits2,
+                size_t nleaves)
+{
+    size_t i;
+
+    for (i = 0; i < 2 * nleaves; i++)
+        dst->words[i] = bits1->words[i] & ~bits2->words[i];
+}
+
+
+static bool
+x86BitmapIsSubset(const struct x86_bitmap *bits,
+                  const struct x86_bitmap *subset,
+                  size_t nleaves)
+{
+    uint64_t missing = 0;
+    size_t i;
+
+    for (i = 0; i < 2 * nleaves; i++)
+        missing |= subset->words[i] & ~bits->words[i];
+
+    return missing == 0;
+}
+
+
+/* Counts features x86DataToCPUFeatures would find in @bits, removing them
+ * from @bits on the way. Counting stops once @limit features are found. */
+static size_t
+x86BitmapCountFeatures(const struct x86_map *map,
+                       struct x86_bitmap *bits,
+                       size_t limit)
+{
+    const struct x86_feature *feature;
+    size_t count = 0;
+
+    for (feature = map->features;
+         feature && count < limit;
+         feature = feature->next) {
+        if (x86BitmapIsSubset(bits, &feature->bits, map->nleaves)) {
+            x86BitmapAndNot(bits, bits, &feature->bits, map->nleaves);
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
 /* also removes all detected features from data */
 static int
 x86DataToCPUFeatures(virCPUDefPtr cpu,
@@ -618,17 +731,7 @@ static struct x86_feature *
 x86FeatureFind(const struct x86_map *map,
                const char *name)
 {
-    struct x86_feature *feature;
-
-    feature = map->features;
-    while (feature != NULL) {
-        if (STREQ(feature->name, name))
-            return feature;
-
-        feature = feature->next;
-    }
-
-    return NULL;
+    return virHashLookup(map->featureIndex, name);
 }
 
 
@@ -746,8 +849,12 @@ x86FeatureLoad(xmlXPathContextPtr ctxt,
 
         migrate_blocker->next = map->migrate_blockers;
         map->migrate_blockers = migrate_blocker;
+        migrate_blocker = NULL;
     }
 
+    if (virHashAddEntry(map->featureIndex, feature->name, feature) < 0)
+        goto error;
+
     if (map->features == NULL) {
         map->features = feature;
     } else {
@@ -853,17 +960,7 @@ static struct x86_model *
 x86ModelFind(const struct x86_map *map,
              const char *name)
 {
-    struct x86_model *model;
-
-    model = map->models;
-    while (model != NULL) {
-        if (STREQ(model->name, name))
-            return model;
-
-        model = model->next;
-    }
-
-    return NULL;
+    return virHashLookup(map->modelIndex, name);
 }
 
 
@@ -1088,6 +1185,9 @@ x86ModelLoad(xmlXPathContextPtr ctxt,
             goto error;
     }
 
+    if (virHashUpdateEntry(map->modelIndex, model->name, model) < 0)
+        goto error;
+
     if (map->models == NULL) {
         map->models = model;
     } else {
@@ -1115,6 +1215,9 @@ x86MapFree(struct x86_map *map)
     if (map == NULL)
         return;
 
+    virHashFree(map->featureIndex);
+    virHashFree(map->modelIndex);
+
     while (map->features != NULL) {
         struct x86_feature *feature = map->features;
         map->features = feature->next;
@@ -1189,6 +1292,9 @@ x86MapLoadInternalFeatures(struct x86_map *map)
         if (virCPUx86DataAddCPUID(feature->data, &x86_kvm_features[i].cpuid))
             goto error;
 
+        if (virHashAddEntry(map->featureIndex, feature->name, feature) < 0)
+            goto error;
+
         if (map->features == NULL) {
             map->features = feature;
         } else {
@@ -1207,6 +1313,48 @@ x86MapLoadInternalFeatures(struct x86_map *map)
 }
 
 
+static int
+x86MapLoadBitmaps(struct x86_map *map)
+{
+    struct x86_feature *feature;
+    struct x86_model *model;
+    size_t i;
+
+    /* models are made of features so their leaves are all we need */
+    for (feature = map->features; feature; feature = feature->next) {
+        for (i = 0; i < feature->data->len; i++) {
+            uint32_t function = feature->data->data[i].function;
+            size_t j;
+
+            for (j = 0; j < map->nleaves; j++) {
+                if (map->leaves[j] == function)
+                    break;
+            }
+
+            if (j < map->nleaves)
+                continue;
+
+            if (map->nleaves == X86_BITMAP_LEAVES) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("CPU map uses more than %d CPUID leaves"),
+                               X86_BITMAP_LEAVES);
+                return -1;
+            }
+
+            map->leaves[map->nleaves++] = function;
+        }
+    }
+
+    for (feature = map->features; feature; feature = feature->next)
+        x86BitmapFromData(map, feature->data, &feature->bits);
+
+    for (model = map->models; model; model = model->next)
+        x86BitmapFromData(map, model->data, &model->bits);
+
+    return 0;
+}
+
+
 static struct x86_map *
 virCPUx86LoadMap(void)
 {
@@ -1215,12 +1363,19 @@ virCPUx86LoadMap(void)
     if (VIR_ALLOC(map) < 0)
         return NULL;
 
+    if (!(map->featureIndex = virHashCreate(128, NULL)) ||
+        !(map->modelIndex = virHashCreate(32, NULL)))
+        goto error;
+
     if (cpuMapLoad("x86", x86MapLoadCallback, map) < 0)
         goto error;
 
     if (x86MapLoadInternalFeatures(map) < 0)
         goto error;
 
+    if (x86MapLoadBitmaps(map) < 0)
+        goto error;
+
     return map;
 
  error:
@@ -1229,9 +1384,41 @@ virCPUx86LoadMap(void)
 }
 
 
+static void
+x86CompareResultFree(void *payload,
+                     const void *name ATTRIBUTE_UNUSED)
+{
+    struct x86_compare_result *result = payload;
+
+    VIR_FREE(result->message);
+    virCPUx86DataFree(result->guest);
+    VIR_FREE(result);
+}
+
+
+static void
+x86DecodeResultFree(void *payload,
+                    const void *name ATTRIBUTE_UNUSED)
+{
+    virCPUDefFree(payload);
+}
+
+
 int
 virCPUx86MapOnceInit(void)
 {
+    if (virMutexInit(&x86CacheLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(x86CompareCache = virHashCreate(X86_CACHE_MAX / 8,
+                                          x86CompareResultFree)) ||
+        !(x86DecodeCache = virHashCreate(X86_CACHE_MAX / 8,
+                                         x86DecodeResultFree)))
+        return -1;
+
     if (!(virCPUx86Map = virCPUx86LoadMap()))
         return -1;
 
@@ -1249,6 +1436,82 @@ virCPUx86GetMap(void)
 }
 
 
+/**
+ * virCPUx86CacheFlush:
+ *
+ * Forget all memoized results of CPU comparison and decoding.
+ */
+void
+virCPUx86CacheFlush(void)
+{
+    if (virCPUx86MapInitialize() < 0)
+        return;
+
+    virMutexLock(&x86CacheLock);
+    virHashRemoveAll(x86CompareCache);
+    virHashRemoveAll(x86DecodeCache);
+    virMutexUnlock(&x86CacheLock);
+}
+
+
+/* Caller must hold x86CacheLock */
+static int
+x86CacheAdd(virHashTablePtr cache,
+            const char *key,
+            void *value)
+{
+    if (!virHashLookup(cache, key) &&
+        virHashSize(cache) >= X86_CACHE_MAX)
+        virHashRemoveAll(cache);
+
+    return virHashUpdateEntry(cache, key, value);
+}
+
+
+static void
+x86CacheKeyCPU(virBufferPtr buf,
+               const virCPUDef *cpu)
+{
+    size_t i;
+
+    virBufferAsprintf(buf, "%d:%d:%d:%s:%s",
+                      cpu->type, cpu->arch, cpu->match,
+                      NULLSTR(cpu->vendor), NULLSTR(cpu->model));
+
+    for (i = 0; i < cpu->nfeatures; i++)
+        virBufferAsprintf(buf, ",%s=%d",
+                          cpu->features[i].name, cpu->features[i].policy);
+
+    virBufferAddChar(buf, ';');
+}
+
+
+static void
+x86CacheKeyData(virBufferPtr buf,
+                const virCPUx86Data *data)
+{
+    struct virCPUx86DataIterator iter = virCPUx86DataIteratorInit(data);
+    virCPUx86CPUID *cpuid;
+
+    while ((cpuid = x86DataCpuidNext(&iter)))
+        virBufferAsprintf(buf, "%x:%x:%x:%x:%x,",
+                          cpuid->function, cpuid->eax, cpuid->ebx,
+                          cpuid->ecx, cpuid->edx);
+
+    virBufferAddChar(buf, ';');
+}
+
+
+static char *
+x86CacheKeyFinish(virBufferPtr buf)
+{
+    if (virBufferCheckError(buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(buf);
+}
+
+
 static char *
 x86CPUDataFormat(const virCPUData *data)
 {
@@ -1352,10 +1615,10 @@ x86CPUDataParse(const char *xmlStr)
 
 
 static virCPUCompareResult
-x86Compute(virCPUDefPtr host,
-           virCPUDefPtr cpu,
-           virCPUDataPtr *guest,
-           char **message)
+x86ComputeUncached(virCPUDefPtr host,
+                   virCPUDefPtr cpu,
+                   virCPUDataPtr *guest,
+                   char **message)
 {
     const struct x86_map *map = NULL;
     struct x86_model *host_model = NULL;
@@ -1504,6 +1767,92 @@ x86Compute(virCPUDefPtr host,
 #undef virX86CpuIncompatible
 
 
+static virCPUCompareResult
+x86Compute(virCPUDefPtr host,
+           virCPUDefPtr cpu,
+           virCPUDataPtr *guest,
+           char **message)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    struct x86_compare_result *result = NULL;
+    const struct x86_compare_result *cached;
+    virCPUDataPtr guestData = NULL;
+    virCPUx86Data *data = NULL;
+    char *msg = NULL;
+    char *key = NULL;
+    virCPUCompareResult ret = VIR_CPU_COMPARE_ERROR;
+
+    if (virCPUx86MapInitialize() < 0)
+        return VIR_CPU_COMPARE_ERROR;
+
+    x86CacheKeyCPU(&buf, host);
+    x86CacheKeyCPU(&buf, cpu);
+    virBufferAddChar(&buf, guest ? 'g' : '-');
+    if (!(key = x86CacheKeyFinish(&buf)))
+        return VIR_CPU_COMPARE_ERROR;
+
+    virMutexLock(&x86CacheLock);
+    if ((cached = virHashLookup(x86CompareCache, key))) {
+        if ((message && VIR_STRDUP(msg, cached->message) < 0) ||
+            (guest && cached->guest && !(data = x86DataCopy(cached->guest)))) {
+            virMutexUnlock(&x86CacheLock);
+            goto cleanup;
+        }
+        ret = cached->ret;
+        if (guest && data &&
+            !(guestData = virCPUx86MakeData(cached->arch, &data)))
+            ret = VIR_CPU_COMPARE_ERROR;
+        virMutexUnlock(&x86CacheLock);
+        goto done;
+    }
+    virMutexUnlock(&x86CacheLock);
+
+    ret = x86ComputeUncached(host, cpu, guest ? &guestData : NULL, &msg);
+    if (ret == VIR_CPU_COMPARE_ERROR)
+        goto cleanup;
+
+    if (VIR_ALLOC(result) < 0 ||
+        VIR_STRDUP(result->message, msg) < 0 ||
+        (guestData &&
+         !(result->guest = x86DataCopy(guestData->data.x86)))) {
+        ret = VIR_CPU_COMPARE_ERROR;
+        goto cleanup;
+    }
+    result->ret = ret;
+    if (guestData)
+        result->arch = guestData->arch;
+
+    /* a failure only costs us recomputing the result next time */
+    virMutexLock(&x86CacheLock);
+    if (x86CacheAdd(x86CompareCache, key, result) == 0)
+        result = NULL;
+    else
+        virResetLastError();
+    virMutexUnlock(&x86CacheLock);
+
+ done:
+    if (ret != VIR_CPU_COMPARE_ERROR) {
+        if (message) {
+            *message = msg;
+            msg = NULL;
+        }
+        if (guest) {
+            *guest = guestData;
+            guestData = NULL;
+        }
+    }
+
+ cleanup:
+    if (result)
+        x86CompareResultFree(result, key);
+    x86FreeCPUData(guestData);
+    virCPUx86DataFree(data);
+    VIR_FREE(msg);
+    VIR_FREE(key);
+    return ret;
+}
+
+
 static virCPUCompareResult
 x86Compare(virCPUDefPtr host,
            virCPUDefPtr cpu,
@@ -1539,17 +1888,23 @@ x86GuestData(virCPUDefPtr host,
 
 
 static int
-x86Decode(virCPUDefPtr cpu,
-          const virCPUx86Data *data,
-          const char **models,
-          unsigned int nmodels,
-          const char *preferred,
-          unsigned int flags)
+x86DecodeUncached(virCPUDefPtr cpu,
+                  const virCPUx86Data *data,
+                  const char **models,
+                  unsigned int nmodels,
+                  const char *preferred,
+                  unsigned int flags)
 {
     int ret = -1;
     const struct x86_map *map;
     const struct x86_model *candidate;
-    virCPUDefPtr cpuCandidate;
+    const struct x86_model *best = NULL;
+    const struct x86_vendor *vendor;
+    struct x86_bitmap dataBits;
+    struct x86_bitmap allBits;
+    struct x86_bitmap bits;
+    size_t bestFeatures = 0;
+    size_t nfeatures;
     virCPUDefPtr cpuModel = NULL;
     virCPUx86Data *copy = NULL;
     virCPUx86Data *features = NULL;
@@ -1561,10 +1916,23 @@ x86Decode(virCPUDefPtr cpu,
     if (!data || !(map = virCPUx86GetMap()))
         return -1;
 
-    candidate = map->models;
-    while (candidate != NULL) {
+    /* Only count the features each candidate would need to be enabled or
+     * disabled on top of it and build the CPU definition for the winner */
+    if (!(copy = x86DataCopy(data)))
+        goto out;
+    vendor = x86DataToVendor(copy, map);
+    x86BitmapFromData(map, copy, &dataBits);
+    x86BitmapFromData(map, data, &allBits);
+    virCPUx86DataFree(copy);
+    copy = NULL;
+
+    for (candidate = map->models; candidate; candidate = candidate->next) {
+        bool isPreferred = preferred && STREQ(candidate->name, preferred);
+        size_t ndisabled;
+        size_t limit = SIZE_MAX;
+
         if (!cpuModelIsAllowed(candidate->name, models, nmodels)) {
-            if (preferred && STREQ(candidate->name, preferred)) {
+            if (isPreferred) {
                 if (cpu->fallback != VIR_CPU_FALLBACK_ALLOW) {
                     virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                    _("CPU model %s is not supported by hypervisor"),
@@ -1579,60 +1947,60 @@ x86Decode(virCPUDefPtr cpu,
                 VIR_DEBUG("CPU model %s not allowed by hypervisor; ignoring",
                           candidate->name);
             }
-            goto next;
+            continue;
         }
 
-        if (!(cpuCandidate = x86DataToCPU(data, candidate, map)))
-            goto out;
-
-        if (candidate->vendor && cpuCandidate->vendor &&
-            STRNEQ(candidate->vendor->name, cpuCandidate->vendor)) {
+        if (candidate->vendor && vendor &&
+            STRNEQ(candidate->vendor->name, vendor->name)) {
             VIR_DEBUG("CPU vendor %s of model %s differs from %s; ignoring",
-                      candidate->vendor->name, candidate->name,
-                      cpuCandidate->vendor);
-            virCPUDefFree(cpuCandidate);
-            goto next;
+                      candidate->vendor->name, candidate->name, vendor->name);
+            continue;
         }
 
-        if (cpu->type == VIR_CPU_TYPE_HOST) {
-            cpuCandidate->type = VIR_CPU_TYPE_HOST;
-            for (i = 0; i < cpuCandidate->nfeatures; i++) {
-                switch (cpuCandidate->features[i].policy) {
-                case VIR_CPU_FEATURE_DISABLE:
-                    virCPUDefFree(cpuCandidate);
-                    goto next;
-                default:
-                    cpuCandidate->features[i].policy = -1;
-                }
-            }
-        }
+        x86BitmapAndNot(&bits, &candidate->bits, &allBits, map->nleaves);
+        ndisabled = x86BitmapCountFeatures(map, &bits, SIZE_MAX);
+
+        /* host CPU cannot have disabled features */
+        if (cpu->type == VIR_CPU_TYPE_HOST && ndisabled > 0)
+            continue;
 
-        if (preferred && STREQ(cpuCandidate->model, preferred)) {
-            virCPUDefFree(cpuModel);
-            cpuModel = cpuCandidate;
-            cpuData = candidate->data;
+        if (isPreferred) {
+            best = candidate;
             break;
         }
 
-        if (cpuModel == NULL
-            || cpuModel->nfeatures > cpuCandidate->nfeatures) {
-            virCPUDefFree(cpuModel);
-            cpuModel = cpuCandidate;
-            cpuData = candidate->data;
-        } else {
-            virCPUDefFree(cpuCandidate);
+        /* a candidate needs strictly fewer features to win */
+        if (best) {
+            if (ndisabled >= bestFeatures)
+                continue;
+            limit = bestFeatures - ndisabled;
         }
 
-    next:
-        candidate = candidate->next;
+        x86BitmapAndNot(&bits, &dataBits, &candidate->bits, map->nleaves);
+        nfeatures = ndisabled + x86BitmapCountFeatures(map, &bits, limit);
+
+        if (!best || bestFeatures > nfeatures) {
+            best = candidate;
+            bestFeatures = nfeatures;
+        }
     }
 
-    if (cpuModel == NULL) {
+    if (!best) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("Cannot find suitable CPU model for given data"));
         goto out;
     }
 
+    if (!(cpuModel = x86DataToCPU(data, best, map)))
+        goto out;
+    cpuData = best->data;
+
+    if (cpu->type == VIR_CPU_TYPE_HOST) {
+        cpuModel->type = VIR_CPU_TYPE_HOST;
+        for (i = 0; i < cpuModel->nfeatures; i++)
+            cpuModel->features[i].policy = -1;
+    }
+
     if (flags & VIR_CONNECT_BASELINE_CPU_EXPAND_FEATURES) {
         if (!(copy = x86DataCopy(cpuData)) ||
             !(features = x86DataFromCPUFeatures(cpuModel, map)))
@@ -1659,6 +2027,75 @@ x86Decode(virCPUDefPtr cpu,
     return ret;
 }
 
+
+static int
+x86Decode(virCPUDefPtr cpu,
+          const virCPUx86Data *data,
+          const char **models,
+          unsigned int nmodels,
+          const char *preferred,
+          unsigned int flags)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virCPUDefPtr result = NULL;
+    char *key = NULL;
+    size_t i;
+    int ret = -1;
+
+    virCheckFlags(VIR_CONNECT_BASELINE_CPU_EXPAND_FEATURES, -1);
+
+    if (!data || virCPUx86MapInitialize() < 0)
+        return -1;
+
+    x86CacheKeyData(&buf, data);
+    virBufferAsprintf(&buf, "%d:%d:%x:%s:%u", cpu->type, cpu->fallback,
+                      flags, NULLSTR(preferred), nmodels);
+    for (i = 0; i < nmodels; i++)
+        virBufferAsprintf(&buf, ",%s", models[i]);
+    if (!(key = x86CacheKeyFinish(&buf)))
+        return -1;
+
+    virMutexLock(&x86CacheLock);
+    if ((result = virHashLookup(x86DecodeCache, key)))
+        result = virCPUDefCopy(result);
+    virMutexUnlock(&x86CacheLock);
+
+    if (!result) {
+        if (x86DecodeUncached(cpu, data, models, nmodels, preferred, flags) < 0)
+            goto cleanup;
+
+        /* a failure only costs us decoding the data again next time */
+        virMutexLock(&x86CacheLock);
+        if ((result = virCPUDefCopy(cpu)) &&
+            x86CacheAdd(x86DecodeCache, key, result) == 0)
+            result = NULL;
+        else
+            virResetLastError();
+        virMutexUnlock(&x86CacheLock);
+
+        ret = 0;
+        goto cleanup;
+    }
+
+    cpu->model = result->model;
+    cpu->vendor = result->vendor;
+    cpu->nfeatures = result->nfeatures;
+    cpu->nfeatures_max = result->nfeatures_max;
+    cpu->features = result->features;
+    result->model = NULL;
+    result->vendor = NULL;
+    result->nfeatures = 0;
+    result->nfeatures_max = 0;
+    result->features = NULL;
+
+    ret = 0;
+
+ cleanup:
+    virCPUDefFree(result);
+    VIR_FREE(key);
+    return ret;
+}
+
 static int
 x86DecodeCPUData(virCPUDefPtr cpu,
                  const virCPUData *data,
@@ -37,4 +37,6 @@ void virCPUx86DataFree(virCPUx86Data *data);
 virCPUDataPtr virCPUx86MakeData(virArch arch,
                                 virCPUx86Data **data);
 
+void virCPUx86CacheFlush(void);
+
 #endif /* __VIR_CPU_X86_H__ */
@@ -194,6 +194,25 @@ typedef int
                           unsigned long long capacity,
                           unsigned int flags);
 
+typedef int
+(*virDrvStorageVolGetJobInfo)(virStorageVolPtr vol,
+                              virStorageVolJobInfoPtr info,
+                              unsigned int flags);
+
+typedef int
+(*virDrvStorageVolJobSetSpeed)(virStorageVolPtr vol,
+                               unsigned long long bandwidth,
+                               unsigned int flags);
+
+typedef int
+(*virDrvStorageVolJobAbort)(virStorageVolPtr vol,
+                            unsigned int flags);
+
+typedef int
+(*virDrvStoragePoolGetJobInfo)(virStoragePoolPtr pool,
+                               virStoragePoolJobInfoPtr info,
+                               unsigned int flags);
+
 typedef int
 (*virDrvStoragePoolIsActive)(virStoragePoolPtr pool);
 
@@ -259,6 +278,10 @@ struct _virStorageDriver {
     virDrvStorageVolResize storageVolResize;
     virDrvStoragePoolIsActive storagePoolIsActive;
     virDrvStoragePoolIsPersistent storagePoolIsPersistent;
+    virDrvStorageVolGetJobInfo storageVolGetJobInfo;
+    virDrvStorageVolJobSetSpeed storageVolJobSetSpeed;
+    virDrvStorageVolJobAbort storageVolJobAbort;
+    virDrvStoragePoolGetJobInfo storagePoolGetJobInfo;
 };
 
 
@@ -10938,6 +10938,12 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * the function return error in case some of the stat types in @stats were
  * not recognized by the daemon.
  *
+ * With VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED, hypervisors which sample
+ * statistics of running domains in the background may return those samples
+ * instead of querying each domain, as long as they are recent enough. The
+ * allowed age depends on the hypervisor configuration. Domains with no
+ * such sample are queried as usual.
+ *
  * Similarly to virConnectListAllDomains, @flags can contain various flags to
  * filter the list of domains to provide stats for.
  *
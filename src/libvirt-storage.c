@@ -846,12 +846,18 @@ virStoragePoolRef(virStoragePoolPtr pool)
 /**
  * virStoragePoolRefresh:
  * @pool: pointer to storage pool
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStoragePoolRefreshFlags
  *
  * Request that the pool refresh its list of volumes. This may
  * involve communicating with a remote server, and/or initializing
  * new devices at the OS layer
  *
+ * With VIR_STORAGE_POOL_REFRESH_LIST_ONLY, pools that can do so only
+ * enumerate their volumes; the size, allocation and format of each
+ * volume are then looked up when the volume itself is queried, which
+ * makes refreshing large network pools much cheaper. Other pools do
+ * a full refresh.
+ *
  * Returns 0 if the volume list was refreshed, -1 on failure
  */
 int
@@ -1453,6 +1459,13 @@ virStorageVolGetKey(virStorageVolPtr vol)
  * qcow2 image files which don't support full preallocation,
  * by creating a sparse image file with metadata.
  *
+ * If @flags contains VIR_STORAGE_VOL_CREATE_BACKGROUND, the call
+ * returns as soon as the volume is defined, while its storage is
+ * allocated by a VIR_STORAGE_VOL_JOB_TYPE_BUILD job. The volume can't
+ * be used until the job is gone; it can be tracked with
+ * virStorageVolGetJobInfo() and cancelled with virStorageVolJobAbort(),
+ * in which case the volume is deleted.
+ *
  * virStorageVolFree should be used to free the resources after the
  * storage volume object is no longer needed.
  *
@@ -2116,3 +2129,183 @@ virStoragePoolIsPersistent(virStoragePoolPtr pool)
     virDispatchError(pool->conn);
     return -1;
 }
+
+
+/**
+ * virStorageVolGetJobInfo:
+ * @vol: pointer to storage volume
+ * @info: pointer to a virStorageVolJobInfo structure
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Request information about the long running operation, such as a wipe,
+ * currently active on @vol.  If an operation is active @info will be
+ * updated with its type, bandwidth limit and current progress.
+ *
+ * Returns -1 in case of failure, 0 when no job is active, 1 when info
+ * was found.
+ */
+int
+virStorageVolGetJobInfo(virStorageVolPtr vol,
+                        virStorageVolJobInfoPtr info,
+                        unsigned int flags)
+{
+    virConnectPtr conn;
+    VIR_DEBUG("vol=%p, info=%p, flags=%x", vol, info, flags);
+
+    virResetLastError();
+
+    if (info)
+        memset(info, 0, sizeof(*info));
+
+    virCheckStorageVolReturn(vol, -1);
+    conn = vol->conn;
+
+    virCheckNonNullArgGoto(info, error);
+
+    if (conn->storageDriver && conn->storageDriver->storageVolGetJobInfo) {
+        int ret;
+        ret = conn->storageDriver->storageVolGetJobInfo(vol, info, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(vol->conn);
+    return -1;
+}
+
+
+/**
+ * virStorageVolJobSetSpeed:
+ * @vol: pointer to storage volume
+ * @bandwidth: bandwidth limit in bytes/s, 0 for unlimited
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Set the maximum rate at which the long running operation on @vol may
+ * write to the underlying storage.  If no job is currently active, the
+ * limit is remembered and applied to the next job started on @vol, as
+ * long as the volume stays known to the pool.
+ *
+ * Returns -1 in case of failure, 0 when successful.
+ */
+int
+virStorageVolJobSetSpeed(virStorageVolPtr vol,
+                         unsigned long long bandwidth,
+                         unsigned int flags)
+{
+    virConnectPtr conn;
+    VIR_DEBUG("vol=%p, bandwidth=%llu, flags=%x", vol, bandwidth, flags);
+
+    virResetLastError();
+
+    virCheckStorageVolReturn(vol, -1);
+    conn = vol->conn;
+
+    virCheckReadOnlyGoto(conn->flags, error);
+
+    if (conn->storageDriver && conn->storageDriver->storageVolJobSetSpeed) {
+        int ret;
+        ret = conn->storageDriver->storageVolJobSetSpeed(vol, bandwidth, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(vol->conn);
+    return -1;
+}
+
+
+/**
+ * virStorageVolJobAbort:
+ * @vol: pointer to storage volume
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Request cancellation of the long running operation active on @vol.
+ * The API which started the job will return an error once the
+ * operation has stopped; the volume contents are then undefined.
+ *
+ * Returns -1 in case of failure, 0 when successful.
+ */
+int
+virStorageVolJobAbort(virStorageVolPtr vol,
+                      unsigned int flags)
+{
+    virConnectPtr conn;
+    VIR_DEBUG("vol=%p, flags=%x", vol, flags);
+
+    virResetLastError();
+
+    virCheckStorageVolReturn(vol, -1);
+    conn = vol->conn;
+
+    virCheckReadOnlyGoto(conn->flags, error);
+
+    if (conn->storageDriver && conn->storageDriver->storageVolJobAbort) {
+        int ret;
+        ret = conn->storageDriver->storageVolJobAbort(vol, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(vol->conn);
+    return -1;
+}
+
+
+/**
+ * virStoragePoolGetJobInfo:
+ * @pool: pointer to storage pool
+ * @info: pointer to a virStoragePoolJobInfo structure to fill in
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Report the pool level operation in progress on @pool, such as a
+ * refresh, if any, along with the number of volumes which have a job
+ * of their own running. The pool stays usable for queries while such
+ * an operation runs, but other operations changing it are refused.
+ *
+ * Returns -1 in case of failure, 0 when successful. If no pool level
+ * operation is running, @info->type is VIR_STORAGE_POOL_JOB_NONE.
+ */
+int
+virStoragePoolGetJobInfo(virStoragePoolPtr pool,
+                         virStoragePoolJobInfoPtr info,
+                         unsigned int flags)
+{
+    virConnectPtr conn;
+    VIR_DEBUG("pool=%p, info=%p, flags=%x", pool, info, flags);
+
+    virResetLastError();
+
+    if (info)
+        memset(info, 0, sizeof(*info));
+
+    virCheckStoragePoolReturn(pool, -1);
+    conn = pool->conn;
+
+    virCheckNonNullArgGoto(info, error);
+
+    if (conn->storageDriver && conn->storageDriver->storagePoolGetJobInfo) {
+        int ret;
+        ret = conn->storageDriver->storagePoolGetJobInfo(pool, info, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(pool->conn);
+    return -1;
+}
@@ -266,14 +266,15 @@ char *virLXCProcessSetupInterfaceBridged(virConnectPtr conn,
         if (virNetDevOpenvswitchAddPort(brname, parentVeth, &net->mac,
                                         vm->uuid, vport, virDomainNetGetActualVlan(net)) < 0)
             goto cleanup;
+
+        if (virNetDevSetOnline(parentVeth, true) < 0)
+            goto cleanup;
     } else {
-        if (virNetDevBridgeAddPort(brname, parentVeth) < 0)
+        if (virNetDevSetLinkConfig(parentVeth, NULL, 0, brname,
+                                   VIR_TRISTATE_BOOL_YES) < 0)
             goto cleanup;
     }
 
-    if (virNetDevSetOnline(parentVeth, true) < 0)
-        goto cleanup;
-
     if (virNetDevBandwidthSet(net->ifname,
                               virDomainNetGetActualBandwidth(net),
                               false) < 0)
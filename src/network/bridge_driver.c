@@ -1209,9 +1209,15 @@ networkDnsmasqConfContents(virNetworkObjPtr network,
      * listening for DHCP, we should write a 0-length hosts
      * file to allow for runtime additions.
      */
-    if (ipv4def || ipv6def)
-        virBufferAsprintf(&configbuf, "dhcp-hostsfile=%s\n",
-                          dctx->hostsfile->path);
+    if (ipv4def || ipv6def) {
+        if (dctx->hostsdir) {
+            virBufferAsprintf(&configbuf, "dhcp-hostsdir=%s\n",
+                              dctx->hostsfile->dirpath);
+        } else {
+            virBufferAsprintf(&configbuf, "dhcp-hostsfile=%s\n",
+                              dctx->hostsfile->path);
+        }
+    }
 
     /* Likewise, always create this file and put it on the
      * commandline, to allow for runtime additions.
@@ -1264,6 +1270,10 @@ networkBuildDhcpDaemonCommandLine(virNetworkObjPtr network,
 
     network->dnsmasqPid = -1;
 
+    /* dnsmasq reads new hosts from their own files in the hostsdir
+     * without being told to reread everything */
+    dctx->hostsdir = dnsmasqCapsGet(caps, DNSMASQ_CAPS_DHCP_HOSTSDIR);
+
     if (networkDnsmasqConfContents(network, pidfile, &configstr, dctx, caps) < 0)
         goto cleanup;
     if (!configstr)
@@ -1375,34 +1385,22 @@ networkStartDhcpDaemon(virNetworkDriverStatePtr driver,
     return ret;
 }
 
-/* networkRefreshDhcpDaemon:
- *  Update dnsmasq config files, then send a SIGHUP so that it rereads
- *  them.   This only works for the dhcp-hostsfile and the
- *  addn-hosts file.
+/* networkDnsmasqHostsContext:
+ *  Build a dnsmasq context holding the dhcp-hosts and the DNS hosts of
+ *  @network, the way the running dnsmasq wants them written.
  *
- *  Returns 0 on success, -1 on failure.
+ *  Returns the context on success, NULL on failure.
  */
-static int
-networkRefreshDhcpDaemon(virNetworkDriverStatePtr driver,
-                         virNetworkObjPtr network)
+static dnsmasqContext *
+networkDnsmasqHostsContext(virNetworkObjPtr network)
 {
-    int ret = -1;
     size_t i;
     virNetworkIpDefPtr ipdef, ipv4def, ipv6def;
     dnsmasqContext *dctx = NULL;
 
-    /* if no IP addresses specified, nothing to do */
-    if (!virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, 0))
-        return 0;
-
-    /* if there's no running dnsmasq, just start it */
-    if (network->dnsmasqPid <= 0 || (kill(network->dnsmasqPid, 0) < 0))
-        return networkStartDhcpDaemon(driver, network);
-
-    VIR_INFO("Refreshing dnsmasq for network %s", network->def->bridge);
     if (!(dctx = dnsmasqContextNew(network->def->name,
                                    driverState->dnsmasqStateDir))) {
-        goto cleanup;
+        goto error;
     }
 
     /* Look for first IPv4 address that has dhcp defined.
@@ -1426,18 +1424,59 @@ networkRefreshDhcpDaemon(virNetworkDriverStatePtr driver,
     }
 
     if (ipv4def && (networkBuildDnsmasqDhcpHostsList(dctx, ipv4def) < 0))
-        goto cleanup;
+        goto error;
 
     if (ipv6def && (networkBuildDnsmasqDhcpHostsList(dctx, ipv6def) < 0))
-        goto cleanup;
+        goto error;
 
     if (networkBuildDnsmasqHostsList(dctx, &network->def->dns) < 0)
+        goto error;
+
+    /* the running dnsmasq was set up to use the hostsdir if it exists */
+    dctx->hostsdir = virFileIsDir(dctx->hostsfile->dirpath);
+
+    return dctx;
+
+ error:
+    dnsmasqContextFree(dctx);
+    return NULL;
+}
+
+/* networkRefreshDhcpDaemon:
+ *  Update dnsmasq config files, then send a SIGHUP so that it rereads
+ *  them, unless hosts were only added to the dhcp-hostsdir, which
+ *  dnsmasq notices by itself.  This only works for the dhcp-hostsfile
+ *  (or dhcp-hostsdir) and the addn-hosts file. If @old holds the hosts
+ *  the files were last written from, only the changed hosts are written.
+ *
+ *  Returns 0 on success, -1 on failure.
+ */
+static int
+networkRefreshDhcpDaemon(virNetworkDriverStatePtr driver,
+                         virNetworkObjPtr network,
+                         const dnsmasqContext *old)
+{
+    int ret = -1;
+    dnsmasqContext *dctx = NULL;
+    bool reload;
+
+    /* if no IP addresses specified, nothing to do */
+    if (!virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, 0))
+        return 0;
+
+    /* if there's no running dnsmasq, just start it */
+    if (network->dnsmasqPid <= 0 || (kill(network->dnsmasqPid, 0) < 0))
+        return networkStartDhcpDaemon(driver, network);
+
+    VIR_INFO("Refreshing dnsmasq for network %s", network->def->bridge);
+    if (!(dctx = networkDnsmasqHostsContext(network)))
         goto cleanup;
 
-    if ((ret = dnsmasqSave(dctx)) < 0)
+    if ((ret = dnsmasqUpdate(dctx, old, &reload)) < 0)
         goto cleanup;
 
-    ret = kill(network->dnsmasqPid, SIGHUP);
+    if (reload)
+        ret = kill(network->dnsmasqPid, SIGHUP);
  cleanup:
     dnsmasqContextFree(dctx);
     return ret;
@@ -1762,7 +1801,7 @@ networkRefreshDaemons(virNetworkDriverStatePtr driver)
              * dnsmasq and/or radvd, or restart them if they've
              * disappeared.
              */
-            networkRefreshDhcpDaemon(driver, network);
+            networkRefreshDhcpDaemon(driver, network, NULL);
             networkRefreshRadvd(driver, network);
         }
         virNetworkObjUnlock(network);
@@ -3076,6 +3115,7 @@ networkUpdate(virNetworkPtr net,
     virNetworkIpDefPtr ipdef;
     bool oldDhcpActive = false;
     bool needFirewallRefresh = false;
+    dnsmasqContext *olddctx = NULL;
 
 
     virCheckFlags(VIR_NETWORK_UPDATE_AFFECT_LIVE |
@@ -3121,6 +3161,17 @@ networkUpdate(virNetworkPtr net,
         /* Take care of anything that must be done before updating the
          * live NetworkDef.
          */
+        if ((section == VIR_NETWORK_SECTION_IP_DHCP_HOST ||
+             section == VIR_NETWORK_SECTION_DNS_HOST ||
+             section == VIR_NETWORK_SECTION_DNS_TXT ||
+             section == VIR_NETWORK_SECTION_DNS_SRV) &&
+            virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, 0)) {
+            /* remember the hosts dnsmasq knows, so that only the files
+             * of the hosts this update changes are rewritten */
+            if (!(olddctx = networkDnsmasqHostsContext(network)))
+                goto cleanup;
+        }
+
         if (network->def->forward.type == VIR_NETWORK_FORWARD_NONE ||
             network->def->forward.type == VIR_NETWORK_FORWARD_NAT ||
             network->def->forward.type == VIR_NETWORK_FORWARD_ROUTE) {
@@ -3196,7 +3247,7 @@ networkUpdate(virNetworkPtr net,
 
             if ((newDhcpActive != oldDhcpActive &&
                  networkRestartDhcpDaemon(driver, network) < 0) ||
-                networkRefreshDhcpDaemon(driver, network) < 0) {
+                networkRefreshDhcpDaemon(driver, network, olddctx) < 0) {
                 goto cleanup;
             }
 
@@ -3207,7 +3258,7 @@ networkUpdate(virNetworkPtr net,
              * can just update the config files and send SIGHUP to
              * dnsmasq.
              */
-            if (networkRefreshDhcpDaemon(driver, network) < 0)
+            if (networkRefreshDhcpDaemon(driver, network, olddctx) < 0)
                 goto cleanup;
 
         }
@@ -3228,6 +3279,7 @@ networkUpdate(virNetworkPtr net,
     }
     ret = 0;
  cleanup:
+    dnsmasqContextFree(olddctx);
     if (network)
         virNetworkObjUnlock(network);
     networkDriverUnlock(driver);
@@ -615,7 +615,7 @@ int networkAddFirewallRules(virNetworkDefPtr def)
 
     fw = virFirewallNew();
 
-    virFirewallStartTransaction(fw, 0);
+    virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_BATCH);
 
     networkAddGeneralFirewallRules(fw, def);
 
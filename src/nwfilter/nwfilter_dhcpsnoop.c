@@ -42,13 +42,18 @@
  */
 #include <config.h>
 
+#include <fcntl.h>
+#include <poll.h>
+
 #ifdef HAVE_LIBPCAP
 # include <pcap.h>
+# include <linux/filter.h>
+# include <linux/if_packet.h>
+# include <net/ethernet.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
 #endif
 
-#include <fcntl.h>
-#include <poll.h>
-
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
@@ -61,6 +66,8 @@
 #include "conf/domain_conf.h"
 #include "nwfilter_gentech_driver.h"
 #include "nwfilter_dhcpsnoop.h"
+#define __NWFILTER_DHCPSNOOP_PRIV_H_ALLOW__
+#include "nwfilter_dhcpsnooppriv.h"
 #include "nwfilter_ipaddrmap.h"
 #include "virnetdev.h"
 #include "virfile.h"
@@ -69,6 +76,7 @@
 #include "configmake.h"
 #include "virtime.h"
 #include "virstring.h"
+#include "intprops.h"
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
 
@@ -92,6 +100,23 @@ struct virNWFilterSnoopState {
     virMutex             snoopLock;  /* protects SnoopReqs and IfNameToKey */
     virHashTablePtr      active;
     virMutex             activeLock; /* protects Active */
+    /* packet capture shared by all requests */
+    int                  captureFD;
+    unsigned char       *captureRing;
+    size_t               captureBlock; /* next ring block to read */
+    bool                 capturePcap; /* no ring, a pcap handle per
+                                       * interface and direction */
+    bool                 captureRunning;
+    int                  captureQuit;
+    int                  captureThreads; /* including exiting ones */
+    virCond              captureCond; /* signalled when one exits */
+    virThreadPoolPtr     decodePool;
+    virHashTablePtr      captureReqs; /* ifindex -> req */
+    struct _virNWFilterSnoopReq **captured; /* all snooped requests */
+    size_t               nCaptured;
+    virMutex             captureLock; /* protects CaptureReqs, Captured
+                                       * and the capture state of all
+                                       * requests */
 };
 
 # define virNWFilterSnoopLock() \
@@ -110,6 +135,14 @@ struct virNWFilterSnoopState {
     do { \
         virMutexUnlock(&virNWFilterSnoopState.activeLock); \
     } while (0)
+# define virNWFilterSnoopCaptureLock() \
+    do { \
+        virMutexLock(&virNWFilterSnoopState.captureLock); \
+    } while (0)
+# define virNWFilterSnoopCaptureUnlock() \
+    do { \
+        virMutexUnlock(&virNWFilterSnoopState.captureLock); \
+    } while (0)
 
 # define VIR_IFKEY_LEN   ((VIR_UUID_STRING_BUFLEN) + (VIR_MAC_STRING_BUFLEN))
 
@@ -119,6 +152,9 @@ typedef virNWFilterSnoopReq *virNWFilterSnoopReqPtr;
 typedef struct _virNWFilterSnoopIPLease virNWFilterSnoopIPLease;
 typedef virNWFilterSnoopIPLease *virNWFilterSnoopIPLeasePtr;
 
+typedef struct _virNWFilterSnoopCapture virNWFilterSnoopCapture;
+typedef virNWFilterSnoopCapture *virNWFilterSnoopCapturePtr;
+
 typedef enum {
     THREAD_STATUS_NONE,
     THREAD_STATUS_OK,
@@ -148,7 +184,9 @@ struct _virNWFilterSnoopReq {
     char                                *threadkey;
 
     virNWFilterSnoopThreadStatus         threadStatus;
-    virCond                              threadStatusCond;
+
+    /* state in the shared packet capture, kept until the req is freed */
+    virNWFilterSnoopCapturePtr           capture;
 
     int                                  jobCompletionStatus;
     /* the number of submitted jobs in the worker's queue */
@@ -233,8 +271,6 @@ struct _virNWFilterSnoopDHCPHdr {
      sizeof(struct udphdr) + \
      offsetof(virNWFilterSnoopDHCPHdr, d_opts))
 
-# define PCAP_PBUFSIZE              576 /* >= IP/TCP/DHCP headers */
-# define PCAP_READ_MAXERRS          25 /* retries on failing device */
 # define PCAP_FLOOD_TIMEOUT_MS      10 /* ms */
 
 typedef struct _virNWFilterDHCPDecodeJob virNWFilterDHCPDecodeJob;
@@ -245,6 +281,7 @@ struct _virNWFilterDHCPDecodeJob {
     int caplen;
     bool fromVM;
     int *qCtr;
+    virNWFilterDHCPDecodeJobPtr next;
 };
 
 # define DHCP_PKT_RATE          10 /* pkts/sec */
@@ -252,6 +289,18 @@ struct _virNWFilterDHCPDecodeJob {
 # define DHCP_BURST_INTERVAL_S  10 /* sec */
 
 /*
+ * The TPACKET_V3 ring of the capture socket shared by all interfaces;
+ * blocks are handed to user space when full or after the timeout
+ */
+# define SNOOP_RING_BLOCK_SIZE      (64 * 1024)
+# define SNOOP_RING_BLOCK_NR        32
+# define SNOOP_RING_FRAME_SIZE      2048
+# define SNOOP_RING_BLOCK_TMO_MS    50
+
+# define SNOOP_DECODE_WORKERS       4
+
+/*
+ * Without TPACKET_V3 every interface gets a pcap handle per direction;
  * libpcap 1.5 requires a 128kb buffer
  * 128 kb is bigger than (DHCP_PKT_BURST * PCAP_PBUFSIZE / 2)
  */
@@ -266,25 +315,41 @@ struct _virNWFilterSnoopRateLimitConf {
     time_t prev;
     unsigned int pkt_ctr;
     time_t burst;
-    const unsigned int rate;
-    const unsigned int burstRate;
-    const unsigned int burstInterval;
+    unsigned int rate;
+    unsigned int burstRate;
+    unsigned int burstInterval;
 };
-# define SNOOP_POLL_MAX_TIMEOUT_MS  (10 * 1000) /* milliseconds */
+/* how often lease timers and cancelled requests are looked at */
+# define SNOOP_POLL_MAX_TIMEOUT_MS  1000 /* milliseconds */
 
 typedef struct _virNWFilterSnoopPcapConf virNWFilterSnoopPcapConf;
 typedef virNWFilterSnoopPcapConf *virNWFilterSnoopPcapConfPtr;
 
 struct _virNWFilterSnoopPcapConf {
-    pcap_t *handle;
-    const pcap_direction_t dir;
-    const char *filter;
+    bool fromVM;
     virNWFilterSnoopRateLimitConf rateLimit; /* indep. rate limiters */
     int qCtr; /* number of jobs in the worker's queue */
-    const unsigned int maxQSize;
+    unsigned int maxQSize;
     unsigned long long penaltyTimeoutAbs;
 };
 
+/*
+ * Per-request state of the shared packet capture; protected by
+ * the capture lock
+ */
+struct _virNWFilterSnoopCapture {
+    int ifindex;
+    char *threadkey; /* copy of the req's key while it is snooped */
+    virNWFilterSnoopPcapConf pcapConf[2]; /* from VM, to VM */
+    pcap_t *handles[2]; /* from VM, to VM; only without the ring */
+    /* packets waiting to be decoded, oldest first */
+    virNWFilterDHCPDecodeJobPtr jobs;
+    virNWFilterDHCPDecodeJobPtr lastJob;
+    bool decoding; /* a worker is draining the jobs */
+    time_t last_displayed;
+    time_t last_displayed_queue;
+};
+
 /* local function prototypes */
 static int virNWFilterSnoopReqLeaseDel(virNWFilterSnoopReqPtr req,
                                        virSocketAddrPtr ipaddr,
@@ -300,6 +365,7 @@ static void virNWFilterSnoopLeaseFileSave(virNWFilterSnoopIPLeasePtr ipl);
 /* local variables */
 static struct virNWFilterSnoopState virNWFilterSnoopState = {
     .leaseFD = -1,
+    .captureFD = -1,
 };
 
 static const unsigned char dhcp_magic[4] = { 99, 130, 83, 99 };
@@ -596,16 +662,10 @@ virNWFilterSnoopReqNew(const char *ifkey)
         virMutexInitRecursive(&req->lock) < 0)
         goto err_free_req;
 
-    if (virCondInit(&req->threadStatusCond) < 0)
-        goto err_destroy_mutex;
-
     virNWFilterSnoopReqGet(req);
 
     return req;
 
- err_destroy_mutex:
-    virMutexDestroy(&req->lock);
-
  err_free_req:
     VIR_FREE(req);
 
@@ -638,8 +698,18 @@ virNWFilterSnoopReqFree(virNWFilterSnoopReqPtr req)
     VIR_FREE(req->filtername);
     virNWFilterHashTableFree(req->vars);
 
+    if (req->capture) {
+        size_t i;
+
+        for (i = 0; i < ARRAY_CARDINALITY(req->capture->handles); i++) {
+            if (req->capture->handles[i])
+                pcap_close(req->capture->handles[i]);
+        }
+        VIR_FREE(req->capture->threadkey);
+        VIR_FREE(req->capture);
+    }
+
     virMutexDestroy(&req->lock);
-    virCondDestroy(&req->threadStatusCond);
 
     VIR_FREE(req);
 }
@@ -1070,125 +1140,108 @@ virNWFilterSnoopDHCPDecode(virNWFilterSnoopReqPtr req,
     return 0;
 }
 
-static pcap_t *
-virNWFilterSnoopDHCPOpen(const char *ifname, virMacAddr *mac,
-                         const char *filter, pcap_direction_t dir)
+/*
+ * Classic BPF program attached to the capture socket. It passes the
+ * first PCAP_PBUFSIZE bytes of the IPv4 DHCP packets on all interfaces
+ * and drops everything else in the kernel. It corresponds to the pcap
+ * filter "udp and (src port 68 and dst port 67 or
+ *                  src port 67 and dst port 68)"
+ * for unfragmented (or first fragments of) IPv4 packets on Ethernet.
+ */
+static struct sock_filter virNWFilterSnoopDHCPFilter[] = {
+    /* IPv4 */
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 0, 13),
+    /* UDP */
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 11),
+    /* no fragment other than the first one */
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 9, 0),
+    /* X = length of the IP header */
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+    /* server to client */
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 14),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 67, 0, 2),
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 68, 3, 4),
+    /* client to server */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 68, 0, 3),
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 67, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, PCAP_PBUFSIZE),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+void
+virNWFilterSnoopDHCPFilterProgram(struct sock_fprog *prog)
 {
-    pcap_t *handle = NULL;
-    struct bpf_program fp;
-    char pcap_errbuf[PCAP_ERRBUF_SIZE];
-    char *ext_filter = NULL;
-    char macaddr[VIR_MAC_STRING_BUFLEN];
+    prog->len = ARRAY_CARDINALITY(virNWFilterSnoopDHCPFilter);
+    prog->filter = virNWFilterSnoopDHCPFilter;
+}
 
-    virMacAddrFormat(mac, macaddr);
+/*
+ * Worker function to decode the DHCP messages of a request and with
+ * that also do the time-consuming work of instantiating the filters.
+ * Only one worker at a time drains the jobs of a request so that its
+ * messages are still decoded in the order they were received.
+ */
+static void virNWFilterDHCPDecodeWorker(void *jobdata,
+                                        void *opaque ATTRIBUTE_UNUSED)
+{
+    virNWFilterSnoopReqPtr req = jobdata;
+    virNWFilterSnoopCapturePtr capture = req->capture;
+    virNWFilterDHCPDecodeJobPtr job;
+    virNWFilterSnoopEthHdrPtr packet;
 
-    if (dir == PCAP_D_IN /* from VM */) {
-        /*
-         * don't want to hear about another VM's DHCP requests
-         *
-         * extend the filter with the macaddr of the VM; filter the
-         * more unlikely parameters first, then go for the MAC
-         */
-        if (virAsprintf(&ext_filter,
-                        "%s and ether src %s", filter, macaddr) < 0)
-            return NULL;
-    } else {
-        /*
-         * Some DHCP servers respond via MAC broadcast; we rely on later
-         * filtering of responses by comparing the MAC address inside the
-         * DHCP response against the one of the VM. Assuming that the
-         * bridge learns the VM's MAC address quickly this should not
-         * generate much more traffic than if we filtered by VM and
-         * braodcast MAC as well
-         */
-        if (VIR_STRDUP(ext_filter, filter) < 0)
-            return NULL;
-    }
+    for (;;) {
+        virNWFilterSnoopCaptureLock();
 
-    handle = pcap_create(ifname, pcap_errbuf);
+        job = capture->jobs;
+        if (job) {
+            capture->jobs = job->next;
+            if (!capture->jobs)
+                capture->lastJob = NULL;
+        } else {
+            capture->decoding = false;
+        }
 
-    if (handle == NULL) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("pcap_create failed"));
-        goto cleanup_nohandle;
-    }
+        virNWFilterSnoopCaptureUnlock();
 
-    if (pcap_set_snaplen(handle, PCAP_PBUFSIZE) < 0 ||
-        pcap_set_buffer_size(handle, PCAP_BUFFERSIZE) < 0 ||
-        pcap_activate(handle) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("setup of pcap handle failed: %s"),
-                       pcap_geterr(handle));
-        goto cleanup;
-    }
+        if (!job)
+            break;
 
-    if (pcap_compile(handle, &fp, ext_filter, 1, PCAP_NETMASK_UNKNOWN) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("pcap_compile: %s"), pcap_geterr(handle));
-        goto cleanup;
-    }
+        packet = (virNWFilterSnoopEthHdrPtr)job->packet;
 
-    if (pcap_setfilter(handle, &fp) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("pcap_setfilter: %s"), pcap_geterr(handle));
-        goto cleanup_freecode;
-    }
+        if (virNWFilterSnoopDHCPDecode(req, packet,
+                                       job->caplen, job->fromVM) == -1) {
+            req->jobCompletionStatus = -1;
 
-    if (pcap_setdirection(handle, dir) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("pcap_setdirection: %s"),
-                       pcap_geterr(handle));
-        goto cleanup_freecode;
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Instantiation of rules failed on "
+                             "interface '%s'"), req->ifname);
+        }
+        virAtomicIntDecAndTest(job->qCtr);
+        VIR_FREE(job);
     }
 
-    pcap_freecode(&fp);
-    VIR_FREE(ext_filter);
-
-    return handle;
-
- cleanup_freecode:
-    pcap_freecode(&fp);
- cleanup:
-    pcap_close(handle);
- cleanup_nohandle:
-    VIR_FREE(ext_filter);
-
-    return NULL;
-}
-
-/*
- * Worker function to decode the DHCP message and with that
- * also do the time-consuming work of instantiating the filters
- */
-static void virNWFilterDHCPDecodeWorker(void *jobdata, void *opaque)
-{
-    virNWFilterSnoopReqPtr req = opaque;
-    virNWFilterDHCPDecodeJobPtr job = jobdata;
-    virNWFilterSnoopEthHdrPtr packet = (virNWFilterSnoopEthHdrPtr)job->packet;
-
-    if (virNWFilterSnoopDHCPDecode(req, packet,
-                                   job->caplen, job->fromVM) == -1) {
-        req->jobCompletionStatus = -1;
-
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Instantiation of rules failed on "
-                         "interface '%s'"), req->ifname);
-    }
-    virAtomicIntDecAndTest(job->qCtr);
-    VIR_FREE(job);
+    /* the reference was taken when the worker was dispatched */
+    virNWFilterSnoopReqPut(req);
 }
 
 /*
- * Submit a job to the worker thread doing the time-consuming work...
+ * Queue a packet for decoding and dispatch a worker for the request
+ * unless one is already busy with it. Must be called with the capture
+ * lock held.
  */
 static int
-virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
+virNWFilterSnoopDHCPDecodeJobSubmit(virNWFilterSnoopReqPtr req,
                                     virNWFilterSnoopEthHdrPtr pep,
-                                    int len, pcap_direction_t dir,
-                                    int *qCtr)
+                                    int len,
+                                    virNWFilterSnoopPcapConfPtr pc)
 {
+    virNWFilterSnoopCapturePtr capture = req->capture;
     virNWFilterDHCPDecodeJobPtr job;
-    int ret;
 
     if (len <= MIN_VALID_DHCP_PKT_SIZE || len > sizeof(job->packet))
         return 0;
@@ -1198,17 +1251,32 @@ virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
 
     memcpy(job->packet, pep, len);
     job->caplen = len;
-    job->fromVM = (dir == PCAP_D_IN);
-    job->qCtr = qCtr;
+    job->fromVM = pc->fromVM;
+    job->qCtr = &pc->qCtr;
 
-    ret = virThreadPoolSendJob(pool, 0, job);
+    if (!capture->decoding) {
+        virNWFilterSnoopReqGet(req);
 
-    if (ret == 0)
-        virAtomicIntInc(qCtr);
+        if (virThreadPoolSendJob(virNWFilterSnoopState.decodePool,
+                                 0, req) < 0) {
+            /* the capture still holds a reference, so this is not the
+             * last one and the req must not be put with our lock held */
+            ignore_value(virAtomicIntDecAndTest(&req->refctr));
+            VIR_FREE(job);
+            return -1;
+        }
+        capture->decoding = true;
+    }
+
+    if (capture->lastJob)
+        capture->lastJob->next = job;
     else
-        VIR_FREE(job);
+        capture->jobs = job;
+    capture->lastJob = job;
 
-    return ret;
+    virAtomicIntInc(job->qCtr);
+
+    return 0;
 }
 
 /*
@@ -1279,301 +1347,786 @@ virNWFilterSnoopRatePenalty(virNWFilterSnoopPcapConfPtr pc,
             usleep(PCAP_FLOOD_TIMEOUT_MS); /* 1 ms */
             pc->penaltyTimeoutAbs = 0;
         } else {
-            /* don't listen to the fd for 1 ms */
+            /* drop the packets of the interface for some time */
             pc->penaltyTimeoutAbs = now + PCAP_FLOOD_TIMEOUT_MS;
         }
     }
 }
 
-static int
-virNWFilterSnoopAdjustPoll(virNWFilterSnoopPcapConfPtr pc,
-                           size_t nPc, struct pollfd *pfd,
-                           int *pollTo)
+/*
+ * Submit a captured packet of @req, seen in the direction of @pc, for
+ * decoding unless the rate or queue limits say otherwise. Must be
+ * called with the capture lock held.
+ */
+static void
+virNWFilterSnoopCapturePacket(virNWFilterSnoopReqPtr req,
+                              virNWFilterSnoopPcapConfPtr pc,
+                              virNWFilterSnoopEthHdrPtr packet,
+                              int len)
 {
-    int ret = 0;
-    size_t i;
-    int tmp;
-    unsigned long long now = 0;
+    virNWFilterSnoopCapturePtr capture = req->capture;
+    unsigned long long now;
+    unsigned int diff;
+
+    /* don't want to hear about another VM's DHCP requests */
+    if (pc->fromVM &&
+        (len < sizeof(*packet) ||
+         virMacAddrCmpRaw(&req->macaddr, packet->eh_src.addr) != 0))
+        return;
 
-    *pollTo = -1;
+    if (pc->penaltyTimeoutAbs != 0) {
+        if (virTimeMillisNowRaw(&now) == 0 && now < pc->penaltyTimeoutAbs)
+            return;
+        pc->penaltyTimeoutAbs = 0;
+    }
 
-    for (i = 0; i < nPc; i++) {
-        if (pc[i].penaltyTimeoutAbs != 0) {
-            if (now == 0) {
-                if (virTimeMillisNow(&now) < 0) {
-                    ret = -1;
-                    break;
-                }
-            }
+    if (virAtomicIntGet(&pc->qCtr) > pc->maxQSize) {
+        if (time(0) - capture->last_displayed_queue > 10) {
+            capture->last_displayed_queue = time(0);
+            VIR_WARN("Worker thread for interface '%s' has a "
+                     "job queue that is too long\n",
+                     req->ifname);
+        }
+        return;
+    }
 
-            if (now < pc[i].penaltyTimeoutAbs) {
-                /* don't listen to incoming data on the fd for some time */
-                pfd[i].events &= ~POLLIN;
-                /*
-                 * calc the max. time to spend in poll() until adjustments
-                 * to the pollfd array are needed again.
-                 */
-                tmp = pc[i].penaltyTimeoutAbs - now;
-                if (*pollTo == -1 || tmp < *pollTo)
-                    *pollTo = tmp;
-            } else {
-                /* listen again to the fd */
-                pfd[i].events |= POLLIN;
-
-                pc[i].penaltyTimeoutAbs = 0;
-            }
+    diff = virNWFilterSnoopRateLimit(&pc->rateLimit);
+    if (diff > 0) {
+        virNWFilterSnoopRatePenalty(pc, diff, DHCP_PKT_RATE);
+        /* rate-limited warnings */
+        if (time(0) - capture->last_displayed > 10) {
+             capture->last_displayed = time(0);
+             VIR_WARN("Too many DHCP packets on interface '%s'",
+                      req->ifname);
         }
+        return;
     }
 
-    return ret;
+    if (virNWFilterSnoopDHCPDecodeJobSubmit(req, packet, len, pc) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Job submission failed on "
+                         "interface '%s'"), req->ifname);
+        /* stops the snooping on this interface */
+        req->jobCompletionStatus = -1;
+    }
+}
+
+/* Format the key of the route to interface @ifindex into @key, which
+ * must have room for INT_BUFSIZE_BOUND(int) bytes */
+static void
+virNWFilterSnoopRouteKey(char *key, int ifindex)
+{
+    snprintf(key, INT_BUFSIZE_BOUND(int), "%d", ifindex);
+}
+
+/*
+ * Route the packets seen on interface @ifindex to @payload, replacing
+ * any previous route.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNWFilterSnoopRouteAdd(virHashTablePtr routes, int ifindex, void *payload)
+{
+    char key[INT_BUFSIZE_BOUND(int)];
+
+    virNWFilterSnoopRouteKey(key, ifindex);
+    return virHashUpdateEntry(routes, key, payload);
+}
+
+/*
+ * Remove the route of interface @ifindex unless it was replaced, i.e.
+ * doesn't lead to @payload anymore.
+ */
+void
+virNWFilterSnoopRouteRemove(virHashTablePtr routes, int ifindex,
+                            void *payload)
+{
+    char key[INT_BUFSIZE_BOUND(int)];
+
+    virNWFilterSnoopRouteKey(key, ifindex);
+    if (virHashLookup(routes, key) == payload)
+        ignore_value(virHashRemoveEntry(routes, key));
+}
+
+static void *
+virNWFilterSnoopRouteLookup(virHashTablePtr routes, int ifindex)
+{
+    char key[INT_BUFSIZE_BOUND(int)];
+
+    virNWFilterSnoopRouteKey(key, ifindex);
+    return virHashLookup(routes, key);
+}
+
+/*
+ * Process the packets in @block of the capture ring, unless the kernel
+ * still owns it, and give it back to the kernel. Each packet seen on
+ * an interface that has a route in @routes is passed to @cb, along
+ * with the payload of the route and whether the interface sent the
+ * packet, i.e. it is going to the VM.
+ *
+ * Returns true if the block was processed, false if it is not ready.
+ */
+bool
+virNWFilterSnoopRingReadBlock(unsigned char *block,
+                              virHashTablePtr routes,
+                              virNWFilterSnoopRingFunc cb,
+                              void *opaque)
+{
+    struct tpacket_block_desc *desc;
+    struct tpacket3_hdr *hdr;
+    struct sockaddr_ll *sll;
+    void *payload;
+    size_t i;
+
+    VIR_WARNINGS_NO_CAST_ALIGN
+    desc = (struct tpacket_block_desc *)block;
+    VIR_WARNINGS_RESET
+
+    if (!(desc->hdr.bh1.block_status & TP_STATUS_USER))
+        return false;
+
+    /* don't read the packets before seeing the status */
+    __sync_synchronize();
+
+    VIR_WARNINGS_NO_CAST_ALIGN
+    hdr = (struct tpacket3_hdr *)(block + desc->hdr.bh1.offset_to_first_pkt);
+    VIR_WARNINGS_RESET
+
+    for (i = 0; i < desc->hdr.bh1.num_pkts; i++) {
+        VIR_WARNINGS_NO_CAST_ALIGN
+        sll = (struct sockaddr_ll *)((char *)hdr +
+                                     TPACKET_ALIGN(sizeof(*hdr)));
+        VIR_WARNINGS_RESET
+
+        if ((payload = virNWFilterSnoopRouteLookup(routes,
+                                                   sll->sll_ifindex)))
+            cb(payload, sll->sll_pkttype == PACKET_OUTGOING,
+               (unsigned char *)hdr + hdr->tp_mac, hdr->tp_snaplen, opaque);
+
+        VIR_WARNINGS_NO_CAST_ALIGN
+        hdr = (struct tpacket3_hdr *)((char *)hdr + hdr->tp_next_offset);
+        VIR_WARNINGS_RESET
+    }
+
+    /* the packets have been copied; return the block */
+    __sync_synchronize();
+    desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+    return true;
 }
 
 /*
- * The DHCP snooping thread. It spends most of its time in the pcap
- * library and if it gets suitable packets, it submits them to the worker
- * thread for processing.
+ * virNWFilterSnoopRingFunc handing a packet to the request snooping the
+ * interface it was seen on. Called with the capture lock held.
  */
 static void
-virNWFilterDHCPSnoopThread(void *req0)
+virNWFilterSnoopCaptureDispatch(void *payload,
+                                bool toVM,
+                                unsigned char *frame,
+                                unsigned int len,
+                                void *opaque ATTRIBUTE_UNUSED)
 {
-    virNWFilterSnoopReqPtr req = req0;
-    struct pcap_pkthdr *hdr;
-    virNWFilterSnoopEthHdrPtr packet;
-    int ifindex = 0;
-    int errcount = 0;
-    int tmp = -1, rv, n, pollTo;
+    virNWFilterSnoopReqPtr req = payload;
+
+    VIR_WARNINGS_NO_CAST_ALIGN
+    virNWFilterSnoopCapturePacket(req, &req->capture->pcapConf[toVM],
+                                  (virNWFilterSnoopEthHdrPtr)frame, len);
+    VIR_WARNINGS_RESET
+}
+
+/*
+ * Process all ring blocks the kernel has handed over to us and give
+ * them back to it.
+ */
+static void
+virNWFilterSnoopCaptureRead(void)
+{
+    unsigned char *block;
+    bool read;
+
+    do {
+        block = virNWFilterSnoopState.captureRing +
+            virNWFilterSnoopState.captureBlock * SNOOP_RING_BLOCK_SIZE;
+
+        virNWFilterSnoopCaptureLock();
+        read = virNWFilterSnoopRingReadBlock(block,
+                                             virNWFilterSnoopState.captureReqs,
+                                             virNWFilterSnoopCaptureDispatch,
+                                             NULL);
+        virNWFilterSnoopCaptureUnlock();
+
+        if (read)
+            virNWFilterSnoopState.captureBlock =
+                (virNWFilterSnoopState.captureBlock + 1) % SNOOP_RING_BLOCK_NR;
+    } while (read);
+}
+
+/*
+ * Open a pcap handle capturing the DHCP packets sent (fromVM) or
+ * received by the VM on interface @ifname
+ */
+static pcap_t *
+virNWFilterSnoopDHCPOpen(const char *ifname, virMacAddr *mac, bool fromVM)
+{
+    pcap_t *handle = NULL;
+    struct bpf_program fp;
+    char pcap_errbuf[PCAP_ERRBUF_SIZE];
+    char *ext_filter = NULL;
+    char macaddr[VIR_MAC_STRING_BUFLEN];
+
+    virMacAddrFormat(mac, macaddr);
+
+    if (fromVM) {
+        /*
+         * don't want to hear about another VM's DHCP requests
+         *
+         * extend the filter with the macaddr of the VM; filter the
+         * more unlikely parameters first, then go for the MAC
+         */
+        if (virAsprintf(&ext_filter,
+                        "dst port 67 and src port 68 and ether src %s",
+                        macaddr) < 0)
+            return NULL;
+    } else {
+        /*
+         * Some DHCP servers respond via MAC broadcast; we rely on later
+         * filtering of responses by comparing the MAC address inside the
+         * DHCP response against the one of the VM.
+         */
+        if (VIR_STRDUP(ext_filter, "src port 67 and dst port 68") < 0)
+            return NULL;
+    }
+
+    handle = pcap_create(ifname, pcap_errbuf);
+
+    if (handle == NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("pcap_create failed"));
+        goto cleanup_nohandle;
+    }
+
+    if (pcap_set_snaplen(handle, PCAP_PBUFSIZE) < 0 ||
+        pcap_set_buffer_size(handle, PCAP_BUFFERSIZE) < 0 ||
+        pcap_activate(handle) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("setup of pcap handle failed: %s"),
+                       pcap_geterr(handle));
+        goto cleanup;
+    }
+
+    if (pcap_compile(handle, &fp, ext_filter, 1, PCAP_NETMASK_UNKNOWN) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("pcap_compile: %s"), pcap_geterr(handle));
+        goto cleanup;
+    }
+
+    if (pcap_setfilter(handle, &fp) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("pcap_setfilter: %s"), pcap_geterr(handle));
+        goto cleanup_freecode;
+    }
+
+    if (pcap_setdirection(handle, fromVM ? PCAP_D_IN : PCAP_D_OUT) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("pcap_setdirection: %s"),
+                       pcap_geterr(handle));
+        goto cleanup_freecode;
+    }
+
+    pcap_freecode(&fp);
+    VIR_FREE(ext_filter);
+
+    return handle;
+
+ cleanup_freecode:
+    pcap_freecode(&fp);
+ cleanup:
+    pcap_close(handle);
+ cleanup_nohandle:
+    VIR_FREE(ext_filter);
+
+    return NULL;
+}
+
+/*
+ * Without the capture ring, wait for the pcap handles of all snooped
+ * requests and submit what they captured. The handles are only closed
+ * by virNWFilterSnoopCaptureRemove(), which runs in the capture thread
+ * as well, so they can be polled without the capture lock.
+ */
+static void
+virNWFilterSnoopCapturePcapRead(void)
+{
+    virNWFilterSnoopReqPtr *reqs = NULL;
+    struct pollfd *fds = NULL;
+    size_t nreqs;
+    size_t nfds;
     size_t i;
-    char *threadkey = NULL;
-    virThreadPoolPtr worker = NULL;
-    time_t last_displayed = 0, last_displayed_queue = 0;
-    virNWFilterSnoopPcapConf pcapConf[] = {
-        {
-            .dir = PCAP_D_IN, /* from VM */
-            .filter = "dst port 67 and src port 68",
-            .rateLimit = {
-                .prev = time(0),
-                .rate = DHCP_PKT_RATE,
-                .burstRate = DHCP_PKT_BURST,
-                .burstInterval = DHCP_BURST_INTERVAL_S,
-            },
-            .maxQSize = MAX_QUEUED_JOBS,
-        }, {
-            .dir = PCAP_D_OUT, /* to VM */
-            .filter = "src port 67 and dst port 68",
-            .rateLimit = {
-                .prev = time(0),
-                .rate = DHCP_PKT_RATE,
-                .burstRate = DHCP_PKT_BURST,
-                .burstInterval = DHCP_BURST_INTERVAL_S,
-            },
-            .maxQSize = MAX_QUEUED_JOBS,
-        },
-    };
-    struct pollfd fds[] = {
-        {
-            /* get a POLLERR if interface goes down or disappears */
-            .events = POLLIN | POLLERR,
-        }, {
-            .events = POLLIN | POLLERR,
-        },
-    };
-    bool error = false;
+    int n;
 
-    /* whoever started us increased the reference counter for the req for us */
+    virNWFilterSnoopCaptureLock();
 
-    /* protect req->ifname & req->threadkey */
-    virNWFilterSnoopReqLock(req);
+    nreqs = virNWFilterSnoopState.nCaptured;
+    nfds = 2 * nreqs;
+    if (VIR_ALLOC_N_QUIET(reqs, nreqs) < 0 ||
+        VIR_ALLOC_N_QUIET(fds, nfds) < 0) {
+        virNWFilterSnoopCaptureUnlock();
+        nfds = 0;
+        goto wait;
+    }
 
-    if (req->ifname && req->threadkey) {
-        for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
-            pcapConf[i].handle =
-                virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
-                                         pcapConf[i].filter,
-                                         pcapConf[i].dir);
-            if (!pcapConf[i].handle) {
-                error = true;
-                break;
-            }
-            fds[i].fd = pcap_fileno(pcapConf[i].handle);
+    for (i = 0; i < nfds; i++) {
+        reqs[i / 2] = virNWFilterSnoopState.captured[i / 2];
+        /* get a POLLERR if interface goes down or disappears */
+        fds[i].fd = pcap_fileno(reqs[i / 2]->capture->handles[i % 2]);
+        fds[i].events = POLLIN | POLLERR;
+    }
+
+    virNWFilterSnoopCaptureUnlock();
+
+ wait:
+    n = poll(fds, nfds, SNOOP_POLL_MAX_TIMEOUT_MS);
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+        VIR_WARN("Polling the DHCP capture handles failed: %d", errno);
+
+    for (i = 0; n > 0 && i < nfds; i++) {
+        virNWFilterSnoopReqPtr req = reqs[i / 2];
+        virNWFilterSnoopCapturePtr capture = req->capture;
+        struct pcap_pkthdr *hdr;
+        const u_char *packet;
+        int rv;
+
+        if (!fds[i].revents)
+            continue;
+        n--;
+
+        rv = pcap_next_ex(capture->handles[i % 2], &hdr, &packet);
+
+        virNWFilterSnoopCaptureLock();
+
+        if (rv < 0) {
+            VIR_WARN("Capturing DHCP packets on interface '%s' failed: %s",
+                     NULLSTR(req->ifname),
+                     pcap_geterr(capture->handles[i % 2]));
+            /* stops the snooping on this interface */
+            req->jobCompletionStatus = -1;
+        } else if (rv > 0) {
+            virNWFilterSnoopCapturePacket(req, &capture->pcapConf[i % 2],
+                                          (virNWFilterSnoopEthHdrPtr)packet,
+                                          hdr->caplen);
         }
-        tmp = virNetDevGetIndex(req->ifname, &ifindex);
-        ignore_value(VIR_STRDUP(threadkey, req->threadkey));
-        worker = virThreadPoolNew(1, 1, 0,
-                                  virNWFilterDHCPDecodeWorker,
-                                  req);
+
+        virNWFilterSnoopCaptureUnlock();
     }
 
-    /* let creator know how well we initialized */
-    if (error == true || !threadkey || tmp < 0 || !worker ||
-        ifindex != req->ifindex)
-        req->threadStatus = THREAD_STATUS_FAIL;
-    else
-        req->threadStatus = THREAD_STATUS_OK;
+    VIR_FREE(reqs);
+    VIR_FREE(fds);
+}
 
-    virCondSignal(&req->threadStatusCond);
+/*
+ * Stop snooping for a request that was cancelled or whose job failed
+ * and drop the reference the capture held on it.
+ */
+static void
+virNWFilterSnoopCaptureRemove(virNWFilterSnoopReqPtr req)
+{
+    virNWFilterSnoopCapturePtr capture = req->capture;
+    virNWFilterDHCPDecodeJobPtr job;
+    size_t i;
 
-    virNWFilterSnoopReqUnlock(req);
+    virNWFilterSnoopCaptureLock();
 
-    if (req->threadStatus != THREAD_STATUS_OK)
-        goto exit;
+    for (i = 0; i < virNWFilterSnoopState.nCaptured; i++) {
+        if (virNWFilterSnoopState.captured[i] == req)
+            break;
+    }
+    if (i == virNWFilterSnoopState.nCaptured) {
+        virNWFilterSnoopCaptureUnlock();
+        return;
+    }
+
+    VIR_DELETE_ELEMENT(virNWFilterSnoopState.captured, i,
+                       virNWFilterSnoopState.nCaptured);
+
+    /* a new req may already have taken over the interface index */
+    virNWFilterSnoopRouteRemove(virNWFilterSnoopState.captureReqs,
+                                capture->ifindex, req);
+
+    /* packets that were not decoded yet are of no interest anymore */
+    while ((job = capture->jobs)) {
+        capture->jobs = job->next;
+        virAtomicIntDecAndTest(job->qCtr);
+        VIR_FREE(job);
+    }
+    capture->lastJob = NULL;
+
+    for (i = 0; i < ARRAY_CARDINALITY(capture->handles); i++) {
+        if (capture->handles[i])
+            pcap_close(capture->handles[i]);
+        capture->handles[i] = NULL;
+    }
+
+    VIR_FREE(capture->threadkey);
+
+    virNWFilterSnoopCaptureUnlock();
+
+    virNWFilterSnoopReqPut(req);
+
+    virAtomicIntDecAndTest(&virNWFilterSnoopState.nThreads);
+}
+
+/*
+ * Run the lease timers of all snooped requests and stop snooping for
+ * those that were cancelled or whose job failed.
+ */
+static void
+virNWFilterSnoopCaptureRunTimers(void)
+{
+    virNWFilterSnoopReqPtr *reqs = NULL;
+    virNWFilterSnoopReqPtr req;
+    size_t nreqs = 0;
+    size_t i;
+    bool done;
+
+    virNWFilterSnoopCaptureLock();
+
+    if (VIR_ALLOC_N_QUIET(reqs, virNWFilterSnoopState.nCaptured) < 0) {
+        virNWFilterSnoopCaptureUnlock();
+        return;
+    }
+
+    for (i = 0; i < virNWFilterSnoopState.nCaptured; i++) {
+        reqs[nreqs] = virNWFilterSnoopState.captured[i];
+        virNWFilterSnoopReqGet(reqs[nreqs++]);
+    }
+
+    virNWFilterSnoopCaptureUnlock();
 
-    while (!error) {
-        if (virNWFilterSnoopAdjustPoll(pcapConf,
-                                       ARRAY_CARDINALITY(pcapConf),
-                                       fds, &pollTo) < 0) {
+    for (i = 0; i < nreqs; i++) {
+        req = reqs[i];
+
+        virNWFilterSnoopReqLeaseTimerRun(req);
+
+        virNWFilterSnoopCaptureLock();
+        done = !virNWFilterSnoopIsActive(req->capture->threadkey) ||
+               req->jobCompletionStatus != 0;
+        virNWFilterSnoopCaptureUnlock();
+
+        if (done)
+            virNWFilterSnoopCaptureRemove(req);
+
+        virNWFilterSnoopReqPut(req);
+    }
+
+    VIR_FREE(reqs);
+}
+
+/*
+ * The DHCP snooping thread shared by all interfaces. It reads the
+ * packets passed by the socket filter from the capture ring, or from
+ * the pcap handles of the requests without one, and submits them to
+ * the decode workers of their requests.
+ *
+ * Once the last request was removed it releases the capture and
+ * exits; the next request starts a new one.
+ */
+static void
+virNWFilterSnoopCaptureThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    struct pollfd fds = {
+        .fd = virNWFilterSnoopState.captureFD,
+        .events = POLLIN,
+    };
+    bool pcap = virNWFilterSnoopState.capturePcap;
+    unsigned long long now, last = 0;
+    unsigned char *ring = NULL;
+    virThreadPoolPtr pool = NULL;
+    int fd = -1;
+
+    for (;;) {
+        if (pcap) {
+            virNWFilterSnoopCapturePcapRead();
+        } else {
+            if (poll(&fds, 1, SNOOP_POLL_MAX_TIMEOUT_MS) < 0 &&
+                errno != EAGAIN && errno != EINTR)
+                VIR_WARN("Polling the DHCP capture socket failed: %d", errno);
+
+            virNWFilterSnoopCaptureRead();
+        }
+
+        if (virTimeMillisNowRaw(&now) < 0 ||
+            now - last >= SNOOP_POLL_MAX_TIMEOUT_MS) {
+            virNWFilterSnoopCaptureRunTimers();
+            last = now;
+        }
+
+        virNWFilterSnoopCaptureLock();
+        if (virNWFilterSnoopState.nCaptured == 0 ||
+            virAtomicIntGet(&virNWFilterSnoopState.captureQuit)) {
+            /* no new request can use the capture anymore */
+            fd = virNWFilterSnoopState.captureFD;
+            ring = virNWFilterSnoopState.captureRing;
+            pool = virNWFilterSnoopState.decodePool;
+            virNWFilterSnoopState.captureFD = -1;
+            virNWFilterSnoopState.captureRing = NULL;
+            virNWFilterSnoopState.decodePool = NULL;
+            virNWFilterSnoopState.captureRunning = false;
+            virNWFilterSnoopCaptureUnlock();
             break;
         }
+        virNWFilterSnoopCaptureUnlock();
+    }
 
-        /* cap pollTo so we don't hold up the join for too long */
-        if (pollTo < 0 || pollTo > SNOOP_POLL_MAX_TIMEOUT_MS)
-            pollTo = SNOOP_POLL_MAX_TIMEOUT_MS;
+    /* waits for the workers, which need the capture lock */
+    virThreadPoolFree(pool);
+    if (ring)
+        munmap(ring, SNOOP_RING_BLOCK_SIZE * SNOOP_RING_BLOCK_NR);
+    VIR_FORCE_CLOSE(fd);
 
-        n = poll(fds, ARRAY_CARDINALITY(fds), pollTo);
+    virNWFilterSnoopCaptureLock();
+    virNWFilterSnoopState.captureThreads--;
+    virCondBroadcast(&virNWFilterSnoopState.captureCond);
+    virNWFilterSnoopCaptureUnlock();
+}
 
-        if (n < 0) {
-            if (errno != EAGAIN && errno != EINTR)
-                error = true;
-        }
+/*
+ * Set up the capture socket, its ring and the decode workers and start
+ * the capture thread, unless that was already done. Kernels before 3.2
+ * have no TPACKET_V3, on those every request gets pcap handles of its
+ * own instead, which the capture thread waits for. Must be called with
+ * the capture lock held.
+ */
+static int
+virNWFilterSnoopCaptureStart(void)
+{
+    struct sock_fprog prog;
+    struct tpacket_req3 treq;
+    struct sockaddr_ll sll;
+    size_t size = SNOOP_RING_BLOCK_SIZE * SNOOP_RING_BLOCK_NR;
+    int version = TPACKET_V3;
+    void *ring = MAP_FAILED;
+    virThreadPoolPtr pool = NULL;
+    virThread thread;
+    int fd;
 
-        virNWFilterSnoopReqLeaseTimerRun(req);
+    if (virNWFilterSnoopState.captureRunning)
+        return 0;
 
-        /*
-         * Check whether we were cancelled or whether
-         * a previously submitted job failed.
-         */
-        if (!virNWFilterSnoopIsActive(threadkey) ||
-            req->jobCompletionStatus != 0)
-            goto exit;
+    if (virNWFilterSnoopState.capturePcap) {
+        fd = -1;
+        goto workers;
+    }
 
-        for (i = 0; n > 0 && i < ARRAY_CARDINALITY(fds); i++) {
-            if (!fds[i].revents)
-                continue;
+    virNWFilterSnoopDHCPFilterProgram(&prog);
 
-            fds[i].revents = 0;
-            n--;
+    /* no protocol yet: nothing is queued before the filter is attached */
+    if ((fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot create DHCP capture socket"));
+        return -1;
+    }
 
-            rv = pcap_next_ex(pcapConf[i].handle, &hdr,
-                              (const u_char **)&packet);
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &prog, sizeof(prog)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot attach DHCP filter to capture socket"));
+        goto error;
+    }
 
-            if (rv < 0) {
-                /* error reading from socket */
-                tmp = -1;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version)) < 0) {
+        VIR_WARN("Cannot use TPACKET_V3 for DHCP snooping (%d), "
+                 "capturing with libpcap per interface", errno);
+        VIR_FORCE_CLOSE(fd);
+        virNWFilterSnoopState.capturePcap = true;
+        goto workers;
+    }
 
-                /* protect req->ifname */
-                virNWFilterSnoopReqLock(req);
+    memset(&treq, 0, sizeof(treq));
+    treq.tp_block_size = SNOOP_RING_BLOCK_SIZE;
+    treq.tp_block_nr = SNOOP_RING_BLOCK_NR;
+    treq.tp_frame_size = SNOOP_RING_FRAME_SIZE;
+    treq.tp_frame_nr = size / SNOOP_RING_FRAME_SIZE;
+    treq.tp_retire_blk_tov = SNOOP_RING_BLOCK_TMO_MS;
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING,
+                   &treq, sizeof(treq)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot set up capture ring"));
+        goto error;
+    }
 
-                if (req->ifname)
-                    tmp = virNetDevValidateConfig(req->ifname, NULL, ifindex);
+    ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        virReportSystemError(errno, "%s",
+                             _("cannot map capture ring"));
+        goto error;
+    }
 
-                virNWFilterSnoopReqUnlock(req);
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = 0; /* all interfaces */
 
-                if (tmp <= 0) {
-                    error = true;
-                    break;
-                }
+    if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot bind capture socket"));
+        goto error;
+    }
 
-                if (++errcount > PCAP_READ_MAXERRS) {
-                    pcap_close(pcapConf[i].handle);
-                    pcapConf[i].handle = NULL;
+ workers:
+    if (!(pool = virThreadPoolNew(1, SNOOP_DECODE_WORKERS, 0,
+                                  virNWFilterDHCPDecodeWorker, NULL)))
+        goto error;
+
+    virNWFilterSnoopState.captureFD = fd;
+    virNWFilterSnoopState.captureRing = ring == MAP_FAILED ? NULL : ring;
+    virNWFilterSnoopState.captureBlock = 0;
+    virNWFilterSnoopState.decodePool = pool;
+    virAtomicIntSet(&virNWFilterSnoopState.captureQuit, 0);
+
+    /* it exits on its own once there is nothing to capture */
+    if (virThreadCreate(&thread, false,
+                        virNWFilterSnoopCaptureThread, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot create DHCP snooping thread"));
+        virNWFilterSnoopState.captureFD = -1;
+        virNWFilterSnoopState.captureRing = NULL;
+        virNWFilterSnoopState.decodePool = NULL;
+        goto error;
+    }
 
-                    /* protect req->ifname */
-                    virNWFilterSnoopReqLock(req);
+    virNWFilterSnoopState.captureThreads++;
+    virNWFilterSnoopState.captureRunning = true;
 
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("interface '%s' failing; "
-                                     "reopening"),
-                                   req->ifname);
-                    if (req->ifname)
-                        pcapConf[i].handle =
-                            virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
-                                                     pcapConf[i].filter,
-                                                     pcapConf[i].dir);
+    return 0;
 
-                    virNWFilterSnoopReqUnlock(req);
+ error:
+    virThreadPoolFree(pool);
+    if (ring != MAP_FAILED)
+        munmap(ring, size);
+    VIR_FORCE_CLOSE(fd);
+    return -1;
+}
 
-                    if (!pcapConf[i].handle) {
-                        error = true;
-                        break;
-                    }
-                }
-                continue;
-            }
+/*
+ * Tell the capture thread to exit even if requests are left and wait
+ * until it, and any thread that is still exiting, has released the
+ * capture.
+ */
+static void
+virNWFilterSnoopCaptureStop(void)
+{
+    virNWFilterSnoopCaptureLock();
 
-            errcount = 0;
-
-            if (rv) {
-                unsigned int diff;
-
-                /* submit packet to worker thread */
-                if (virAtomicIntGet(&pcapConf[i].qCtr) >
-                    pcapConf[i].maxQSize) {
-                    if (last_displayed_queue - time(0) > 10) {
-                        last_displayed_queue = time(0);
-                        VIR_WARN("Worker thread for interface '%s' has a "
-                                 "job queue that is too long\n",
-                                 req->ifname);
-                    }
-                    continue;
-                }
-
-                diff = virNWFilterSnoopRateLimit(&pcapConf[i].rateLimit);
-                if (diff > 0) {
-                    virNWFilterSnoopRatePenalty(&pcapConf[i], diff,
-                                                DHCP_PKT_RATE);
-                    /* rate-limited warnings */
-                    if (time(0) - last_displayed > 10) {
-                         last_displayed = time(0);
-                         VIR_WARN("Too many DHCP packets on interface '%s'",
-                                  req->ifname);
-                    }
-                    continue;
-                }
-
-                if (virNWFilterSnoopDHCPDecodeJobSubmit(worker, packet,
-                                                      hdr->caplen,
-                                                      pcapConf[i].dir,
-                                                      &pcapConf[i].qCtr) < 0) {
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("Job submission failed on "
-                                     "interface '%s'"), req->ifname);
-                    error = true;
-                    break;
-                }
-            }
-        } /* for all fds */
-    } /* while (!error) */
+    virAtomicIntSet(&virNWFilterSnoopState.captureQuit, 1);
 
-    /* protect IfNameToKey */
-    virNWFilterSnoopLock();
+    while (virNWFilterSnoopState.captureThreads > 0) {
+        if (virCondWait(&virNWFilterSnoopState.captureCond,
+                        &virNWFilterSnoopState.captureLock) < 0) {
+            VIR_WARN("Unable to wait for the DHCP snooping thread");
+            break;
+        }
+    }
 
-    /* protect req->ifname & req->threadkey */
-    virNWFilterSnoopReqLock(req);
+    virNWFilterSnoopCaptureUnlock();
+}
 
-    virNWFilterSnoopCancel(&req->threadkey);
+static void
+virNWFilterSnoopPcapConfInit(virNWFilterSnoopPcapConfPtr pc, bool fromVM)
+{
+    pc->fromVM = fromVM;
+    pc->rateLimit.prev = time(0);
+    pc->rateLimit.pkt_ctr = 0;
+    pc->rateLimit.burst = 0;
+    pc->rateLimit.rate = DHCP_PKT_RATE;
+    pc->rateLimit.burstRate = DHCP_PKT_BURST;
+    pc->rateLimit.burstInterval = DHCP_BURST_INTERVAL_S;
+    pc->maxQSize = MAX_QUEUED_JOBS;
+    pc->penaltyTimeoutAbs = 0;
+}
 
-    ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
-                                    req->ifname));
+/*
+ * Start snooping the DHCP traffic of the req's interface. On success
+ * the capture takes over the caller's reference to the req and drops
+ * it once the req was cancelled.
+ *
+ * Must be called with the req locked and after it was activated.
+ */
+static int
+virNWFilterSnoopCaptureAdd(virNWFilterSnoopReqPtr req)
+{
+    virNWFilterSnoopCapturePtr capture;
+    int ifindex;
+    size_t i;
+    int ret = -1;
 
-    VIR_FREE(req->ifname);
+    /* the interface may have been replaced in the meantime */
+    if (virNetDevGetIndex(req->ifname, &ifindex) < 0)
+        return -1;
 
-    virNWFilterSnoopReqUnlock(req);
-    virNWFilterSnoopUnlock();
+    if (ifindex != req->ifindex) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("interface '%s' changed while setting up "
+                         "DHCP snooping"), req->ifname);
+        return -1;
+    }
 
- exit:
-    virThreadPoolFree(worker);
+    if (!req->capture && VIR_ALLOC(req->capture) < 0)
+        return -1;
+    capture = req->capture;
 
-    virNWFilterSnoopReqPut(req);
+    virNWFilterSnoopCaptureLock();
 
-    VIR_FREE(threadkey);
+    if (virNWFilterSnoopCaptureStart() < 0)
+        goto cleanup;
 
-    for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
-        if (pcapConf[i].handle)
-            pcap_close(pcapConf[i].handle);
+    if (virNWFilterSnoopState.capturePcap) {
+        for (i = 0; i < ARRAY_CARDINALITY(capture->handles); i++) {
+            if (!capture->handles[i] &&
+                !(capture->handles[i] =
+                  virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
+                                           i == 0)))
+                goto cleanup;
+        }
     }
 
-    virAtomicIntDecAndTest(&virNWFilterSnoopState.nThreads);
+    VIR_FREE(capture->threadkey);
+    if (VIR_STRDUP(capture->threadkey, req->threadkey) < 0)
+        goto cleanup;
 
-    return;
+    capture->ifindex = ifindex;
+    virNWFilterSnoopPcapConfInit(&capture->pcapConf[0], true);
+    virNWFilterSnoopPcapConfInit(&capture->pcapConf[1], false);
+
+    if (VIR_APPEND_ELEMENT_COPY(virNWFilterSnoopState.captured,
+                                virNWFilterSnoopState.nCaptured, req) < 0)
+        goto cleanup;
+
+    if (virNWFilterSnoopRouteAdd(virNWFilterSnoopState.captureReqs,
+                                 ifindex, req) < 0) {
+        VIR_DELETE_ELEMENT(virNWFilterSnoopState.captured,
+                           virNWFilterSnoopState.nCaptured - 1,
+                           virNWFilterSnoopState.nCaptured);
+        goto cleanup;
+    }
+
+    virAtomicIntInc(&virNWFilterSnoopState.nThreads);
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        for (i = 0; i < ARRAY_CARDINALITY(capture->handles); i++) {
+            if (capture->handles[i])
+                pcap_close(capture->handles[i]);
+            capture->handles[i] = NULL;
+        }
+        VIR_FREE(capture->threadkey);
+    }
+    virNWFilterSnoopCaptureUnlock();
+    return ret;
 }
 
 static void
@@ -1599,9 +2152,7 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
     bool isnewreq;
     char ifkey[VIR_IFKEY_LEN];
     int tmp;
-    virThread thread;
     virNWFilterVarValuePtr dhcpsrvrs;
-    bool threadPuts = false;
 
     virNWFilterSnoopIFKeyFMT(ifkey, vmuuid, macaddr);
 
@@ -1683,21 +2234,8 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
         goto exit_rem_ifnametokey;
     }
 
-    /* prevent thread from holding req */
     virNWFilterSnoopReqLock(req);
 
-    if (virThreadCreate(&thread, false, virNWFilterDHCPSnoopThread,
-                        req) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("virNWFilterDHCPSnoopReq virThreadCreate "
-                         "failed on interface '%s'"), ifname);
-        goto exit_snoopreq_unlock;
-    }
-
-    threadPuts = true;
-
-    virAtomicIntInc(&virNWFilterSnoopState.nThreads);
-
     req->threadkey = virNWFilterSnoopActivate(req);
     if (!req->threadkey) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -1713,16 +2251,21 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
         goto exit_snoop_cancel;
     }
 
-    /* sync with thread */
-    if (virCondWait(&req->threadStatusCond, &req->lock) < 0 ||
-        req->threadStatus != THREAD_STATUS_OK)
+    if (virNWFilterSnoopCaptureAdd(req) < 0) {
+        req->threadStatus = THREAD_STATUS_FAIL;
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Starting DHCP snooping failed on "
+                         "interface '%s'"), req->ifname);
         goto exit_snoop_cancel;
+    }
+
+    req->threadStatus = THREAD_STATUS_OK;
 
     virNWFilterSnoopReqUnlock(req);
 
     virNWFilterSnoopUnlock();
 
-    /* do not 'put' the req -- the thread will do this */
+    /* do not 'put' the req -- the capture will do this */
 
     return 0;
 
@@ -1735,8 +2278,7 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
  exit_snoopunlock:
     virNWFilterSnoopUnlock();
  exit_snoopreqput:
-    if (!threadPuts)
-        virNWFilterSnoopReqPut(req);
+    virNWFilterSnoopReqPut(req);
 
     return -1;
 }
@@ -2084,17 +2626,21 @@ virNWFilterDHCPSnoopInit(void)
     VIR_DEBUG("Initializing DHCP snooping");
 
     if (virMutexInitRecursive(&virNWFilterSnoopState.snoopLock) < 0 ||
-        virMutexInit(&virNWFilterSnoopState.activeLock) < 0)
+        virMutexInit(&virNWFilterSnoopState.activeLock) < 0 ||
+        virMutexInit(&virNWFilterSnoopState.captureLock) < 0 ||
+        virCondInit(&virNWFilterSnoopState.captureCond) < 0)
         return -1;
 
     virNWFilterSnoopState.ifnameToKey = virHashCreate(0, NULL);
     virNWFilterSnoopState.active = virHashCreate(0, NULL);
     virNWFilterSnoopState.snoopReqs =
         virHashCreate(0, virNWFilterSnoopReqRelease);
+    virNWFilterSnoopState.captureReqs = virHashCreate(0, NULL);
 
     if (!virNWFilterSnoopState.ifnameToKey ||
         !virNWFilterSnoopState.snoopReqs ||
-        !virNWFilterSnoopState.active)
+        !virNWFilterSnoopState.active ||
+        !virNWFilterSnoopState.captureReqs)
         goto err_exit;
 
     virNWFilterSnoopLeaseFileLoad();
@@ -2112,6 +2658,9 @@ virNWFilterDHCPSnoopInit(void)
     virHashFree(virNWFilterSnoopState.active);
     virNWFilterSnoopState.active = NULL;
 
+    virHashFree(virNWFilterSnoopState.captureReqs);
+    virNWFilterSnoopState.captureReqs = NULL;
+
     return -1;
 }
 
@@ -2187,6 +2736,15 @@ virNWFilterDHCPSnoopShutdown(void)
     virNWFilterSnoopEndThreads();
     virNWFilterSnoopJoinThreads();
 
+    virNWFilterSnoopCaptureStop();
+
+    virNWFilterSnoopCaptureLock();
+    virHashFree(virNWFilterSnoopState.captureReqs);
+    virNWFilterSnoopState.captureReqs = NULL;
+    VIR_FREE(virNWFilterSnoopState.captured);
+    virNWFilterSnoopState.nCaptured = 0;
+    virNWFilterSnoopCaptureUnlock();
+
     virNWFilterSnoopLock();
 
     virNWFilterSnoopLeaseFileClose();
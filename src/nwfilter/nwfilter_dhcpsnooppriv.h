@@ -0,0 +1,58 @@
+/*
+ * nwfilter_dhcpsnooppriv.h: DHCP snooping internals exposed for tests
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NWFILTER_DHCPSNOOP_PRIV_H_ALLOW__
+# error "nwfilter_dhcpsnooppriv.h may only be included by nwfilter_dhcpsnoop.c or test suites"
+#endif
+
+#ifndef __NWFILTER_DHCPSNOOP_PRIV_H__
+# define __NWFILTER_DHCPSNOOP_PRIV_H__
+
+# ifdef HAVE_LIBPCAP
+#  include <linux/filter.h>
+
+#  include "internal.h"
+#  include "virhash.h"
+
+#  define PCAP_PBUFSIZE              576 /* >= IP/TCP/DHCP headers */
+
+void virNWFilterSnoopDHCPFilterProgram(struct sock_fprog *prog);
+
+int virNWFilterSnoopRouteAdd(virHashTablePtr routes,
+                             int ifindex,
+                             void *payload);
+void virNWFilterSnoopRouteRemove(virHashTablePtr routes,
+                                 int ifindex,
+                                 void *payload);
+
+typedef void (*virNWFilterSnoopRingFunc)(void *payload,
+                                         bool toVM,
+                                         unsigned char *frame,
+                                         unsigned int len,
+                                         void *opaque);
+
+bool virNWFilterSnoopRingReadBlock(unsigned char *block,
+                                   virHashTablePtr routes,
+                                   virNWFilterSnoopRingFunc cb,
+                                   void *opaque);
+
+# endif /* HAVE_LIBPCAP */
+
+#endif /* __NWFILTER_DHCPSNOOP_PRIV_H__ */
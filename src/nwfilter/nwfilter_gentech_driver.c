@@ -72,6 +72,20 @@ static virNWFilterTechDriverPtr filter_tech_drivers[] = {
  */
 static virMutex updateMutex;
 
+/* Maps the name of every interface with instantiated filters to the
+ * set of names of the filters its rules were built from, so that an
+ * update of a filter only rebuilds the interfaces referencing it.
+ * Interfaces missing from the index are always rebuilt.
+ *
+ * Protected by updateMutex */
+static virHashTablePtr ifaceFilters;
+
+static void
+virNWFilterIfaceFiltersFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virHashFree(payload);
+}
+
 int virNWFilterTechDriversInit(bool privileged)
 {
     size_t i = 0;
@@ -79,6 +93,11 @@ int virNWFilterTechDriversInit(bool privileged)
     if (virMutexInitRecursive(&updateMutex) < 0)
         return -1;
 
+    if (!(ifaceFilters = virHashCreate(0, virNWFilterIfaceFiltersFree))) {
+        virMutexDestroy(&updateMutex);
+        return -1;
+    }
+
     while (filter_tech_drivers[i]) {
         if (!(filter_tech_drivers[i]->flags & TECHDRV_FLAG_INITIALIZED))
             filter_tech_drivers[i]->init(privileged);
@@ -96,6 +115,8 @@ void virNWFilterTechDriversShutdown(void)
             filter_tech_drivers[i]->shutdown();
         i++;
     }
+    virHashFree(ifaceFilters);
+    ifaceFilters = NULL;
     virMutexDestroy(&updateMutex);
 }
 
@@ -324,6 +345,88 @@ virNWFilterInstReset(virNWFilterInstPtr inst)
 }
 
 
+/*
+ * Records that the rules of @ifname were built from @filter and the
+ * filters it includes, as collected in @inst. On failure the interface
+ * is left out of the index, which only costs it being rebuilt on
+ * every filter update.
+ *
+ * Call this function while holding the NWFilter update mutex
+ */
+static void
+virNWFilterIfaceFiltersSet(const char *ifname,
+                           virNWFilterDefPtr filter,
+                           virNWFilterInstPtr inst)
+{
+    virHashTablePtr filters;
+    size_t i;
+
+    if (!ifaceFilters)
+        return;
+
+    virHashRemoveEntry(ifaceFilters, ifname);
+
+    if (!(filters = virHashCreate(inst->nfilters + 1, NULL)))
+        goto error;
+
+    if (virHashAddEntry(ifaceFilters, ifname, filters) < 0) {
+        virHashFree(filters);
+        goto error;
+    }
+
+    if (virHashUpdateEntry(filters, filter->name, (void *)~0) < 0)
+        goto error;
+
+    for (i = 0; i < inst->nfilters; i++) {
+        if (virHashUpdateEntry(filters, inst->filters[i]->def->name,
+                               (void *)~0) < 0)
+            goto error;
+    }
+
+    return;
+
+ error:
+    virHashRemoveEntry(ifaceFilters, ifname);
+    virResetLastError();
+}
+
+
+/*
+ * Call this function while holding the NWFilter update mutex
+ */
+static void
+virNWFilterIfaceFiltersForget(const char *ifname)
+{
+    if (ifaceFilters)
+        virHashRemoveEntry(ifaceFilters, ifname);
+}
+
+
+/*
+ * Returns whether the rules of @ifname need to be rebuilt when the
+ * filter @filtername changes. A NULL @filtername means any filter
+ * may have changed.
+ */
+static bool
+virNWFilterIfaceUsesFilter(const char *ifname,
+                           const char *filtername)
+{
+    virHashTablePtr filters;
+    bool ret = true;
+
+    if (!filtername)
+        return true;
+
+    virMutexLock(&updateMutex);
+    if (ifaceFilters &&
+        (filters = virHashLookup(ifaceFilters, ifname)) &&
+        !virHashLookup(filters, filtername))
+        ret = false;
+    virMutexUnlock(&updateMutex);
+
+    return ret;
+}
+
 
 static int
 virNWFilterDefToInst(virNWFilterDriverStatePtr driver,
@@ -645,6 +748,10 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
 
     memset(&inst, 0, sizeof(inst));
 
+    /* Until the tree of filters is walked again the interface is
+     * not known to be unaffected by any filter */
+    virNWFilterIfaceFiltersForget(ifname);
+
     if (!missing_vars) {
         rc = -1;
         goto err_exit;
@@ -718,6 +825,8 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
     if (rc < 0)
         goto err_exit;
 
+    virNWFilterIfaceFiltersSet(ifname, filter, &inst);
+
     switch (useNewFilter) {
     case INSTANTIATE_FOLLOW_NEWFILTER:
         instantiate = *foundNewFilter;
@@ -1089,6 +1198,8 @@ _virNWFilterTeardownFilter(const char *ifname)
 
     techdriver->allTeardown(ifname);
 
+    virNWFilterIfaceFiltersForget(ifname);
+
     virNWFilterIPAddrMapDelIPAddr(ifname, NULL);
 
     virNWFilterUnlockIface(ifname);
@@ -1126,6 +1237,14 @@ virNWFilterDomainFWUpdateCB(virDomainObjPtr obj,
             if ((net->filter) && (net->ifname)) {
                 switch (cb->step) {
                 case STEP_APPLY_NEW:
+                    if (!virNWFilterIfaceUsesFilter(net->ifname,
+                                                    cb->filtername)) {
+                        /* changed filter not referenced at all */
+                        ret = virHashAddEntry(cb->skipInterfaces,
+                                              net->ifname,
+                                              (void *)~0);
+                        break;
+                    }
                     ret = virNWFilterUpdateInstantiateFilter(cb->opaque,
                                                              vm->uuid,
                                                              net,
@@ -1141,6 +1260,10 @@ virNWFilterDomainFWUpdateCB(virDomainObjPtr obj,
                 case STEP_TEAR_NEW:
                     if (!virHashLookup(cb->skipInterfaces, net->ifname)) {
                         ret = virNWFilterRollbackUpdateFilter(net);
+                        /* the index now describes the discarded filters */
+                        virMutexLock(&updateMutex);
+                        virNWFilterIfaceFiltersForget(net->ifname);
+                        virMutexUnlock(&updateMutex);
                     }
                     break;
 
@@ -40,6 +40,8 @@
 #include "virnuma.h"
 #include "qemu_monitor.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "viratomic.h"
 #include "qemu_hostdev.h"
 
 #include <fcntl.h>
@@ -308,6 +310,8 @@ struct _virQEMUCaps {
 struct _virQEMUCapsCache {
     virMutex lock;
     virHashTablePtr binaries;
+    virHashTablePtr probing;    /* binaries being probed right now */
+    virCond probed;             /* signalled whenever a probe finishes */
     char *libDir;
     char *cacheDir;
     uid_t runUid;
@@ -708,11 +712,34 @@ virQEMUCapsIsValidForKVM(virArch hostarch,
     return false;
 }
 
+/* qemu-kvm/kvm binaries can only be used if
+ *  - host & guest arches match
+ * Or
+ *  - hostarch is x86_64 and guest arch is i686
+ * The latter simply needs "-cpu qemu32"
+ */
+static int virQEMUCapsCacheLookupInternal(virQEMUCapsCachePtr cache,
+                                          const char *binary,
+                                          bool probe,
+                                          virQEMUCapsPtr *qemuCaps);
+
+static const char *const virQEMUCapsKVMBinaries[] = {
+    "/usr/libexec/qemu-kvm", /* RHEL */
+    "qemu-kvm", /* Fedora */
+    "kvm", /* Upstream .spec */
+};
+
+/*
+ * Without @probe, binaries which were not probed yet are registered with
+ * no machine types and are probed once something actually needs their
+ * capabilities, see qemuDomainDefPostParse.
+ */
 static int
 virQEMUCapsInitGuest(virCapsPtr caps,
                      virQEMUCapsCachePtr cache,
                      virArch hostarch,
-                     virArch guestarch)
+                     virArch guestarch,
+                     bool probe)
 {
     size_t i;
     char *kvmbin = NULL;
@@ -728,30 +755,22 @@ virQEMUCapsInitGuest(virCapsPtr caps,
 
     /* Ignore binary if extracting version info fails */
     if (binary) {
-        if (!(qemubinCaps = virQEMUCapsCacheLookup(cache, binary))) {
+        if (virQEMUCapsCacheLookupInternal(cache, binary, probe,
+                                           &qemubinCaps) < 0) {
             virResetLastError();
             VIR_FREE(binary);
         }
     }
 
-    /* qemu-kvm/kvm binaries can only be used if
-     *  - host & guest arches match
-     * Or
-     *  - hostarch is x86_64 and guest arch is i686
-     * The latter simply needs "-cpu qemu32"
-     */
     if (virQEMUCapsIsValidForKVM(hostarch, guestarch)) {
-        const char *const kvmbins[] = { "/usr/libexec/qemu-kvm", /* RHEL */
-                                        "qemu-kvm", /* Fedora */
-                                        "kvm" }; /* Upstream .spec */
-
-        for (i = 0; i < ARRAY_CARDINALITY(kvmbins); ++i) {
-            kvmbin = virFindFileInPath(kvmbins[i]);
+        for (i = 0; i < ARRAY_CARDINALITY(virQEMUCapsKVMBinaries); ++i) {
+            kvmbin = virFindFileInPath(virQEMUCapsKVMBinaries[i]);
 
             if (!kvmbin)
                 continue;
 
-            if (!(kvmbinCaps = virQEMUCapsCacheLookup(cache, kvmbin))) {
+            if (virQEMUCapsCacheLookupInternal(cache, kvmbin, probe,
+                                               &kvmbinCaps) < 0) {
                 virResetLastError();
                 VIR_FREE(kvmbin);
                 continue;
@@ -799,17 +818,22 @@ virQEMUCapsInitGuestFromBinary(virCapsPtr caps,
     if (!binary)
         return 0;
 
+    /* A binary which was not probed yet is assumed to support KVM
+     * whenever the host could run the guest arch with it */
     if (virFileExists("/dev/kvm") &&
         (virQEMUCapsGet(qemubinCaps, QEMU_CAPS_KVM) ||
          virQEMUCapsGet(qemubinCaps, QEMU_CAPS_ENABLE_KVM) ||
-         kvmbin))
+         kvmbin ||
+         (!qemubinCaps &&
+          virQEMUCapsIsValidForKVM(virArchFromHost(), guestarch))))
         haskvm = true;
 
     if (virFileExists("/dev/kqemu") &&
         virQEMUCapsGet(qemubinCaps, QEMU_CAPS_KQEMU))
         haskqemu = true;
 
-    if (virQEMUCapsGetMachineTypesCaps(qemubinCaps, &nmachines, &machines) < 0)
+    if (qemubinCaps &&
+        virQEMUCapsGetMachineTypesCaps(qemubinCaps, &nmachines, &machines) < 0)
         goto cleanup;
 
     /* We register kvm as the base emulator too, since we can
@@ -828,6 +852,7 @@ virQEMUCapsInitGuestFromBinary(virCapsPtr caps,
 
     if (caps->host.cpu &&
         caps->host.cpu->model &&
+        qemubinCaps &&
         virQEMUCapsGetCPUDefinitions(qemubinCaps, NULL) > 0 &&
         !virCapabilitiesAddGuestFeature(guest, "cpuselection", true, false))
         goto cleanup;
@@ -863,7 +888,7 @@ virQEMUCapsInitGuestFromBinary(virCapsPtr caps,
     if (haskvm) {
         virCapsGuestDomainPtr dom;
 
-        if (kvmbin &&
+        if (kvmbinCaps &&
             virQEMUCapsGetMachineTypesCaps(kvmbinCaps, &nmachines, &machines) < 0)
             goto cleanup;
 
@@ -965,7 +990,110 @@ virQEMUCapsInitPages(virCapsPtr caps)
 }
 
 
-virCapsPtr virQEMUCapsInit(virQEMUCapsCachePtr cache)
+/* How many emulator binaries may be probed at the same time */
+#define QEMU_CAPS_PROBE_WORKERS 4
+
+struct virQEMUCapsProbeQueue {
+    virQEMUCapsCachePtr cache;
+    virMutex lock;
+    char **binaries;
+    size_t nbinaries;
+    size_t next;
+};
+
+static void
+virQEMUCapsProbeWorker(void *opaque)
+{
+    struct virQEMUCapsProbeQueue *queue = opaque;
+    virQEMUCapsPtr qemuCaps;
+    const char *binary;
+
+    while (true) {
+        binary = NULL;
+        virMutexLock(&queue->lock);
+        if (queue->next < queue->nbinaries)
+            binary = queue->binaries[queue->next++];
+        virMutexUnlock(&queue->lock);
+
+        if (!binary)
+            break;
+
+        if (!(qemuCaps = virQEMUCapsCacheLookup(queue->cache, binary)))
+            virResetLastError();
+        virObjectUnref(qemuCaps);
+    }
+}
+
+
+/*
+ * Fills the cache with capabilities of all binaries virQEMUCapsInitGuest
+ * is going to look at, probing several of them at once. Any failure is
+ * ignored here since virQEMUCapsInitGuest deals with it anyway.
+ */
+static void
+virQEMUCapsInitProbeAll(virQEMUCapsCachePtr cache,
+                        virArch hostarch)
+{
+    struct virQEMUCapsProbeQueue queue = { .cache = cache };
+    virThread workers[QEMU_CAPS_PROBE_WORKERS];
+    size_t nworkers = 0;
+    char *binary;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < VIR_ARCH_LAST + ARRAY_CARDINALITY(virQEMUCapsKVMBinaries); i++) {
+        if (i < VIR_ARCH_LAST)
+            binary = virQEMUCapsFindBinaryForArch(hostarch, i);
+        else
+            binary = virFindFileInPath(virQEMUCapsKVMBinaries[i - VIR_ARCH_LAST]);
+
+        if (!binary)
+            continue;
+
+        for (j = 0; j < queue.nbinaries; j++) {
+            if (STREQ(queue.binaries[j], binary))
+                break;
+        }
+
+        if (j < queue.nbinaries) {
+            VIR_FREE(binary);
+        } else if (VIR_APPEND_ELEMENT(queue.binaries, queue.nbinaries,
+                                      binary) < 0) {
+            VIR_FREE(binary);
+            goto cleanup;
+        }
+    }
+
+    /* nothing to gain from probing a single binary in a thread */
+    if (queue.nbinaries < 2 ||
+        virMutexInit(&queue.lock) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Probing %zu QEMU binaries", queue.nbinaries);
+
+    while (nworkers < QEMU_CAPS_PROBE_WORKERS &&
+           nworkers < queue.nbinaries) {
+        if (virThreadCreate(&workers[nworkers], true,
+                            virQEMUCapsProbeWorker, &queue) < 0)
+            break;
+        nworkers++;
+    }
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    virMutexDestroy(&queue.lock);
+
+ cleanup:
+    virResetLastError();
+    for (i = 0; i < queue.nbinaries; i++)
+        VIR_FREE(queue.binaries[i]);
+    VIR_FREE(queue.binaries);
+}
+
+
+virCapsPtr virQEMUCapsInit(virQEMUCapsCachePtr cache,
+                           bool probe)
 {
     virCapsPtr caps;
     size_t i;
@@ -1003,10 +1131,13 @@ virCapsPtr virQEMUCapsInit(virQEMUCapsCachePtr cache)
      * so just probe for them all - we gracefully fail
      * if a qemu-system-$ARCH binary can't be found
      */
+    if (probe)
+        virQEMUCapsInitProbeAll(cache, hostarch);
+
     for (i = 0; i < VIR_ARCH_LAST; i++)
         if (virQEMUCapsInitGuest(caps, cache,
                                  hostarch,
-                                 i) < 0)
+                                 i, probe) < 0)
             goto error;
 
     return caps;
@@ -1888,6 +2019,10 @@ virQEMUCapsPtr virQEMUCapsNewCopy(virQEMUCapsPtr qemuCaps)
 
     virBitmapCopy(ret->flags, qemuCaps->flags);
 
+    if (VIR_STRDUP(ret->binary, qemuCaps->binary) < 0)
+        goto error;
+    ret->ctime = qemuCaps->ctime;
+
     ret->usedQMP = qemuCaps->usedQMP;
     ret->version = qemuCaps->version;
     ret->kvmVersion = qemuCaps->kvmVersion;
@@ -2054,6 +2189,11 @@ virArch virQEMUCapsGetArch(virQEMUCapsPtr qemuCaps)
     return qemuCaps->arch;
 }
 
+time_t virQEMUCapsGetCtime(virQEMUCapsPtr qemuCaps)
+{
+    return qemuCaps->ctime;
+}
+
 
 unsigned int virQEMUCapsGetVersion(virQEMUCapsPtr qemuCaps)
 {
@@ -3203,6 +3343,10 @@ virQEMUCapsInitQMPMonitor(virQEMUCapsPtr qemuCaps,
     return ret;
 }
 
+/* Numbers the sockets and pidfiles of concurrent probes; only ever
+ * touched through virAtomicIntInc since probes run in several threads */
+static int virQEMUCapsProbeCounter;
+
 static int
 virQEMUCapsInitQMP(virQEMUCapsPtr qemuCaps,
                    const char *libDir,
@@ -3220,11 +3364,14 @@ virQEMUCapsInitQMP(virQEMUCapsPtr qemuCaps,
     pid_t pid = 0;
     virDomainObjPtr vm = NULL;
     virDomainXMLOptionPtr xmlopt = NULL;
+    int probe = virAtomicIntInc(&virQEMUCapsProbeCounter);
 
     /* the ".sock" sufix is important to avoid a possible clash with a qemu
-     * domain called "capabilities"
+     * domain called "capabilities"; different binaries may be probed
+     * concurrently so each probe needs its own socket and pidfile
      */
-    if (virAsprintf(&monpath, "%s/%s", libDir, "capabilities.monitor.sock") < 0)
+    if (virAsprintf(&monpath, "%s/capabilities.monitor.%d.sock",
+                    libDir, probe) < 0)
         goto cleanup;
     if (virAsprintf(&monarg, "unix:%s,server,nowait", monpath) < 0)
         goto cleanup;
@@ -3235,7 +3382,7 @@ virQEMUCapsInitQMP(virQEMUCapsPtr qemuCaps,
      * -daemonize we need QEMU to be allowed to create them, rather
      * than libvirtd. So we're using libDir which QEMU can write to
      */
-    if (virAsprintf(&pidfile, "%s/%s", libDir, "capabilities.pidfile") < 0)
+    if (virAsprintf(&pidfile, "%s/capabilities.%d.pidfile", libDir, probe) < 0)
         goto cleanup;
 
     memset(&config, 0, sizeof(config));
@@ -3353,16 +3500,25 @@ virQEMUCapsLogProbeFailure(const char *binary)
 }
 
 
-virQEMUCapsPtr virQEMUCapsNewForBinary(const char *binary,
-                                       const char *libDir,
-                                       const char *cacheDir,
-                                       uid_t runUid,
-                                       gid_t runGid)
+/*
+ * Returns 1 and fills @ret on success, 0 if @probe is false and the
+ * capabilities of @binary are not cached on disk, -1 on error.
+ */
+static int
+virQEMUCapsNewForBinaryInternal(const char *binary,
+                                const char *libDir,
+                                const char *cacheDir,
+                                uid_t runUid,
+                                gid_t runGid,
+                                bool probe,
+                                virQEMUCapsPtr *ret)
 {
     virQEMUCapsPtr qemuCaps;
     struct stat sb;
     int rv;
 
+    *ret = NULL;
+
     if (!(qemuCaps = virQEMUCapsNew()))
         goto error;
 
@@ -3391,6 +3547,11 @@ virQEMUCapsPtr virQEMUCapsNewForBinary(const char *binary,
     if ((rv = virQEMUCapsInitCached(qemuCaps, cacheDir)) < 0)
         goto error;
 
+    if (rv == 0 && !probe) {
+        virObjectUnref(qemuCaps);
+        return 0;
+    }
+
     if (rv == 0) {
         if (virQEMUCapsInitQMP(qemuCaps, libDir, runUid, runGid) < 0) {
             virQEMUCapsLogProbeFailure(binary);
@@ -3407,12 +3568,28 @@ virQEMUCapsPtr virQEMUCapsNewForBinary(const char *binary,
             goto error;
     }
 
-    return qemuCaps;
+    *ret = qemuCaps;
+    return 1;
 
  error:
     virObjectUnref(qemuCaps);
-    qemuCaps = NULL;
-    return NULL;
+    return -1;
+}
+
+
+virQEMUCapsPtr virQEMUCapsNewForBinary(const char *binary,
+                                       const char *libDir,
+                                       const char *cacheDir,
+                                       uid_t runUid,
+                                       gid_t runGid)
+{
+    virQEMUCapsPtr qemuCaps;
+
+    if (virQEMUCapsNewForBinaryInternal(binary, libDir, cacheDir,
+                                        runUid, runGid, true, &qemuCaps) < 0)
+        return NULL;
+
+    return qemuCaps;
 }
 
 
@@ -3448,7 +3625,16 @@ virQEMUCapsCacheNew(const char *libDir,
         return NULL;
     }
 
-    if (!(cache->binaries = virHashCreate(10, virObjectFreeHashData)))
+    if (virCondInit(&cache->probed) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize condition variable"));
+        virMutexDestroy(&cache->lock);
+        VIR_FREE(cache);
+        return NULL;
+    }
+
+    if (!(cache->binaries = virHashCreate(10, virObjectFreeHashData)) ||
+        !(cache->probing = virHashCreate(10, NULL)))
         goto error;
     if (VIR_STRDUP(cache->libDir, libDir) < 0)
         goto error;
@@ -3466,38 +3652,97 @@ virQEMUCapsCacheNew(const char *libDir,
 }
 
 
-virQEMUCapsPtr
-virQEMUCapsCacheLookup(virQEMUCapsCachePtr cache, const char *binary)
+/*
+ * Probing a binary takes a while, so the cache is not locked while doing
+ * so. Lookups of other binaries are not blocked by a probe in progress,
+ * lookups of the same binary wait for the probe to finish instead of
+ * starting another one.
+ *
+ * Without @probe, only capabilities already known in memory or cached on
+ * disk are returned and 0 is returned if @binary would have to be run.
+ */
+static int
+virQEMUCapsCacheLookupInternal(virQEMUCapsCachePtr cache,
+                               const char *binary,
+                               bool probe,
+                               virQEMUCapsPtr *qemuCaps)
 {
     virQEMUCapsPtr ret = NULL;
+    int rv = 1;
+
+    *qemuCaps = NULL;
+
     virMutexLock(&cache->lock);
-    ret = virHashLookup(cache->binaries, binary);
-    if (ret &&
-        !virQEMUCapsIsValid(ret)) {
-        VIR_DEBUG("Cached capabilities %p no longer valid for %s",
-                  ret, binary);
-        virHashRemoveEntry(cache->binaries, binary);
-        ret = NULL;
+    while (true) {
+        ret = virHashLookup(cache->binaries, binary);
+        if (ret &&
+            !virQEMUCapsIsValid(ret)) {
+            VIR_DEBUG("Cached capabilities %p no longer valid for %s",
+                      ret, binary);
+            virHashRemoveEntry(cache->binaries, binary);
+            ret = NULL;
+        }
+
+        if (ret || !virHashLookup(cache->probing, binary))
+            break;
+
+        if (!probe) {
+            virMutexUnlock(&cache->lock);
+            return 0;
+        }
+
+        VIR_DEBUG("Waiting for capabilities of %s to be probed", binary);
+        if (virCondWait(&cache->probed, &cache->lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait for capabilities probe"));
+            virMutexUnlock(&cache->lock);
+            return -1;
+        }
     }
+
     if (!ret) {
+        if (virHashAddEntry(cache->probing, binary, (void *) binary) < 0) {
+            virMutexUnlock(&cache->lock);
+            return -1;
+        }
+        virMutexUnlock(&cache->lock);
+
         VIR_DEBUG("Creating capabilities for %s",
                   binary);
-        ret = virQEMUCapsNewForBinary(binary, cache->libDir,
-                                      cache->cacheDir,
-                                      cache->runUid, cache->runGid);
+        rv = virQEMUCapsNewForBinaryInternal(binary, cache->libDir,
+                                             cache->cacheDir,
+                                             cache->runUid, cache->runGid,
+                                             probe, &ret);
+
+        virMutexLock(&cache->lock);
+        virHashRemoveEntry(cache->probing, binary);
         if (ret) {
             VIR_DEBUG("Caching capabilities %p for %s",
                       ret, binary);
-            if (virHashAddEntry(cache->binaries, binary, ret) < 0) {
+            if (virHashUpdateEntry(cache->binaries, binary, ret) < 0) {
                 virObjectUnref(ret);
                 ret = NULL;
+                rv = -1;
             }
         }
+        virCondBroadcast(&cache->probed);
     }
     VIR_DEBUG("Returning caps %p for %s", ret, binary);
-    virObjectRef(ret);
+    *qemuCaps = virObjectRef(ret);
     virMutexUnlock(&cache->lock);
-    return ret;
+    return rv;
+}
+
+
+virQEMUCapsPtr
+virQEMUCapsCacheLookup(virQEMUCapsCachePtr cache, const char *binary)
+{
+    virQEMUCapsPtr qemuCaps;
+
+    if (virQEMUCapsCacheLookupInternal(cache, binary, true, &qemuCaps) < 0)
+        return NULL;
+
+    return qemuCaps;
 }
 
 
@@ -3554,6 +3799,8 @@ virQEMUCapsCacheFree(virQEMUCapsCachePtr cache)
     VIR_FREE(cache->libDir);
     VIR_FREE(cache->cacheDir);
     virHashFree(cache->binaries);
+    virHashFree(cache->probing);
+    virCondDestroy(&cache->probed);
     virMutexDestroy(&cache->lock);
     VIR_FREE(cache);
 }
@@ -6145,12 +6145,12 @@ qemuBuildClockArgStr(virDomainClockDefPtr def)
 }
 
 static int
-qemuBuildCpuModelArgStr(virQEMUDriverPtr driver,
-                        const virDomainDef *def,
-                        virBufferPtr buf,
-                        virQEMUCapsPtr qemuCaps,
-                        bool *hasHwVirt,
-                        bool migrating)
+qemuBuildCpuModelArgStrUncached(const virDomainDef *def,
+                                virBufferPtr buf,
+                                virCapsPtr caps,
+                                virQEMUCapsPtr qemuCaps,
+                                bool *hasHwVirt,
+                                bool migrating)
 {
     int ret = -1;
     size_t i;
@@ -6163,13 +6163,9 @@ qemuBuildCpuModelArgStr(virQEMUDriverPtr driver,
     char *compare_msg = NULL;
     virCPUCompareResult cmp;
     const char *preferred;
-    virCapsPtr caps = NULL;
     bool compareAgainstHost = (def->virtType == VIR_DOMAIN_VIRT_KVM ||
         def->cpu->mode != VIR_CPU_MODE_CUSTOM);
 
-    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
-        goto cleanup;
-
     host = caps->host.cpu;
 
     if (!host ||
@@ -6276,7 +6272,6 @@ qemuBuildCpuModelArgStr(virQEMUDriverPtr driver,
 
     ret = 0;
  cleanup:
-    virObjectUnref(caps);
     VIR_FREE(compare_msg);
     cpuDataFree(data);
     virCPUDefFree(guest);
@@ -6284,6 +6279,64 @@ qemuBuildCpuModelArgStr(virQEMUDriverPtr driver,
     return ret;
 }
 
+static int
+qemuBuildCpuModelArgStr(virQEMUDriverPtr driver,
+                        const virDomainDef *def,
+                        virBufferPtr buf,
+                        virQEMUCapsPtr qemuCaps,
+                        bool *hasHwVirt,
+                        bool migrating)
+{
+    virBuffer model = VIR_BUFFER_INITIALIZER;
+    virCapsPtr caps = NULL;
+    char *cpuxml = NULL;
+    char *key = NULL;
+    char *str = NULL;
+    int rc;
+    int ret = -1;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+        goto cleanup;
+
+    if (!driver->cpuModelCache) {
+        ret = qemuBuildCpuModelArgStrUncached(def, buf, caps, qemuCaps,
+                                              hasHwVirt, migrating);
+        goto cleanup;
+    }
+
+    if (!(cpuxml = virCPUDefFormat(def->cpu, 0)) ||
+        virAsprintf(&key, "%s:%d:%d:%d", cpuxml, def->virtType,
+                    def->os.arch, migrating) < 0)
+        goto cleanup;
+
+    if ((rc = qemuCPUModelCacheLookup(driver, key, caps, qemuCaps,
+                                      &str, hasHwVirt)) < 0)
+        goto cleanup;
+
+    if (rc == 0) {
+        if (qemuBuildCpuModelArgStrUncached(def, &model, caps, qemuCaps,
+                                            hasHwVirt, migrating) < 0 ||
+            virBufferCheckError(&model) < 0)
+            goto cleanup;
+
+        str = virBufferContentAndReset(&model);
+        if (qemuCPUModelCacheAdd(driver, key, caps, qemuCaps,
+                                 str, *hasHwVirt) < 0)
+            goto cleanup;
+    }
+
+    virBufferAdd(buf, str, -1);
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&model);
+    virObjectUnref(caps);
+    VIR_FREE(cpuxml);
+    VIR_FREE(key);
+    VIR_FREE(str);
+    return ret;
+}
+
 static int
 qemuBuildCpuArgStr(virQEMUDriverPtr driver,
                    const virDomainDef *def,
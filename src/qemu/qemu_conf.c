@@ -252,6 +252,8 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
     cfg->securityDefaultConfined = true;
     cfg->securityRequireConfined = false;
 
+    cfg->maxReconnectWorkers = 16;
+
     cfg->keepAliveInterval = 5;
     cfg->keepAliveCount = 5;
     cfg->seccompSandbox = -1;
@@ -696,6 +698,8 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     GET_VALUE_BOOL("set_process_name", cfg->setProcessName);
     GET_VALUE_LONG("max_processes", cfg->maxProcesses);
     GET_VALUE_LONG("max_files", cfg->maxFiles);
+    GET_VALUE_LONG("max_reconnect_workers", cfg->maxReconnectWorkers);
+    GET_VALUE_LONG("stats_sample_interval", cfg->statsSampleInterval);
 
     GET_VALUE_STR("lock_manager", cfg->lockManagerName);
 
@@ -798,7 +802,12 @@ virQEMUDriverCreateXMLConf(virQEMUDriverPtr driver)
 }
 
 
-virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver)
+/*
+ * Without @probe, emulator binaries are not run; their capabilities are
+ * probed on first use instead.
+ */
+virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver,
+                                           bool probe)
 {
     size_t i, j;
     virCapsPtr caps;
@@ -810,7 +819,7 @@ virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver)
                              VIR_DOMAIN_VIRT_QEMU,};
 
     /* Basic host arch / guest machine capabilities */
-    if (!(caps = virQEMUCapsInit(driver->qemuCapsCache)))
+    if (!(caps = virQEMUCapsInit(driver->qemuCapsCache, probe)))
         goto error;
 
     if (virGetHostUUID(caps->host.host_uuid)) {
@@ -880,7 +889,7 @@ virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
     virCapsPtr ret = NULL;
     if (refresh) {
         virCapsPtr caps = NULL;
-        if ((caps = virQEMUDriverCreateCapabilities(driver)) == NULL)
+        if ((caps = virQEMUDriverCreateCapabilities(driver, true)) == NULL)
             return NULL;
 
         qemuDriverLock(driver);
@@ -1348,6 +1357,133 @@ qemuSetUnprivSGIO(virDomainDeviceDefPtr dev)
     return ret;
 }
 
+/* Starting a domain with a guest CPU model means comparing it with the
+ * host CPU and decoding it into one of the models QEMU knows, which
+ * involves the whole CPU map. The result only depends on the guest CPU
+ * definition, the host CPU and the emulator, so it is remembered across
+ * starts. Every domain start works on a private copy of the emulator
+ * capabilities, so entries are matched on the emulator binary and its
+ * ctime, which is what the capabilities cache keys on as well. Entries
+ * keep a reference to the host capabilities they were resolved against
+ * and are ignored once those have been replaced. */
+#define QEMU_CPU_MODEL_CACHE_MAX 256
+
+typedef struct _qemuCPUModelCacheEntry qemuCPUModelCacheEntry;
+typedef qemuCPUModelCacheEntry *qemuCPUModelCacheEntryPtr;
+struct _qemuCPUModelCacheEntry {
+    virCapsPtr caps;
+    char *binary;
+    time_t ctime;
+    char *model;
+    bool hasHwVirt;
+};
+
+static void
+qemuCPUModelCacheEntryFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    qemuCPUModelCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    virObjectUnref(entry->caps);
+    VIR_FREE(entry->binary);
+    VIR_FREE(entry->model);
+    VIR_FREE(entry);
+}
+
+virHashTablePtr
+qemuCPUModelCacheNew(void)
+{
+    return virHashCreate(32, qemuCPUModelCacheEntryFree);
+}
+
+/**
+ * qemuCPUModelCacheLookup:
+ * @driver: qemu driver
+ * @key: the guest CPU and whatever else the model was resolved with
+ * @caps: current host capabilities
+ * @qemuCaps: capabilities of the emulator
+ * @model: filled in with a copy of the -cpu argument
+ * @hasHwVirt: filled in with whether nested virtualization is needed
+ *
+ * Returns 1 if a model resolved against @caps and @qemuCaps is cached
+ * for @key, 0 if not and -1 on error.
+ */
+int
+qemuCPUModelCacheLookup(virQEMUDriverPtr driver,
+                        const char *key,
+                        virCapsPtr caps,
+                        virQEMUCapsPtr qemuCaps,
+                        char **model,
+                        bool *hasHwVirt)
+{
+    qemuCPUModelCacheEntryPtr entry;
+    int ret = 0;
+
+    if (!driver->cpuModelCache)
+        return 0;
+
+    qemuDriverLock(driver);
+
+    if ((entry = virHashLookup(driver->cpuModelCache, key)) &&
+        entry->caps == caps &&
+        STREQ_NULLABLE(entry->binary, virQEMUCapsGetBinary(qemuCaps)) &&
+        entry->ctime == virQEMUCapsGetCtime(qemuCaps)) {
+        if (VIR_STRDUP(*model, entry->model) < 0) {
+            ret = -1;
+        } else {
+            *hasHwVirt = entry->hasHwVirt;
+            ret = 1;
+        }
+    }
+
+    qemuDriverUnlock(driver);
+    return ret;
+}
+
+int
+qemuCPUModelCacheAdd(virQEMUDriverPtr driver,
+                     const char *key,
+                     virCapsPtr caps,
+                     virQEMUCapsPtr qemuCaps,
+                     const char *model,
+                     bool hasHwVirt)
+{
+    qemuCPUModelCacheEntryPtr entry = NULL;
+    int ret = -1;
+
+    if (!driver->cpuModelCache)
+        return 0;
+
+    if (VIR_ALLOC(entry) < 0 ||
+        VIR_STRDUP(entry->model, model) < 0 ||
+        VIR_STRDUP(entry->binary, virQEMUCapsGetBinary(qemuCaps)) < 0)
+        goto cleanup;
+    entry->caps = virObjectRef(caps);
+    entry->ctime = virQEMUCapsGetCtime(qemuCaps);
+    entry->hasHwVirt = hasHwVirt;
+
+    qemuDriverLock(driver);
+
+    /* Most hosts run a handful of CPU configurations; if there are
+     * many more, just start over */
+    if (!virHashLookup(driver->cpuModelCache, key) &&
+        virHashSize(driver->cpuModelCache) >= QEMU_CPU_MODEL_CACHE_MAX)
+        virHashRemoveAll(driver->cpuModelCache);
+
+    if (virHashUpdateEntry(driver->cpuModelCache, key, entry) == 0) {
+        entry = NULL;
+        ret = 0;
+    }
+
+    qemuDriverUnlock(driver);
+
+ cleanup:
+    qemuCPUModelCacheEntryFree(entry, NULL);
+    return ret;
+}
+
 int qemuDriverAllocateID(virQEMUDriverPtr driver)
 {
     return virAtomicIntInc(&driver->nextvmid);
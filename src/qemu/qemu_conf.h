@@ -144,6 +144,10 @@ struct _virQEMUDriverConfig {
     int maxProcesses;
     int maxFiles;
 
+    unsigned int maxReconnectWorkers;
+
+    unsigned int statsSampleInterval;
+
     int maxQueuedJobs;
 
     char **securityDriverNames;
@@ -190,6 +194,18 @@ struct _virQEMUDriver {
     /* Immutable pointer, self-locking APIs */
     virThreadPoolPtr workerPool;
 
+    /* Background bulk stats sampler, only running if
+     * stats_sample_interval is set. Require lock for
+     * statsSamplerQuit */
+    virThread statsSampler;
+    bool statsSamplerRunning;
+    bool statsSamplerQuit;
+    virCond statsSamplerCond;
+
+    /* Atomic increment only */
+    unsigned int statsCacheHits;
+    unsigned int statsCacheMisses;
+
     /* Atomic increment only */
     int nextvmid;
 
@@ -231,6 +247,10 @@ struct _virQEMUDriver {
     /* Immutable pointer. Unsafe APIs. XXX */
     virHashTablePtr sharedDevices;
 
+    /* Immutable pointer. Resolved guest CPU models, see
+     * qemuCPUModelCacheLookup. May be NULL. */
+    virHashTablePtr cpuModelCache;
+
     /* Immutable pointer, self-locking APIs */
     virPortAllocatorPtr remotePorts;
 
@@ -272,7 +292,8 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
 
 virQEMUDriverConfigPtr virQEMUDriverGetConfig(virQEMUDriverPtr driver);
 
-virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver);
+virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver,
+                                           bool probe);
 virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
                                         bool refresh);
 
@@ -313,6 +334,26 @@ int qemuRemoveSharedDisk(virQEMUDriverPtr driver,
 
 int qemuSetUnprivSGIO(virDomainDeviceDefPtr dev);
 
+virHashTablePtr qemuCPUModelCacheNew(void);
+
+int qemuCPUModelCacheLookup(virQEMUDriverPtr driver,
+                            const char *key,
+                            virCapsPtr caps,
+                            virQEMUCapsPtr qemuCaps,
+                            char **model,
+                            bool *hasHwVirt)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5) ATTRIBUTE_NONNULL(6);
+
+int qemuCPUModelCacheAdd(virQEMUDriverPtr driver,
+                         const char *key,
+                         virCapsPtr caps,
+                         virQEMUCapsPtr qemuCaps,
+                         const char *model,
+                         bool hasHwVirt)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5);
+
 int qemuDriverAllocateID(virQEMUDriverPtr driver);
 virDomainXMLOptionPtr virQEMUDriverCreateXMLConf(virQEMUDriverPtr driver);
 
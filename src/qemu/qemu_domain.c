@@ -142,6 +142,12 @@ qemuDomainObjInitJob(qemuDomainObjPrivatePtr priv)
         return -1;
     }
 
+    if (virCondInit(&priv->job.queryCond) < 0) {
+        virCondDestroy(&priv->job.cond);
+        virCondDestroy(&priv->job.asyncCond);
+        return -1;
+    }
+
     return 0;
 }
 
@@ -202,6 +208,7 @@ qemuDomainObjFreeJob(qemuDomainObjPrivatePtr priv)
     VIR_FREE(priv->job.completed);
     virCondDestroy(&priv->job.cond);
     virCondDestroy(&priv->job.asyncCond);
+    virCondDestroy(&priv->job.queryCond);
 }
 
 static bool
@@ -418,6 +425,9 @@ qemuDomainObjPrivateAlloc(void)
     if (virCondInit(&priv->unplugFinished) < 0)
         goto error;
 
+    if (virCondInit(&priv->trayMoved) < 0)
+        goto error;
+
     if (!(priv->devs = virChrdevAlloc()))
         goto error;
 
@@ -430,6 +440,19 @@ qemuDomainObjPrivateAlloc(void)
     return NULL;
 }
 
+void
+qemuDomainStatsCacheFree(qemuDomainStatsCachePtr cache)
+{
+    size_t i;
+
+    if (!cache)
+        return;
+
+    for (i = 0; i < QEMU_DOMAIN_STATS_CACHE_GROUPS; i++)
+        virTypedParamsFree(cache->params[i], cache->nparams[i]);
+    VIR_FREE(cache);
+}
+
 static void
 qemuDomainObjPrivateFree(void *data)
 {
@@ -446,8 +469,10 @@ qemuDomainObjPrivateFree(void *data)
     VIR_FREE(priv->iothreadpids);
     VIR_FREE(priv->lockState);
     VIR_FREE(priv->origname);
+    qemuDomainStatsCacheFree(priv->statsCache);
 
     virCondDestroy(&priv->unplugFinished);
+    virCondDestroy(&priv->trayMoved);
     virChrdevFree(priv->devs);
 
     /* This should never be non-NULL if we get here, but just in case... */
@@ -929,8 +954,10 @@ virDomainXMLNamespace virQEMUDriverDomainXMLNamespace = {
 static int
 qemuDomainDefPostParse(virDomainDefPtr def,
                        virCapsPtr caps,
-                       void *opaque ATTRIBUTE_UNUSED)
+                       void *opaque)
 {
+    virQEMUDriverPtr driver = opaque;
+    virQEMUCapsPtr qemuCaps = NULL;
     bool addDefaultUSB = true;
     bool addImplicitSATA = false;
     bool addPCIRoot = false;
@@ -944,6 +971,21 @@ qemuDomainDefPostParse(virDomainDefPtr def,
         !(def->emulator = virDomainDefGetDefaultEmulator(def, caps)))
         return -1;
 
+    /* The driver capabilities lack the machine types of emulators which
+     * were not probed yet, probe the emulator now to get its default.
+     * A broken emulator is reported once the domain is started. */
+    if (!def->os.machine && driver && driver->qemuCapsCache) {
+        if (!(qemuCaps = virQEMUCapsCacheLookup(driver->qemuCapsCache,
+                                                def->emulator))) {
+            virResetLastError();
+        } else if (VIR_STRDUP(def->os.machine,
+                              virQEMUCapsGetDefaultMachine(qemuCaps)) < 0) {
+            virObjectUnref(qemuCaps);
+            return -1;
+        }
+        virObjectUnref(qemuCaps);
+    }
+
     /* Add implicit PCI root controller if the machine has one */
     switch (def->os.arch) {
     case VIR_ARCH_I686:
@@ -1280,27 +1322,58 @@ qemuDomainJobAllowed(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
     return !priv->job.active && qemuDomainNestedJobAllowed(priv, job);
 }
 
-/* Give up waiting for mutex after 30 seconds */
-#define QEMU_JOB_WAIT_TIME (1000ull * 30)
+/*
+ * Wait on @cond until @then (ms since the epoch), or fail right away
+ * with ETIMEDOUT if @then is 0
+ */
+static int
+qemuDomainObjWaitJob(virCondPtr cond,
+                     virDomainObjPtr obj,
+                     unsigned long long then)
+{
+    if (!then) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    return virCondWaitUntil(cond, &obj->parent.lock, then);
+}
+
+static bool
+qemuDomainQueryJobAllowed(qemuDomainObjPrivatePtr priv)
+{
+    return !priv->job.active ||
+        (QEMU_JOB_SHARED_MASK & JOB_MASK(priv->job.active)) != 0;
+}
 
 /*
  * obj must be locked before calling
+ *
+ * With @shared, a QEMU_JOB_QUERY does not become the active job; it
+ * only counts itself in priv->job.queries and may run next to any job
+ * in QEMU_JOB_SHARED_MASK.
+ *
+ * @timeout is in milliseconds, QEMU_JOB_WAIT_NONE fails immediately if
+ * the job cannot be started.
  */
 static int ATTRIBUTE_NONNULL(1)
 qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
                               virDomainObjPtr obj,
                               qemuDomainJob job,
-                              qemuDomainAsyncJob asyncJob)
+                              qemuDomainAsyncJob asyncJob,
+                              bool shared,
+                              unsigned long long timeout)
 {
     qemuDomainObjPrivatePtr priv = obj->privateData;
     unsigned long long now;
-    unsigned long long then;
+    unsigned long long then = 0;
     bool nested = job == QEMU_JOB_ASYNC_NESTED;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     int ret = -1;
 
     VIR_DEBUG("Starting %s: %s (async=%s vm=%p name=%s)",
-              job == QEMU_JOB_ASYNC ? "async job" : "job",
+              job == QEMU_JOB_ASYNC ? "async job" :
+              shared ? "shared job" : "job",
               qemuDomainJobTypeToString(job),
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
               obj, obj->def->name);
@@ -1311,7 +1384,8 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     }
 
     priv->jobs_queued++;
-    then = now + QEMU_JOB_WAIT_TIME;
+    if (timeout != QEMU_JOB_WAIT_NONE)
+        then = now + timeout;
 
     virObjectRef(obj);
 
@@ -1323,13 +1397,32 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
 
     while (!nested && !qemuDomainNestedJobAllowed(priv, job)) {
         VIR_DEBUG("Waiting for async job (vm=%p name=%s)", obj, obj->def->name);
-        if (virCondWaitUntil(&priv->job.asyncCond, &obj->parent.lock, then) < 0)
+        if (qemuDomainObjWaitJob(&priv->job.asyncCond, obj, then) < 0)
             goto error;
     }
 
+    if (shared) {
+        while (!qemuDomainQueryJobAllowed(priv)) {
+            VIR_DEBUG("Waiting for exclusive job (vm=%p name=%s)",
+                      obj, obj->def->name);
+            if (qemuDomainObjWaitJob(&priv->job.queryCond, obj, then) < 0)
+                goto error;
+        }
+
+        if (!qemuDomainNestedJobAllowed(priv, job))
+            goto retry;
+
+        priv->job.queries++;
+        VIR_DEBUG("Started shared job: %s (queries=%u vm=%p name=%s)",
+                  qemuDomainJobTypeToString(job), priv->job.queries,
+                  obj, obj->def->name);
+        virObjectUnref(cfg);
+        return 0;
+    }
+
     while (priv->job.active) {
         VIR_DEBUG("Waiting for job (vm=%p name=%s)", obj, obj->def->name);
-        if (virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then) < 0)
+        if (qemuDomainObjWaitJob(&priv->job.cond, obj, then) < 0)
             goto error;
     }
 
@@ -1340,6 +1433,25 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
 
     qemuDomainObjResetJob(priv);
 
+    /* Claim the job first so that no new query can start, then let
+     * the running ones finish */
+    if (job != QEMU_JOB_ASYNC &&
+        !(QEMU_JOB_SHARED_MASK & JOB_MASK(job))) {
+        priv->job.active = job;
+        priv->job.owner = virThreadSelfID();
+
+        while (priv->job.queries) {
+            VIR_DEBUG("Waiting for %u shared jobs (vm=%p name=%s)",
+                      priv->job.queries, obj, obj->def->name);
+            if (qemuDomainObjWaitJob(&priv->job.cond, obj, then) < 0) {
+                qemuDomainObjResetJob(priv);
+                virCondSignal(&priv->job.cond);
+                virCondBroadcast(&priv->job.queryCond);
+                goto error;
+            }
+        }
+    }
+
     if (job != QEMU_JOB_ASYNC) {
         VIR_DEBUG("Started job: %s (async=%s vm=%p name=%s)",
                    qemuDomainJobTypeToString(job),
@@ -1366,14 +1478,15 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     return 0;
 
  error:
-    VIR_WARN("Cannot start job (%s, %s) for domain %s;"
-             " current job is (%s, %s) owned by (%llu, %llu)",
-             qemuDomainJobTypeToString(job),
-             qemuDomainAsyncJobTypeToString(asyncJob),
-             obj->def->name,
-             qemuDomainJobTypeToString(priv->job.active),
-             qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
-             priv->job.owner, priv->job.asyncOwner);
+    if (timeout != QEMU_JOB_WAIT_NONE)
+        VIR_WARN("Cannot start job (%s, %s) for domain %s;"
+                 " current job is (%s, %s) owned by (%llu, %llu)",
+                 qemuDomainJobTypeToString(job),
+                 qemuDomainAsyncJobTypeToString(asyncJob),
+                 obj->def->name,
+                 qemuDomainJobTypeToString(priv->job.active),
+                 qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                 priv->job.owner, priv->job.asyncOwner);
 
     ret = -1;
     if (errno == ETIMEDOUT) {
@@ -1412,7 +1525,8 @@ int qemuDomainObjBeginJob(virQEMUDriverPtr driver,
                           qemuDomainJob job)
 {
     if (qemuDomainObjBeginJobInternal(driver, obj, job,
-                                      QEMU_ASYNC_JOB_NONE) < 0)
+                                      QEMU_ASYNC_JOB_NONE, false,
+                                      QEMU_JOB_WAIT_TIME) < 0)
         return -1;
     else
         return 0;
@@ -1423,7 +1537,8 @@ int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
                                qemuDomainAsyncJob asyncJob)
 {
     if (qemuDomainObjBeginJobInternal(driver, obj, QEMU_JOB_ASYNC,
-                                      asyncJob) < 0)
+                                      asyncJob, false,
+                                      QEMU_JOB_WAIT_TIME) < 0)
         return -1;
     else
         return 0;
@@ -1449,7 +1564,8 @@ qemuDomainObjBeginNestedJob(virQEMUDriverPtr driver,
 
     return qemuDomainObjBeginJobInternal(driver, obj,
                                          QEMU_JOB_ASYNC_NESTED,
-                                         QEMU_ASYNC_JOB_NONE);
+                                         QEMU_ASYNC_JOB_NONE, false,
+                                         QEMU_JOB_WAIT_TIME);
 }
 
 
@@ -1478,6 +1594,55 @@ bool qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
     if (qemuDomainTrackJob(job))
         qemuDomainObjSaveJob(driver, obj);
     virCondSignal(&priv->job.cond);
+    virCondBroadcast(&priv->job.queryCond);
+
+    return virObjectUnref(obj);
+}
+
+/*
+ * obj must be locked before calling
+ *
+ * Starts a query job which, unlike qemuDomainObjBeginJob(QEMU_JOB_QUERY),
+ * does not wait for modify jobs to finish. Other shared query jobs and
+ * any job from QEMU_JOB_SHARED_MASK may use the monitor concurrently, so
+ * callers must not keep pointers into obj->def across monitor calls.
+ *
+ * Gives up after @timeout milliseconds, or right away with
+ * QEMU_JOB_WAIT_NONE. Returns 0 on success, -2 if the job could not be
+ * acquired in time and -1 on other errors. Successful calls must be
+ * followed by qemuDomainObjEndQueryJob().
+ */
+int
+qemuDomainObjBeginQueryJob(virQEMUDriverPtr driver,
+                           virDomainObjPtr obj,
+                           unsigned long long timeout)
+{
+    return qemuDomainObjBeginJobInternal(driver, obj, QEMU_JOB_QUERY,
+                                         QEMU_ASYNC_JOB_NONE, true,
+                                         timeout);
+}
+
+/*
+ * obj must be locked before calling
+ *
+ * Returns true if @obj was still referenced, false if it was
+ * disposed of.
+ */
+bool
+qemuDomainObjEndQueryJob(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                         virDomainObjPtr obj)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    priv->jobs_queued--;
+    priv->job.queries--;
+
+    VIR_DEBUG("Stopping shared job: %s (queries=%u vm=%p name=%s)",
+              qemuDomainJobTypeToString(QEMU_JOB_QUERY), priv->job.queries,
+              obj, obj->def->name);
+
+    if (!priv->job.queries)
+        virCondBroadcast(&priv->job.cond);
 
     return virObjectUnref(obj);
 }
@@ -1548,7 +1713,11 @@ qemuDomainObjEnterMonitorInternal(virQEMUDriverPtr driver,
               priv->mon, obj, obj->def->name);
     virObjectLock(priv->mon);
     virObjectRef(priv->mon);
-    ignore_value(virTimeMillisNow(&priv->monStart));
+    /* Shared query jobs may use the monitor at the same time, only the
+     * thread owning the job reported by virDomainGetControlInfo times
+     * its monitor calls */
+    if (priv->job.owner == virThreadSelfID())
+        ignore_value(virTimeMillisNow(&priv->monStart));
     virObjectUnlock(obj);
 
     return 0;
@@ -1570,11 +1739,15 @@ qemuDomainObjExitMonitorInternal(virQEMUDriverPtr driver,
     VIR_DEBUG("Exited monitor (mon=%p vm=%p name=%s)",
               priv->mon, obj, obj->def->name);
 
-    priv->monStart = 0;
+    if (priv->job.owner == virThreadSelfID())
+        priv->monStart = 0;
     if (!hasRefs)
         priv->mon = NULL;
 
-    if (priv->job.active == QEMU_JOB_ASYNC_NESTED) {
+    /* Shared query jobs may be leaving the monitor while another thread
+     * holds the nested job */
+    if (priv->job.active == QEMU_JOB_ASYNC_NESTED &&
+        priv->job.owner == virThreadSelfID()) {
         qemuDomainObjResetJob(priv);
         qemuDomainObjSaveJob(driver, obj);
         virCondSignal(&priv->job.cond);
@@ -59,6 +59,25 @@
      JOB_MASK(QEMU_JOB_DESTROY) |       \
      JOB_MASK(QEMU_JOB_ABORT))
 
+/* Jobs which may run while shared query jobs are using the monitor.
+ * qemuMonitorSend() makes each thread wait until the command of any
+ * other thread got its reply, so only jobs which tear the monitor down
+ * need to wait for queries to finish. */
+# define QEMU_JOB_SHARED_MASK           \
+    (JOB_MASK(QEMU_JOB_QUERY) |         \
+     JOB_MASK(QEMU_JOB_SUSPEND) |       \
+     JOB_MASK(QEMU_JOB_MODIFY) |        \
+     JOB_MASK(QEMU_JOB_ABORT) |         \
+     JOB_MASK(QEMU_JOB_MIGRATION_OP) |  \
+     JOB_MASK(QEMU_JOB_ASYNC_NESTED))
+
+/* How long to wait for a job before giving up, in milliseconds */
+# define QEMU_JOB_WAIT_TIME             (1000ull * 30)
+/* Read-only APIs would rather fail fast than queue */
+# define QEMU_JOB_WAIT_QUERY            (1000ull * 5)
+/* Do not wait at all */
+# define QEMU_JOB_WAIT_NONE             0
+
 /* Jobs which have to be tracked in domain state XML. */
 # define QEMU_DOMAIN_TRACK_JOBS         \
     (JOB_MASK(QEMU_JOB_DESTROY) |       \
@@ -118,6 +137,9 @@ struct qemuDomainJobObj {
     qemuDomainJob active;               /* Currently running job */
     unsigned long long owner;           /* Thread id which set current job */
 
+    virCond queryCond;                  /* Use to coordinate with shared queries */
+    unsigned int queries;               /* Number of running shared query jobs */
+
     virCond asyncCond;                  /* Use to coordinate with async jobs */
     qemuDomainAsyncJob asyncJob;        /* Currently active async job */
     unsigned long long asyncOwner;      /* Thread which set current async job */
@@ -134,6 +156,23 @@ typedef void (*qemuDomainCleanupCallback)(virQEMUDriverPtr driver,
 
 typedef struct _qemuDomainObjPrivate qemuDomainObjPrivate;
 typedef qemuDomainObjPrivate *qemuDomainObjPrivatePtr;
+/* One slot per bit of virDomainStatsTypes */
+# define QEMU_DOMAIN_STATS_CACHE_GROUPS 32
+
+/* Bulk stats of a running domain sampled in the background, shared by
+ * all callers asking for cached stats */
+typedef struct _qemuDomainStatsCache qemuDomainStatsCache;
+typedef qemuDomainStatsCache *qemuDomainStatsCachePtr;
+struct _qemuDomainStatsCache {
+    unsigned long long sampled; /* ms since the epoch */
+    unsigned int stats; /* virDomainStatsTypes present below */
+
+    virTypedParameterPtr params[QEMU_DOMAIN_STATS_CACHE_GROUPS];
+    int nparams[QEMU_DOMAIN_STATS_CACHE_GROUPS];
+};
+
+void qemuDomainStatsCacheFree(qemuDomainStatsCachePtr cache);
+
 struct _qemuDomainObjPrivate {
     struct qemuDomainJobObj job;
 
@@ -183,12 +222,15 @@ struct _qemuDomainObjPrivate {
     virCgroupPtr cgroup;
 
     virCond unplugFinished; /* signals that unpluggingDevice was unplugged */
+    virCond trayMoved; /* signals DEVICE_TRAY_MOVED updating a disk tray */
     const char *unpluggingDevice; /* alias of the device that is being unplugged */
     char **qemuDevices; /* NULL-terminated list of devices aliases known to QEMU */
 
     bool hookRun;  /* true if there was a hook run over this domain */
 
     bool quiesced; /* true if filesystems are quiesced */
+
+    qemuDomainStatsCachePtr statsCache; /* NULL unless sampled */
 };
 
 typedef enum {
@@ -229,6 +271,13 @@ int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
 bool qemuDomainObjEndJob(virQEMUDriverPtr driver,
                          virDomainObjPtr obj)
     ATTRIBUTE_RETURN_CHECK;
+int qemuDomainObjBeginQueryJob(virQEMUDriverPtr driver,
+                               virDomainObjPtr obj,
+                               unsigned long long timeout)
+    ATTRIBUTE_RETURN_CHECK;
+bool qemuDomainObjEndQueryJob(virQEMUDriverPtr driver,
+                              virDomainObjPtr obj)
+    ATTRIBUTE_RETURN_CHECK;
 bool qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver,
                               virDomainObjPtr obj)
     ATTRIBUTE_RETURN_CHECK;
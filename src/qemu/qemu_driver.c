@@ -45,6 +45,7 @@
 
 
 #include "qemu_driver.h"
+#include "qemu_driverpriv.h"
 #include "qemu_agent.h"
 #include "qemu_conf.h"
 #include "qemu_capabilities.h"
@@ -88,6 +89,7 @@
 #include "virkeycode.h"
 #include "virnodesuspend.h"
 #include "virtime.h"
+#include "viratomic.h"
 #include "virtypedparam.h"
 #include "virbitmap.h"
 #include "virstring.h"
@@ -169,6 +171,9 @@ static int qemuOpenFileAs(uid_t fallback_uid, gid_t fallback_gid,
                           const char *path, int oflags,
                           bool *needUnlink, bool *bypassSecurityDriver);
 
+static int qemuDomainStatsSamplerStart(virQEMUDriverPtr driver);
+static void qemuDomainStatsSamplerStop(virQEMUDriverPtr driver);
+
 
 virQEMUDriverPtr qemu_driver = NULL;
 
@@ -759,6 +764,9 @@ qemuStateInitialize(bool privileged,
     if (!(qemu_driver->sharedDevices = virHashCreate(30, qemuSharedDeviceEntryFree)))
         goto error;
 
+    if (!(qemu_driver->cpuModelCache = qemuCPUModelCacheNew()))
+        goto error;
+
     if (privileged) {
         if (chown(cfg->libDir, cfg->user, cfg->group) < 0) {
             virReportSystemError(errno,
@@ -799,7 +807,8 @@ qemuStateInitialize(bool privileged,
     if (!qemu_driver->qemuCapsCache)
         goto error;
 
-    if ((qemu_driver->caps = virQEMUDriverCreateCapabilities(qemu_driver)) == NULL)
+    if ((qemu_driver->caps = virQEMUDriverCreateCapabilities(qemu_driver,
+                                                             false)) == NULL)
         goto error;
 
     if (!(qemu_driver->xmlopt = virQEMUDriverCreateXMLConf(qemu_driver)))
@@ -886,6 +895,9 @@ qemuStateInitialize(bool privileged,
     if (!qemu_driver->workerPool)
         goto error;
 
+    if (qemuDomainStatsSamplerStart(qemu_driver) < 0)
+        goto error;
+
     virObjectUnref(conn);
 
     virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
@@ -1031,10 +1043,13 @@ qemuStateCleanup(void)
     if (!qemu_driver)
         return -1;
 
+    qemuDomainStatsSamplerStop(qemu_driver);
+
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->hostdevMgr);
     virHashFree(qemu_driver->sharedDevices);
+    virHashFree(qemu_driver->cpuModelCache);
     virObjectUnref(qemu_driver->caps);
     virQEMUCapsCacheFree(qemu_driver->qemuCapsCache);
 
@@ -2638,9 +2653,8 @@ static int qemuDomainGetInfo(virDomainPtr dom,
             info->memory = vm->def->mem.max_balloon;
         } else if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BALLOON_EVENT)) {
             info->memory = vm->def->mem.cur_balloon;
-        } else if (qemuDomainJobAllowed(priv, QEMU_JOB_QUERY)) {
-            if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
-                goto cleanup;
+        } else if (qemuDomainObjBeginQueryJob(driver, vm,
+                                              QEMU_JOB_WAIT_NONE) == 0) {
             if (!virDomainObjIsActive(vm)) {
                 err = 0;
             } else {
@@ -2648,7 +2662,7 @@ static int qemuDomainGetInfo(virDomainPtr dom,
                 err = qemuMonitorGetBalloonInfo(priv->mon, &balloon);
                 qemuDomainObjExitMonitor(driver, vm);
             }
-            if (!qemuDomainObjEndJob(driver, vm)) {
+            if (!qemuDomainObjEndQueryJob(driver, vm)) {
                 vm = NULL;
                 goto cleanup;
             }
@@ -2666,6 +2680,8 @@ static int qemuDomainGetInfo(virDomainPtr dom,
                 info->memory = balloon;
             }
         } else {
+            /* Don't delay if the monitor can't be used right now */
+            virResetLastError();
             info->memory = vm->def->mem.cur_balloon;
         }
     } else {
@@ -6208,12 +6224,11 @@ static char *qemuDomainGetXMLDesc(virDomainPtr dom,
         (vm->def->memballoon->model != VIR_DOMAIN_MEMBALLOON_MODEL_NONE) &&
         !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BALLOON_EVENT) &&
         (virDomainObjIsActive(vm))) {
-        /* Don't delay if someone's using the monitor, just use
+        /* Don't delay if the monitor can't be used right now, just use
          * existing most recent data instead */
-        if (qemuDomainJobAllowed(priv, QEMU_JOB_QUERY)) {
-            if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
-                goto cleanup;
-
+        if (qemuDomainObjBeginQueryJob(driver, vm, QEMU_JOB_WAIT_NONE) < 0) {
+            virResetLastError();
+        } else {
             if (!virDomainObjIsActive(vm)) {
                 virReportError(VIR_ERR_OPERATION_INVALID,
                                "%s", _("domain is not running"));
@@ -6225,7 +6240,7 @@ static char *qemuDomainGetXMLDesc(virDomainPtr dom,
             qemuDomainObjExitMonitor(driver, vm);
 
  endjob:
-            if (!qemuDomainObjEndJob(driver, vm)) {
+            if (!qemuDomainObjEndQueryJob(driver, vm)) {
                 vm = NULL;
                 goto cleanup;
             }
@@ -10115,6 +10130,7 @@ qemuDomainBlockStats(virDomainPtr dom,
     virDomainObjPtr vm;
     virDomainDiskDefPtr disk = NULL;
     qemuDomainObjPrivatePtr priv;
+    char *alias = NULL;
 
     if (!*path) {
         virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
@@ -10128,7 +10144,7 @@ qemuDomainBlockStats(virDomainPtr dom,
     if (virDomainBlockStatsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (qemuDomainObjBeginQueryJob(driver, vm, QEMU_JOB_WAIT_QUERY) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
@@ -10150,11 +10166,15 @@ qemuDomainBlockStats(virDomainPtr dom,
         goto endjob;
     }
 
+    /* The disk may be unplugged while we are in the monitor */
+    if (VIR_STRDUP(alias, disk->info.alias) < 0)
+        goto endjob;
+
     priv = vm->privateData;
 
     qemuDomainObjEnterMonitor(driver, vm);
     ret = qemuMonitorGetBlockStatsInfo(priv->mon,
-                                       disk->info.alias,
+                                       alias,
                                        &stats->rd_req,
                                        &stats->rd_bytes,
                                        NULL,
@@ -10167,12 +10187,13 @@ qemuDomainBlockStats(virDomainPtr dom,
     qemuDomainObjExitMonitor(driver, vm);
 
  endjob:
-    if (!qemuDomainObjEndJob(driver, vm))
+    if (!qemuDomainObjEndQueryJob(driver, vm))
         vm = NULL;
 
  cleanup:
     if (vm)
         virObjectUnlock(vm);
+    VIR_FREE(alias);
     return ret;
 }
 
@@ -10193,6 +10214,7 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
     long long rd_req, rd_bytes, wr_req, wr_bytes, rd_total_times;
     long long wr_total_times, flush_req, flush_total_times, errs;
     virTypedParameterPtr param;
+    char *alias = NULL;
 
     virCheckFlags(VIR_TYPED_PARAM_STRING_OKAY, -1);
 
@@ -10211,7 +10233,7 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
     if (virDomainBlockStatsFlagsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (qemuDomainObjBeginQueryJob(driver, vm, QEMU_JOB_WAIT_QUERY) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
@@ -10234,6 +10256,10 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
                             disk->dst);
              goto endjob;
         }
+
+        /* The disk may be unplugged while we are in the monitor */
+        if (VIR_STRDUP(alias, disk->info.alias) < 0)
+            goto endjob;
     }
 
     priv = vm->privateData;
@@ -10249,7 +10275,7 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
     }
 
     ret = qemuMonitorGetBlockStatsInfo(priv->mon,
-                                       disk->info.alias,
+                                       alias,
                                        &rd_req,
                                        &rd_bytes,
                                        &rd_total_times,
@@ -10342,12 +10368,13 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
     *nparams = tmp;
 
  endjob:
-    if (!qemuDomainObjEndJob(driver, vm))
+    if (!qemuDomainObjEndQueryJob(driver, vm))
         vm = NULL;
 
  cleanup:
     if (vm)
         virObjectUnlock(vm);
+    VIR_FREE(alias);
     return ret;
 }
 
@@ -10732,7 +10759,7 @@ qemuDomainMemoryStats(virDomainPtr dom,
     if (virDomainMemoryStatsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (qemuDomainObjBeginQueryJob(driver, vm, QEMU_JOB_WAIT_QUERY) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
@@ -10758,7 +10785,7 @@ qemuDomainMemoryStats(virDomainPtr dom,
         }
     }
 
-    if (!qemuDomainObjEndJob(driver, vm))
+    if (!qemuDomainObjEndQueryJob(driver, vm))
         vm = NULL;
 
  cleanup:
@@ -17878,6 +17905,7 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
     char *ret = NULL;
     virQEMUDriverPtr driver = conn->privateData;
     virQEMUCapsPtr qemuCaps = NULL;
+    virCapsPtr caps = NULL;
     int virttype; /* virDomainVirtType */
     virDomainCapsPtr domCaps = NULL;
     int arch = virArchFromHost(); /* virArch */
@@ -17929,8 +17957,20 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
             goto cleanup;
         }
     } else {
+        /* the emulators for @arch may not have been probed yet */
         if (!(qemuCaps = virQEMUCapsCacheLookupByArch(driver->qemuCapsCache,
                                                       arch))) {
+            if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+                goto cleanup;
+
+            emulatorbin = virCapabilitiesDefaultGuestEmulator(caps, "hvm", arch,
+                                        virDomainVirtTypeToString(virttype));
+            if (emulatorbin)
+                qemuCaps = virQEMUCapsCacheLookup(driver->qemuCapsCache,
+                                                  emulatorbin);
+        }
+
+        if (!qemuCaps) {
             virReportError(VIR_ERR_INVALID_ARG,
                            _("unable to find any emulator to serve '%s' "
                              "architecture"), virArchToString(arch));
@@ -17964,6 +18004,7 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
     ret = virDomainCapsFormat(domCaps);
  cleanup:
     virObjectUnref(cfg);
+    virObjectUnref(caps);
     virObjectUnref(domCaps);
     virObjectUnref(qemuCaps);
     return ret;
@@ -17975,6 +18016,7 @@ qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
+                        qemuDomainStatsSharedPtr shared ATTRIBUTE_UNUSED,
                         unsigned int privflags ATTRIBUTE_UNUSED)
 {
     if (virTypedParamsAddInt(&record->params,
@@ -17995,12 +18037,6 @@ qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 }
 
 
-typedef enum {
-    QEMU_DOMAIN_STATS_HAVE_JOB = (1 << 0), /* job is entered, monitor can be
-                                              accessed */
-} qemuDomainStatsFlags;
-
-
 #define HAVE_JOB(flags) ((flags) & QEMU_DOMAIN_STATS_HAVE_JOB)
 
 
@@ -18009,6 +18045,7 @@ qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                       virDomainObjPtr dom,
                       virDomainStatsRecordPtr record,
                       int *maxparams,
+                      qemuDomainStatsSharedPtr shared ATTRIBUTE_UNUSED,
                       unsigned int privflags ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
@@ -18050,6 +18087,7 @@ qemuDomainGetStatsBalloon(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                           virDomainObjPtr dom,
                           virDomainStatsRecordPtr record,
                           int *maxparams,
+                          qemuDomainStatsSharedPtr shared ATTRIBUTE_UNUSED,
                           unsigned int privflags ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
@@ -18088,6 +18126,7 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                        virDomainObjPtr dom,
                        virDomainStatsRecordPtr record,
                        int *maxparams,
+                       qemuDomainStatsSharedPtr shared ATTRIBUTE_UNUSED,
                        unsigned int privflags ATTRIBUTE_UNUSED)
 {
     size_t i;
@@ -18193,10 +18232,12 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                             virDomainObjPtr dom,
                             virDomainStatsRecordPtr record,
                             int *maxparams,
+                            qemuDomainStatsSharedPtr shared,
                             unsigned int privflags ATTRIBUTE_UNUSED)
 {
     size_t i;
     struct _virDomainInterfaceStats tmp;
+    int rc;
 
     if (!virDomainObjIsActive(dom))
         return 0;
@@ -18213,7 +18254,13 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
         QEMU_ADD_NAME_PARAM(record, maxparams,
                             "net", i, dom->def->nets[i]->ifname);
 
-        if (virNetInterfaceStats(dom->def->nets[i]->ifname, &tmp) < 0) {
+        if (shared && shared->ifstats)
+            rc = virNetInterfaceStatsTableGet(shared->ifstats,
+                                              dom->def->nets[i]->ifname, &tmp);
+        else
+            rc = virNetInterfaceStats(dom->def->nets[i]->ifname, &tmp);
+
+        if (rc < 0) {
             virResetLastError();
             continue;
         }
@@ -18273,6 +18320,7 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
+                        qemuDomainStatsSharedPtr shared ATTRIBUTE_UNUSED,
                         unsigned int privflags)
 {
     size_t i;
@@ -18356,6 +18404,7 @@ typedef int
                           virDomainObjPtr dom,
                           virDomainStatsRecordPtr record,
                           int *maxparams,
+                          qemuDomainStatsSharedPtr shared,
                           unsigned int flags);
 
 struct qemuDomainGetStatsWorker {
@@ -18417,11 +18466,12 @@ qemuDomainGetStatsNeedMonitor(unsigned int stats)
 }
 
 
-static int
+int
 qemuDomainGetStats(virConnectPtr conn,
                    virDomainObjPtr dom,
                    unsigned int stats,
                    virDomainStatsRecordPtr *record,
+                   qemuDomainStatsSharedPtr shared,
                    unsigned int flags)
 {
     int maxparams = 0;
@@ -18435,7 +18485,8 @@ qemuDomainGetStats(virConnectPtr conn,
     for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
         if (stats & qemuDomainGetStatsWorkers[i].stats) {
             if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, tmp,
-                                                  &maxparams, flags) < 0)
+                                                  &maxparams, shared,
+                                                  flags) < 0)
                 goto cleanup;
         }
     }
@@ -18457,6 +18508,310 @@ qemuDomainGetStats(virConnectPtr conn,
 }
 
 
+static int
+qemuDomainStatsAppendParams(virDomainStatsRecordPtr record,
+                            int *maxparams,
+                            virTypedParameterPtr params,
+                            int nparams)
+{
+    size_t max = *maxparams;
+    size_t n = record->nparams;
+    size_t i;
+
+    if (VIR_RESIZE_N(record->params, max, n, nparams) < 0)
+        return -1;
+    *maxparams = max;
+
+    for (i = 0; i < nparams; i++) {
+        virTypedParameterPtr param = &record->params[record->nparams];
+
+        *param = params[i];
+        if (params[i].type == VIR_TYPED_PARAM_STRING &&
+            VIR_STRDUP(param->value.s, params[i].value.s) < 0)
+            return -1;
+        record->nparams++;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Serve @stats for @dom from the background sampler. The state group
+ * is cheap and always taken live. Must be called with @dom locked, no
+ * job needed. Returns 1 and fills @record on a hit, 0 if the sample is
+ * missing or too old, -1 on error.
+ */
+int
+qemuDomainGetStatsCached(virConnectPtr conn,
+                         virDomainObjPtr dom,
+                         unsigned int stats,
+                         virDomainStatsRecordPtr *record)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuDomainStatsCachePtr cache = priv->statsCache;
+    virDomainStatsRecordPtr tmp = NULL;
+    unsigned long long now;
+    int maxparams = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!cfg->statsSampleInterval || !cache ||
+        !virDomainObjIsActive(dom) ||
+        (stats & ~VIR_DOMAIN_STATS_STATE & ~cache->stats) ||
+        virTimeMillisNow(&now) < 0 ||
+        now - cache->sampled > 2000ULL * cfg->statsSampleInterval) {
+        virAtomicIntInc(&driver->statsCacheMisses);
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC(tmp) < 0)
+        goto cleanup;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        unsigned int group = qemuDomainGetStatsWorkers[i].stats;
+        int bit = ffs(group) - 1;
+
+        if (!(stats & group))
+            continue;
+
+        if (group == VIR_DOMAIN_STATS_STATE) {
+            if (qemuDomainGetStatsWorkers[i].func(driver, dom, tmp,
+                                                  &maxparams, NULL, 0) < 0)
+                goto cleanup;
+        } else if (qemuDomainStatsAppendParams(tmp, &maxparams,
+                                               cache->params[bit],
+                                               cache->nparams[bit]) < 0) {
+            goto cleanup;
+        }
+    }
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name, dom->def->uuid)))
+        goto cleanup;
+
+    virAtomicIntInc(&driver->statsCacheHits);
+    *record = tmp;
+    tmp = NULL;
+    ret = 1;
+
+ cleanup:
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        VIR_FREE(tmp);
+    }
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+/* Refresh the stats cache of @dom, which is locked and referenced */
+void
+qemuDomainStatsSampleOne(virQEMUDriverPtr driver,
+                         virDomainObjPtr dom,
+                         qemuDomainStatsSharedPtr shared)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuDomainStatsCachePtr cache = NULL;
+    size_t i;
+
+    if (!virDomainObjIsActive(dom))
+        return;
+
+    if (qemuDomainObjBeginQueryJob(driver, dom, QEMU_JOB_WAIT_QUERY) < 0) {
+        /* Try again next time, readers fall back to live queries */
+        virResetLastError();
+        return;
+    }
+
+    if (VIR_ALLOC(cache) < 0)
+        goto endjob;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        unsigned int group = qemuDomainGetStatsWorkers[i].stats;
+        int bit = ffs(group) - 1;
+        virDomainStatsRecord record;
+        int maxparams = 0;
+
+        if (group == VIR_DOMAIN_STATS_STATE)
+            continue;
+
+        memset(&record, 0, sizeof(record));
+        if (qemuDomainGetStatsWorkers[i].func(driver, dom, &record, &maxparams,
+                                              shared,
+                                              QEMU_DOMAIN_STATS_HAVE_JOB) < 0) {
+            /* Leave this group to live queries */
+            virTypedParamsFree(record.params, record.nparams);
+            virResetLastError();
+            continue;
+        }
+
+        cache->params[bit] = record.params;
+        cache->nparams[bit] = record.nparams;
+        cache->stats |= group;
+    }
+
+    if (virTimeMillisNow(&cache->sampled) < 0) {
+        virResetLastError();
+        goto endjob;
+    }
+
+    /* The monitor was entered, so the domain may be gone meanwhile */
+    if (virDomainObjIsActive(dom)) {
+        qemuDomainStatsCacheFree(priv->statsCache);
+        priv->statsCache = cache;
+        cache = NULL;
+    }
+
+ endjob:
+    ignore_value(qemuDomainObjEndQueryJob(driver, dom));
+    qemuDomainStatsCacheFree(cache);
+}
+
+
+struct qemuDomainStatsSampleData {
+    virDomainObjPtr *doms;
+    size_t ndoms;
+};
+
+static int
+qemuDomainStatsSampleCollect(virDomainObjPtr obj,
+                             void *opaque)
+{
+    struct qemuDomainStatsSampleData *data = opaque;
+
+    if (!virDomainObjIsActive(obj))
+        return 0;
+
+    if (VIR_APPEND_ELEMENT(data->doms, data->ndoms, obj) < 0)
+        return -1;
+    virObjectRef(obj);
+
+    return 0;
+}
+
+
+static void
+qemuDomainStatsSamplePass(virQEMUDriverPtr driver)
+{
+    struct qemuDomainStatsSampleData data = { NULL, 0 };
+    qemuDomainStatsShared shared = { NULL };
+    unsigned long long then;
+    unsigned long long now;
+    size_t i;
+
+    if (virTimeMillisNow(&then) < 0)
+        return;
+
+    virDomainObjListForEach(driver->domains,
+                            qemuDomainStatsSampleCollect, &data);
+
+    /* As in qemuConnectGetAllDomainStats */
+    if (data.ndoms > 1 && !(shared.ifstats = virNetInterfaceStatsTableNew()))
+        virResetLastError();
+
+    for (i = 0; i < data.ndoms; i++) {
+        virObjectLock(data.doms[i]);
+        qemuDomainStatsSampleOne(driver, data.doms[i], &shared);
+        virObjectUnlock(data.doms[i]);
+        virObjectUnref(data.doms[i]);
+    }
+
+    virNetInterfaceStatsTableFree(shared.ifstats);
+
+    if (virTimeMillisNow(&now) == 0)
+        VIR_DEBUG("Sampled stats of %zu domains in %llu ms, "
+                  "cache hits=%u misses=%u", data.ndoms, now - then,
+                  virAtomicIntGet(&driver->statsCacheHits),
+                  virAtomicIntGet(&driver->statsCacheMisses));
+
+    VIR_FREE(data.doms);
+}
+
+
+static void
+qemuDomainStatsSampler(void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    unsigned long long interval = cfg->statsSampleInterval * 1000ULL;
+    unsigned long long next;
+
+    virObjectUnref(cfg);
+
+    virMutexLock(&driver->lock);
+    while (!driver->statsSamplerQuit) {
+        virMutexUnlock(&driver->lock);
+        qemuDomainStatsSamplePass(driver);
+        virMutexLock(&driver->lock);
+
+        if (virTimeMillisNow(&next) < 0)
+            break;
+        next += interval;
+
+        while (!driver->statsSamplerQuit &&
+               virCondWaitUntil(&driver->statsSamplerCond,
+                                &driver->lock, next) == 0)
+            ;
+    }
+    virMutexUnlock(&driver->lock);
+}
+
+
+static int
+qemuDomainStatsSamplerStart(virQEMUDriverPtr driver)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    int ret = -1;
+
+    if (!cfg->statsSampleInterval) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virCondInit(&driver->statsSamplerCond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize stats sampler condition"));
+        goto cleanup;
+    }
+
+    driver->statsSamplerQuit = false;
+    if (virThreadCreate(&driver->statsSampler, true,
+                        qemuDomainStatsSampler, driver) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot create stats sampler thread"));
+        virCondDestroy(&driver->statsSamplerCond);
+        goto cleanup;
+    }
+    driver->statsSamplerRunning = true;
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+static void
+qemuDomainStatsSamplerStop(virQEMUDriverPtr driver)
+{
+    if (!driver->statsSamplerRunning)
+        return;
+
+    virMutexLock(&driver->lock);
+    driver->statsSamplerQuit = true;
+    virCondSignal(&driver->statsSamplerCond);
+    virMutexUnlock(&driver->lock);
+
+    virThreadJoin(&driver->statsSampler);
+    virCondDestroy(&driver->statsSamplerCond);
+    driver->statsSamplerRunning = false;
+}
+
+
 static int
 qemuConnectGetAllDomainStats(virConnectPtr conn,
                              virDomainPtr *doms,
@@ -18469,6 +18824,7 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     virDomainPtr *domlist = NULL;
     virDomainObjPtr dom = NULL;
     virDomainStatsRecordPtr *tmpstats = NULL;
+    qemuDomainStatsShared shared = { NULL };
     bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
     int ntempdoms;
     int nstats = 0;
@@ -18478,12 +18834,14 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     unsigned int domflags = 0;
 
     if (ndoms)
-        virCheckFlags(VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+        virCheckFlags(VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS |
+                      VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED, -1);
     else
         virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
                       VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
                       VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
-                      VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+                      VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS |
+                      VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED, -1);
 
     if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
         return -1;
@@ -18513,9 +18871,16 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     if (qemuDomainGetStatsNeedMonitor(stats))
         privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
 
+    /* One netlink dump covers the interfaces of all the domains. If
+     * it fails, they are looked up one by one instead. */
+    if (stats & VIR_DOMAIN_STATS_INTERFACE && ndoms > 1 &&
+        !(shared.ifstats = virNetInterfaceStatsTableNew()))
+        virResetLastError();
+
     for (i = 0; i < ndoms; i++) {
         domflags = privflags;
         virDomainStatsRecordPtr tmp = NULL;
+        int rc;
 
         if (!(dom = qemuDomObjFromDomain(doms[i])))
             continue;
@@ -18524,18 +18889,34 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
             !virConnectGetAllDomainStatsCheckACL(conn, dom->def))
             continue;
 
+        if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED) {
+            domflags = 0;
+            if ((rc = qemuDomainGetStatsCached(conn, dom, stats, &tmp)) < 0)
+                goto cleanup;
+
+            if (rc > 0) {
+                tmpstats[nstats++] = tmp;
+                virObjectUnlock(dom);
+                dom = NULL;
+                continue;
+            }
+            domflags = privflags;
+        }
+
         if (HAVE_JOB(domflags) &&
-            qemuDomainObjBeginJob(driver, dom, QEMU_JOB_QUERY) < 0)
+            qemuDomainObjBeginQueryJob(driver, dom, QEMU_JOB_WAIT_QUERY) < 0) {
             /* As it was never requested. Gather as much as possible anyway. */
+            virResetLastError();
             domflags &= ~QEMU_DOMAIN_STATS_HAVE_JOB;
+        }
 
-        if (qemuDomainGetStats(conn, dom, stats, &tmp, domflags) < 0)
+        if (qemuDomainGetStats(conn, dom, stats, &tmp, &shared, domflags) < 0)
             goto endjob;
 
         if (tmp)
             tmpstats[nstats++] = tmp;
 
-        if (HAVE_JOB(domflags) && !qemuDomainObjEndJob(driver, dom)) {
+        if (HAVE_JOB(domflags) && !qemuDomainObjEndQueryJob(driver, dom)) {
             dom = NULL;
             continue;
         }
@@ -18551,7 +18932,7 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
 
  endjob:
     if (HAVE_JOB(domflags) && dom)
-        if (!qemuDomainObjEndJob(driver, dom))
+        if (!qemuDomainObjEndQueryJob(driver, dom))
             dom = NULL;
 
  cleanup:
@@ -18560,6 +18941,7 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
 
     virDomainStatsRecordListFree(tmpstats);
     virDomainListFree(domlist);
+    virNetInterfaceStatsTableFree(shared.ifstats);
 
     return ret;
 }
@@ -0,0 +1,61 @@
+/*
+ * qemu_driverpriv.h: private declarations for the QEMU driver
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __QEMU_DRIVERPRIV_H__
+# define __QEMU_DRIVERPRIV_H__
+
+# include "domain_conf.h"
+# include "qemu_conf.h"
+# include "virstats.h"
+
+/*
+ * This header file should never be used outside unit tests.
+ */
+
+/* Read once for all the domains of a query rather than for each */
+typedef struct _qemuDomainStatsShared qemuDomainStatsShared;
+typedef qemuDomainStatsShared *qemuDomainStatsSharedPtr;
+struct _qemuDomainStatsShared {
+    virNetInterfaceStatsTablePtr ifstats; /* NULL to query each interface */
+};
+
+typedef enum {
+    QEMU_DOMAIN_STATS_HAVE_JOB = (1 << 0), /* job is entered, monitor can be
+                                              accessed */
+} qemuDomainStatsFlags;
+
+int qemuDomainGetStats(virConnectPtr conn,
+                       virDomainObjPtr dom,
+                       unsigned int stats,
+                       virDomainStatsRecordPtr *record,
+                       qemuDomainStatsSharedPtr shared,
+                       unsigned int flags);
+
+int qemuDomainGetStatsCached(virConnectPtr conn,
+                             virDomainObjPtr dom,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr *record);
+
+void qemuDomainStatsSampleOne(virQEMUDriverPtr driver,
+                              virDomainObjPtr dom,
+                              qemuDomainStatsSharedPtr shared);
+
+#endif /* __QEMU_DRIVERPRIV_H__ */
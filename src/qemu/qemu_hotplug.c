@@ -55,11 +55,12 @@
 
 VIR_LOG_INIT("qemu.qemu_hotplug");
 
-#define CHANGE_MEDIA_RETRIES 10
-
 /* Wait up to 5 seconds for device removal to finish. */
 unsigned long long qemuDomainRemoveDeviceWaitTime = 1000ull * 5;
 
+/* Wait up to 5 seconds for the tray to open after eject. */
+unsigned long long qemuDomainChangeMediaWaitTime = 1000ull * 5;
+
 
 /**
  * qemuDomainPrepareDisk:
@@ -165,7 +166,7 @@ qemuDomainChangeEjectableMedia(virQEMUDriverPtr driver,
     int ret = -1;
     char *driveAlias = NULL;
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    int retries = CHANGE_MEDIA_RETRIES;
+    unsigned long long until;
     const char *format = NULL;
     char *sourcestr = NULL;
 
@@ -196,23 +197,30 @@ qemuDomainChangeEjectableMedia(virQEMUDriverPtr driver,
     if (ret < 0)
         goto error;
 
+    if (virTimeMillisNow(&until) < 0) {
+        ret = -1;
+        goto error;
+    }
+    until += qemuDomainChangeMediaWaitTime;
+
+    /* DEVICE_TRAY_MOVED updates tray_status and wakes us up */
     virObjectRef(vm);
-    /* we don't want to report errors from media tray_open polling */
-    while (retries) {
-        if (disk->tray_status == VIR_DOMAIN_DISK_TRAY_OPEN)
+    while (disk->tray_status != VIR_DOMAIN_DISK_TRAY_OPEN) {
+        VIR_DEBUG("Waiting for tray of %s to open", disk->dst);
+        if (virCondWaitUntil(&priv->trayMoved, &vm->parent.lock, until) < 0) {
+            if (errno == ETIMEDOUT) {
+                virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                               _("Unable to eject media"));
+            } else {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to wait on tray condition"));
+            }
             break;
-
-        retries--;
-        virObjectUnlock(vm);
-        VIR_DEBUG("Waiting 500ms for tray to open. Retries left %d", retries);
-        usleep(500 * 1000); /* sleep 500ms */
-        virObjectLock(vm);
+        }
     }
     virObjectUnref(vm);
 
-    if (retries <= 0) {
-        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
-                       _("Unable to eject media"));
+    if (disk->tray_status != VIR_DOMAIN_DISK_TRAY_OPEN) {
         ret = -1;
         goto error;
     }
@@ -27,5 +27,6 @@
  */
 
 extern unsigned long long qemuDomainRemoveDeviceWaitTime;
+extern unsigned long long qemuDomainChangeMediaWaitTime;
 
 #endif /* __QEMU_HOTPLUGPRIV_H__ */
@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include "dirname.h"
 #include "qemu_monitor.h"
 #include "qemu_monitor_text.h"
 #include "qemu_monitor_json.h"
@@ -42,6 +43,7 @@
 #include "virobject.h"
 #include "virprobe.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #ifdef WITH_DTRACE_PROBES
 # include "libvirt_qemu_probes.h"
@@ -58,6 +60,9 @@ struct _qemuMonitor {
     virObjectLockable parent;
 
     virCond notify;
+    /* Signalled when @msg is cleared. Threads sharing the monitor,
+     * such as query jobs, wait on it before sending their command */
+    virCond idle;
 
     int fd;
     int watch;
@@ -262,6 +267,7 @@ static void qemuMonitorDispose(void *obj)
 
     virResetError(&mon->lastError);
     virCondDestroy(&mon->notify);
+    virCondDestroy(&mon->idle);
     VIR_FREE(mon->buffer);
     virJSONValueFree(mon->options);
     VIR_FREE(mon->balloonpath);
@@ -269,14 +275,25 @@ static void qemuMonitorDispose(void *obj)
 }
 
 
+/* Longest time to wait between two connection attempts, in milliseconds.
+ * Attempts are normally triggered by the socket showing up, this only
+ * bounds how late a dead QEMU or a platform without file notification
+ * is noticed. */
+#define QEMU_MONITOR_CONNECT_WAIT_MAX 200
+
 static int
 qemuMonitorOpenUnix(const char *monitor, pid_t cpid)
 {
     struct sockaddr_un addr;
     int monfd;
     int timeout = 30; /* In seconds */
+    int wait = 1; /* In milliseconds, doubled after each attempt */
+    unsigned long long now;
+    unsigned long long deadline;
+    char *dir = NULL;
+    virFileWatchPtr watch = NULL;
     int ret;
-    size_t i = 0;
+    int rc;
 
     if ((monfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
         virReportSystemError(errno,
@@ -292,34 +309,64 @@ qemuMonitorOpenUnix(const char *monitor, pid_t cpid)
         goto error;
     }
 
-    do {
+    /* Watch for QEMU creating the socket rather than probing for it at
+     * a fixed rate, so that we connect as soon as it is listening. The
+     * watch has to exist before the first attempt, or the socket could
+     * show up unnoticed in between. */
+    if (!(dir = mdir_name(monitor))) {
+        virReportOOMError();
+        goto error;
+    }
+    if (!(watch = virFileWatchNew(dir)))
+        goto error;
+
+    if (virTimeMillisNow(&now) < 0)
+        goto error;
+    deadline = now + timeout * 1000;
+
+    while (true) {
         ret = connect(monfd, (struct sockaddr *) &addr, sizeof(addr));
 
         if (ret == 0)
             break;
 
-        if ((errno == ENOENT || errno == ECONNREFUSED) &&
-            (!cpid || virProcessKill(cpid, 0) == 0)) {
-            /* ENOENT       : Socket may not have shown up yet
-             * ECONNREFUSED : Leftover socket hasn't been removed yet */
-            continue;
+        if ((errno != ENOENT && errno != ECONNREFUSED) ||
+            (cpid && virProcessKill(cpid, 0) < 0)) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to connect to monitor socket"));
+            goto error;
         }
 
-        virReportSystemError(errno, "%s",
-                             _("failed to connect to monitor socket"));
-        goto error;
+        /* ENOENT       : Socket may not have shown up yet
+         * ECONNREFUSED : Leftover socket hasn't been removed yet, or
+         *                QEMU has not started listening on it */
+        if (virTimeMillisNow(&now) < 0)
+            goto error;
 
-    } while ((++i <= timeout*5) && (usleep(.2 * 1000000) <= 0));
+        if (now >= deadline) {
+            virReportSystemError(errno, "%s",
+                                 _("monitor socket did not show up"));
+            goto error;
+        }
 
-    if (ret != 0) {
-        virReportSystemError(errno, "%s",
-                             _("monitor socket did not show up"));
-        goto error;
+        if ((rc = virFileWatchWait(watch, MIN(wait, deadline - now))) < 0)
+            goto error;
+
+        /* Something happened in the directory, so the socket is probably
+         * there; otherwise back off towards QEMU_MONITOR_CONNECT_WAIT_MAX */
+        if (rc > 0)
+            wait = 1;
+        else
+            wait = MIN(wait * 2, QEMU_MONITOR_CONNECT_WAIT_MAX);
     }
 
+    virFileWatchFree(watch);
+    VIR_FREE(dir);
     return monfd;
 
  error:
+    virFileWatchFree(watch);
+    VIR_FREE(dir);
     VIR_FORCE_CLOSE(monfd);
     return -1;
 }
@@ -789,6 +836,12 @@ qemuMonitorOpenInternal(virDomainObjPtr vm,
                        _("cannot initialize monitor condition"));
         goto cleanup;
     }
+    if (virCondInit(&mon->idle) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize monitor condition"));
+        virCondDestroy(&mon->notify);
+        goto cleanup;
+    }
     mon->fd = fd;
     mon->hasSendFD = hasSendFD;
     mon->vm = virObjectRef(vm);
@@ -956,6 +1009,17 @@ int qemuMonitorSend(qemuMonitorPtr mon,
 {
     int ret = -1;
 
+    /* Waiting for the reply drops the monitor lock, so another thread
+     * may be in the middle of a command of its own. Only one command
+     * can be outstanding, so wait for it to complete. */
+    while (mon->msg) {
+        if (virCondWait(&mon->idle, &mon->parent.lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to wait on monitor condition"));
+            return -1;
+        }
+    }
+
     /* Check whether qemu quit unexpectedly */
     if (mon->lastError.code != VIR_ERR_OK) {
         VIR_DEBUG("Attempt to send command while error is set %s",
@@ -971,7 +1035,7 @@ int qemuMonitorSend(qemuMonitorPtr mon,
           "mon=%p msg=%s fd=%d",
           mon, mon->msg->txBuffer, mon->msg->txFD);
 
-    while (!mon->msg->finished) {
+    while (!msg->finished) {
         if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("Unable to wait on monitor condition"));
@@ -991,6 +1055,7 @@ int qemuMonitorSend(qemuMonitorPtr mon,
  cleanup:
     mon->msg = NULL;
     qemuMonitorUpdateWatch(mon);
+    virCondBroadcast(&mon->idle);
 
     return ret;
 }
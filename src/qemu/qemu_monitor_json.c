@@ -43,6 +43,7 @@
 #include "virjson.h"
 #include "virprobe.h"
 #include "virstring.h"
+#include "virtime.h"
 #include "cpu/cpu_x86.h"
 
 #ifdef WITH_DTRACE_PROBES
@@ -57,6 +58,11 @@ VIR_LOG_INIT("qemu.qemu_monitor_json");
 
 #define LINE_ENDING "\r\n"
 
+/* How long 'cont' is retried while QEMU still expects migration data,
+ * and the longest pause between two attempts (ms) */
+#define QEMU_MONITOR_JSON_CONT_WAIT 1000
+#define QEMU_MONITOR_JSON_CONT_DELAY_MAX 100
+
 static void qemuMonitorJSONHandleShutdown(qemuMonitorPtr mon, virJSONValuePtr data);
 static void qemuMonitorJSONHandleReset(qemuMonitorPtr mon, virJSONValuePtr data);
 static void qemuMonitorJSONHandlePowerdown(qemuMonitorPtr mon, virJSONValuePtr data);
@@ -975,11 +981,19 @@ qemuMonitorJSONStartCPUs(qemuMonitorPtr mon,
     int ret;
     virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("cont", NULL);
     virJSONValuePtr reply = NULL;
-    size_t i = 0;
-    int timeout = 3;
+    unsigned long long now;
+    unsigned long long until;
+    unsigned int delay = 1;
+
     if (!cmd)
         return -1;
 
+    if (virTimeMillisNow(&until) < 0) {
+        virJSONValueFree(cmd);
+        return -1;
+    }
+    until += QEMU_MONITOR_JSON_CONT_WAIT;
+
     do {
         ret = qemuMonitorJSONCommand(mon, cmd, &reply);
 
@@ -997,8 +1011,14 @@ qemuMonitorJSONStartCPUs(qemuMonitorPtr mon,
 
         virJSONValueFree(reply);
         reply = NULL;
-        usleep(250000);
-    } while (++i <= timeout);
+
+        /* QEMU emits no event once incoming migration finishes, so
+         * back off quickly instead of sleeping a fixed time */
+        if (virTimeMillisNow(&now) < 0 || now >= until)
+            break;
+        usleep(MIN(delay, until - now) * 1000);
+        delay = MIN(delay * 2, QEMU_MONITOR_JSON_CONT_DELAY_MAX);
+    } while (true);
 
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
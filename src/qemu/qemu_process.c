@@ -1215,7 +1215,7 @@ qemuProcessHandleGraphics(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     return -1;
 }
 
-static int
+int
 qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                             virDomainObjPtr vm,
                             const char *devAlias,
@@ -1225,6 +1225,7 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
     virDomainDiskDefPtr disk;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
@@ -1239,6 +1240,7 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             disk->tray_status = VIR_DOMAIN_DISK_TRAY_OPEN;
         else if (reason == VIR_DOMAIN_EVENT_TRAY_CHANGE_CLOSE)
             disk->tray_status = VIR_DOMAIN_DISK_TRAY_CLOSED;
+        virCondBroadcast(&priv->trayMoved);
 
         if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after tray moved event",
@@ -1673,10 +1675,14 @@ typedef int qemuProcessLogHandleOutput(virDomainObjPtr vm,
                                        int fd);
 
 /*
+ * Read the log from @fd until @func is satisfied, waking up whenever
+ * @logfile changes rather than at a fixed rate. @timeout is in seconds.
+ *
  * Returns -1 for error, 0 on success
  */
 static int
 qemuProcessReadLogOutput(virDomainObjPtr vm,
+                         const char *logfile,
                          int fd,
                          char *buf,
                          size_t buflen,
@@ -1684,13 +1690,23 @@ qemuProcessReadLogOutput(virDomainObjPtr vm,
                          const char *what,
                          int timeout)
 {
-    int retries = (timeout*10);
+    unsigned long long now;
+    unsigned long long deadline;
+    virFileWatchPtr watch = NULL;
     int got = 0;
     int ret = -1;
 
     buf[0] = '\0';
 
-    while (retries) {
+    /* Set up before the first read so that no write goes unnoticed */
+    if (!(watch = virFileWatchNew(logfile)))
+        goto cleanup;
+
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+    deadline = now + timeout * 1000;
+
+    while (now < deadline) {
         ssize_t func_ret;
         bool isdead;
 
@@ -1725,8 +1741,10 @@ qemuProcessReadLogOutput(virDomainObjPtr vm,
             goto cleanup;
         }
 
-        usleep(100*1000);
-        retries--;
+        /* QEMU dying without writing anything is only seen on timeout */
+        if (virFileWatchWait(watch, MIN(100, deadline - now)) < 0 ||
+            virTimeMillisNow(&now) < 0)
+            goto cleanup;
     }
 
     virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -1734,6 +1752,7 @@ qemuProcessReadLogOutput(virDomainObjPtr vm,
                    what, buf);
 
  cleanup:
+    virFileWatchFree(watch);
     return ret;
 }
 
@@ -2030,12 +2049,19 @@ qemuProcessWaitForMonitor(virQEMUDriverPtr driver,
         return -1;
 
     if (logfd != -1 && !virQEMUCapsUsedQMP(qemuCaps)) {
-        if (VIR_ALLOC_N(buf, buf_size) < 0)
-            goto closelog;
+        virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+        char *logfile = NULL;
+        int rc = -1;
+
+        if (VIR_ALLOC_N(buf, buf_size) >= 0 &&
+            virAsprintf(&logfile, "%s/%s.log", cfg->logDir, vm->def->name) >= 0)
+            rc = qemuProcessReadLogOutput(vm, logfile, logfd, buf, buf_size,
+                                          qemuProcessFindCharDevicePTYs,
+                                          "console", 30);
+        VIR_FREE(logfile);
+        virObjectUnref(cfg);
 
-        if (qemuProcessReadLogOutput(vm, logfd, buf, buf_size,
-                                     qemuProcessFindCharDevicePTYs,
-                                     "console", 30) < 0)
+        if (rc < 0)
             goto closelog;
     }
 
@@ -3395,12 +3421,32 @@ struct qemuProcessReconnectData {
     void *payload;
     struct qemuDomainJobObj oldjob;
 };
+
+/*
+ * Domains waiting to be reconnected, shared by a bounded number of
+ * worker threads. Domains which were in the middle of an async job
+ * come first, as recovering those is the most urgent.
+ */
+typedef struct _qemuProcessReconnectQueue qemuProcessReconnectQueue;
+typedef qemuProcessReconnectQueue *qemuProcessReconnectQueuePtr;
+struct _qemuProcessReconnectQueue {
+    virMutex lock;
+
+    struct qemuProcessReconnectData **items;
+    size_t nitems;
+    size_t nprio; /* items[0..nprio) had an async job */
+    size_t next;
+
+    size_t nworkers; /* the last worker to finish frees the queue */
+    unsigned long long started;
+};
+
 /*
  * Open an existing VM's monitor, re-detect VCPU threads
  * and re-reserve the security labels in use
  *
- * We own the virConnectPtr we are passed here - whoever started
- * this thread function has increased the reference counter to it
+ * We own the virConnectPtr we are passed here - whoever queued
+ * this domain has increased the reference counter to it
  * so that we now have to close it.
  */
 static void
@@ -3417,16 +3463,25 @@ qemuProcessReconnect(void *opaque)
     virQEMUDriverConfigPtr cfg;
     size_t i;
     int ret;
+    char *name = NULL;
+    unsigned long long start = 0;
+    unsigned long long now;
+    bool reconnected = false;
 
     memcpy(&oldjob, &data->oldjob, sizeof(oldjob));
 
     VIR_FREE(data);
 
+    ignore_value(virTimeMillisNow(&start));
+
     virObjectLock(obj);
 
     cfg = virQEMUDriverGetConfig(driver);
     VIR_DEBUG("Reconnect monitor to %p '%s'", obj, obj->def->name);
 
+    /* The domain may be gone by the time we are done */
+    ignore_value(VIR_STRDUP_QUIET(name, obj->def->name));
+
     priv = obj->privateData;
 
     /* Job was started by the caller for us */
@@ -3571,10 +3626,8 @@ qemuProcessReconnect(void *opaque)
     if (obj && virObjectUnref(obj))
         virObjectUnlock(obj);
 
-    virObjectUnref(conn);
-    virObjectUnref(cfg);
-
-    return;
+    reconnected = true;
+    goto cleanup;
 
  error:
     if (!qemuDomainObjEndJob(driver, obj))
@@ -3606,17 +3659,89 @@ qemuProcessReconnect(void *opaque)
                 virObjectUnlock(obj);
         }
     }
+
+ cleanup:
+    if (start && virTimeMillisNow(&now) == 0) {
+        if (reconnected)
+            VIR_INFO("Reconnected to domain '%s' in %llu ms",
+                     NULLSTR(name), now - start);
+        else
+            VIR_INFO("Failed to reconnect to domain '%s' after %llu ms",
+                     NULLSTR(name), now - start);
+    }
+    VIR_FREE(name);
     virObjectUnref(conn);
     virObjectUnref(cfg);
 }
 
+
+static void
+qemuProcessReconnectQueueRun(qemuProcessReconnectQueuePtr queue)
+{
+    struct qemuProcessReconnectData *data;
+
+    while (true) {
+        virMutexLock(&queue->lock);
+        data = NULL;
+        if (queue->next < queue->nitems)
+            data = queue->items[queue->next++];
+        virMutexUnlock(&queue->lock);
+
+        if (!data)
+            break;
+
+        qemuProcessReconnect(data);
+    }
+}
+
+
+static void
+qemuProcessReconnectQueueDispose(qemuProcessReconnectQueuePtr queue)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) == 0)
+        VIR_INFO("Finished reconnecting %zu domains (%zu with pending jobs) in %llu ms",
+                 queue->nitems, queue->nprio, now - queue->started);
+
+    virMutexDestroy(&queue->lock);
+    VIR_FREE(queue->items);
+}
+
+
+static void
+qemuProcessReconnectWorker(void *opaque)
+{
+    qemuProcessReconnectQueuePtr queue = opaque;
+    bool last;
+
+    qemuProcessReconnectQueueRun(queue);
+
+    virMutexLock(&queue->lock);
+    last = --queue->nworkers == 0;
+    virMutexUnlock(&queue->lock);
+
+    if (!last)
+        return;
+
+    qemuProcessReconnectQueueDispose(queue);
+    VIR_FREE(queue);
+}
+
+struct qemuProcessReconnectHelperData {
+    virConnectPtr conn;
+    virQEMUDriverPtr driver;
+    qemuProcessReconnectQueuePtr queue;
+};
+
 static int
 qemuProcessReconnectHelper(virDomainObjPtr obj,
                            void *opaque)
 {
-    virThread thread;
-    struct qemuProcessReconnectData *src = opaque;
+    struct qemuProcessReconnectHelperData *src = opaque;
+    qemuProcessReconnectQueuePtr queue = src->queue;
     struct qemuProcessReconnectData *data;
+    int rc;
 
     if (!obj->pid)
         return 0;
@@ -3624,11 +3749,12 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
     if (VIR_ALLOC(data) < 0)
         return -1;
 
-    memcpy(data, src, sizeof(*data));
+    data->conn = src->conn;
+    data->driver = src->driver;
     data->payload = obj;
 
     /*
-     * We create a separate thread to run qemuProcessReconnect in it.
+     * A worker thread runs qemuProcessReconnect for this domain later on.
      * However, qemuProcessReconnect needs to:
      * 1. just before monitor reconnect do lightweight MonitorEnter
      *    (increase VM refcount, unlock VM & driver)
@@ -3640,6 +3766,9 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
      * NB, we can't do normal MonitorEnter & MonitorExit because
      * these two lock the monitor lock, which does not exists in
      * this early phase.
+     *
+     * The job is taken right away, so that APIs on this domain wait
+     * for the reconnect instead of racing with it.
      */
 
     virObjectLock(obj);
@@ -3655,17 +3784,22 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
      */
     virObjectRef(data->conn);
 
-    if (virThreadCreate(&thread, false, qemuProcessReconnect, data) < 0) {
+    if (data->oldjob.asyncJob != QEMU_ASYNC_JOB_NONE) {
+        rc = VIR_INSERT_ELEMENT(queue->items, queue->nprio,
+                                queue->nitems, data);
+        if (rc == 0)
+            queue->nprio++;
+    } else {
+        rc = VIR_APPEND_ELEMENT(queue->items, queue->nitems, data);
+    }
 
+    if (rc < 0) {
         virObjectUnref(data->conn);
 
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Could not create thread. QEMU initialization "
-                         "might be incomplete"));
         if (!qemuDomainObjEndJob(src->driver, obj)) {
             obj = NULL;
         } else if (virObjectUnref(obj)) {
-           /* We can't spawn a thread and thus connect to monitor.
+           /* We can't queue the domain and thus connect to monitor.
             * Kill qemu */
             qemuProcessStop(src->driver, obj, VIR_DOMAIN_SHUTOFF_FAILED, 0);
             if (!obj->persistent)
@@ -3689,13 +3823,86 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
  * qemuProcessReconnectAll
  *
  * Try to re-open the resources for live VMs that we care
- * about.
+ * about. This only queues the work, which is done by at most
+ * max_reconnect_workers threads in the background.
  */
 void
 qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver)
 {
-    struct qemuProcessReconnectData data = {.conn = conn, .driver = driver};
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuProcessReconnectQueuePtr queue;
+    qemuProcessReconnectQueue serial;
+    struct qemuProcessReconnectHelperData data = {.conn = conn,
+                                                  .driver = driver};
+    virThread thread;
+    size_t nworkers;
+    size_t i;
+
+    /* Without a queue the workers could share, reconnect one domain
+     * after another from here rather than leaving them all without
+     * a monitor */
+    if (VIR_ALLOC(queue) < 0) {
+        VIR_WARN("Unable to allocate reconnect queue, reconnecting serially");
+        memset(&serial, 0, sizeof(serial));
+        queue = &serial;
+    }
+
+    if (virMutexInit(&queue->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        if (queue != &serial)
+            VIR_FREE(queue);
+        goto cleanup;
+    }
+
+    ignore_value(virTimeMillisNow(&queue->started));
+
+    data.queue = queue;
     virDomainObjListForEach(driver->domains, qemuProcessReconnectHelper, &data);
+
+    if (queue->nitems == 0) {
+        virMutexDestroy(&queue->lock);
+        if (queue != &serial)
+            VIR_FREE(queue);
+        goto cleanup;
+    }
+
+    if (queue == &serial) {
+        VIR_DEBUG("Reconnecting to %zu domains serially", queue->nitems);
+        qemuProcessReconnectQueueRun(queue);
+        qemuProcessReconnectQueueDispose(queue);
+        goto cleanup;
+    }
+
+    nworkers = MIN(queue->nitems, MAX(1, cfg->maxReconnectWorkers));
+    VIR_DEBUG("Reconnecting to %zu domains using %zu threads",
+              queue->nitems, nworkers);
+
+    /* Workers cannot finish before all of them are counted, since the
+     * last one to exit frees the queue */
+    virMutexLock(&queue->lock);
+    for (i = 0; i < nworkers; i++) {
+        if (virThreadCreate(&thread, false,
+                            qemuProcessReconnectWorker, queue) < 0) {
+            VIR_WARN("Unable to create reconnect thread, using %zu", i);
+            break;
+        }
+        queue->nworkers++;
+    }
+
+    if (queue->nworkers > 0) {
+        virMutexUnlock(&queue->lock);
+        goto cleanup;
+    }
+
+    /* Not even one thread: do the work here rather than killing
+     * domains we could otherwise keep */
+    queue->nworkers = 1;
+    virMutexUnlock(&queue->lock);
+    qemuProcessReconnectWorker(queue);
+
+ cleanup:
+    virObjectUnref(cfg);
 }
 
 static int
@@ -4016,6 +4223,59 @@ qemuPrepareNVRAM(virQEMUDriverConfigPtr cfg,
 }
 
 
+/* Wall clock time spent in each phase of qemuProcessStart, logged once
+ * the start finishes so that slow starts can be broken down */
+typedef struct _qemuProcessStartProfile qemuProcessStartProfile;
+struct _qemuProcessStartProfile {
+    unsigned long long started;
+    unsigned long long last;
+    virBuffer phases;
+};
+
+static void
+qemuProcessStartProfileInit(qemuProcessStartProfile *prof)
+{
+    memset(prof, 0, sizeof(*prof));
+    if (virTimeMillisNow(&prof->started) < 0)
+        virResetLastError();
+    prof->last = prof->started;
+}
+
+static void
+qemuProcessStartProfilePhase(qemuProcessStartProfile *prof,
+                             const char *phase)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    virBufferAsprintf(&prof->phases, " %s=%llu", phase, now - prof->last);
+    prof->last = now;
+}
+
+static void
+qemuProcessStartProfileReport(qemuProcessStartProfile *prof,
+                              virDomainObjPtr vm,
+                              bool success)
+{
+    char *phases = NULL;
+
+    if (virBufferCheckError(&prof->phases) == 0)
+        phases = virBufferContentAndReset(&prof->phases);
+    else
+        virResetLastError();
+
+    VIR_INFO("%s domain %s after %llu ms:%s",
+             success ? "Started" : "Failed to start", vm->def->name,
+             prof->last - prof->started, phases ? phases : "");
+
+    virBufferFreeAndReset(&prof->phases);
+    VIR_FREE(phases);
+}
+
 int qemuProcessStart(virConnectPtr conn,
                      virQEMUDriverPtr driver,
                      virDomainObjPtr vm,
@@ -4044,11 +4304,14 @@ int qemuProcessStart(virConnectPtr conn,
     virQEMUDriverConfigPtr cfg;
     virCapsPtr caps = NULL;
     unsigned int hostdev_flags = 0;
+    qemuProcessStartProfile prof;
 
     VIR_DEBUG("vm=%p name=%s id=%d pid=%llu",
               vm, vm->def->name, vm->def->id,
               (unsigned long long)vm->pid);
 
+    qemuProcessStartProfileInit(&prof);
+
     /* Okay, these are just internal flags,
      * but doesn't hurt to check */
     virCheckFlags(VIR_QEMU_PROCESS_START_COLD |
@@ -4320,6 +4583,8 @@ int qemuProcessStart(virConnectPtr conn,
     if (VIR_ALLOC(priv->monConfig) < 0)
         goto cleanup;
 
+    qemuProcessStartProfilePhase(&prof, "prepare");
+
     VIR_DEBUG("Preparing monitor state");
     if (qemuProcessPrepareMonitorChr(cfg, priv->monConfig, vm->def->name) < 0)
         goto cleanup;
@@ -4357,6 +4622,8 @@ int qemuProcessStart(virConnectPtr conn,
             goto cleanup;
     }
 
+    qemuProcessStartProfilePhase(&prof, "addresses");
+
     VIR_DEBUG("Building emulator command line");
     if (!(cmd = qemuBuildCommandLine(conn, driver, vm->def, priv->monConfig,
                                      priv->monJSON, priv->qemuCaps,
@@ -4365,6 +4632,8 @@ int qemuProcessStart(virConnectPtr conn,
                                      qemuCheckFips())))
         goto cleanup;
 
+    qemuProcessStartProfilePhase(&prof, "cmdline");
+
     /* now that we know it is about to start call the hook if present */
     if (virHookPresent(VIR_HOOK_DRIVER_QEMU)) {
         char *xml = qemuDomainDefFormatXML(driver, vm->def, 0);
@@ -4487,6 +4756,8 @@ int qemuProcessStart(virConnectPtr conn,
                   vm, vm->def->name);
     }
 
+    qemuProcessStartProfilePhase(&prof, "exec");
+
     VIR_DEBUG("Writing early domain status to disk");
     if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
         goto cleanup;
@@ -4561,10 +4832,14 @@ int qemuProcessStart(virConnectPtr conn,
     if (qemuProcessSetEmulatorAffinity(vm) < 0)
         goto cleanup;
 
+    qemuProcessStartProfilePhase(&prof, "handshake");
+
     VIR_DEBUG("Waiting for monitor to show up");
     if (qemuProcessWaitForMonitor(driver, vm, asyncJob, priv->qemuCaps, pos) < 0)
         goto cleanup;
 
+    qemuProcessStartProfilePhase(&prof, "monitor");
+
     /* Failure to connect to agent shouldn't be fatal */
     if ((ret = qemuConnectAgent(driver, vm)) < 0) {
         if (ret == -2)
@@ -4659,6 +4934,8 @@ int qemuProcessStart(virConnectPtr conn,
     }
     qemuDomainObjExitMonitor(driver, vm);
 
+    qemuProcessStartProfilePhase(&prof, "setup");
+
     if (!(flags & VIR_QEMU_PROCESS_START_PAUSED)) {
         VIR_DEBUG("Starting domain CPUs");
         /* Allow the CPUS to start executing */
@@ -4707,6 +4984,9 @@ int qemuProcessStart(virConnectPtr conn,
     if (!migrateFrom)
         qemuMonitorSetDomainLog(priv->mon, -1);
 
+    qemuProcessStartProfilePhase(&prof, "finish");
+    qemuProcessStartProfileReport(&prof, vm, true);
+
     virCommandFree(cmd);
     VIR_FORCE_CLOSE(logfile);
     virObjectUnref(cfg);
@@ -4724,6 +5004,8 @@ int qemuProcessStart(virConnectPtr conn,
     VIR_FORCE_CLOSE(logfile);
     if (priv->mon)
         qemuMonitorSetDomainLog(priv->mon, -1);
+    qemuProcessStartProfilePhase(&prof, "failed");
+    qemuProcessStartProfileReport(&prof, vm, false);
     qemuProcessStop(driver, vm, VIR_DOMAIN_SHUTOFF_FAILED, stop_flags);
     virObjectUnref(cfg);
     virObjectUnref(caps);
@@ -4842,6 +5124,9 @@ void qemuProcessStop(virQEMUDriverPtr driver,
     virPortAllocatorRelease(driver->remotePorts, priv->nbdPort);
     priv->nbdPort = 0;
 
+    qemuDomainStatsCacheFree(priv->statsCache);
+    priv->statsCache = NULL;
+
     if (priv->agent) {
         qemuAgentClose(priv->agent);
         priv->agent = NULL;
@@ -4964,8 +5249,11 @@ void qemuProcessStop(virQEMUDriverPtr driver,
 
  retry:
     if ((ret = qemuRemoveCgroup(driver, vm)) < 0) {
-        if (ret == -EBUSY && (retries++ < 5)) {
-            usleep(200*1000);
+        /* The cgroup is busy until the kernel has reaped all QEMU
+         * threads, which usually takes a few ms. Back off from 2ms,
+         * giving up after about a second in total. */
+        if (ret == -EBUSY && (retries++ < 9)) {
+            usleep((1 << retries) * 1000);
             goto retry;
         }
         VIR_WARN("Failed to remove cgroup for %s",
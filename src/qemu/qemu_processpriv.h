@@ -34,4 +34,10 @@ int qemuProcessHandleDeviceDeleted(qemuMonitorPtr mon,
                                    const char *devAlias,
                                    void *opaque);
 
+int qemuProcessHandleTrayChange(qemuMonitorPtr mon,
+                                virDomainObjPtr vm,
+                                const char *devAlias,
+                                int reason,
+                                void *opaque);
+
 #endif /* __QEMU_PROCESSPRIV_H__ */
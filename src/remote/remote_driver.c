@@ -3822,6 +3822,43 @@ remoteStoragePoolListAllVolumes(virStoragePoolPtr pool,
     return rv;
 }
 
+static int
+remoteStorageVolGetJobInfo(virStorageVolPtr vol,
+                           virStorageVolJobInfoPtr info,
+                           unsigned int flags)
+{
+    int rv = -1;
+    remote_storage_vol_get_job_info_args args;
+    remote_storage_vol_get_job_info_ret ret;
+    struct private_data *priv = vol->conn->privateData;
+
+    remoteDriverLock(priv);
+
+    make_nonnull_storage_vol(&args.vol, vol);
+    args.flags = flags;
+
+    if (call(vol->conn, priv, 0, REMOTE_PROC_STORAGE_VOL_GET_JOB_INFO,
+             (xdrproc_t)xdr_remote_storage_vol_get_job_info_args,
+               (char *)&args,
+             (xdrproc_t)xdr_remote_storage_vol_get_job_info_ret,
+               (char *)&ret) == -1)
+        goto done;
+
+    if (ret.found) {
+        info->type = ret.type;
+        info->bandwidth = ret.bandwidth;
+        info->cur = ret.cur;
+        info->end = ret.end;
+        rv = 1;
+    } else {
+        rv = 0;
+    }
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 
 /*----------------------------------------------------------------------*/
 
@@ -8337,6 +8374,10 @@ static virStorageDriver storage_driver = {
     .storageVolResize = remoteStorageVolResize, /* 0.9.10 */
     .storagePoolIsActive = remoteStoragePoolIsActive, /* 0.7.3 */
     .storagePoolIsPersistent = remoteStoragePoolIsPersistent, /* 0.7.3 */
+    .storageVolGetJobInfo = remoteStorageVolGetJobInfo, /* 1.2.10 */
+    .storageVolJobSetSpeed = remoteStorageVolJobSetSpeed, /* 1.2.10 */
+    .storageVolJobAbort = remoteStorageVolJobAbort, /* 1.2.10 */
+    .storagePoolGetJobInfo = remoteStoragePoolGetJobInfo, /* 1.2.10 */
 };
 
 static virSecretDriver secret_driver = {
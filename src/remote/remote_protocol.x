@@ -1889,6 +1889,41 @@ struct remote_storage_vol_resize_args {
     unsigned int flags;
 };
 
+struct remote_storage_vol_get_job_info_args {
+    remote_nonnull_storage_vol vol;
+    unsigned int flags;
+};
+
+struct remote_storage_vol_get_job_info_ret {
+    int found;
+    int type;
+    unsigned hyper bandwidth;
+    unsigned hyper cur;
+    unsigned hyper end;
+};
+
+struct remote_storage_vol_job_set_speed_args {
+    remote_nonnull_storage_vol vol;
+    unsigned hyper bandwidth;
+    unsigned int flags;
+};
+
+struct remote_storage_vol_job_abort_args {
+    remote_nonnull_storage_vol vol;
+    unsigned int flags;
+};
+
+struct remote_storage_pool_get_job_info_args {
+    remote_nonnull_storage_pool pool;
+    unsigned int flags;
+};
+
+struct remote_storage_pool_get_job_info_ret { /* insert@1 */
+    int type;
+    unsigned hyper timeElapsed;
+    unsigned int volJobs;
+};
+
 /* Node driver calls: */
 
 struct remote_node_num_of_devices_args {
@@ -5505,5 +5540,29 @@ enum remote_procedure {
      * @generate: none
      * @acl: connect:write
      */
-    REMOTE_PROC_NODE_ALLOC_PAGES = 347
+    REMOTE_PROC_NODE_ALLOC_PAGES = 347,
+
+    /**
+     * @generate: none
+     * @acl: storage_vol:read
+     */
+    REMOTE_PROC_STORAGE_VOL_GET_JOB_INFO = 348,
+
+    /**
+     * @generate: both
+     * @acl: storage_vol:format
+     */
+    REMOTE_PROC_STORAGE_VOL_JOB_SET_SPEED = 349,
+
+    /**
+     * @generate: both
+     * @acl: storage_vol:format
+     */
+    REMOTE_PROC_STORAGE_VOL_JOB_ABORT = 350,
+
+    /**
+     * @generate: both
+     * @acl: storage_pool:read
+     */
+    REMOTE_PROC_STORAGE_POOL_GET_JOB_INFO = 351
 };
@@ -60,6 +60,9 @@
 #include "virstring.h"
 #include "virxml.h"
 #include "fdstream.h"
+#include "virprocess.h"
+#include "virthread.h"
+#include "virtime.h"
 
 #if WITH_STORAGE_LVM
 # include "storage_backend_logical.h"
@@ -96,6 +99,21 @@
 
 VIR_LOG_INIT("storage.storage_backend");
 
+/* Number of threads overwriting a volume in parallel */
+#define VIR_STORAGE_WIPE_WORKERS 4
+/* Size of each write, and of the range each thread grabs at once */
+#define VIR_STORAGE_WIPE_CHUNK (1024 * 1024)
+/* Alignment suitable for O_DIRECT on any device */
+#define VIR_STORAGE_WIPE_ALIGN 4096
+#define VIR_STORAGE_WIPE_SECTOR_SIZE 512
+/* Range zeroed per ioctl, small enough to report progress regularly */
+#define VIR_STORAGE_WIPE_OFFLOAD_CHUNK (1024ULL * 1024 * 1024)
+/* Longest sleep in ms before checking whether a throttled job was aborted */
+#define VIR_STORAGE_JOB_THROTTLE_STEP 100
+/* Range zeroed at once when preallocating by writing, small enough
+ * for an abort to be noticed quickly */
+#define VIR_STORAGE_PREALLOC_CHUNK (64 * 1024 * 1024)
+
 static virStorageBackendPtr backends[] = {
 #if WITH_STORAGE_DIR
     &virStorageBackendDirectory,
@@ -156,6 +174,15 @@ enum {
 #define READ_BLOCK_SIZE_DEFAULT  (1024 * 1024)
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
 
+static void
+virStorageBackendJobReportAborted(virStorageVolDefPtr vol)
+{
+    virReportError(VIR_ERR_OPERATION_ABORTED,
+                   _("operation on volume '%s' was aborted"),
+                   vol->name);
+}
+
+
 static int ATTRIBUTE_NONNULL(2)
 virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           virStorageVolDefPtr inputvol,
@@ -240,6 +267,12 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
 
             }
         } while ((amtleft -= interval) > 0);
+
+        if (virStorageBackendJobProgress(vol->job, amtread, true) < 0) {
+            ret = -ECANCELED;
+            virStorageBackendJobReportAborted(vol);
+            goto cleanup;
+        }
     }
 
     if (fdatasync(fd) < 0) {
@@ -345,6 +378,11 @@ virStorageBackendCreateBlockFrom(virConnectPtr conn ATTRIBUTE_UNUSED,
     return ret;
 }
 
+static int virStorageBackendPreallocLocal(virStorageVolDefPtr vol,
+                                          int fd,
+                                          off_t offset,
+                                          off_t length);
+
 static int
 createRawFile(int fd, virStorageVolDefPtr vol,
               virStorageVolDefPtr inputvol)
@@ -375,6 +413,15 @@ createRawFile(int fd, virStorageVolDefPtr vol,
     if (vol->target.allocation) {
         if (fallocate(fd, 0, 0, vol->target.allocation) == 0) {
             need_alloc = false;
+            /* When copying, progress is accounted as data is copied */
+            if (!inputvol &&
+                virStorageBackendJobProgress(vol->job,
+                                             vol->target.allocation,
+                                             false) < 0) {
+                ret = -ECANCELED;
+                virStorageBackendJobReportAborted(vol);
+                goto cleanup;
+            }
         } else if (errno != ENOSYS && errno != EOPNOTSUPP) {
             ret = -errno;
             virReportSystemError(errno,
@@ -401,10 +448,10 @@ createRawFile(int fd, virStorageVolDefPtr vol,
     }
 
     if (remain && need_alloc) {
-        if (safezero(fd, vol->target.allocation - remain, remain) < 0) {
-            ret = -errno;
-            virReportSystemError(errno, _("cannot fill file '%s'"),
-                                 vol->target.path);
+        if (virStorageBackendPreallocLocal(vol, fd,
+                                           vol->target.allocation - remain,
+                                           remain) < 0) {
+            ret = -1;
             goto cleanup;
         }
     }
@@ -1780,62 +1827,614 @@ virStorageBackendVolZeroSparseFileLocal(virStorageVolDefPtr vol,
 }
 
 
+virStorageVolJobPtr
+virStorageBackendJobNew(int type,
+                        unsigned long long end,
+                        unsigned long long bandwidth)
+{
+    virStorageVolJobPtr job;
+
+    if (VIR_ALLOC(job) < 0)
+        return NULL;
+
+    if (virMutexInit(&job->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(job);
+        return NULL;
+    }
+
+    job->type = type;
+    job->end = end;
+    job->bandwidth = bandwidth;
+    if (virTimeMillisNow(&job->windowStart) < 0) {
+        virStorageBackendJobFree(job);
+        return NULL;
+    }
+
+    return job;
+}
+
+
+void
+virStorageBackendJobFree(virStorageVolJobPtr job)
+{
+    if (!job)
+        return;
+
+    virMutexDestroy(&job->lock);
+    VIR_FREE(job);
+}
+
+
+void
+virStorageBackendJobGetInfo(virStorageVolJobPtr job,
+                            virStorageVolJobInfoPtr info)
+{
+    virMutexLock(&job->lock);
+    info->type = job->type;
+    info->bandwidth = job->bandwidth;
+    info->cur = job->cur;
+    info->end = job->end;
+    virMutexUnlock(&job->lock);
+}
+
+
+void
+virStorageBackendJobSetSpeed(virStorageVolJobPtr job,
+                             unsigned long long bandwidth)
+{
+    unsigned long long now;
+
+    virMutexLock(&job->lock);
+    job->bandwidth = bandwidth;
+    /* Start a new rate window so the new limit applies from now on,
+     * rather than averaged over the whole job */
+    if (virTimeMillisNow(&now) == 0) {
+        job->windowStart = now;
+        job->windowBytes = 0;
+    }
+    virMutexUnlock(&job->lock);
+}
+
+
+void
+virStorageBackendJobAbort(virStorageVolJobPtr job)
+{
+    virMutexLock(&job->lock);
+    job->abort = true;
+    if (job->pid > 0)
+        virProcessKill(job->pid, SIGTERM);
+    virMutexUnlock(&job->lock);
+}
+
+
+bool
+virStorageBackendJobIsAborted(virStorageVolJobPtr job)
+{
+    bool ret;
+
+    if (!job)
+        return false;
+
+    virMutexLock(&job->lock);
+    ret = job->abort;
+    virMutexUnlock(&job->lock);
+
+    return ret;
+}
+
+
+/**
+ * virStorageBackendJobSetPid:
+ * @job: the job, may be NULL
+ * @pid: helper process doing the work, 0 once it has exited
+ *
+ * Record the helper process, so that aborting the job can kill it.
+ *
+ * Returns -1 if the job was aborted already, 0 otherwise.
+ */
+int
+virStorageBackendJobSetPid(virStorageVolJobPtr job,
+                           pid_t pid)
+{
+    int ret = 0;
+
+    if (!job)
+        return 0;
+
+    virMutexLock(&job->lock);
+    if (job->abort && pid > 0) {
+        virProcessKill(pid, SIGTERM);
+        ret = -1;
+    }
+    job->pid = pid;
+    virMutexUnlock(&job->lock);
+
+    return ret;
+}
+
+
+/**
+ * virStorageBackendJobProgress:
+ * @job: the job, may be NULL
+ * @bytes: number of bytes just processed
+ * @throttle: whether these bytes count against the bandwidth limit
+ *
+ * Account @bytes towards the job's progress, sleeping as needed to
+ * keep the job within its bandwidth limit. Safe to call from several
+ * worker threads at once.
+ *
+ * Returns -1 if the job has been aborted, 0 otherwise.
+ */
+int
+virStorageBackendJobProgress(virStorageVolJobPtr job,
+                             unsigned long long bytes,
+                             bool throttle)
+{
+    unsigned long long now;
+    unsigned long long delay = 0;
+
+    if (!job)
+        return 0;
+
+    virMutexLock(&job->lock);
+    job->cur += bytes;
+    job->windowBytes += bytes;
+    if (throttle && job->bandwidth &&
+        virTimeMillisNow(&now) == 0) {
+        unsigned long long due = job->windowStart +
+            job->windowBytes * 1000 / job->bandwidth;
+        if (due > now)
+            delay = due - now;
+    }
+    virMutexUnlock(&job->lock);
+
+    /* Sleep in small steps so an abort doesn't wait for the whole delay */
+    while (delay > 0) {
+        unsigned long long step = MIN(delay, VIR_STORAGE_JOB_THROTTLE_STEP);
+
+        if (virStorageBackendJobIsAborted(job))
+            return -1;
+        usleep(step * 1000);
+        delay -= step;
+    }
+
+    return virStorageBackendJobIsAborted(job) ? -1 : 0;
+}
+
+
+#if defined(__linux__) && defined(BLKZEROOUT)
+/*
+ * Ask the kernel to zero the range without us sending any data,
+ * either by discarding it on devices which guarantee that discarded
+ * blocks read back as zeroes, or by BLKZEROOUT which turns into
+ * WRITE SAME on devices supporting it.
+ *
+ * Returns 1 if the range was zeroed, 0 if the device supports neither
+ * (nothing was written and the caller should fall back to plain
+ * writes), or -1 on error.
+ */
+static int
+virStorageBackendWipeOffloadLocal(virStorageVolDefPtr vol,
+                                  int fd,
+                                  off_t extent_start,
+                                  off_t extent_length,
+                                  bool discard)
+{
+    virStorageVolJobPtr job = vol->job;
+    unsigned int discard_zeroes = 0;
+    unsigned long request = BLKZEROOUT;
+    off_t offset = extent_start;
+    off_t remaining = extent_length;
+    bool throttle = true;
+
+    if ((extent_start | extent_length) % VIR_STORAGE_WIPE_SECTOR_SIZE)
+        return 0;
+
+# ifdef BLKDISCARDZEROES
+    if (discard &&
+        ioctl(fd, BLKDISCARDZEROES, &discard_zeroes) == 0 && discard_zeroes) {
+        request = BLKDISCARD;
+        /* Discard doesn't write anything, so it needs no throttling */
+        throttle = false;
+    }
+# endif
+
+    while (remaining > 0) {
+        uint64_t range[2];
+
+        range[0] = offset;
+        range[1] = MIN(remaining, VIR_STORAGE_WIPE_OFFLOAD_CHUNK);
+
+        if (ioctl(fd, request, range) < 0) {
+            if (offset == extent_start &&
+                (errno == ENOTTY || errno == EOPNOTSUPP || errno == EINVAL)) {
+                if (request == BLKDISCARD) {
+                    VIR_DEBUG("discard unsupported on '%s', trying zeroout",
+                              vol->target.path);
+                    request = BLKZEROOUT;
+                    throttle = true;
+                    continue;
+                }
+                VIR_DEBUG("zeroout unsupported on '%s'", vol->target.path);
+                return 0;
+            }
+            virReportSystemError(errno,
+                                 _("Failed to zero %ju bytes at offset %ju "
+                                   "of volume with path '%s'"),
+                                 (uintmax_t)range[1], (uintmax_t)range[0],
+                                 vol->target.path);
+            return -1;
+        }
+
+        offset += range[1];
+        remaining -= range[1];
+
+        if (virStorageBackendJobProgress(job, range[1], throttle) < 0) {
+            virStorageBackendJobReportAborted(vol);
+            return -1;
+        }
+    }
+
+    VIR_DEBUG("Zeroed %ju bytes of volume with path '%s' using %s",
+              (uintmax_t)extent_length, vol->target.path,
+              request == BLKDISCARD ? "discard" : "zeroout");
+    return 1;
+}
+#else /* !(defined(__linux__) && defined(BLKZEROOUT)) */
+static int
+virStorageBackendWipeOffloadLocal(virStorageVolDefPtr vol ATTRIBUTE_UNUSED,
+                                  int fd ATTRIBUTE_UNUSED,
+                                  off_t extent_start ATTRIBUTE_UNUSED,
+                                  off_t extent_length ATTRIBUTE_UNUSED,
+                                  bool discard ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+#endif /* !(defined(__linux__) && defined(BLKZEROOUT)) */
+
+
+/*
+ * Make sure the given range of @fd is allocated and reads back as
+ * zeroes, preferring methods which don't send the zeroes to the disk.
+ * Unlike wiping, blocks are never discarded, as that would defeat
+ * the preallocation on thinly provisioned devices.
+ */
+static int
+virStorageBackendPreallocLocal(virStorageVolDefPtr vol,
+                               int fd,
+                               off_t offset,
+                               off_t length)
+{
+    struct stat st;
+    int rc;
+
+#if HAVE_FALLOCATE - 0 && defined(FALLOC_FL_ZERO_RANGE)
+    if (fallocate(fd, FALLOC_FL_ZERO_RANGE, offset, length) == 0) {
+        if (virStorageBackendJobProgress(vol->job, length, false) < 0) {
+            virStorageBackendJobReportAborted(vol);
+            return -1;
+        }
+        return 0;
+    }
+    if (errno != ENOSYS && errno != EOPNOTSUPP) {
+        virReportSystemError(errno,
+                             _("cannot allocate %ju bytes in file '%s'"),
+                             (uintmax_t)length, vol->target.path);
+        return -1;
+    }
+#endif
+
+    if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode) &&
+        (rc = virStorageBackendWipeOffloadLocal(vol, fd, offset,
+                                                length, false)) != 0)
+        return rc < 0 ? -1 : 0;
+
+    while (length > 0) {
+        off_t chunk = MIN(length, VIR_STORAGE_PREALLOC_CHUNK);
+
+        if (safezero(fd, offset, chunk) < 0) {
+            virReportSystemError(errno, _("cannot fill file '%s'"),
+                                 vol->target.path);
+            return -1;
+        }
+
+        offset += chunk;
+        length -= chunk;
+
+        if (virStorageBackendJobProgress(vol->job, chunk, true) < 0) {
+            virStorageBackendJobReportAborted(vol);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+typedef struct _virStorageBackendWipeData virStorageBackendWipeData;
+typedef virStorageBackendWipeData *virStorageBackendWipeDataPtr;
+struct _virStorageBackendWipeData {
+    virMutex lock;
+
+    const char *path;
+    virStorageVolJobPtr job;
+
+    off_t next; /* next chunk to hand out to a writer */
+    off_t end;  /* end of the range covered by the writers */
+
+    bool failed;
+    bool aborted;
+    int err;    /* errno of the first failure */
+    off_t errOffset;
+};
+
+static void
+virStorageBackendWipeDataFail(virStorageBackendWipeDataPtr data,
+                              int err,
+                              off_t offset)
+{
+    virMutexLock(&data->lock);
+    if (!data->failed) {
+        data->failed = true;
+        data->err = err;
+        data->errOffset = offset;
+    }
+    virMutexUnlock(&data->lock);
+}
+
+/*
+ * Writer thread: repeatedly grabs the next chunk of the range and
+ * overwrites it with zeroes. Errors can't be reported from here, as
+ * they'd be lost with the thread, so they are recorded in @opaque.
+ */
+static void
+virStorageBackendWipeWorker(void *opaque)
+{
+    virStorageBackendWipeDataPtr data = opaque;
+    void *base = NULL; /* Location to be freed */
+    char *buf = NULL; /* Aligned location within base */
+    int fd;
+
+    /* O_DIRECT keeps a multi terabyte wipe from evicting the whole
+     * page cache, but not every filesystem supports it */
+    if ((fd = open(data->path, O_WRONLY | O_DIRECT)) < 0 &&
+        (errno != EINVAL ||
+         (fd = open(data->path, O_WRONLY)) < 0)) {
+        virStorageBackendWipeDataFail(data, errno, 0);
+        return;
+    }
+
+#if HAVE_POSIX_MEMALIGN
+    if (posix_memalign(&base, VIR_STORAGE_WIPE_ALIGN,
+                       VIR_STORAGE_WIPE_CHUNK)) {
+        virStorageBackendWipeDataFail(data, ENOMEM, 0);
+        goto cleanup;
+    }
+    buf = base;
+#else
+    if (VIR_ALLOC_N_QUIET(buf, VIR_STORAGE_WIPE_CHUNK +
+                          VIR_STORAGE_WIPE_ALIGN - 1) < 0) {
+        virStorageBackendWipeDataFail(data, ENOMEM, 0);
+        goto cleanup;
+    }
+    base = buf;
+    buf = (char *) (((intptr_t) base + VIR_STORAGE_WIPE_ALIGN - 1) &
+                    ~(intptr_t) (VIR_STORAGE_WIPE_ALIGN - 1));
+#endif
+    memset(buf, 0, VIR_STORAGE_WIPE_CHUNK);
+
+    for (;;) {
+        off_t offset;
+        size_t len;
+        size_t done = 0;
+
+        virMutexLock(&data->lock);
+        if (data->failed || data->aborted || data->next >= data->end) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        offset = data->next;
+        len = MIN(data->end - offset, VIR_STORAGE_WIPE_CHUNK);
+        data->next += len;
+        virMutexUnlock(&data->lock);
+
+        while (done < len) {
+            ssize_t written = pwrite(fd, buf + done,
+                                     len - done, offset + done);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                virStorageBackendWipeDataFail(data, errno, offset + done);
+                goto cleanup;
+            }
+            done += written;
+        }
+
+        if (virStorageBackendJobProgress(data->job, len, true) < 0) {
+            virMutexLock(&data->lock);
+            data->aborted = true;
+            virMutexUnlock(&data->lock);
+            break;
+        }
+    }
+
+    if (fdatasync(fd) < 0)
+        virStorageBackendWipeDataFail(data, errno, data->end);
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(base);
+}
+
+
 static int
 virStorageBackendWipeExtentLocal(virStorageVolDefPtr vol,
                                  int fd,
                                  off_t extent_start,
                                  off_t extent_length,
-                                 char *writebuf,
-                                 size_t writebuf_length,
                                  size_t *bytes_wiped)
 {
-    int ret = -1, written = 0;
-    off_t remaining = 0;
-    size_t write_size = 0;
+    virStorageBackendWipeData data;
+    virThread workers[VIR_STORAGE_WIPE_WORKERS];
+    size_t nworkers = 0;
+    size_t nchunks;
+    size_t i;
+    off_t aligned_length;
+    off_t remaining;
+    char *writebuf = NULL;
+    int ret = -1;
 
     VIR_DEBUG("extent logical start: %ju len: %ju",
               (uintmax_t)extent_start, (uintmax_t)extent_length);
 
-    if ((ret = lseek(fd, extent_start, SEEK_SET)) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to seek to position %ju in volume "
-                               "with path '%s'"),
-                             (uintmax_t)extent_start, vol->target.path);
+    memset(&data, 0, sizeof(data));
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+
+    /* The writers use O_DIRECT, which needs aligned offsets and lengths;
+     * anything left over at the end is written through @fd below */
+    aligned_length = extent_length - (extent_length % VIR_STORAGE_WIPE_ALIGN);
+    if (extent_start % VIR_STORAGE_WIPE_ALIGN)
+        aligned_length = 0;
+
+    data.path = vol->target.path;
+    data.job = vol->job;
+    data.next = extent_start;
+    data.end = extent_start + aligned_length;
+
+    /* The writers take chunks until the range is done, so whichever of
+     * them could be started cover all of it */
+    nchunks = VIR_DIV_UP(aligned_length, VIR_STORAGE_WIPE_CHUNK);
+    for (i = 0; i < MIN(nchunks, VIR_STORAGE_WIPE_WORKERS); i++) {
+        if (virThreadCreate(&workers[i], true,
+                            virStorageBackendWipeWorker, &data) < 0) {
+            char ebuf[1024];
+            VIR_WARN("Unable to create wipe thread for '%s': %s",
+                     vol->target.path, virStrerror(errno, ebuf, sizeof(ebuf)));
+            break;
+        }
+        nworkers++;
+    }
+
+    /* Without any writer thread, the loop below covers everything */
+    if (nworkers == 0)
+        aligned_length = 0;
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    if (data.aborted) {
+        virStorageBackendJobReportAborted(vol);
         goto cleanup;
     }
 
-    remaining = extent_length;
-    while (remaining > 0) {
+    if (data.failed) {
+        if (data.err)
+            virReportSystemError(data.err,
+                                 _("Failed to wipe storage volume with path "
+                                   "'%s' at offset %ju"),
+                                 vol->target.path, (uintmax_t)data.errOffset);
+        goto cleanup;
+    }
+
+    *bytes_wiped += aligned_length;
 
-        write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
-        written = safewrite(fd, writebuf, write_size);
-        if (written < 0) {
+    if (aligned_length < extent_length) {
+        size_t writebuf_length = MIN(extent_length - aligned_length,
+                                     VIR_STORAGE_WIPE_CHUNK);
+
+        if (lseek(fd, extent_start + aligned_length, SEEK_SET) < 0) {
             virReportSystemError(errno,
-                                 _("Failed to write %zu bytes to "
-                                   "storage volume with path '%s'"),
-                                 write_size, vol->target.path);
+                                 _("Failed to seek to position %ju in volume "
+                                   "with path '%s'"),
+                                 (uintmax_t)(extent_start + aligned_length),
+                                 vol->target.path);
+            goto cleanup;
+        }
 
+        if (VIR_ALLOC_N(writebuf, writebuf_length) < 0)
             goto cleanup;
+
+        remaining = extent_length - aligned_length;
+        while (remaining > 0) {
+            size_t write_size = MIN(writebuf_length, remaining);
+            int written = safewrite(fd, writebuf, write_size);
+
+            if (written < 0) {
+                virReportSystemError(errno,
+                                     _("Failed to write %zu bytes to "
+                                       "storage volume with path '%s'"),
+                                     write_size, vol->target.path);
+                goto cleanup;
+            }
+
+            *bytes_wiped += written;
+            remaining -= written;
+
+            if (virStorageBackendJobProgress(vol->job, written, true) < 0) {
+                virStorageBackendJobReportAborted(vol);
+                goto cleanup;
+            }
         }
 
-        *bytes_wiped += written;
-        remaining -= written;
+        if (fdatasync(fd) < 0) {
+            virReportSystemError(errno,
+                                 _("cannot sync data to volume with path '%s'"),
+                                 vol->target.path);
+            goto cleanup;
+        }
     }
 
-    if (fdatasync(fd) < 0) {
-        ret = -errno;
-        virReportSystemError(errno,
-                             _("cannot sync data to volume with path '%s'"),
-                             vol->target.path);
+    VIR_DEBUG("Wrote %zu bytes to volume with path '%s' using %zu writers",
+              *bytes_wiped, vol->target.path, nworkers);
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(writebuf);
+    virMutexDestroy(&data.lock);
+    return ret;
+}
+
+
+static int
+virStorageBackendWipeScrubLocal(virStorageVolDefPtr vol,
+                                const char *alg_char)
+{
+    virCommandPtr cmd;
+    pid_t pid = -1;
+    int ret = -1;
+
+    cmd = virCommandNew(SCRUB);
+    virCommandAddArgList(cmd, "-f", "-p", alg_char,
+                         vol->target.path, NULL);
+
+    if (virCommandRunAsync(cmd, &pid) < 0)
+        goto cleanup;
+
+    /* Let an abort kill scrub, which has no other way to be told */
+    if (virStorageBackendJobSetPid(vol->job, pid) < 0) {
+        virCommandAbort(cmd);
+        virStorageBackendJobReportAborted(vol);
         goto cleanup;
     }
 
-    VIR_DEBUG("Wrote %zu bytes to volume with path '%s'",
-              *bytes_wiped, vol->target.path);
+    ret = virCommandWait(cmd, NULL);
+    virStorageBackendJobSetPid(vol->job, 0);
 
-    ret = 0;
+    if (virStorageBackendJobIsAborted(vol->job)) {
+        virResetLastError();
+        virStorageBackendJobReportAborted(vol);
+        ret = -1;
+    }
 
  cleanup:
+    virCommandFree(cmd);
     return ret;
 }
 
@@ -1849,9 +2448,7 @@ virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
 {
     int ret = -1, fd = -1;
     struct stat st;
-    char *writebuf = NULL;
     size_t bytes_wiped = 0;
-    virCommandPtr cmd = NULL;
 
     virCheckFlags(0, -1);
 
@@ -1904,37 +2501,34 @@ virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
             virReportError(VIR_ERR_INVALID_ARG,
                            _("unsupported algorithm %d"),
                            algorithm);
-        }
-        cmd = virCommandNew(SCRUB);
-        virCommandAddArgList(cmd, "-f", "-p", alg_char,
-                             vol->target.path, NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
             goto cleanup;
+        }
 
-        ret = 0;
+        ret = virStorageBackendWipeScrubLocal(vol, alg_char);
         goto cleanup;
     } else {
         if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
             ret = virStorageBackendVolZeroSparseFileLocal(vol, st.st_size, fd);
         } else {
-
-            if (VIR_ALLOC_N(writebuf, st.st_blksize) < 0)
-                goto cleanup;
+            if (S_ISBLK(st.st_mode)) {
+                ret = virStorageBackendWipeOffloadLocal(vol, fd, 0,
+                                                        vol->target.allocation,
+                                                        true);
+                if (ret != 0) {
+                    ret = ret < 0 ? -1 : 0;
+                    goto cleanup;
+                }
+            }
 
             ret = virStorageBackendWipeExtentLocal(vol,
                                                    fd,
                                                    0,
                                                    vol->target.allocation,
-                                                   writebuf,
-                                                   st.st_blksize,
                                                    &bytes_wiped);
         }
     }
 
  cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(writebuf);
     VIR_FORCE_CLOSE(fd);
     return ret;
 }
@@ -2028,3 +2622,115 @@ virStorageBackendFindGlusterPoolSources(const char *host ATTRIBUTE_UNUSED,
     return 0;
 }
 #endif /* #ifdef GLUSTER_CLI */
+
+
+typedef struct _virStorageBackendParallelData virStorageBackendParallelData;
+typedef virStorageBackendParallelData *virStorageBackendParallelDataPtr;
+struct _virStorageBackendParallelData {
+    virMutex lock;
+
+    virStorageBackendParallelFunc func;
+    void *opaque;
+
+    size_t next; /* next item to hand out */
+    size_t nitems;
+
+    virErrorPtr err; /* first failure, reported by the caller */
+};
+
+static void
+virStorageBackendParallelWorker(void *opaque)
+{
+    virStorageBackendParallelDataPtr data = opaque;
+
+    for (;;) {
+        size_t idx;
+
+        virMutexLock(&data->lock);
+        if (data->err || data->next >= data->nitems) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        idx = data->next++;
+        virMutexUnlock(&data->lock);
+
+        if (data->func(idx, data->opaque) < 0) {
+            /* Errors are thread local, so carry it over to the caller */
+            virMutexLock(&data->lock);
+            if (!data->err)
+                data->err = virSaveLastError();
+            virMutexUnlock(&data->lock);
+            break;
+        }
+    }
+}
+
+
+/**
+ * virStorageBackendRunParallel:
+ * @nitems: number of items to process
+ * @nworkers: maximum number of threads to use
+ * @func: callback processing a single item
+ * @opaque: data passed to @func
+ *
+ * Call @func for every index in [0, @nitems) from up to @nworkers
+ * threads, for backends which need a round trip per volume. @func
+ * must be thread safe. Once an item fails, no further ones are
+ * started and the first error is reported from the calling thread.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+virStorageBackendRunParallel(size_t nitems,
+                             size_t nworkers,
+                             virStorageBackendParallelFunc func,
+                             void *opaque)
+{
+    virStorageBackendParallelData data;
+    virThreadPtr workers = NULL;
+    size_t nstarted = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+    data.func = func;
+    data.opaque = opaque;
+    data.nitems = nitems;
+
+    /* The calling thread is one of the workers */
+    nworkers = MIN(nworkers, nitems);
+    if (nworkers > 1 && VIR_ALLOC_N_QUIET(workers, nworkers - 1) == 0) {
+        for (i = 0; i < nworkers - 1; i++) {
+            if (virThreadCreate(&workers[i], true,
+                                virStorageBackendParallelWorker, &data) < 0) {
+                VIR_WARN("Unable to create worker thread, using %zu", i);
+                break;
+            }
+            nstarted++;
+        }
+    }
+
+    /* This covers everything if no thread could be started */
+    virStorageBackendParallelWorker(&data);
+
+    for (i = 0; i < nstarted; i++)
+        virThreadJoin(&workers[i]);
+
+    if (data.err) {
+        virSetError(data.err);
+        virFreeError(data.err);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(workers);
+    virMutexDestroy(&data.lock);
+    return ret;
+}
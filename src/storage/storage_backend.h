@@ -29,6 +29,7 @@
 # include "internal.h"
 # include "storage_conf.h"
 # include "vircommand.h"
+# include "virthread.h"
 # include "storage_driver.h"
 
 typedef char * (*virStorageBackendFindPoolSources)(virConnectPtr conn,
@@ -131,6 +132,45 @@ int virStorageBackendVolWipeLocal(virConnectPtr conn,
                                   unsigned int algorithm,
                                   unsigned int flags);
 
+/* Progress of a long running operation on a volume. The pool lock is
+ * not held while the job runs, so all fields are protected by @lock. */
+struct _virStorageVolJob {
+    virMutex lock;
+
+    int type; /* virStorageVolJobType */
+    unsigned long long cur; /* bytes processed so far */
+    unsigned long long end; /* bytes to process in total */
+
+    unsigned long long bandwidth; /* bytes/s, 0 for unlimited */
+    unsigned long long windowStart; /* ms since epoch */
+    unsigned long long windowBytes; /* bytes processed since windowStart */
+
+    pid_t pid; /* helper process doing the work, if any */
+    bool abort;
+};
+
+virStorageVolJobPtr virStorageBackendJobNew(int type,
+                                            unsigned long long end,
+                                            unsigned long long bandwidth);
+void virStorageBackendJobFree(virStorageVolJobPtr job);
+void virStorageBackendJobGetInfo(virStorageVolJobPtr job,
+                                 virStorageVolJobInfoPtr info);
+void virStorageBackendJobSetSpeed(virStorageVolJobPtr job,
+                                  unsigned long long bandwidth);
+void virStorageBackendJobAbort(virStorageVolJobPtr job);
+bool virStorageBackendJobIsAborted(virStorageVolJobPtr job);
+int virStorageBackendJobSetPid(virStorageVolJobPtr job,
+                               pid_t pid);
+int virStorageBackendJobProgress(virStorageVolJobPtr job,
+                                 unsigned long long bytes,
+                                 bool throttle);
+
+typedef int (*virStorageBackendParallelFunc)(size_t idx, void *opaque);
+int virStorageBackendRunParallel(size_t nitems,
+                                 size_t nworkers,
+                                 virStorageBackendParallelFunc func,
+                                 void *opaque);
+
 typedef struct _virStorageBackend virStorageBackend;
 typedef virStorageBackend *virStorageBackendPtr;
 
@@ -144,6 +184,8 @@ struct _virStorageBackend {
     virStorageBackendStartPool startPool;
     virStorageBackendBuildPool buildPool;
     virStorageBackendRefreshPool refreshPool; /* Must be non-NULL */
+    /* Like refreshPool, but may leave volume details to refreshVol */
+    virStorageBackendRefreshPool listPool;
     virStorageBackendStopPool stopPool;
     virStorageBackendDeletePool deletePool;
 
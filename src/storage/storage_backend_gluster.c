@@ -36,6 +36,9 @@
 
 VIR_LOG_INIT("storage.storage_backend_gluster");
 
+/* Number of volume headers being read in parallel while refreshing a pool */
+#define VIR_STORAGE_GLUSTER_REFRESH_WORKERS 16
+
 struct _virStorageBackendGlusterState {
     glfs_t *vol;
 
@@ -231,74 +234,39 @@ virStorageBackendGlusterSetMetadata(virStorageBackendGlusterStatePtr state,
 }
 
 
-/* Populate *volptr for the given name and stat information, or leave
- * it NULL if the entry should be skipped (such as ".").  Return 0 on
- * success, -1 on failure. */
+/* Fill in format, backing store and the rest of what can be learned
+ * from the header of the file backing @vol.  Only touches @vol and
+ * @state->vol, so several volumes may be probed at once. */
 static int
-virStorageBackendGlusterRefreshVol(virStorageBackendGlusterStatePtr state,
-                                   const char *name,
-                                   struct stat *st,
-                                   virStorageVolDefPtr *volptr)
+virStorageBackendGlusterProbeVol(virStorageBackendGlusterStatePtr state,
+                                 virStorageVolDefPtr vol)
 {
     int ret = -1;
-    virStorageVolDefPtr vol = NULL;
     glfs_fd_t *fd = NULL;
     virStorageSourcePtr meta = NULL;
     char *header = NULL;
     ssize_t len = VIR_STORAGE_MAX_HEADER;
     int backingFormat;
 
-    *volptr = NULL;
-
-    /* Silently skip '.' and '..'.  */
-    if (STREQ(name, ".") || STREQ(name, ".."))
-        return 0;
-
-    /* Follow symlinks; silently skip broken links and loops.  */
-    if (S_ISLNK(st->st_mode) && glfs_stat(state->vol, name, st) < 0) {
-        if (errno == ENOENT || errno == ELOOP) {
-            VIR_WARN("ignoring dangling symlink '%s'", name);
-            ret = 0;
-        } else {
-            virReportSystemError(errno, _("cannot stat '%s'"), name);
-        }
-        return ret;
-    }
-
-    if (VIR_ALLOC(vol) < 0)
-        goto cleanup;
-
-    if (virStorageBackendUpdateVolTargetInfoFD(&vol->target, -1, st, true) < 0)
-        goto cleanup;
-
-    if (virStorageBackendGlusterSetMetadata(state, vol, name) < 0)
-        goto cleanup;
-
-    if (S_ISDIR(st->st_mode)) {
-        vol->type = VIR_STORAGE_VOL_NETDIR;
-        vol->target.format = VIR_STORAGE_FILE_DIR;
-        *volptr = vol;
-        vol = NULL;
-        ret = 0;
-        goto cleanup;
-    }
-
     /* No need to worry about O_NONBLOCK - gluster doesn't allow creation
      * of fifos, so there's nothing it would protect us from. */
-    if (!(fd = glfs_open(state->vol, name, O_RDONLY | O_NOCTTY))) {
+    if (!(fd = glfs_open(state->vol, vol->name, O_RDONLY | O_NOCTTY))) {
         /* A dangling symlink now implies a TOCTTOU race; report it.  */
-        virReportSystemError(errno, _("cannot open volume '%s'"), name);
+        virReportSystemError(errno, _("cannot open volume '%s'"), vol->name);
         goto cleanup;
     }
 
-    if ((len = virStorageBackendGlusterReadHeader(fd, name, len, &header)) < 0)
+    if ((len = virStorageBackendGlusterReadHeader(fd, vol->name,
+                                                  len, &header)) < 0)
         goto cleanup;
 
-    if (!(meta = virStorageFileGetMetadataFromBuf(name, header, len,
+    if (!(meta = virStorageFileGetMetadataFromBuf(vol->name, header, len,
                                                   VIR_STORAGE_FILE_AUTO,
                                                   &backingFormat)))
         goto cleanup;
 
+    virStorageSourceFree(vol->target.backingStore);
+    vol->target.backingStore = NULL;
     if (meta->backingStoreRaw) {
         if (VIR_ALLOC(vol->target.backingStore) < 0)
             goto cleanup;
@@ -316,35 +284,111 @@ virStorageBackendGlusterRefreshVol(virStorageBackendGlusterStatePtr state,
     if (meta->capacity)
         vol->target.capacity = meta->capacity;
     if (meta->encryption) {
+        virStorageEncryptionFree(vol->target.encryption);
         vol->target.encryption = meta->encryption;
         meta->encryption = NULL;
         if (vol->target.format == VIR_STORAGE_FILE_QCOW ||
             vol->target.format == VIR_STORAGE_FILE_QCOW2)
             vol->target.encryption->format = VIR_STORAGE_ENCRYPTION_FORMAT_QCOW;
     }
+    virBitmapFree(vol->target.features);
     vol->target.features = meta->features;
     meta->features = NULL;
+    VIR_FREE(vol->target.compat);
     vol->target.compat = meta->compat;
     meta->compat = NULL;
 
-    *volptr = vol;
-    vol = NULL;
     ret = 0;
  cleanup:
     virStorageSourceFree(meta);
-    virStorageVolDefFree(vol);
     if (fd)
         glfs_close(fd);
     VIR_FREE(header);
     return ret;
 }
 
+
+/* Populate *volptr for the given name and stat information, or leave
+ * it NULL if the entry should be skipped (such as ".").  The header of
+ * regular files is left for virStorageBackendGlusterProbeVol.  Return 0
+ * on success, -1 on failure. */
 static int
-virStorageBackendGlusterRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
-                                    virStoragePoolObjPtr pool)
+virStorageBackendGlusterRefreshVol(virStorageBackendGlusterStatePtr state,
+                                   const char *name,
+                                   struct stat *st,
+                                   virStorageVolDefPtr *volptr)
+{
+    int ret = -1;
+    virStorageVolDefPtr vol = NULL;
+
+    *volptr = NULL;
+
+    /* Silently skip '.' and '..'.  */
+    if (STREQ(name, ".") || STREQ(name, ".."))
+        return 0;
+
+    /* Follow symlinks; silently skip broken links and loops.  */
+    if (S_ISLNK(st->st_mode) && glfs_stat(state->vol, name, st) < 0) {
+        if (errno == ENOENT || errno == ELOOP) {
+            VIR_WARN("ignoring dangling symlink '%s'", name);
+            ret = 0;
+        } else {
+            virReportSystemError(errno, _("cannot stat '%s'"), name);
+        }
+        return ret;
+    }
+
+    if (VIR_ALLOC(vol) < 0)
+        goto cleanup;
+
+    if (virStorageBackendUpdateVolTargetInfoFD(&vol->target, -1, st, true) < 0)
+        goto cleanup;
+
+    if (virStorageBackendGlusterSetMetadata(state, vol, name) < 0)
+        goto cleanup;
+
+    if (S_ISDIR(st->st_mode)) {
+        vol->type = VIR_STORAGE_VOL_NETDIR;
+        vol->target.format = VIR_STORAGE_FILE_DIR;
+    }
+
+    *volptr = vol;
+    vol = NULL;
+    ret = 0;
+ cleanup:
+    virStorageVolDefFree(vol);
+    return ret;
+}
+
+
+typedef struct _virStorageBackendGlusterRefreshData virStorageBackendGlusterRefreshData;
+typedef virStorageBackendGlusterRefreshData *virStorageBackendGlusterRefreshDataPtr;
+struct _virStorageBackendGlusterRefreshData {
+    virStoragePoolObjPtr pool;
+    virStorageBackendGlusterStatePtr state;
+};
+
+static int
+virStorageBackendGlusterProbeVolWorker(size_t idx,
+                                       void *opaque)
+{
+    virStorageBackendGlusterRefreshDataPtr data = opaque;
+    virStorageVolDefPtr vol = data->pool->volumes.objs[idx];
+
+    if (vol->type == VIR_STORAGE_VOL_NETDIR)
+        return 0;
+
+    return virStorageBackendGlusterProbeVol(data->state, vol);
+}
+
+
+static int
+virStorageBackendGlusterRefreshPoolInternal(virStoragePoolObjPtr pool,
+                                            bool probe)
 {
     int ret = -1;
     virStorageBackendGlusterStatePtr state = NULL;
+    virStorageBackendGlusterRefreshData data;
     struct {
         struct dirent ent;
         /* See comment below about readdir_r needing padding */
@@ -397,6 +441,19 @@ virStorageBackendGlusterRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
+    /* Reading each header costs a network round trip or more; glfs
+     * handles may be shared between threads, so overlap them */
+    if (probe) {
+        data.pool = pool;
+        data.state = state;
+
+        if (virStorageBackendRunParallel(pool->volumes.count,
+                                         VIR_STORAGE_GLUSTER_REFRESH_WORKERS,
+                                         virStorageBackendGlusterProbeVolWorker,
+                                         &data) < 0)
+            goto cleanup;
+    }
+
     if (glfs_statvfs(state->vol, state->dir, &sb) < 0) {
         virReportSystemError(errno, _("cannot statvfs path '%s' in '%s'"),
                              state->dir, state->volname);
@@ -420,6 +477,59 @@ virStorageBackendGlusterRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
+static int
+virStorageBackendGlusterRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                    virStoragePoolObjPtr pool)
+{
+    return virStorageBackendGlusterRefreshPoolInternal(pool, true);
+}
+
+
+/* Sizes come for free with the directory listing, only the headers
+ * are left for virStorageBackendGlusterVolRefresh */
+static int
+virStorageBackendGlusterListPool(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                 virStoragePoolObjPtr pool)
+{
+    return virStorageBackendGlusterRefreshPoolInternal(pool, false);
+}
+
+
+static int
+virStorageBackendGlusterVolRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                   virStoragePoolObjPtr pool,
+                                   virStorageVolDefPtr vol)
+{
+    virStorageBackendGlusterStatePtr state = NULL;
+    struct stat st;
+    int ret = -1;
+
+    if (!(state = virStorageBackendGlusterOpen(pool)))
+        goto cleanup;
+
+    if (glfs_stat(state->vol, vol->name, &st) < 0) {
+        virReportSystemError(errno, _("cannot stat '%s'"), vol->name);
+        goto cleanup;
+    }
+
+    if (virStorageBackendUpdateVolTargetInfoFD(&vol->target, -1, &st, true) < 0)
+        goto cleanup;
+
+    if (S_ISDIR(st.st_mode)) {
+        vol->type = VIR_STORAGE_VOL_NETDIR;
+        vol->target.format = VIR_STORAGE_FILE_DIR;
+    } else if (virStorageBackendGlusterProbeVol(state, vol) < 0) {
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStorageBackendGlusterClose(state);
+    return ret;
+}
+
+
 static int
 virStorageBackendGlusterVolDelete(virConnectPtr conn ATTRIBUTE_UNUSED,
                                   virStoragePoolObjPtr pool,
@@ -534,8 +644,10 @@ virStorageBackend virStorageBackendGluster = {
     .type = VIR_STORAGE_POOL_GLUSTER,
 
     .refreshPool = virStorageBackendGlusterRefreshPool,
+    .listPool = virStorageBackendGlusterListPool,
     .findPoolSources = virStorageBackendGlusterFindPoolSources,
 
+    .refreshVol = virStorageBackendGlusterVolRefresh,
     .deleteVol = virStorageBackendGlusterVolDelete,
 };
 
@@ -26,7 +26,6 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <stdio.h>
-#include <regex.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -39,6 +38,8 @@
 #include "virlog.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virhash.h"
+#include "c-ctype.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -66,28 +67,115 @@ virStorageBackendLogicalSetActive(virStoragePoolObjPtr pool,
 
 #define VIR_STORAGE_VOL_LOGICAL_SEGTYPE_STRIPED "striped"
 
-struct virStorageBackendLogicalPoolVolData {
-    virStoragePoolObjPtr pool;
-    virStorageVolDefPtr vol;
+/*
+ * Fields requested from lvs, in the order they are passed to --options.
+ * With --nameprefixes every field is reported as LVM2_<FIELD>='<value>',
+ * so we never have to guess which separator is safe for a given field
+ * (encrypted volumes print ':' in their name (rhbz 470693) and the
+ * "devices" field of striped volumes contains ',' (rhbz 727474)).
+ */
+enum {
+    VIR_STORAGE_LOGICAL_LV_FIELD_NAME,
+    VIR_STORAGE_LOGICAL_LV_FIELD_ORIGIN,
+    VIR_STORAGE_LOGICAL_LV_FIELD_UUID,
+    VIR_STORAGE_LOGICAL_LV_FIELD_DEVICES,
+    VIR_STORAGE_LOGICAL_LV_FIELD_SEGTYPE,
+    VIR_STORAGE_LOGICAL_LV_FIELD_STRIPES,
+    VIR_STORAGE_LOGICAL_LV_FIELD_SEG_SIZE,
+    VIR_STORAGE_LOGICAL_LV_FIELD_EXTENT_SIZE,
+    VIR_STORAGE_LOGICAL_LV_FIELD_SIZE,
+    VIR_STORAGE_LOGICAL_LV_FIELD_ATTR,
+    VIR_STORAGE_LOGICAL_LV_FIELD_VG_SIZE,
+    VIR_STORAGE_LOGICAL_LV_FIELD_VG_FREE,
+
+    VIR_STORAGE_LOGICAL_LV_FIELD_LAST
 };
 
+VIR_ENUM_DECL(virStorageBackendLogicalLVField)
+VIR_ENUM_IMPL(virStorageBackendLogicalLVField,
+              VIR_STORAGE_LOGICAL_LV_FIELD_LAST,
+              "LVM2_LV_NAME", "LVM2_ORIGIN", "LVM2_LV_UUID",
+              "LVM2_DEVICES", "LVM2_SEGTYPE", "LVM2_STRIPES",
+              "LVM2_SEG_SIZE", "LVM2_VG_EXTENT_SIZE", "LVM2_LV_SIZE",
+              "LVM2_LV_ATTR", "LVM2_VG_SIZE", "LVM2_VG_FREE")
+
+#define VIR_STORAGE_LOGICAL_LV_OPTIONS \
+    "lv_name,origin,lv_uuid,devices,segtype,stripes,seg_size," \
+    "vg_extent_size,lv_size,lv_attr,vg_size,vg_free"
+
+
+/*
+ * Parse the "devices" field of one segment, which looks like
+ *
+ *   /dev/sda2(0),/dev/sdb1(1024)
+ *
+ * with one "path(offset)" pair per stripe, and append the
+ * resulting extents to @vol.
+ */
+static int
+virStorageBackendLogicalParseExtents(virStorageVolDefPtr vol,
+                                     char *devices,
+                                     int nextents,
+                                     unsigned long long length,
+                                     unsigned long long size)
+{
+    char *p = devices;
+    size_t i;
+
+    if (VIR_REALLOC_N(vol->source.extents,
+                      vol->source.nextent + nextents) < 0)
+        return -1;
+
+    for (i = 0; i < nextents; i++) {
+        virStorageVolSourceExtentPtr extent;
+        unsigned long long offset;
+        char *open_paren;
+        char *end;
+
+        if (!(open_paren = strchr(p, '(')) ||
+            open_paren == p ||
+            virStrToLong_ull(open_paren + 1, &end, 10, &offset) < 0 ||
+            *end != ')' ||
+            (end[1] != '\0' && end[1] != ',') ||
+            (end[1] == '\0' && i != nextents - 1)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed volume extent devices value"));
+            return -1;
+        }
+
+        extent = &vol->source.extents[vol->source.nextent];
+        if (VIR_STRNDUP(extent->path, p, open_paren - p) < 0)
+            return -1;
+
+        extent->start = offset * size;
+        extent->end = (offset * size) + length;
+        vol->source.nextent++;
+
+        p = end + 2;
+    }
+
+    return 0;
+}
+
 static int
-virStorageBackendLogicalMakeVol(char **const groups,
-                                void *opaque)
+virStorageBackendLogicalMakeVol(virStoragePoolObjPtr pool,
+                                virStorageVolDefPtr filter,
+                                virHashTablePtr vols,
+                                char **const fields)
 {
-    struct virStorageBackendLogicalPoolVolData *data = opaque;
-    virStoragePoolObjPtr pool = data->pool;
     virStorageVolDefPtr vol = NULL;
     bool is_new_vol = false;
-    unsigned long long offset, size, length;
-    const char *regex_unit = "(\\S+)\\((\\S+)\\)";
-    char *regex = NULL;
-    regex_t *reg = NULL;
-    regmatch_t *vars = NULL;
-    char *p = NULL;
-    size_t i;
-    int err, nextents, nvars, ret = -1;
-    const char *attrs = groups[9];
+    unsigned long long size, length;
+    int nextents, ret = -1;
+    const char *name = fields[VIR_STORAGE_LOGICAL_LV_FIELD_NAME];
+    const char *origin = fields[VIR_STORAGE_LOGICAL_LV_FIELD_ORIGIN];
+    const char *attrs = fields[VIR_STORAGE_LOGICAL_LV_FIELD_ATTR];
+
+    /* Rows without any device, e.g. thin volumes, have no extents */
+    if (!name || !attrs || strlen(attrs) < 5 ||
+        !fields[VIR_STORAGE_LOGICAL_LV_FIELD_DEVICES] ||
+        !*fields[VIR_STORAGE_LOGICAL_LV_FIELD_DEVICES])
+        return 0;
 
     /* Skip inactive volume */
     if (attrs[4] != 'a')
@@ -102,15 +190,15 @@ virStorageBackendLogicalMakeVol(char **const groups,
         return 0;
 
     /* See if we're only looking for a specific volume */
-    if (data->vol != NULL) {
-        vol = data->vol;
-        if (STRNEQ(vol->name, groups[0]))
+    if (filter != NULL) {
+        vol = filter;
+        if (STRNEQ(vol->name, name))
             return 0;
     }
 
     /* Or filling in more data on an existing volume */
     if (vol == NULL)
-        vol = virStorageVolDefFindByName(pool, groups[0]);
+        vol = virHashLookup(vols, name);
 
     /* Or a completely new volume */
     if (vol == NULL) {
@@ -120,7 +208,7 @@ virStorageBackendLogicalMakeVol(char **const groups,
         is_new_vol = true;
         vol->type = VIR_STORAGE_VOL_BLOCK;
 
-        if (VIR_STRDUP(vol->name, groups[0]) < 0)
+        if (VIR_STRDUP(vol->name, name) < 0)
             goto cleanup;
 
     }
@@ -135,7 +223,7 @@ virStorageBackendLogicalMakeVol(char **const groups,
      * the --virtualsize/-V option. We've already ignored the (t)hin
      * pool definition. In the manner libvirt defines these, the
      * thin pool is hidden to the lvs output, except as the name
-     * in brackets [] described for the groups[1] (backingStore).
+     * in brackets [] described for the origin (backingStore).
      */
     if (attrs[0] == 's')
         vol->target.sparse = true;
@@ -146,205 +234,290 @@ virStorageBackendLogicalMakeVol(char **const groups,
      *
      * (lvs outputs "[$lvname_vorigin] for field "origin" if the
      *  lv is created with "--virtualsize").
+     *
+     * Multi-segment volumes repeat the origin on every row, so
+     * only fill it in once.
      */
-    if (groups[1] && !STREQ(groups[1], "") && (groups[1][0] != '[')) {
+    if (origin && !STREQ(origin, "") && (origin[0] != '[') &&
+        !vol->target.backingStore) {
         if (VIR_ALLOC(vol->target.backingStore) < 0)
             goto cleanup;
 
         if (virAsprintf(&vol->target.backingStore->path, "%s/%s",
-                        pool->def->target.path, groups[1]) < 0)
+                        pool->def->target.path, origin) < 0)
             goto cleanup;
 
         vol->target.backingStore->format = VIR_STORAGE_POOL_LOGICAL_LVM2;
     }
 
-    if (!vol->key && VIR_STRDUP(vol->key, groups[2]) < 0)
-        goto cleanup;
-
-    if (virStorageBackendUpdateVolInfo(vol, true, false,
-                                       VIR_STORAGE_VOL_OPEN_DEFAULT) < 0)
+    if (!vol->key &&
+        VIR_STRDUP(vol->key, fields[VIR_STORAGE_LOGICAL_LV_FIELD_UUID]) < 0)
         goto cleanup;
 
     nextents = 1;
-    if (STREQ(groups[4], VIR_STORAGE_VOL_LOGICAL_SEGTYPE_STRIPED)) {
-        if (virStrToLong_i(groups[5], NULL, 10, &nextents) < 0) {
+    if (STREQ_NULLABLE(fields[VIR_STORAGE_LOGICAL_LV_FIELD_SEGTYPE],
+                       VIR_STORAGE_VOL_LOGICAL_SEGTYPE_STRIPED)) {
+        if (virStrToLong_i(fields[VIR_STORAGE_LOGICAL_LV_FIELD_STRIPES],
+                           NULL, 10, &nextents) < 0 ||
+            nextents < 1) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("malformed volume extent stripes value"));
             goto cleanup;
         }
     }
 
-    /* Finally fill in extents information */
-    if (VIR_REALLOC_N(vol->source.extents,
-                      vol->source.nextent + nextents) < 0)
-        goto cleanup;
-
-    if (virStrToLong_ull(groups[6], NULL, 10, &length) < 0) {
+    if (virStrToLong_ull(fields[VIR_STORAGE_LOGICAL_LV_FIELD_SEG_SIZE],
+                         NULL, 10, &length) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("malformed volume extent length value"));
         goto cleanup;
     }
-    if (virStrToLong_ull(groups[7], NULL, 10, &size) < 0) {
+    if (virStrToLong_ull(fields[VIR_STORAGE_LOGICAL_LV_FIELD_EXTENT_SIZE],
+                         NULL, 10, &size) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("malformed volume extent size value"));
         goto cleanup;
     }
-    if (virStrToLong_ull(groups[8], NULL, 10, &vol->target.allocation) < 0) {
+    if (virStrToLong_ull(fields[VIR_STORAGE_LOGICAL_LV_FIELD_SIZE],
+                         NULL, 10, &vol->target.allocation) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("malformed volume allocation value"));
         goto cleanup;
     }
 
-    /* Now parse the "devices" field separately */
-    if (VIR_STRDUP(regex, regex_unit) < 0)
+    /* Finally fill in extents information */
+    if (virStorageBackendLogicalParseExtents(vol,
+                                             fields[VIR_STORAGE_LOGICAL_LV_FIELD_DEVICES],
+                                             nextents, length, size) < 0)
         goto cleanup;
 
-    for (i = 1; i < nextents; i++) {
-        if (VIR_REALLOC_N(regex, strlen(regex) + strlen(regex_unit) + 2) < 0)
+    if (is_new_vol) {
+        if (virHashAddEntry(vols, vol->name, vol) < 0)
             goto cleanup;
-        /* "," is the separator of "devices" field */
-        strcat(regex, ",");
-        strncat(regex, regex_unit, strlen(regex_unit));
+
+        if (VIR_APPEND_ELEMENT(pool->volumes.objs,
+                               pool->volumes.count, vol) < 0) {
+            virHashRemoveEntry(vols, vol->name);
+            goto cleanup;
+        }
     }
 
-    if (VIR_ALLOC(reg) < 0)
-        goto cleanup;
+    ret = 0;
 
-    /* Each extent has a "path:offset" pair, and vars[0] will
-     * be the whole matched string.
-     */
-    nvars = (nextents * 2) + 1;
-    if (VIR_ALLOC_N(vars, nvars) < 0)
-        goto cleanup;
+ cleanup:
+    if (is_new_vol && (ret == -1))
+        virStorageVolDefFree(vol);
+    return ret;
+}
 
-    err = regcomp(reg, regex, REG_EXTENDED);
-    if (err != 0) {
-        char error[100];
-        regerror(err, reg, error, sizeof(error));
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Failed to compile regex %s"),
-                       error);
-        goto cleanup;
-    }
 
-    err = regexec(reg, groups[3], nvars, vars, 0);
-    regfree(reg);
-    if (err != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("malformed volume extent devices value"));
-        goto cleanup;
+/*
+ * Split one line of "--nameprefixes" report output in place, storing
+ * a pointer to each known field's value in @fields. Unknown fields
+ * are ignored so newer lvm releases may add columns freely.
+ */
+static int
+virStorageBackendLogicalParseReportLine(char *line,
+                                        char **fields)
+{
+    char *p = line;
+    char *key = NULL;
+
+    memset(fields, 0, sizeof(*fields) * VIR_STORAGE_LOGICAL_LV_FIELD_LAST);
+
+    for (;;) {
+        char *value;
+        int field;
+
+        virSkipSpaces((const char **) &p);
+        if (!*p)
+            break;
+
+        key = p;
+        if (!(p = strchr(p, '=')))
+            goto error;
+        *p++ = '\0';
+
+        if (*p == '\'') {
+            /* Quoted values end at the first quote followed by
+             * whitespace or end of line */
+            value = ++p;
+            while ((p = strchr(p, '\'')) &&
+                   p[1] != '\0' && !c_isspace(p[1]))
+                p++;
+            if (!p)
+                goto error;
+        } else {
+            value = p;
+            while (*p && !c_isspace(*p))
+                p++;
+        }
+        if (*p)
+            *p++ = '\0';
+
+        if ((field = virStorageBackendLogicalLVFieldTypeFromString(key)) >= 0)
+            fields[field] = value;
     }
 
-    p = groups[3];
+    return 0;
 
-    /* vars[0] is skipped */
-    for (i = 0; i < nextents; i++) {
-        size_t j;
-        int len;
-        char *offset_str = NULL;
+ error:
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("malformed lvs report field '%s'"), key);
+    return -1;
+}
 
-        j = (i * 2) + 1;
-        len = vars[j].rm_eo - vars[j].rm_so;
-        p[vars[j].rm_eo] = '\0';
 
-        if (VIR_STRNDUP(vol->source.extents[vol->source.nextent].path,
-                        p + vars[j].rm_so, len) < 0)
-            goto cleanup;
+/**
+ * virStorageBackendLogicalParseLVs:
+ * @pool: the pool to fill in
+ * @vol: if non-NULL, only fill in the volume with this name
+ * @output: lvs report, modified in place
+ *
+ * Parse the output of lvs run with --nameprefixes and
+ * VIR_STORAGE_LOGICAL_LV_OPTIONS. Volumes are added to @pool (or @vol
+ * updated), and, when listing the whole pool, the volume group size and
+ * free space reported alongside every row are stored in the pool
+ * definition, which saves a separate vgs run.
+ *
+ * Returns the number of report rows seen, or -1 on error.
+ */
+int
+virStorageBackendLogicalParseLVs(virStoragePoolObjPtr pool,
+                                 virStorageVolDefPtr vol,
+                                 char *output)
+{
+    char *fields[VIR_STORAGE_LOGICAL_LV_FIELD_LAST];
+    virHashTablePtr vols = NULL;
+    char *line = output;
+    char *next;
+    size_t i;
+    int nrows = 0;
+    int ret = -1;
 
-        len = vars[j + 1].rm_eo - vars[j + 1].rm_so;
-        if (VIR_STRNDUP(offset_str, p + vars[j + 1].rm_so, len) < 0)
+    /* Volumes are looked up by name once per segment, which is too
+     * costly to do by walking the list in VGs with thousands of LVs */
+    if (!(vols = virHashCreate(pool->volumes.count + 64, NULL)))
+        return -1;
+
+    for (i = 0; i < pool->volumes.count; i++) {
+        if (virHashAddEntry(vols, pool->volumes.objs[i]->name,
+                            pool->volumes.objs[i]) < 0)
             goto cleanup;
+    }
 
-        if (virStrToLong_ull(offset_str, NULL, 10, &offset) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("malformed volume extent offset value"));
-            VIR_FREE(offset_str);
+    for (; line && *line; line = next) {
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+
+        if (virStringIsEmpty(line))
+            continue;
+
+        if (virStorageBackendLogicalParseReportLine(line, fields) < 0)
             goto cleanup;
-        }
 
-        VIR_FREE(offset_str);
+        if (!fields[VIR_STORAGE_LOGICAL_LV_FIELD_NAME])
+            continue;
 
-        vol->source.extents[vol->source.nextent].start = offset * size;
-        vol->source.extents[vol->source.nextent].end = (offset * size) + length;
-        vol->source.nextent++;
-    }
+        nrows++;
 
-    if (is_new_vol &&
-        VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0)
-        goto cleanup;
+        if (!vol &&
+            fields[VIR_STORAGE_LOGICAL_LV_FIELD_VG_SIZE] &&
+            fields[VIR_STORAGE_LOGICAL_LV_FIELD_VG_FREE]) {
+            if (virStrToLong_ull(fields[VIR_STORAGE_LOGICAL_LV_FIELD_VG_SIZE],
+                                 NULL, 10, &pool->def->capacity) < 0 ||
+                virStrToLong_ull(fields[VIR_STORAGE_LOGICAL_LV_FIELD_VG_FREE],
+                                 NULL, 10, &pool->def->available) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("malformed volume group size value"));
+                goto cleanup;
+            }
+            pool->def->allocation = pool->def->capacity - pool->def->available;
+        }
 
-    ret = 0;
+        if (virStorageBackendLogicalMakeVol(pool, vol, vols, fields) < 0)
+            goto cleanup;
+    }
+
+    ret = nrows;
 
  cleanup:
-    VIR_FREE(regex);
-    VIR_FREE(reg);
-    VIR_FREE(vars);
-    if (is_new_vol && (ret == -1))
-        virStorageVolDefFree(vol);
+    virHashFree(vols);
     return ret;
 }
 
+
 static int
 virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                                 virStorageVolDefPtr vol)
 {
     /*
-     * # lvs --separator , --noheadings --units b --unbuffered --nosuffix --options \
-     * "lv_name,origin,uuid,devices,seg_size,vg_extent_size,size,lv_attr" VGNAME
-     *
-     * RootLV,,06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky,/dev/hda2(0),5234491392,33554432,5234491392,-wi-ao
-     * SwapLV,,oHviCK-8Ik0-paqS-V20c-nkhY-Bm1e-zgzU0M,/dev/hda2(156),1040187392,33554432,1040187392,-wi-ao
-     * Test2,,3pg3he-mQsA-5Sui-h0i6-HNmc-Cz7W-QSndcR,/dev/hda2(219),1073741824,33554432,1073741824,owi-a-
-     * Test3,,UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht,/dev/hda2(251),2181038080,33554432,2181038080,-wi-a-
-     * Test3,Test2,UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht,/dev/hda2(187),1040187392,33554432,1040187392,swi-a-
+     * # lvs --noheadings --nameprefixes --units b --unbuffered --nosuffix \
+     *   --options "lv_name,origin,lv_uuid,devices,segtype,stripes,seg_size,\
+     *   vg_extent_size,lv_size,lv_attr,vg_size,vg_free" VGNAME
      *
-     * Pull out name, origin, & uuid, device, device extent start #,
-     * segment size, extent size, size, attrs
+     * LVM2_LV_NAME='RootLV' LVM2_ORIGIN='' LVM2_LV_UUID='06UgP5-...' \
+     *   LVM2_DEVICES='/dev/hda2(0)' LVM2_SEGTYPE='linear' LVM2_STRIPES='1' \
+     *   LVM2_SEG_SIZE='5234491392' LVM2_VG_EXTENT_SIZE='33554432' \
+     *   LVM2_LV_SIZE='5234491392' LVM2_LV_ATTR='-wi-ao' \
+     *   LVM2_VG_SIZE='10603200512' LVM2_VG_FREE='4328521728'
      *
      * NB can be multiple rows per volume if they have many extents
      *
-     * NB lvs from some distros (e.g. SLES10 SP2) outputs trailing "," on each line
-     *
-     * NB Encrypted logical volumes can print ':' in their name, so it is
-     *    not a suitable separator (rhbz 470693).
-     * NB "devices" field has multiple device paths and "," if the volume is
-     *    striped, so "," is not a suitable separator either (rhbz 727474).
+     * When looking up a single volume only that LV is reported, rather
+     * than the whole volume group.
      */
-    const char *regexes[] = {
-       "^\\s*(\\S+)#(\\S*)#(\\S+)#(\\S+)#(\\S+)#([0-9]+)#(\\S+)#([0-9]+)#([0-9]+)#(\\S+)#?\\s*$"
-    };
-    int vars[] = {
-        10
-    };
     int ret = -1;
-    virCommandPtr cmd;
-    struct virStorageBackendLogicalPoolVolData cbdata = {
-        .pool = pool,
-        .vol = vol,
-    };
+    int nrows;
+    char *output = NULL;
+    char *target = NULL;
+    virCommandPtr cmd = NULL;
+    size_t i;
+
+    if (vol) {
+        if (virAsprintf(&target, "%s/%s",
+                        pool->def->source.name, vol->name) < 0)
+            goto cleanup;
+    } else {
+        if (VIR_STRDUP(target, pool->def->source.name) < 0)
+            goto cleanup;
+    }
 
     cmd = virCommandNewArgList(LVS,
-                               "--separator", "#",
                                "--noheadings",
+                               "--nameprefixes",
                                "--units", "b",
                                "--unbuffered",
                                "--nosuffix",
-                               "--options",
-                               "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr",
-                               pool->def->source.name,
+                               "--options", VIR_STORAGE_LOGICAL_LV_OPTIONS,
+                               target,
                                NULL);
-    if (virCommandRunRegex(cmd,
-                           1,
-                           regexes,
-                           vars,
-                           virStorageBackendLogicalMakeVol,
-                           &cbdata,
-                           "lvs") < 0)
+    virCommandSetOutputBuffer(cmd, &output);
+    if (virCommandRun(cmd, NULL) < 0)
         goto cleanup;
 
-    ret = 0;
+    if ((nrows = virStorageBackendLogicalParseLVs(pool, vol, output)) < 0)
+        goto cleanup;
+
+    /* Device details are read once per volume, not once per segment */
+    if (vol) {
+        if (virStorageBackendUpdateVolInfo(vol, true, false,
+                                           VIR_STORAGE_VOL_OPEN_DEFAULT) < 0)
+            goto cleanup;
+    } else {
+        for (i = 0; i < pool->volumes.count; i++) {
+            if (virStorageBackendUpdateVolInfo(pool->volumes.objs[i],
+                                               true, false,
+                                               VIR_STORAGE_VOL_OPEN_DEFAULT) < 0)
+                goto cleanup;
+        }
+    }
+
+    ret = nrows;
  cleanup:
     virCommandFree(cmd);
+    VIR_FREE(output);
+    VIR_FREE(target);
     return ret;
 }
 
@@ -596,13 +769,20 @@ virStorageBackendLogicalRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
         2
     };
     virCommandPtr cmd = NULL;
+    int nrows;
     int ret = -1;
 
     virFileWaitForDevices();
 
-    /* Get list of all logical volumes */
-    if (virStorageBackendLogicalFindLVs(pool, NULL) < 0)
+    /* Get list of all logical volumes, along with the volgrp metadata */
+    if ((nrows = virStorageBackendLogicalFindLVs(pool, NULL)) < 0)
+        goto cleanup;
+
+    /* lvs reports nothing at all for an empty volume group */
+    if (nrows > 0) {
+        ret = 0;
         goto cleanup;
+    }
 
     cmd = virCommandNewArgList(VGS,
                                "--separator", ":",
@@ -26,6 +26,10 @@
 
 # include "storage_backend.h"
 
+int virStorageBackendLogicalParseLVs(virStoragePoolObjPtr pool,
+                                     virStorageVolDefPtr vol,
+                                     char *output);
+
 extern virStorageBackend virStorageBackendLogical;
 
 #endif /* __VIR_STORAGE_BACKEND_LOGICAL_H__ */
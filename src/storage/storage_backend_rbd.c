@@ -39,6 +39,9 @@
 
 VIR_LOG_INIT("storage.storage_backend_rbd");
 
+/* Number of images being looked at in parallel while refreshing a pool */
+#define VIR_STORAGE_RBD_REFRESH_WORKERS 16
+
 struct _virStorageBackendRBDState {
     rados_t cluster;
     rados_ioctx_t ioctx;
@@ -267,6 +270,27 @@ static int virStorageBackendRBDCloseRADOSConn(virStorageBackendRBDStatePtr ptr)
     return ret;
 }
 
+static int
+virStorageBackendRBDSetVolPath(virStoragePoolObjPtr pool,
+                               virStorageVolDefPtr vol)
+{
+    vol->type = VIR_STORAGE_VOL_NETWORK;
+
+    VIR_FREE(vol->target.path);
+    if (virAsprintf(&vol->target.path, "%s/%s",
+                    pool->def->source.name,
+                    vol->name) == -1)
+        return -1;
+
+    VIR_FREE(vol->key);
+    if (virAsprintf(&vol->key, "%s/%s",
+                    pool->def->source.name,
+                    vol->name) == -1)
+        return -1;
+
+    return 0;
+}
+
 static int volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
                                               virStoragePoolObjPtr pool,
                                               virStorageBackendRBDStatePtr ptr)
@@ -297,18 +321,8 @@ static int volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
 
     vol->target.capacity = info.size;
     vol->target.allocation = info.obj_size * info.num_objs;
-    vol->type = VIR_STORAGE_VOL_NETWORK;
 
-    VIR_FREE(vol->target.path);
-    if (virAsprintf(&vol->target.path, "%s/%s",
-                    pool->def->source.name,
-                    vol->name) == -1)
-        goto cleanup;
-
-    VIR_FREE(vol->key);
-    if (virAsprintf(&vol->key, "%s/%s",
-                    pool->def->source.name,
-                    vol->name) == -1)
+    if (virStorageBackendRBDSetVolPath(pool, vol) < 0)
         goto cleanup;
 
     ret = 0;
@@ -318,8 +332,29 @@ static int volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
     return ret;
 }
 
-static int virStorageBackendRBDRefreshPool(virConnectPtr conn,
-                                           virStoragePoolObjPtr pool)
+typedef struct _virStorageBackendRBDRefreshData virStorageBackendRBDRefreshData;
+typedef virStorageBackendRBDRefreshData *virStorageBackendRBDRefreshDataPtr;
+struct _virStorageBackendRBDRefreshData {
+    virStoragePoolObjPtr pool;
+    virStorageBackendRBDStatePtr ptr;
+};
+
+/* Runs in parallel with other images, sharing the RADOS IoCTX, which
+ * librados allows */
+static int
+virStorageBackendRBDRefreshVolWorker(size_t idx,
+                                     void *opaque)
+{
+    virStorageBackendRBDRefreshDataPtr data = opaque;
+
+    return volStorageBackendRBDRefreshVolInfo(data->pool->volumes.objs[idx],
+                                              data->pool, data->ptr);
+}
+
+static int
+virStorageBackendRBDRefreshPoolInternal(virConnectPtr conn,
+                                        virStoragePoolObjPtr pool,
+                                        bool details)
 {
     size_t max_size = 1024;
     int ret = -1;
@@ -327,6 +362,7 @@ static int virStorageBackendRBDRefreshPool(virConnectPtr conn,
     int r = 0;
     char *name, *names = NULL;
     virStorageBackendRBDState ptr;
+    virStorageBackendRBDRefreshData data;
     ptr.cluster = NULL;
     ptr.ioctx = NULL;
 
@@ -392,29 +428,57 @@ static int virStorageBackendRBDRefreshPool(virConnectPtr conn,
 
         name += strlen(name) + 1;
 
-        if (volStorageBackendRBDRefreshVolInfo(vol, pool, &ptr) < 0) {
+        if (virStorageBackendRBDSetVolPath(pool, vol) < 0) {
             virStorageVolDefFree(vol);
             goto cleanup;
         }
 
         if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0) {
             virStorageVolDefFree(vol);
-            virStoragePoolObjClearVols(pool);
             goto cleanup;
         }
     }
 
+    /* Each image needs its own round trips to be opened and stat'ed,
+     * so keep several of them in flight */
+    if (details) {
+        data.pool = pool;
+        data.ptr = &ptr;
+
+        if (virStorageBackendRunParallel(pool->volumes.count,
+                                         VIR_STORAGE_RBD_REFRESH_WORKERS,
+                                         virStorageBackendRBDRefreshVolWorker,
+                                         &data) < 0)
+            goto cleanup;
+    }
+
     VIR_DEBUG("Found %zu images in RBD pool %s",
               pool->volumes.count, pool->def->source.name);
 
     ret = 0;
 
  cleanup:
+    if (ret < 0)
+        virStoragePoolObjClearVols(pool);
     VIR_FREE(names);
     virStorageBackendRBDCloseRADOSConn(&ptr);
     return ret;
 }
 
+static int virStorageBackendRBDRefreshPool(virConnectPtr conn,
+                                           virStoragePoolObjPtr pool)
+{
+    return virStorageBackendRBDRefreshPoolInternal(conn, pool, true);
+}
+
+/* Size and allocation of each image are only fetched by refreshVol, when
+ * someone asks for them */
+static int virStorageBackendRBDListPool(virConnectPtr conn,
+                                        virStoragePoolObjPtr pool)
+{
+    return virStorageBackendRBDRefreshPoolInternal(conn, pool, false);
+}
+
 static int virStorageBackendRBDDeleteVol(virConnectPtr conn,
                                          virStoragePoolObjPtr pool,
                                          virStorageVolDefPtr vol,
@@ -460,21 +524,7 @@ virStorageBackendRBDCreateVol(virConnectPtr conn ATTRIBUTE_UNUSED,
                               virStoragePoolObjPtr pool,
                               virStorageVolDefPtr vol)
 {
-    vol->type = VIR_STORAGE_VOL_NETWORK;
-
-    VIR_FREE(vol->target.path);
-    if (virAsprintf(&vol->target.path, "%s/%s",
-                    pool->def->source.name,
-                    vol->name) == -1)
-        return -1;
-
-    VIR_FREE(vol->key);
-    if (virAsprintf(&vol->key, "%s/%s",
-                    pool->def->source.name,
-                    vol->name) == -1)
-        return -1;
-
-    return 0;
+    return virStorageBackendRBDSetVolPath(pool, vol);
 }
 
 static int virStorageBackendRBDCreateImage(rados_ioctx_t io,
@@ -624,6 +674,7 @@ virStorageBackend virStorageBackendRBD = {
     .type = VIR_STORAGE_POOL_RBD,
 
     .refreshPool = virStorageBackendRBDRefreshPool,
+    .listPool = virStorageBackendRBDListPool,
     .createVol = virStorageBackendRBDCreateVol,
     .buildVol = virStorageBackendRBDBuildVol,
     .refreshVol = virStorageBackendRBDRefreshVol,
@@ -49,6 +49,7 @@
 #include "configmake.h"
 #include "virstring.h"
 #include "viraccessapicheck.h"
+#include "virtime.h"
 #include "dirname.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
@@ -65,6 +66,19 @@ struct _virStorageVolStreamInfo {
     char *pool_name;
 };
 
+typedef struct _virStorageVolBuildData virStorageVolBuildData;
+typedef virStorageVolBuildData *virStorageVolBuildDataPtr;
+struct _virStorageVolBuildData {
+    virStorageDriverStatePtr driver;
+    virStorageBackendPtr backend;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr voldef;
+    virStorageVolDefPtr buildvoldef; /* shallow copy of @voldef */
+    virStorageVolPtr volobj;
+    virStorageVolJobPtr job;
+    unsigned int flags;
+};
+
 static void storageDriverLock(virStorageDriverStatePtr driver)
 {
     virMutexLock(&driver->lock);
@@ -74,6 +88,182 @@ static void storageDriverUnlock(virStorageDriverStatePtr driver)
     virMutexUnlock(&driver->lock);
 }
 
+VIR_ENUM_DECL(storagePoolJob)
+VIR_ENUM_IMPL(storagePoolJob, VIR_STORAGE_POOL_JOB_LAST,
+              "none",
+              "start",
+              "build",
+              "refresh",
+              "destroy",
+              "delete")
+
+static int
+storagePoolObjCheckNoJob(virStoragePoolObjPtr pool)
+{
+    if (pool->job == VIR_STORAGE_POOL_JOB_NONE)
+        return 0;
+
+    virReportError(VIR_ERR_OPERATION_INVALID,
+                   _("storage pool '%s' is busy with a %s job"),
+                   pool->def->name, storagePoolJobTypeToString(pool->job));
+    return -1;
+}
+
+/*
+ * Mark @job as running on @pool, which must be locked. The caller may
+ * then drop the pool lock around slow I/O and must end the job with
+ * the pool locked again. Jobs don't queue: like the asyncjobs checks,
+ * this fails straight away if the pool is already busy.
+ */
+static int
+storagePoolObjBeginJob(virStoragePoolObjPtr pool,
+                       virStoragePoolJobType job)
+{
+    if (storagePoolObjCheckNoJob(pool) < 0)
+        return -1;
+
+    if (virTimeMillisNow(&pool->jobStarted) < 0)
+        return -1;
+
+    VIR_DEBUG("Starting %s job on storage pool '%s'",
+              storagePoolJobTypeToString(job), pool->def->name);
+    pool->job = job;
+    return 0;
+}
+
+static void
+storagePoolObjEndJob(virStoragePoolObjPtr pool)
+{
+    VIR_DEBUG("Finished %s job on storage pool '%s'",
+              storagePoolJobTypeToString(pool->job), pool->def->name);
+    pool->job = VIR_STORAGE_POOL_JOB_NONE;
+    pool->jobStarted = 0;
+
+    /* A redefinition made while the job was running had to be deferred */
+    if (!virStoragePoolObjIsActive(pool) && pool->newDef) {
+        virStoragePoolDefFree(pool->def);
+        pool->def = pool->newDef;
+        pool->newDef = NULL;
+    }
+}
+
+static void
+storagePoolObjRelock(virStorageDriverStatePtr driver,
+                     virStoragePoolObjPtr pool)
+{
+    storageDriverLock(driver);
+    virStoragePoolObjLock(pool);
+    storageDriverUnlock(driver);
+}
+
+/*
+ * Scan the volumes of @pool without holding its lock, so that queries
+ * keep seeing the previous results meanwhile. The backend fills in a
+ * scratch object sharing the pool definition, whose results replace
+ * the pool's once the lock is taken back. Must be called within a job,
+ * with the pool locked; returns with the pool locked. With @listOnly,
+ * backends able to do so skip per-volume details, which refreshVol
+ * fills in on lookup.
+ */
+static int
+storagePoolObjRefreshUnlocked(virConnectPtr conn,
+                              virStorageDriverStatePtr driver,
+                              virStorageBackendPtr backend,
+                              virStoragePoolObjPtr pool,
+                              bool listOnly)
+{
+    virStorageBackendRefreshPool refreshPool = backend->refreshPool;
+    virStoragePoolObj scratch;
+    virStoragePoolDef scratchdef;
+    virStoragePoolSourceDevicePtr devices = NULL;
+    size_t ndevice = pool->def->source.ndevice;
+    size_t i;
+    int ret;
+
+    /* Free extents are recomputed by the disk backend, so they must
+     * not be shared with the definition other threads can format */
+    if (ndevice && VIR_ALLOC_N(devices, ndevice) < 0)
+        return -1;
+    for (i = 0; i < ndevice; i++) {
+        devices[i] = pool->def->source.devices[i];
+        devices[i].freeExtents = NULL;
+        devices[i].nfreeExtent = 0;
+    }
+
+    memset(&scratch, 0, sizeof(scratch));
+    scratchdef = *pool->def;
+    scratchdef.source.devices = devices;
+    scratch.def = &scratchdef;
+    scratch.active = pool->active;
+
+    if (listOnly && backend->listPool)
+        refreshPool = backend->listPool;
+
+    virStoragePoolObjUnlock(pool);
+    ret = refreshPool(conn, &scratch);
+    storagePoolObjRelock(driver, pool);
+
+    virStoragePoolObjClearVols(pool);
+
+    if (ret < 0) {
+        virStoragePoolObjClearVols(&scratch);
+        for (i = 0; i < ndevice; i++)
+            VIR_FREE(devices[i].freeExtents);
+        VIR_FREE(devices);
+        return -1;
+    }
+
+    pool->volumes = scratch.volumes;
+    pool->def->capacity = scratchdef.capacity;
+    pool->def->allocation = scratchdef.allocation;
+    pool->def->available = scratchdef.available;
+    for (i = 0; i < ndevice; i++) {
+        virStoragePoolSourceDevicePtr dev = &pool->def->source.devices[i];
+
+        VIR_FREE(dev->freeExtents);
+        dev->freeExtents = devices[i].freeExtents;
+        dev->nfreeExtent = devices[i].nfreeExtent;
+        dev->geometry = devices[i].geometry;
+    }
+    VIR_FREE(devices);
+
+    return 0;
+}
+
+/*
+ * Start @pool and scan its volumes, from within a job. Called and
+ * returns with the pool locked, but drops the lock while working.
+ */
+static int
+storagePoolObjStart(virConnectPtr conn,
+                    virStorageDriverStatePtr driver,
+                    virStorageBackendPtr backend,
+                    virStoragePoolObjPtr pool)
+{
+    if (backend->startPool) {
+        int rc;
+
+        virStoragePoolObjUnlock(pool);
+        rc = backend->startPool(conn, pool);
+        storagePoolObjRelock(driver, pool);
+
+        if (rc < 0)
+            return -1;
+    }
+
+    if (storagePoolObjRefreshUnlocked(conn, driver, backend, pool, false) < 0) {
+        if (backend->stopPool) {
+            virStoragePoolObjUnlock(pool);
+            backend->stopPool(conn, pool);
+            storagePoolObjRelock(driver, pool);
+        }
+        return -1;
+    }
+
+    pool->active = 1;
+    return 0;
+}
+
 static void
 storageDriverAutostart(virStorageDriverStatePtr driver)
 {
@@ -93,6 +283,11 @@ storageDriverAutostart(virStorageDriverStatePtr driver)
         bool started = false;
 
         virStoragePoolObjLock(pool);
+        if (pool->job != VIR_STORAGE_POOL_JOB_NONE) {
+            virStoragePoolObjUnlock(pool);
+            continue;
+        }
+
         if ((backend = virStorageBackendForType(pool->def->type)) == NULL) {
             VIR_ERROR(_("Missing backend %d"), pool->def->type);
             virStoragePoolObjUnlock(pool);
@@ -162,6 +357,17 @@ storageStateInitialize(bool privileged,
         VIR_FREE(driverState);
         return -1;
     }
+    if (virMutexInit(&driverState->buildLock) < 0) {
+        virMutexDestroy(&driverState->lock);
+        VIR_FREE(driverState);
+        return -1;
+    }
+    if (virCondInit(&driverState->buildCond) < 0) {
+        virMutexDestroy(&driverState->buildLock);
+        virMutexDestroy(&driverState->lock);
+        VIR_FREE(driverState);
+        return -1;
+    }
     storageDriverLock(driverState);
 
     if (privileged) {
@@ -249,9 +455,39 @@ storageStateReload(void)
 static int
 storageStateCleanup(void)
 {
+    size_t i, j;
+
     if (!driverState)
         return -1;
 
+    /* Background volume builds use the pools and the driver until
+     * they finish, so ask them to stop and wait for them */
+    storageDriverLock(driverState);
+    for (i = 0; i < driverState->pools.count; i++) {
+        virStoragePoolObjPtr pool = driverState->pools.objs[i];
+
+        virStoragePoolObjLock(pool);
+        for (j = 0; j < pool->volumes.count; j++) {
+            virStorageVolDefPtr vol = pool->volumes.objs[j];
+
+            if (vol->building && vol->job)
+                virStorageBackendJobAbort(vol->job);
+        }
+        virStoragePoolObjUnlock(pool);
+    }
+    storageDriverUnlock(driverState);
+
+    virMutexLock(&driverState->buildLock);
+    while (driverState->buildThreads > 0) {
+        if (virCondWait(&driverState->buildCond,
+                        &driverState->buildLock) < 0) {
+            VIR_WARN("Unable to wait for volume builds to finish");
+            virMutexUnlock(&driverState->buildLock);
+            return -1;
+        }
+    }
+    virMutexUnlock(&driverState->buildLock);
+
     storageDriverLock(driverState);
 
     /* free inactive pools */
@@ -260,6 +496,8 @@ storageStateCleanup(void)
     VIR_FREE(driverState->configDir);
     VIR_FREE(driverState->autostartDir);
     storageDriverUnlock(driverState);
+    virCondDestroy(&driverState->buildCond);
+    virMutexDestroy(&driverState->buildLock);
     virMutexDestroy(&driverState->lock);
     VIR_FREE(driverState);
 
@@ -607,6 +845,7 @@ storagePoolCreateXML(virConnectPtr conn,
     virStoragePoolObjPtr pool = NULL;
     virStoragePoolPtr ret = NULL;
     virStorageBackendPtr backend;
+    int rc;
 
     virCheckFlags(0, NULL);
 
@@ -630,22 +869,28 @@ storagePoolCreateXML(virConnectPtr conn,
         goto cleanup;
     def = NULL;
 
-    if (backend->startPool &&
-        backend->startPool(conn, pool) < 0) {
+    if (storagePoolObjBeginJob(pool, VIR_STORAGE_POOL_JOB_START) < 0) {
         virStoragePoolObjRemove(&driver->pools, pool);
         pool = NULL;
         goto cleanup;
     }
 
-    if (backend->refreshPool(conn, pool) < 0) {
-        if (backend->stopPool)
-            backend->stopPool(conn, pool);
+    /* Don't block other pools while this one starts */
+    storageDriverUnlock(driver);
+    rc = storagePoolObjStart(conn, driver, backend, pool);
+
+    /* Removing the pool needs the driver lock, which comes first */
+    virStoragePoolObjUnlock(pool);
+    storageDriverLock(driver);
+    virStoragePoolObjLock(pool);
+    storagePoolObjEndJob(pool);
+
+    if (rc < 0) {
         virStoragePoolObjRemove(&driver->pools, pool);
         pool = NULL;
         goto cleanup;
     }
     VIR_INFO("Creating storage pool '%s'", pool->def->name);
-    pool->active = 1;
 
     ret = virGetStoragePool(conn, pool->def->name, pool->def->uuid,
                             NULL, NULL);
@@ -742,6 +987,9 @@ storagePoolUndefine(virStoragePoolPtr obj)
         goto cleanup;
     }
 
+    if (storagePoolObjCheckNoJob(pool) < 0)
+        goto cleanup;
+
     if (virStoragePoolObjDeleteDef(pool) < 0)
         goto cleanup;
 
@@ -770,6 +1018,7 @@ static int
 storagePoolCreate(virStoragePoolPtr obj,
                   unsigned int flags)
 {
+    virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
     virStoragePoolObjPtr pool;
     virStorageBackendPtr backend;
     int ret = -1;
@@ -791,19 +1040,16 @@ storagePoolCreate(virStoragePoolPtr obj,
                        pool->def->name);
         goto cleanup;
     }
-    if (backend->startPool &&
-        backend->startPool(obj->conn, pool) < 0)
-        goto cleanup;
 
-    if (backend->refreshPool(obj->conn, pool) < 0) {
-        if (backend->stopPool)
-            backend->stopPool(obj->conn, pool);
+    if (storagePoolObjBeginJob(pool, VIR_STORAGE_POOL_JOB_START) < 0)
         goto cleanup;
+
+    if (storagePoolObjStart(obj->conn, driver, backend, pool) == 0) {
+        VIR_INFO("Starting up storage pool '%s'", pool->def->name);
+        ret = 0;
     }
 
-    VIR_INFO("Starting up storage pool '%s'", pool->def->name);
-    pool->active = 1;
-    ret = 0;
+    storagePoolObjEndJob(pool);
 
  cleanup:
     virStoragePoolObjUnlock(pool);
@@ -814,6 +1060,7 @@ static int
 storagePoolBuild(virStoragePoolPtr obj,
                  unsigned int flags)
 {
+    virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
     virStoragePoolObjPtr pool;
     virStorageBackendPtr backend;
     int ret = -1;
@@ -834,9 +1081,20 @@ storagePoolBuild(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (backend->buildPool &&
-        backend->buildPool(obj->conn, pool, flags) < 0)
-        goto cleanup;
+    if (backend->buildPool) {
+        int rc;
+
+        if (storagePoolObjBeginJob(pool, VIR_STORAGE_POOL_JOB_BUILD) < 0)
+            goto cleanup;
+
+        virStoragePoolObjUnlock(pool);
+        rc = backend->buildPool(obj->conn, pool, flags);
+        storagePoolObjRelock(driver, pool);
+        storagePoolObjEndJob(pool);
+
+        if (rc < 0)
+            goto cleanup;
+    }
     ret = 0;
 
  cleanup:
@@ -852,16 +1110,10 @@ storagePoolDestroy(virStoragePoolPtr obj)
     virStoragePoolObjPtr pool;
     virStorageBackendPtr backend;
     int ret = -1;
+    int rc = 0;
 
-    storageDriverLock(driver);
-    if (!(pool = virStoragePoolObjFindByUUID(&driver->pools, obj->uuid))) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(obj->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_STORAGE_POOL,
-                       _("no storage pool with matching uuid '%s' (%s)"),
-                       uuidstr, obj->name);
-        goto cleanup;
-    }
+    if (!(pool = virStoragePoolObjFromStoragePool(obj)))
+        return -1;
 
     if (virStoragePoolDestroyEnsureACL(obj->conn, pool->def) < 0)
         goto cleanup;
@@ -882,29 +1134,40 @@ storagePoolDestroy(virStoragePoolPtr obj)
         goto cleanup;
     }
 
-    if (backend->stopPool &&
-        backend->stopPool(obj->conn, pool) < 0)
+    if (storagePoolObjBeginJob(pool, VIR_STORAGE_POOL_JOB_DESTROY) < 0)
         goto cleanup;
 
-    virStoragePoolObjClearVols(pool);
+    virStoragePoolObjUnlock(pool);
 
-    pool->active = 0;
-    VIR_INFO("Shutting down storage pool '%s'", pool->def->name);
+    if (backend->stopPool)
+        rc = backend->stopPool(obj->conn, pool);
 
-    if (pool->configFile == NULL) {
-        virStoragePoolObjRemove(&driver->pools, pool);
-        pool = NULL;
-    } else if (pool->newDef) {
-        virStoragePoolDefFree(pool->def);
-        pool->def = pool->newDef;
-        pool->newDef = NULL;
+    /* Removing a transient pool needs the driver lock, which comes first */
+    storageDriverLock(driver);
+    virStoragePoolObjLock(pool);
+    storagePoolObjEndJob(pool);
+
+    if (rc == 0) {
+        virStoragePoolObjClearVols(pool);
+
+        pool->active = 0;
+        VIR_INFO("Shutting down storage pool '%s'", pool->def->name);
+
+        if (pool->configFile == NULL) {
+            virStoragePoolObjRemove(&driver->pools, pool);
+            pool = NULL;
+        } else if (pool->newDef) {
+            virStoragePoolDefFree(pool->def);
+            pool->def = pool->newDef;
+            pool->newDef = NULL;
+        }
+        ret = 0;
     }
-    ret = 0;
+    storageDriverUnlock(driver);
 
  cleanup:
     if (pool)
         virStoragePoolObjUnlock(pool);
-    storageDriverUnlock(driver);
     return ret;
 }
 
@@ -912,9 +1175,11 @@ static int
 storagePoolDelete(virStoragePoolPtr obj,
                   unsigned int flags)
 {
+    virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
     virStoragePoolObjPtr pool;
     virStorageBackendPtr backend;
     int ret = -1;
+    int rc;
 
     if (!(pool = virStoragePoolObjFromStoragePool(obj)))
         return -1;
@@ -944,7 +1209,16 @@ storagePoolDelete(virStoragePoolPtr obj,
                        "%s", _("pool does not support pool deletion"));
         goto cleanup;
     }
-    if (backend->deletePool(obj->conn, pool, flags) < 0)
+
+    if (storagePoolObjBeginJob(pool, VIR_STORAGE_POOL_JOB_DELETE) < 0)
+        goto cleanup;
+
+    virStoragePoolObjUnlock(pool);
+    rc = backend->deletePool(obj->conn, pool, flags);
+    storagePoolObjRelock(driver, pool);
+    storagePoolObjEndJob(pool);
+
+    if (rc < 0)
         goto cleanup;
     VIR_INFO("Deleting storage pool '%s'", pool->def->name);
     ret = 0;
@@ -964,17 +1238,10 @@ storagePoolRefresh(virStoragePoolPtr obj,
     virStorageBackendPtr backend;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_POOL_REFRESH_LIST_ONLY, -1);
 
-    storageDriverLock(driver);
-    if (!(pool = virStoragePoolObjFindByUUID(&driver->pools, obj->uuid))) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(obj->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_STORAGE_POOL,
-                       _("no storage pool with matching uuid '%s' (%s)"),
-                       uuidstr, obj->name);
-        goto cleanup;
-    }
+    if (!(pool = virStoragePoolObjFromStoragePool(obj)))
+        return -1;
 
     if (virStoragePoolRefreshEnsureACL(obj->conn, pool->def) < 0)
         goto cleanup;
@@ -995,25 +1262,71 @@ storagePoolRefresh(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    virStoragePoolObjClearVols(pool);
-    if (backend->refreshPool(obj->conn, pool) < 0) {
+    if (storagePoolObjBeginJob(pool, VIR_STORAGE_POOL_JOB_REFRESH) < 0)
+        goto cleanup;
+
+    if (storagePoolObjRefreshUnlocked(obj->conn, driver, backend, pool,
+                                      !!(flags & VIR_STORAGE_POOL_REFRESH_LIST_ONLY)) < 0) {
+        virStoragePoolObjUnlock(pool);
+
         if (backend->stopPool)
             backend->stopPool(obj->conn, pool);
 
+        /* Removing a transient pool needs the driver lock, which comes first */
+        storageDriverLock(driver);
+        virStoragePoolObjLock(pool);
         pool->active = 0;
+        storagePoolObjEndJob(pool);
 
         if (pool->configFile == NULL) {
             virStoragePoolObjRemove(&driver->pools, pool);
             pool = NULL;
         }
+        storageDriverUnlock(driver);
         goto cleanup;
     }
+
+    storagePoolObjEndJob(pool);
     ret = 0;
 
  cleanup:
     if (pool)
         virStoragePoolObjUnlock(pool);
-    storageDriverUnlock(driver);
+    return ret;
+}
+
+
+static int
+storagePoolGetJobInfo(virStoragePoolPtr obj,
+                      virStoragePoolJobInfoPtr info,
+                      unsigned int flags)
+{
+    virStoragePoolObjPtr pool;
+    unsigned long long now;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(pool = virStoragePoolObjFromStoragePool(obj)))
+        return -1;
+
+    if (virStoragePoolGetJobInfoEnsureACL(obj->conn, pool->def) < 0)
+        goto cleanup;
+
+    memset(info, 0, sizeof(*info));
+    info->type = pool->job;
+    info->volJobs = pool->asyncjobs;
+
+    if (pool->job != VIR_STORAGE_POOL_JOB_NONE) {
+        if (virTimeMillisNow(&now) < 0)
+            goto cleanup;
+        info->timeElapsed = now - pool->jobStarted;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjUnlock(pool);
     return ret;
 }
 
@@ -1592,6 +1905,9 @@ storageVolDelete(virStorageVolPtr obj,
     if (virStorageVolDeleteEnsureACL(obj->conn, pool->def, vol) < 0)
         goto cleanup;
 
+    if (storagePoolObjCheckNoJob(pool) < 0)
+        goto cleanup;
+
     if (vol->in_use) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        _("volume '%s' is still in use."),
@@ -1606,6 +1922,13 @@ storageVolDelete(virStorageVolPtr obj,
         goto cleanup;
     }
 
+    if (vol->job) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' has an active job."),
+                       vol->name);
+        goto cleanup;
+    }
+
     if (storageVolDeleteInternal(obj, backend, pool, vol, flags, true) < 0)
         goto cleanup;
 
@@ -1617,6 +1940,84 @@ storageVolDelete(virStorageVolPtr obj,
 }
 
 
+static void
+storageVolBuildDataFree(virStorageVolBuildDataPtr data)
+{
+    if (!data)
+        return;
+
+    virObjectUnref(data->volobj);
+    virStorageBackendJobFree(data->job);
+    VIR_FREE(data->buildvoldef);
+    VIR_FREE(data);
+}
+
+
+/*
+ * Allocate the volume described by @data. Must be called without the
+ * pool lock and with the volume marked as building. Returns with the
+ * pool locked again; on failure the volume has been removed.
+ */
+static int
+storageVolCreateBuild(virStorageVolBuildDataPtr data)
+{
+    virStoragePoolObjPtr pool = data->pool;
+    virStorageVolDefPtr voldef = data->voldef;
+    int buildret;
+
+    buildret = data->backend->buildVol(data->volobj->conn, pool,
+                                       data->buildvoldef, data->flags);
+
+    storageDriverLock(data->driver);
+    virStoragePoolObjLock(pool);
+    storageDriverUnlock(data->driver);
+
+    voldef->building = false;
+    voldef->job = NULL;
+    pool->asyncjobs--;
+
+    if (buildret < 0) {
+        storageVolDeleteInternal(data->volobj, data->backend, pool, voldef,
+                                 0, false);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+storageVolBuildThread(void *opaque)
+{
+    virStorageVolBuildDataPtr data = opaque;
+    virStorageDriverStatePtr driver = data->driver;
+    virStoragePoolObjPtr pool = data->pool;
+
+    if (storageVolCreateBuild(data) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_WARN("Failed to allocate volume '%s' in storage pool '%s': %s",
+                 data->volobj->name, pool->def->name,
+                 err ? err->message : _("unknown error"));
+    } else {
+        /* Update pool metadata */
+        pool->def->allocation += data->buildvoldef->target.allocation;
+        pool->def->available -= data->buildvoldef->target.allocation;
+
+        VIR_INFO("Allocated volume '%s' in storage pool '%s'",
+                 data->volobj->name, pool->def->name);
+    }
+
+    virStoragePoolObjUnlock(pool);
+    storageVolBuildDataFree(data);
+
+    /* Last, as storageStateCleanup frees @driver once we're done */
+    virMutexLock(&driver->buildLock);
+    if (--driver->buildThreads == 0)
+        virCondBroadcast(&driver->buildCond);
+    virMutexUnlock(&driver->buildLock);
+}
+
+
 static virStorageVolPtr
 storageVolCreateXML(virStoragePoolPtr obj,
                     const char *xmldesc,
@@ -1627,9 +2028,11 @@ storageVolCreateXML(virStoragePoolPtr obj,
     virStorageBackendPtr backend;
     virStorageVolDefPtr voldef = NULL;
     virStorageVolPtr ret = NULL, volobj = NULL;
-    virStorageVolDefPtr buildvoldef = NULL;
+    virStorageVolBuildDataPtr data = NULL;
+    virThread thread;
 
-    virCheckFlags(VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA, NULL);
+    virCheckFlags(VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA |
+                  VIR_STORAGE_VOL_CREATE_BACKGROUND, NULL);
 
     if (!(pool = virStoragePoolObjFromStoragePool(obj)))
         return NULL;
@@ -1650,6 +2053,9 @@ storageVolCreateXML(virStoragePoolPtr obj,
     if (virStorageVolCreateXMLEnsureACL(obj->conn, pool->def, voldef) < 0)
         goto cleanup;
 
+    if (storagePoolObjCheckNoJob(pool) < 0)
+        goto cleanup;
+
     if (virStorageVolDefFindByName(pool, voldef->name)) {
         virReportError(VIR_ERR_STORAGE_VOL_EXIST,
                        _("'%s'"), voldef->name);
@@ -1667,6 +2073,16 @@ storageVolCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
+    if (VIR_ALLOC(data) < 0 ||
+        VIR_ALLOC(data->buildvoldef) < 0)
+        goto cleanup;
+
+    if (backend->buildVol &&
+        !(data->job = virStorageBackendJobNew(VIR_STORAGE_VOL_JOB_TYPE_BUILD,
+                                              voldef->target.allocation,
+                                              0)))
+        goto cleanup;
+
     /* Wipe any key the user may have suggested, as volume creation
      * will generate the canonical key.  */
     VIR_FREE(voldef->key);
@@ -1682,47 +2098,68 @@ storageVolCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (VIR_ALLOC(buildvoldef) < 0) {
-        voldef = NULL;
-        goto cleanup;
-    }
-
     /* Make a shallow copy of the 'defined' volume definition, since the
      * original allocation value will change as the user polls 'info',
      * but we only need the initial requested values
      */
-    memcpy(buildvoldef, voldef, sizeof(*voldef));
+    memcpy(data->buildvoldef, voldef, sizeof(*voldef));
 
     if (backend->buildVol) {
-        int buildret;
+        data->driver = driver;
+        data->backend = backend;
+        data->pool = pool;
+        data->voldef = voldef;
+        data->volobj = virObjectRef(volobj);
+        data->flags = flags & ~VIR_STORAGE_VOL_CREATE_BACKGROUND;
 
         /* Drop the pool lock during volume allocation */
         pool->asyncjobs++;
         voldef->building = true;
-        virStoragePoolObjUnlock(pool);
-
-        buildret = backend->buildVol(obj->conn, pool, buildvoldef, flags);
+        voldef->job = data->buildvoldef->job = data->job;
+
+        if (flags & VIR_STORAGE_VOL_CREATE_BACKGROUND) {
+            /* The thread waits for the pool lock before finishing, so
+             * it can't complete before we return */
+            virMutexLock(&driver->buildLock);
+            driver->buildThreads++;
+            virMutexUnlock(&driver->buildLock);
+
+            if (virThreadCreate(&thread, false,
+                                storageVolBuildThread, data) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to create volume build thread"));
+                virMutexLock(&driver->buildLock);
+                driver->buildThreads--;
+                virMutexUnlock(&driver->buildLock);
+                voldef->building = false;
+                voldef->job = NULL;
+                pool->asyncjobs--;
+                storageVolDeleteInternal(volobj, backend, pool, voldef,
+                                         0, false);
+                voldef = NULL;
+                goto cleanup;
+            }
+            data = NULL;
 
-        storageDriverLock(driver);
-        virStoragePoolObjLock(pool);
-        storageDriverUnlock(driver);
+            VIR_INFO("Allocating volume '%s' in storage pool '%s' "
+                     "in the background", volobj->name, pool->def->name);
+            ret = volobj;
+            volobj = NULL;
+            voldef = NULL;
+            goto cleanup;
+        }
 
-        voldef->building = false;
-        pool->asyncjobs--;
+        virStoragePoolObjUnlock(pool);
 
-        if (buildret < 0) {
-            VIR_FREE(buildvoldef);
-            storageVolDeleteInternal(volobj, backend, pool, voldef,
-                                     0, false);
+        if (storageVolCreateBuild(data) < 0) {
             voldef = NULL;
             goto cleanup;
         }
-
     }
 
     /* Update pool metadata */
-    pool->def->allocation += buildvoldef->target.allocation;
-    pool->def->available -= buildvoldef->target.allocation;
+    pool->def->allocation += data->buildvoldef->target.allocation;
+    pool->def->available -= data->buildvoldef->target.allocation;
 
     VIR_INFO("Creating volume '%s' in storage pool '%s'",
              volobj->name, pool->def->name);
@@ -1733,7 +2170,7 @@ storageVolCreateXML(virStoragePoolPtr obj,
  cleanup:
     virObjectUnref(volobj);
     virStorageVolDefFree(voldef);
-    VIR_FREE(buildvoldef);
+    storageVolBuildDataFree(data);
     if (pool)
         virStoragePoolObjUnlock(pool);
     return ret;
@@ -1810,6 +2247,10 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
     if (virStorageVolCreateXMLFromEnsureACL(obj->conn, pool->def, newvol) < 0)
         goto cleanup;
 
+    if (storagePoolObjCheckNoJob(pool) < 0 ||
+        (origpool && storagePoolObjCheckNoJob(origpool) < 0))
+        goto cleanup;
+
     if (virStorageVolDefFindByName(pool, newvol->name)) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("storage volume name '%s' already in use."),
@@ -1839,6 +2280,13 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
         goto cleanup;
     }
 
+    if (origvol->job) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' has an active job."),
+                       origvol->name);
+        goto cleanup;
+    }
+
     if (backend->refreshVol &&
         backend->refreshVol(obj->conn, pool, origvol) < 0)
         goto cleanup;
@@ -2070,6 +2518,13 @@ storageVolUpload(virStorageVolPtr obj,
         goto cleanup;
     }
 
+    if (vol->job) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' has an active job."),
+                       vol->name);
+        goto cleanup;
+    }
+
     if (!backend->uploadVol) {
         virReportError(VIR_ERR_NO_SUPPORT, "%s",
                        _("storage pool doesn't support volume upload"));
@@ -2144,6 +2599,13 @@ storageVolResize(virStorageVolPtr obj,
         goto cleanup;
     }
 
+    if (vol->job) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' has an active job."),
+                       vol->name);
+        goto cleanup;
+    }
+
     if (flags & VIR_STORAGE_VOL_RESIZE_DELTA) {
         abs_capacity = vol->target.capacity + capacity;
         flags &= ~VIR_STORAGE_VOL_RESIZE_DELTA;
@@ -2204,9 +2666,11 @@ storageVolWipePattern(virStorageVolPtr obj,
                       unsigned int algorithm,
                       unsigned int flags)
 {
+    virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
     virStorageBackendPtr backend;
     virStoragePoolObjPtr pool = NULL;
     virStorageVolDefPtr vol = NULL;
+    virStorageVolJobPtr job = NULL;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -2225,6 +2689,9 @@ storageVolWipePattern(virStorageVolPtr obj,
     if (virStorageVolWipePatternEnsureACL(obj->conn, pool->def, vol) < 0)
         goto cleanup;
 
+    if (storagePoolObjCheckNoJob(pool) < 0)
+        goto cleanup;
+
     if (vol->in_use) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        _("volume '%s' is still in use."),
@@ -2239,14 +2706,40 @@ storageVolWipePattern(virStorageVolPtr obj,
         goto cleanup;
     }
 
+    if (vol->job) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' has an active job."),
+                       vol->name);
+        goto cleanup;
+    }
+
     if (!backend->wipeVol) {
         virReportError(VIR_ERR_NO_SUPPORT, "%s",
                        _("storage pool doesn't support volume wiping"));
         goto cleanup;
     }
 
+    if (!(job = virStorageBackendJobNew(VIR_STORAGE_VOL_JOB_TYPE_WIPE,
+                                        vol->target.allocation,
+                                        vol->jobBandwidth)))
+        goto cleanup;
+
+    /* Drop the pool lock while wiping, so the job can be monitored
+     * and aborted */
+    pool->asyncjobs++;
+    vol->job = job;
+    virStoragePoolObjUnlock(pool);
+
     ret = backend->wipeVol(obj->conn, pool, vol, algorithm, flags);
 
+    storageDriverLock(driver);
+    virStoragePoolObjLock(pool);
+    storageDriverUnlock(driver);
+
+    vol->job = NULL;
+    pool->asyncjobs--;
+    virStorageBackendJobFree(job);
+
  cleanup:
     virStoragePoolObjUnlock(pool);
 
@@ -2261,6 +2754,98 @@ storageVolWipe(virStorageVolPtr obj,
 }
 
 
+static int
+storageVolGetJobInfo(virStorageVolPtr obj,
+                     virStorageVolJobInfoPtr info,
+                     unsigned int flags)
+{
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(vol = virStorageVolDefFromVol(obj, &pool, NULL)))
+        return -1;
+
+    if (virStorageVolGetJobInfoEnsureACL(obj->conn, pool->def, vol) < 0)
+        goto cleanup;
+
+    if (!vol->job) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    virStorageBackendJobGetInfo(vol->job, info);
+    ret = 1;
+
+ cleanup:
+    virStoragePoolObjUnlock(pool);
+    return ret;
+}
+
+
+static int
+storageVolJobSetSpeed(virStorageVolPtr obj,
+                      unsigned long long bandwidth,
+                      unsigned int flags)
+{
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(vol = virStorageVolDefFromVol(obj, &pool, NULL)))
+        return -1;
+
+    if (virStorageVolJobSetSpeedEnsureACL(obj->conn, pool->def, vol) < 0)
+        goto cleanup;
+
+    vol->jobBandwidth = bandwidth;
+    if (vol->job)
+        virStorageBackendJobSetSpeed(vol->job, bandwidth);
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjUnlock(pool);
+    return ret;
+}
+
+
+static int
+storageVolJobAbort(virStorageVolPtr obj,
+                   unsigned int flags)
+{
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(vol = virStorageVolDefFromVol(obj, &pool, NULL)))
+        return -1;
+
+    if (virStorageVolJobAbortEnsureACL(obj->conn, pool->def, vol) < 0)
+        goto cleanup;
+
+    if (!vol->job) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("no job is active on volume '%s'"),
+                       vol->name);
+        goto cleanup;
+    }
+
+    virStorageBackendJobAbort(vol->job);
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjUnlock(pool);
+    return ret;
+}
+
+
 static int
 storageVolGetInfo(virStorageVolPtr obj,
                   virStorageVolInfoPtr info)
@@ -2409,6 +2994,10 @@ static virStorageDriver storageDriver = {
 
     .storagePoolIsActive = storagePoolIsActive, /* 0.7.3 */
     .storagePoolIsPersistent = storagePoolIsPersistent, /* 0.7.3 */
+    .storageVolGetJobInfo = storageVolGetJobInfo, /* 1.2.10 */
+    .storageVolJobSetSpeed = storageVolJobSetSpeed, /* 1.2.10 */
+    .storageVolJobAbort = storageVolJobAbort, /* 1.2.10 */
+    .storagePoolGetJobInfo = storagePoolGetJobInfo, /* 1.2.10 */
 };
 
 
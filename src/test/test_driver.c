@@ -5098,6 +5098,34 @@ testStoragePoolGetInfo(virStoragePoolPtr pool,
     return ret;
 }
 
+static int
+testStoragePoolGetJobInfo(virStoragePoolPtr pool,
+                          virStoragePoolJobInfoPtr info,
+                          unsigned int flags)
+{
+    testConnPtr privconn = pool->conn->privateData;
+    virStoragePoolObjPtr privpool;
+
+    virCheckFlags(0, -1);
+
+    testDriverLock(privconn);
+    privpool = virStoragePoolObjFindByName(&privconn->pools,
+                                           pool->name);
+    testDriverUnlock(privconn);
+
+    if (privpool == NULL) {
+        virReportError(VIR_ERR_INVALID_ARG, __FUNCTION__);
+        return -1;
+    }
+
+    /* Pool operations of the test driver complete at once */
+    memset(info, 0, sizeof(*info));
+    info->type = VIR_STORAGE_POOL_JOB_NONE;
+
+    virStoragePoolObjUnlock(privpool);
+    return 0;
+}
+
 static char *
 testStoragePoolGetXMLDesc(virStoragePoolPtr pool,
                           unsigned int flags)
@@ -5816,6 +5844,98 @@ testStorageVolGetPath(virStorageVolPtr vol)
     return ret;
 }
 
+/* Look up the definition of @vol, leaving its pool locked in *@pool */
+static virStorageVolDefPtr
+testStorageVolDefFromVol(virStorageVolPtr vol,
+                         virStoragePoolObjPtr *pool)
+{
+    testConnPtr privconn = vol->conn->privateData;
+    virStorageVolDefPtr privvol;
+
+    testDriverLock(privconn);
+    *pool = virStoragePoolObjFindByName(&privconn->pools, vol->pool);
+    testDriverUnlock(privconn);
+
+    if (*pool == NULL) {
+        virReportError(VIR_ERR_INVALID_ARG, __FUNCTION__);
+        return NULL;
+    }
+
+    if (!(privvol = virStorageVolDefFindByName(*pool, vol->name))) {
+        virReportError(VIR_ERR_NO_STORAGE_VOL,
+                       _("no storage vol with matching name '%s'"),
+                       vol->name);
+        goto error;
+    }
+
+    if (!virStoragePoolObjIsActive(*pool)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("storage pool '%s' is not active"), vol->pool);
+        goto error;
+    }
+
+    return privvol;
+
+ error:
+    virStoragePoolObjUnlock(*pool);
+    *pool = NULL;
+    return NULL;
+}
+
+/* Volume operations of the test driver complete at once, so there is
+ * never a job to report on or to abort */
+static int
+testStorageVolGetJobInfo(virStorageVolPtr vol,
+                         virStorageVolJobInfoPtr info,
+                         unsigned int flags)
+{
+    virStoragePoolObjPtr privpool;
+
+    virCheckFlags(0, -1);
+
+    if (!testStorageVolDefFromVol(vol, &privpool))
+        return -1;
+
+    memset(info, 0, sizeof(*info));
+    virStoragePoolObjUnlock(privpool);
+    return 0;
+}
+
+static int
+testStorageVolJobSetSpeed(virStorageVolPtr vol,
+                          unsigned long long bandwidth,
+                          unsigned int flags)
+{
+    virStoragePoolObjPtr privpool;
+    virStorageVolDefPtr privvol;
+
+    virCheckFlags(0, -1);
+
+    if (!(privvol = testStorageVolDefFromVol(vol, &privpool)))
+        return -1;
+
+    privvol->jobBandwidth = bandwidth;
+    virStoragePoolObjUnlock(privpool);
+    return 0;
+}
+
+static int
+testStorageVolJobAbort(virStorageVolPtr vol,
+                       unsigned int flags)
+{
+    virStoragePoolObjPtr privpool;
+
+    virCheckFlags(0, -1);
+
+    if (!testStorageVolDefFromVol(vol, &privpool))
+        return -1;
+
+    virReportError(VIR_ERR_OPERATION_INVALID,
+                   _("no job is active on volume '%s'"), vol->name);
+    virStoragePoolObjUnlock(privpool);
+    return -1;
+}
+
 
 /* Node device implementations */
 static virDrvOpenStatus testNodeDeviceOpen(virConnectPtr conn,
@@ -7544,6 +7664,10 @@ static virStorageDriver testStorageDriver = {
     .storageVolGetPath = testStorageVolGetPath, /* 0.5.0 */
     .storagePoolIsActive = testStoragePoolIsActive, /* 0.7.3 */
     .storagePoolIsPersistent = testStoragePoolIsPersistent, /* 0.7.3 */
+    .storageVolGetJobInfo = testStorageVolGetJobInfo, /* 1.2.10 */
+    .storageVolJobSetSpeed = testStorageVolJobSetSpeed, /* 1.2.10 */
+    .storageVolJobAbort = testStorageVolJobAbort, /* 1.2.10 */
+    .storagePoolGetJobInfo = testStoragePoolGetJobInfo, /* 1.2.10 */
 };
 
 static virNodeDeviceDriver testNodeDeviceDriver = {
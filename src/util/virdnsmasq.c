@@ -34,6 +34,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <dirent.h>
 
 #ifdef HAVE_PATHS_H
 # include <paths.h>
@@ -42,7 +43,9 @@
 #include "internal.h"
 #include "datatypes.h"
 #include "virbitmap.h"
+#include "vircrypto.h"
 #include "virdnsmasq.h"
+#include "virhash.h"
 #include "virutil.h"
 #include "vircommand.h"
 #include "viralloc.h"
@@ -56,6 +59,7 @@
 VIR_LOG_INIT("util.dnsmasq");
 
 #define DNSMASQ_HOSTSFILE_SUFFIX "hostsfile"
+#define DNSMASQ_HOSTSDIR_SUFFIX "hostsdir"
 #define DNSMASQ_ADDNHOSTSFILE_SUFFIX "addnhosts"
 
 static void
@@ -172,85 +176,75 @@ addnhostsNew(const char *name,
 static int
 addnhostsWrite(const char *path,
                dnsmasqAddnHost *hosts,
-               unsigned int nhosts)
+               unsigned int nhosts,
+               bool *changed)
 {
-    char *tmp;
-    FILE *f;
-    bool istmp = true;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *content = NULL;
+    char *old = NULL;
+    char *tmp = NULL;
     size_t i, j;
     int rc = 0;
 
+    *changed = true;
+
+    for (i = 0; i < nhosts; i++) {
+        virBufferAsprintf(&buf, "%s\t", hosts[i].ip);
+        for (j = 0; j < hosts[i].nhostnames; j++)
+            virBufferAsprintf(&buf, "%s\t", hosts[i].hostnames[j]);
+        virBufferAddChar(&buf, '\n');
+    }
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        return -ENOMEM;
+    }
+
     /* even if there are 0 hosts, create a 0 length file, to allow
      * for runtime addition.
      */
-
-    if (virAsprintf(&tmp, "%s.new", path) < 0)
+    if (!(content = virBufferContentAndReset(&buf)) &&
+        VIR_STRDUP_QUIET(content, "") < 0)
         return -ENOMEM;
 
-    if (!(f = fopen(tmp, "w"))) {
-        istmp = false;
-        if (!(f = fopen(path, "w"))) {
-            rc = -errno;
-            goto cleanup;
-        }
+    /* dnsmasq need not reread an unchanged file */
+    if (virFileReadAllQuiet(path, 1024 * 1024 * 1024, &old) >= 0 &&
+        STREQ(old, content)) {
+        *changed = false;
+        goto cleanup;
     }
 
-    for (i = 0; i < nhosts; i++) {
-        if (fputs(hosts[i].ip, f) == EOF || fputc('\t', f) == EOF) {
-            rc = -errno;
-            VIR_FORCE_FCLOSE(f);
-
-            if (istmp)
-                unlink(tmp);
-
-            goto cleanup;
-        }
-
-        for (j = 0; j < hosts[i].nhostnames; j++) {
-            if (fputs(hosts[i].hostnames[j], f) == EOF || fputc('\t', f) == EOF) {
-                rc = -errno;
-                VIR_FORCE_FCLOSE(f);
-
-                if (istmp)
-                    unlink(tmp);
-
-                goto cleanup;
-            }
-        }
-
-        if (fputc('\n', f) == EOF) {
-            rc = -errno;
-            VIR_FORCE_FCLOSE(f);
-
-            if (istmp)
-                unlink(tmp);
-
-            goto cleanup;
-        }
+    if (virAsprintf(&tmp, "%s.new", path) < 0) {
+        rc = -ENOMEM;
+        goto cleanup;
     }
 
-    if (VIR_FCLOSE(f) == EOF) {
+    if (virFileWriteStr(tmp, content, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) < 0) {
         rc = -errno;
+        unlink(tmp);
         goto cleanup;
     }
 
-    if (istmp && rename(tmp, path) < 0) {
+    if (rename(tmp, path) < 0) {
         rc = -errno;
         unlink(tmp);
         goto cleanup;
     }
 
  cleanup:
+    VIR_FREE(content);
+    VIR_FREE(old);
     VIR_FREE(tmp);
 
     return rc;
 }
 
 static int
-addnhostsSave(dnsmasqAddnHostsfile *addnhostsfile)
+addnhostsSave(dnsmasqAddnHostsfile *addnhostsfile,
+              bool *changed)
 {
     int err = addnhostsWrite(addnhostsfile->path, addnhostsfile->hosts,
-                             addnhostsfile->nhosts);
+                             addnhostsfile->nhosts, changed);
 
     if (err < 0) {
         virReportSystemError(-err, _("cannot write config file '%s'"),
@@ -291,6 +285,7 @@ hostsfileFree(dnsmasqHostsfile *hostsfile)
     }
 
     VIR_FREE(hostsfile->path);
+    VIR_FREE(hostsfile->dirpath);
 
     VIR_FREE(hostsfile);
 }
@@ -365,7 +360,9 @@ hostsfileNew(const char *name,
     hostsfile->nhosts = 0;
 
     if (virAsprintf(&hostsfile->path, "%s/%s.%s", config_dir, name,
-                    DNSMASQ_HOSTSFILE_SUFFIX) < 0)
+                    DNSMASQ_HOSTSFILE_SUFFIX) < 0 ||
+        virAsprintf(&hostsfile->dirpath, "%s/%s.%s", config_dir, name,
+                    DNSMASQ_HOSTSDIR_SUFFIX) < 0)
         goto error;
 
     return hostsfile;
@@ -445,6 +442,217 @@ hostsfileSave(dnsmasqHostsfile *hostsfile)
     return 0;
 }
 
+/*
+ * Keep one file per dhcp-host in dnsmasq's hostsdir. A file is named
+ * after the hash of the entry it holds, so the file of a host can be
+ * written or removed without looking at any other host. dnsmasq picks
+ * up new files by itself, but forgets about removed ones only when it
+ * rereads its configuration.
+ */
+static char *
+hostsdirHostPath(dnsmasqHostsfile *hostsfile,
+                 const char *host,
+                 bool hidden)
+{
+    char *hash = NULL;
+    char *path = NULL;
+
+    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256, host, &hash) < 0)
+        return NULL;
+
+    ignore_value(virAsprintf(&path, "%s/%s%s%s", hostsfile->dirpath,
+                             hidden ? "." : "", hash, hidden ? ".new" : ""));
+    VIR_FREE(hash);
+    return path;
+}
+
+static int
+hostsdirAddHost(dnsmasqHostsfile *hostsfile,
+                const char *host)
+{
+    char *path = NULL;
+    char *tmp = NULL;
+    char *entry = NULL;
+    int ret = -1;
+
+    /* dnsmasq must not see half written files */
+    if (!(path = hostsdirHostPath(hostsfile, host, false)) ||
+        !(tmp = hostsdirHostPath(hostsfile, host, true)) ||
+        virAsprintf(&entry, "%s\n", host) < 0)
+        goto cleanup;
+
+    if (virFileWriteStr(tmp, entry, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) < 0 ||
+        rename(tmp, path) < 0) {
+        virReportSystemError(errno, _("cannot write config file '%s'"),
+                             path);
+        unlink(tmp);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(path);
+    VIR_FREE(tmp);
+    VIR_FREE(entry);
+    return ret;
+}
+
+static int
+hostsdirRemoveHost(dnsmasqHostsfile *hostsfile,
+                   const char *host)
+{
+    char *path;
+    int ret = -1;
+
+    if (!(path = hostsdirHostPath(hostsfile, host, false)))
+        return -1;
+
+    if (unlink(path) < 0 && errno != ENOENT) {
+        virReportSystemError(errno, _("cannot remove config file '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(path);
+    return ret;
+}
+
+/*
+ * Brings the whole hostsdir in line with @hostsfile, for when it is not
+ * known what the directory holds. Sets @removed if a file was removed.
+ */
+static int
+hostsdirSave(dnsmasqHostsfile *hostsfile,
+             bool *removed)
+{
+    virHashTablePtr wanted = NULL;
+    char **names = NULL;
+    char *path = NULL;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    size_t i;
+    int direrr;
+    int ret = -1;
+
+    *removed = false;
+
+    if (virFileMakePath(hostsfile->dirpath) < 0) {
+        virReportSystemError(errno, _("cannot create directory '%s'"),
+                             hostsfile->dirpath);
+        return -1;
+    }
+
+    if (!(wanted = virHashCreate(hostsfile->nhosts + 1, NULL)) ||
+        VIR_ALLOC_N(names, hostsfile->nhosts) < 0)
+        goto cleanup;
+
+    for (i = 0; i < hostsfile->nhosts; i++) {
+        if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256,
+                                hostsfile->hosts[i].host, &names[i]) < 0 ||
+            virHashUpdateEntry(wanted, names[i],
+                               hostsfile->hosts[i].host) < 0)
+            goto cleanup;
+    }
+
+    if (!(dir = opendir(hostsfile->dirpath))) {
+        virReportSystemError(errno, _("cannot open directory '%s'"),
+                             hostsfile->dirpath);
+        goto cleanup;
+    }
+
+    while ((direrr = virDirRead(dir, &ent, hostsfile->dirpath)) > 0) {
+        /* dnsmasq ignores these, and so do we */
+        if (ent->d_name[0] == '.')
+            continue;
+
+        /* the host is there already */
+        if (virHashRemoveEntry(wanted, ent->d_name) == 0)
+            continue;
+
+        if (virAsprintf(&path, "%s/%s", hostsfile->dirpath, ent->d_name) < 0)
+            goto cleanup;
+
+        if (unlink(path) < 0 && errno != ENOENT) {
+            virReportSystemError(errno, _("cannot remove config file '%s'"),
+                                 path);
+            goto cleanup;
+        }
+        VIR_FREE(path);
+
+        *removed = true;
+    }
+    if (direrr < 0)
+        goto cleanup;
+
+    for (i = 0; i < hostsfile->nhosts; i++) {
+        if (!virHashLookup(wanted, names[i]))
+            continue;
+
+        if (hostsdirAddHost(hostsfile, hostsfile->hosts[i].host) < 0)
+            goto cleanup;
+
+        ignore_value(virHashRemoveEntry(wanted, names[i]));
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (dir)
+        closedir(dir);
+    virHashFree(wanted);
+    if (names) {
+        for (i = 0; i < hostsfile->nhosts; i++)
+            VIR_FREE(names[i]);
+        VIR_FREE(names);
+    }
+    VIR_FREE(path);
+    return ret;
+}
+
+/*
+ * Writes and removes only the files of the hosts which differ between
+ * @old, which the hostsdir is known to hold, and @hostsfile. A network
+ * update changes a single host, so the entries both lists start and
+ * end with are skipped without any I/O. Sets @removed if a file was
+ * removed.
+ */
+static int
+hostsdirSaveChanges(dnsmasqHostsfile *hostsfile,
+                    dnsmasqHostsfile *old,
+                    bool *removed)
+{
+    size_t prefix = 0;
+    size_t suffix = 0;
+    size_t i;
+
+    *removed = false;
+
+    while (prefix < old->nhosts && prefix < hostsfile->nhosts &&
+           STREQ(old->hosts[prefix].host, hostsfile->hosts[prefix].host))
+        prefix++;
+
+    while (suffix < old->nhosts - prefix &&
+           suffix < hostsfile->nhosts - prefix &&
+           STREQ(old->hosts[old->nhosts - suffix - 1].host,
+                 hostsfile->hosts[hostsfile->nhosts - suffix - 1].host))
+        suffix++;
+
+    for (i = prefix; i < old->nhosts - suffix; i++) {
+        if (hostsdirRemoveHost(hostsfile, old->hosts[i].host) < 0)
+            return -1;
+        *removed = true;
+    }
+
+    for (i = prefix; i < hostsfile->nhosts - suffix; i++) {
+        if (hostsdirAddHost(hostsfile, hostsfile->hosts[i].host) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
 /**
  * dnsmasqContextNew:
  *
@@ -536,32 +744,71 @@ dnsmasqAddHost(dnsmasqContext *ctx,
 }
 
 /**
- * dnsmasqSave:
+ * dnsmasqUpdate:
  * @ctx: pointer to the dnsmasq context for each network
+ * @old: context the files on disk were saved from, or NULL if unknown
+ * @reload: set to true if dnsmasq must reread its configuration
  *
- * Saves all the configurations associated with a context to disk.
+ * Saves all the configurations associated with a context to disk,
+ * leaving alone what did not change. Given @old, only the dhcp-hosts
+ * which differ from it are written or removed in the hostsdir.
  */
 int
-dnsmasqSave(const dnsmasqContext *ctx)
+dnsmasqUpdate(const dnsmasqContext *ctx,
+              const dnsmasqContext *old,
+              bool *reload)
 {
+    bool changed = false;
     int ret = 0;
 
+    *reload = false;
+
     if (virFileMakePath(ctx->config_dir) < 0) {
         virReportSystemError(errno, _("cannot create config directory '%s'"),
                              ctx->config_dir);
         return -1;
     }
 
-    if (ctx->hostsfile)
-        ret = hostsfileSave(ctx->hostsfile);
+    if (ctx->hostsfile) {
+        if (ctx->hostsdir && old && old->hostsfile) {
+            ret = hostsdirSaveChanges(ctx->hostsfile, old->hostsfile,
+                                      &changed);
+        } else if (ctx->hostsdir) {
+            ret = hostsdirSave(ctx->hostsfile, &changed);
+        } else {
+            /* tells which of the two is in use */
+            if (virFileIsDir(ctx->hostsfile->dirpath) &&
+                virFileDeleteTree(ctx->hostsfile->dirpath) < 0)
+                return -1;
+            ret = hostsfileSave(ctx->hostsfile);
+            changed = true;
+        }
+        *reload = changed;
+    }
     if (ret == 0) {
-        if (ctx->addnhostsfile)
-            ret = addnhostsSave(ctx->addnhostsfile);
+        if (ctx->addnhostsfile) {
+            ret = addnhostsSave(ctx->addnhostsfile, &changed);
+            *reload |= changed;
+        }
     }
 
     return ret;
 }
 
+/**
+ * dnsmasqSave:
+ * @ctx: pointer to the dnsmasq context for each network
+ *
+ * Saves all the configurations associated with a context to disk.
+ */
+int
+dnsmasqSave(const dnsmasqContext *ctx)
+{
+    bool reload;
+
+    return dnsmasqUpdate(ctx, NULL, &reload);
+}
+
 
 /**
  * dnsmasqDelete:
@@ -574,8 +821,11 @@ dnsmasqDelete(const dnsmasqContext *ctx)
 {
     int ret = 0;
 
-    if (ctx->hostsfile)
+    if (ctx->hostsfile) {
         ret = genericFileDelete(ctx->hostsfile->path);
+        if (virFileIsDir(ctx->hostsfile->dirpath))
+            ret = virFileDeleteTree(ctx->hostsfile->dirpath);
+    }
     if (ctx->addnhostsfile)
         ret = genericFileDelete(ctx->addnhostsfile->path);
 
@@ -677,6 +927,10 @@ dnsmasqCapsSetFromBuffer(dnsmasqCapsPtr caps, const char *buf)
     if (strstr(buf, "--bind-interfaces with SO_BINDTODEVICE"))
         dnsmasqCapsSet(caps, DNSMASQ_CAPS_BINDTODEVICE);
 
+    if (caps->version >= (DNSMASQ_HOSTSDIR_MAJOR_REQD * 1000000) +
+                         (DNSMASQ_HOSTSDIR_MINOR_REQD * 1000))
+        dnsmasqCapsSet(caps, DNSMASQ_CAPS_DHCP_HOSTSDIR);
+
     VIR_INFO("dnsmasq version is %d.%d, --bind-dynamic is %spresent, "
              "SO_BINDTODEVICE is %sin use",
              (int)caps->version / 1000000,
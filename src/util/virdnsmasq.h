@@ -43,6 +43,7 @@ typedef struct
     dnsmasqDhcpHost *hosts;
 
     char            *path;  /* Absolute path of dnsmasq's hostsfile. */
+    char            *dirpath; /* Absolute path of dnsmasq's hostsdir. */
 } dnsmasqHostsfile;
 
 typedef struct
@@ -66,11 +67,13 @@ typedef struct
     char                 *config_dir;
     dnsmasqHostsfile     *hostsfile;
     dnsmasqAddnHostsfile *addnhostsfile;
+    bool                  hostsdir; /* dhcp-hosts go to hostsfile->dirpath */
 } dnsmasqContext;
 
 typedef enum {
    DNSMASQ_CAPS_BIND_DYNAMIC = 0, /* support for --bind-dynamic */
    DNSMASQ_CAPS_BINDTODEVICE = 1, /* uses SO_BINDTODEVICE for --bind-interfaces */
+   DNSMASQ_CAPS_DHCP_HOSTSDIR = 2, /* support for --dhcp-hostsdir */
 
    DNSMASQ_CAPS_LAST,             /* this must always be the last item */
 } dnsmasqCapsFlags;
@@ -92,6 +95,9 @@ int              dnsmasqAddHost(dnsmasqContext *ctx,
                                 virSocketAddr *ip,
                                 const char *name);
 int              dnsmasqSave(const dnsmasqContext *ctx);
+int              dnsmasqUpdate(const dnsmasqContext *ctx,
+                               const dnsmasqContext *old,
+                               bool *reload);
 int              dnsmasqDelete(const dnsmasqContext *ctx);
 int              dnsmasqReload(pid_t pid);
 
@@ -109,6 +115,8 @@ unsigned long dnsmasqCapsGetVersion(dnsmasqCapsPtr caps);
 # define DNSMASQ_DHCPv6_MINOR_REQD 64
 # define DNSMASQ_RA_MAJOR_REQD 2
 # define DNSMASQ_RA_MINOR_REQD 64
+# define DNSMASQ_HOSTSDIR_MAJOR_REQD 2
+# define DNSMASQ_HOSTSDIR_MINOR_REQD 73
 
 # define DNSMASQ_DHCPv6_SUPPORT(CAPS)        \
     (dnsmasqCapsGetVersion(CAPS) >=          \
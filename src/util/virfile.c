@@ -27,6 +27,7 @@
 
 #include <passfd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pty.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -55,6 +56,10 @@
 # include <sys/ioctl.h>
 #endif
 
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
 #include "configmake.h"
 #include "viralloc.h"
 #include "vircommand.h"
@@ -3077,3 +3082,113 @@ int virFileIsSharedFS(const char *path)
                                  VIR_FILE_SHFS_SMB |
                                  VIR_FILE_SHFS_CIFS);
 }
+
+
+struct _virFileWatch {
+    int fd; /* inotify instance, -1 if unavailable */
+};
+
+/**
+ * virFileWatchNew:
+ * @path: file or directory to watch
+ *
+ * Set up a watch reporting files being created, written to or having
+ * their attributes changed at @path, or within it if it is a
+ * directory. It must be created before checking whatever condition
+ * will be waited on, so that no change goes unnoticed in between.
+ * Where no notification mechanism is available, virFileWatchWait
+ * simply sleeps.
+ *
+ * Returns the new watch, or NULL on allocation failure.
+ */
+virFileWatchPtr
+virFileWatchNew(const char *path)
+{
+    virFileWatchPtr watch;
+#if HAVE_SYS_INOTIFY_H
+    char ebuf[1024];
+#endif
+
+    if (VIR_ALLOC(watch) < 0)
+        return NULL;
+
+    watch->fd = -1;
+
+#if HAVE_SYS_INOTIFY_H
+    if ((watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        VIR_DEBUG("Unable to create inotify instance for %s: %s",
+                  path, virStrerror(errno, ebuf, sizeof(ebuf)));
+        return watch;
+    }
+
+    if (inotify_add_watch(watch->fd, path,
+                          IN_CREATE | IN_MOVED_TO | IN_MODIFY |
+                          IN_ATTRIB | IN_CLOSE_WRITE) < 0) {
+        VIR_DEBUG("Unable to watch %s: %s",
+                  path, virStrerror(errno, ebuf, sizeof(ebuf)));
+        VIR_FORCE_CLOSE(watch->fd);
+    }
+#else
+    VIR_DEBUG("No file notification available for %s", path);
+#endif
+
+    return watch;
+}
+
+
+/**
+ * virFileWatchWait:
+ * @watch: watch created by virFileWatchNew
+ * @timeout: maximum time to wait, in milliseconds
+ *
+ * Wait until something changes at the watched path, or @timeout
+ * expires. Spurious wakeups are possible, so the caller must check
+ * again whatever it is waiting for.
+ *
+ * Returns 1 if a change was seen, 0 on timeout, -1 on error.
+ */
+int
+virFileWatchWait(virFileWatchPtr watch,
+                 int timeout)
+{
+    struct pollfd fds[1];
+    char buf[4096];
+    int rc;
+
+    if (watch->fd < 0) {
+        usleep(timeout * 1000);
+        return 0;
+    }
+
+    fds[0].fd = watch->fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+
+    if ((rc = poll(fds, ARRAY_CARDINALITY(fds), timeout)) < 0) {
+        if (errno == EINTR)
+            return 0;
+        virReportSystemError(errno, "%s",
+                             _("failed to wait for file changes"));
+        return -1;
+    }
+
+    if (rc == 0)
+        return 0;
+
+    /* Only the wakeup matters, drop the events themselves */
+    while (read(watch->fd, buf, sizeof(buf)) > 0)
+        ;
+
+    return 1;
+}
+
+
+void
+virFileWatchFree(virFileWatchPtr watch)
+{
+    if (!watch)
+        return;
+
+    VIR_FORCE_CLOSE(watch->fd);
+    VIR_FREE(watch);
+}
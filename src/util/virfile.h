@@ -291,6 +291,15 @@ struct _virHugeTLBFS {
     bool deflt;                     /* is this the default huge page size */
 };
 
+typedef struct _virFileWatch virFileWatch;
+typedef virFileWatch *virFileWatchPtr;
+
+virFileWatchPtr virFileWatchNew(const char *path)
+    ATTRIBUTE_NONNULL(1);
+int virFileWatchWait(virFileWatchPtr watch, int timeout)
+    ATTRIBUTE_NONNULL(1);
+void virFileWatchFree(virFileWatchPtr watch);
+
 int virFileGetHugepageSize(const char *path,
                            unsigned long long *size);
 int virFileFindHugeTLBFS(virHugeTLBFSPtr *ret_fs,
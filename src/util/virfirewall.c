@@ -90,12 +90,59 @@ struct _virFirewall {
     size_t currentGroup;
 };
 
+static const char *
+virFirewallLayerRestoreCommand(virFirewallLayer layer)
+{
+    switch (layer) {
+    case VIR_FIREWALL_LAYER_IPV4:
+        return IPTABLES_RESTORE_PATH;
+    case VIR_FIREWALL_LAYER_IPV6:
+        return IP6TABLES_RESTORE_PATH;
+    case VIR_FIREWALL_LAYER_ETHERNET:
+    case VIR_FIREWALL_LAYER_LAST:
+        break;
+    }
+    /* ebtables-restore has no --noflush, so ebtables rules are
+     * never batched */
+    return NULL;
+}
+
 static virFirewallBackend currentBackend = VIR_FIREWALL_BACKEND_AUTOMATIC;
 static virMutex ruleLock = VIR_MUTEX_INITIALIZER;
 
+/* Whether the *tables-restore binary of a layer can be used by
+ * the direct backend to apply a batch of rules in one go */
+static bool haveRestore[VIR_FIREWALL_LAYER_LAST];
+static virFirewallRestore currentRestore = VIR_FIREWALL_RESTORE_AUTOMATIC;
+
 static int
 virFirewallValidateBackend(virFirewallBackend backend);
 
+static void
+virFirewallDetectRestore(void)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_FIREWALL_LAYER_LAST; i++) {
+        const char *restore = virFirewallLayerRestoreCommand(i);
+
+        switch (currentRestore) {
+        case VIR_FIREWALL_RESTORE_AUTOMATIC:
+        case VIR_FIREWALL_RESTORE_LAST:
+            haveRestore[i] = restore && virFileIsExecutable(restore);
+            break;
+        case VIR_FIREWALL_RESTORE_ENABLED:
+            haveRestore[i] = restore != NULL;
+            break;
+        case VIR_FIREWALL_RESTORE_DISABLED:
+            haveRestore[i] = false;
+            break;
+        }
+        VIR_DEBUG("Batching for layer %zu is %s", i,
+                  haveRestore[i] ? "available" : "not available");
+    }
+}
+
 static int
 virFirewallOnceInit(void)
 {
@@ -158,6 +205,8 @@ virFirewallValidateBackend(virFirewallBackend backend)
             }
         }
         VIR_DEBUG("found iptables/ip6tables/ebtables, using direct backend");
+
+        virFirewallDetectRestore();
     }
 
     currentBackend = backend;
@@ -175,6 +224,15 @@ virFirewallSetBackend(virFirewallBackend backend)
     return virFirewallValidateBackend(backend);
 }
 
+/* Lets tests batch rules, or not, regardless of what is installed
+ * on the host they run on */
+void
+virFirewallSetRestore(virFirewallRestore restore)
+{
+    currentRestore = restore;
+    virFirewallDetectRestore();
+}
+
 static virFirewallGroupPtr
 virFirewallGroupNew(void)
 {
@@ -832,12 +890,199 @@ virFirewallApplyRule(virFirewallPtr firewall,
     return ret;
 }
 
+/*
+ * Whether @arg makes it through *tables-restore unchanged. Older
+ * releases only know about double quotes around arguments, with no
+ * way to escape a quote or backslash inside them, and newer ones
+ * treat backslashes and single quotes specially as well. Arguments
+ * with any of those, or empty ones, are only passed on the command
+ * line.
+ */
+static bool
+virFirewallRestoreArgIsSafe(const char *arg)
+{
+    return *arg && !strpbrk(arg, "\"'\\\n");
+}
+
+
+/*
+ * A rule can be batched if its outcome does not need to be looked
+ * at on its own: query rules need their output, and rules whose
+ * errors are ignored must not abort the rest of the batch.
+ */
+static bool
+virFirewallRuleIsBatchable(virFirewallRulePtr rule)
+{
+    size_t i;
+
+    if (rule->queryCB || rule->ignoreErrors || !haveRestore[rule->layer])
+        return false;
+
+    for (i = 0; i < rule->argsLen; i++) {
+        if (!virFirewallRestoreArgIsSafe(rule->args[i]))
+            return false;
+    }
+
+    return true;
+}
+
+
+/* Locates the table option of @rule, storing the table in @table
+ * and the number of arguments the option spans in @nargs, which is
+ * zero if the rule works on the default table. Returns the index of
+ * the option. */
+static size_t
+virFirewallRuleFindTable(virFirewallRulePtr rule,
+                         const char **table,
+                         size_t *nargs)
+{
+    size_t i;
+
+    for (i = 0; i < rule->argsLen; i++) {
+        if ((STREQ(rule->args[i], "-t") ||
+             STREQ(rule->args[i], "--table")) &&
+            i + 1 < rule->argsLen) {
+            *table = rule->args[i + 1];
+            *nargs = 2;
+            return i;
+        }
+        if (STRPREFIX(rule->args[i], "--table=")) {
+            *table = rule->args[i] + strlen("--table=");
+            *nargs = 1;
+            return i;
+        }
+    }
+
+    *table = "filter";
+    *nargs = 0;
+    return 0;
+}
+
+
+/* Only for arguments virFirewallRestoreArgIsSafe() accepts, which
+ * need no escaping within the quotes */
+static void
+virFirewallRestoreQuote(virBufferPtr buf,
+                        const char *arg)
+{
+    if (strpbrk(arg, " \t#"))
+        virBufferAsprintf(buf, "\"%s\"", arg);
+    else
+        virBufferAdd(buf, arg, -1);
+}
+
+
+/*
+ * Formats @rules in the *tables-restore format. Every change of
+ * table starts a new section so the rules are committed in the
+ * order they were added.
+ */
+static char *
+virFirewallRulesToRestore(virFirewallRulePtr *rules,
+                          size_t nrules)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const char *current = NULL;
+    size_t i, j;
+
+    for (i = 0; i < nrules; i++) {
+        const char *table;
+        size_t ntableargs;
+        size_t tableidx = virFirewallRuleFindTable(rules[i], &table,
+                                                   &ntableargs);
+        bool first = true;
+
+        if (!current || STRNEQ(current, table)) {
+            if (current)
+                virBufferAddLit(&buf, "COMMIT\n");
+            virBufferAsprintf(&buf, "*%s\n", table);
+            current = table;
+        }
+
+        for (j = 0; j < rules[i]->argsLen; j++) {
+            if (j >= tableidx && j < tableidx + ntableargs)
+                continue;
+            if (!first)
+                virBufferAddChar(&buf, ' ');
+            virFirewallRestoreQuote(&buf, rules[i]->args[j]);
+            first = false;
+        }
+        virBufferAddChar(&buf, '\n');
+    }
+
+    if (current)
+        virBufferAddLit(&buf, "COMMIT\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/*
+ * Applies @rules, which all belong to the same layer, with a single
+ * *tables-restore process instead of one process per rule.
+ */
+static int
+virFirewallApplyRulesBatch(virFirewallPtr firewall,
+                           virFirewallRulePtr *rules,
+                           size_t nrules)
+{
+    const char *bin = virFirewallLayerRestoreCommand(rules[0]->layer);
+    virCommandPtr cmd = NULL;
+    char *input = NULL;
+    char *error = NULL;
+    int status;
+    size_t i;
+    int ret = -1;
+
+    if (nrules == 1)
+        return virFirewallApplyRule(firewall, rules[0], false);
+
+    for (i = 0; i < nrules; i++) {
+        char *str = virFirewallRuleToString(rules[i]);
+        VIR_INFO("Batching rule '%s'", NULLSTR(str));
+        VIR_FREE(str);
+    }
+
+    if (!(input = virFirewallRulesToRestore(rules, nrules)))
+        goto cleanup;
+
+    VIR_DEBUG("Applying %zu rules with %s:\n%s", nrules, bin, input);
+
+    cmd = virCommandNewArgList(bin, "--noflush", NULL);
+    virCommandSetInputBuffer(cmd, input);
+    virCommandSetErrorBuffer(cmd, &error);
+
+    if (virCommandRun(cmd, &status) < 0)
+        goto cleanup;
+
+    if (status != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to apply firewall rules with %s: %s"),
+                       bin, NULLSTR(error));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCommandFree(cmd);
+    VIR_FREE(input);
+    VIR_FREE(error);
+    return ret;
+}
+
+
 static int
 virFirewallApplyGroup(virFirewallPtr firewall,
                       size_t idx)
 {
     virFirewallGroupPtr group = firewall->groups[idx];
     bool ignoreErrors = (group->actionFlags & VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
+    bool batch = (group->actionFlags & VIR_FIREWALL_TRANSACTION_BATCH) &&
+        !ignoreErrors && currentBackend == VIR_FIREWALL_BACKEND_DIRECT;
+    size_t nbatch = 0;
     size_t i;
 
     VIR_INFO("Starting transaction for %p flags=%x",
@@ -845,11 +1090,36 @@ virFirewallApplyGroup(virFirewallPtr firewall,
     firewall->currentGroup = idx;
     group->addingRollback = false;
     for (i = 0; i < group->naction; i++) {
+        virFirewallRulePtr rule = group->action[i];
+
+        /* The pending batch is group->action[i - nbatch .. i - 1] */
+        if (nbatch &&
+            (!virFirewallRuleIsBatchable(rule) ||
+             group->action[i - nbatch]->layer != rule->layer)) {
+            if (virFirewallApplyRulesBatch(firewall,
+                                           group->action + i - nbatch,
+                                           nbatch) < 0)
+                return -1;
+            nbatch = 0;
+        }
+
+        if (batch && virFirewallRuleIsBatchable(rule)) {
+            nbatch++;
+            continue;
+        }
+
         if (virFirewallApplyRule(firewall,
-                                 group->action[i],
+                                 rule,
                                  ignoreErrors) < 0)
             return -1;
     }
+
+    if (nbatch &&
+        virFirewallApplyRulesBatch(firewall,
+                                   group->action + i - nbatch,
+                                   nbatch) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -90,6 +90,9 @@ typedef enum {
     /* Ignore all errors when applying rules, so no
      * rollback block will be required */
     VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS = (1 << 0),
+    /* Allow consecutive iptables/ip6tables rules to be
+     * applied in a single restore run by the direct backend */
+    VIR_FIREWALL_TRANSACTION_BATCH = (1 << 1),
 } virFirewallTransactionFlags;
 
 void virFirewallStartTransaction(virFirewallPtr firewall,
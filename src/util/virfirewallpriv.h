@@ -42,4 +42,14 @@ typedef enum {
 
 int virFirewallSetBackend(virFirewallBackend backend);
 
+typedef enum {
+    VIR_FIREWALL_RESTORE_AUTOMATIC, /* batch if *tables-restore is installed */
+    VIR_FIREWALL_RESTORE_ENABLED,
+    VIR_FIREWALL_RESTORE_DISABLED,
+
+    VIR_FIREWALL_RESTORE_LAST,
+} virFirewallRestore;
+
+void virFirewallSetRestore(virFirewallRestore restore);
+
 #endif /* __VIR_FIREWALL_PRIV_H__ */
@@ -23,6 +23,8 @@
 #include <config.h>
 
 #include "virnetdev.h"
+#include "virnetdevbridge.h"
+#include "virnetdevlinkcache.h"
 #include "virmacaddr.h"
 #include "virfile.h"
 #include "virerror.h"
@@ -158,6 +160,10 @@ int virNetDevExists(const char *ifname)
     int fd = -1;
     int ret = -1;
     struct ifreq ifr;
+    virNetDevLinkCacheEntry link;
+
+    if (virNetDevLinkCacheLookup(ifname, &link) > 0)
+        return 1;
 
     if ((fd = virNetDevSetupControl(ifname, &ifr)) < 0)
         return -1;
@@ -226,6 +232,7 @@ int virNetDevSetMAC(const char *ifname,
         goto cleanup;
     }
 
+    virNetDevLinkCacheInvalidate(ifname);
     ret = 0;
 
  cleanup:
@@ -294,6 +301,12 @@ int virNetDevGetMAC(const char *ifname,
     int fd = -1;
     int ret = -1;
     struct ifreq ifr;
+    virNetDevLinkCacheEntry link;
+
+    if (virNetDevLinkCacheLookup(ifname, &link) > 0 && link.hasMAC) {
+        virMacAddrSet(macaddr, &link.mac);
+        return 0;
+    }
 
     if ((fd = virNetDevSetupControl(ifname, &ifr)) < 0)
         return -1;
@@ -427,6 +440,10 @@ int virNetDevGetMTU(const char *ifname)
     int fd = -1;
     int ret = -1;
     struct ifreq ifr;
+    virNetDevLinkCacheEntry link;
+
+    if (virNetDevLinkCacheLookup(ifname, &link) > 0)
+        return link.mtu;
 
     if ((fd = virNetDevSetupControl(ifname, &ifr)) < 0)
         return -1;
@@ -484,6 +501,7 @@ int virNetDevSetMTU(const char *ifname, int mtu)
         goto cleanup;
     }
 
+    virNetDevLinkCacheInvalidate(ifname);
     ret = 0;
 
  cleanup:
@@ -546,6 +564,7 @@ int virNetDevSetNamespace(const char *ifname, pid_t pidInNs)
 
     argv[5] = pid;
     rc = virRun(argv, NULL);
+    virNetDevLinkCacheInvalidate(ifname);
 
     VIR_FREE(pid);
     return rc;
@@ -588,6 +607,7 @@ int virNetDevSetName(const char* ifname, const char *newifname)
         goto cleanup;
     }
 
+    virNetDevLinkCacheInvalidate(ifname);
     ret = 0;
 
  cleanup:
@@ -646,6 +666,7 @@ int virNetDevSetOnline(const char *ifname,
                                  ifname);
             goto cleanup;
         }
+        virNetDevLinkCacheInvalidate(ifname);
     }
 
     ret = 0;
@@ -682,6 +703,12 @@ int virNetDevIsOnline(const char *ifname,
     int fd = -1;
     int ret = -1;
     struct ifreq ifr;
+    virNetDevLinkCacheEntry link;
+
+    if (virNetDevLinkCacheLookup(ifname, &link) > 0) {
+        *online = (link.flags & IFF_UP) ? true : false;
+        return 0;
+    }
 
     if ((fd = virNetDevSetupControl(ifname, &ifr)) < 0)
         return -1;
@@ -726,9 +753,15 @@ int virNetDevGetIndex(const char *ifname, int *ifindex)
 {
     int ret = -1;
     struct ifreq ifreq;
-    int fd = socket(VIR_NETDEV_FAMILY, SOCK_DGRAM, 0);
+    virNetDevLinkCacheEntry link;
+    int fd;
 
-    if (fd < 0) {
+    if (virNetDevLinkCacheLookup(ifname, &link) > 0) {
+        *ifindex = link.ifindex;
+        return 0;
+    }
+
+    if ((fd = socket(VIR_NETDEV_FAMILY, SOCK_DGRAM, 0)) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to open control socket"));
         return -1;
@@ -1873,6 +1906,225 @@ virNetDevRestoreNetConfig(const char *linkdev ATTRIBUTE_UNUSED,
 
 #endif /* defined(__linux__) && defined(HAVE_LIBNL) */
 
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+/* Kernels before 2.6.39 silently ignore IFLA_MASTER in RTM_SETLINK.
+ * Whether the running one honours it is found out the first time a
+ * port is attached: -1 unknown, 0 no, 1 yes. */
+static int virNetDevSetMasterWorks = -1;
+
+static struct nl_msg *
+virNetDevSetLinkMsg(const char *ifname)
+{
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+
+    if (!(nl_msg = nlmsg_alloc_simple(RTM_SETLINK, NLM_F_REQUEST))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put(nl_msg, IFLA_IFNAME, strlen(ifname) + 1, ifname) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        nlmsg_free(nl_msg);
+        return NULL;
+    }
+
+    return nl_msg;
+}
+
+/*
+ * Check whether @ifname really ended up in the bridge with index
+ * @brindex, and remember the answer.
+ */
+static int
+virNetDevCheckMaster(const char *ifname, int brindex)
+{
+    struct nlattr *tb[IFLA_MAX + 1] = { NULL, };
+    void *nlData = NULL;
+
+    if (virNetDevLinkDump(ifname, -1, &nlData, tb, 0, 0) < 0)
+        return -1;
+
+    virNetDevSetMasterWorks = tb[IFLA_MASTER] &&
+        (int)nla_get_u32(tb[IFLA_MASTER]) == brindex;
+    VIR_DEBUG("IFLA_MASTER %s supported", virNetDevSetMasterWorks ? "is" : "isn't");
+
+    VIR_FREE(nlData);
+    return 0;
+}
+
+/**
+ * virNetDevSetLinkConfig:
+ * @ifname: name of the interface
+ * @macaddr: MAC address to set, or NULL
+ * @mtu: MTU to set, or 0
+ * @brname: name of the bridge to add the interface to, or NULL
+ * @online: bring the interface up or down, or leave it alone
+ *
+ * Apply the usual configuration of a freshly created interface with
+ * batches of netlink requests rather than one ioctl() each: first the
+ * MAC address and MTU, then, only once both took effect, the bridge
+ * port and the link state, so that an interface is never attached or
+ * brought up half configured. Since the kernel carries on after a
+ * failed request within a batch, some changes of the failing batch
+ * may have taken effect on failure.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNetDevSetLinkConfig(const char *ifname,
+                       const virMacAddr *macaddr,
+                       int mtu,
+                       const char *brname,
+                       virTristateBool online)
+{
+    virNetlinkBatchPtr batch = NULL;
+    struct nl_msg *nl_msg;
+    int brindex = -1;
+    int macIdx = -1;
+    int mtuIdx = -1;
+    int masterIdx = -1;
+    int onlineIdx = -1;
+    int err;
+    int ret = -1;
+
+    if (brname && virNetDevGetIndex(brname, &brindex) < 0)
+        return -1;
+
+    if (!(batch = virNetlinkBatchNew()))
+        return -1;
+
+    if (macaddr) {
+        if (!(nl_msg = virNetDevSetLinkMsg(ifname)))
+            goto cleanup;
+        if (nla_put(nl_msg, IFLA_ADDRESS, VIR_MAC_BUFLEN, macaddr->addr) < 0)
+            goto buffer_too_small;
+        if ((macIdx = virNetlinkBatchAdd(batch, nl_msg)) < 0)
+            goto cleanup;
+    }
+
+    if (mtu > 0) {
+        if (!(nl_msg = virNetDevSetLinkMsg(ifname)))
+            goto cleanup;
+        if (nla_put_u32(nl_msg, IFLA_MTU, mtu) < 0)
+            goto buffer_too_small;
+        if ((mtuIdx = virNetlinkBatchAdd(batch, nl_msg)) < 0)
+            goto cleanup;
+    }
+
+    if (virNetlinkBatchSubmit(batch) < 0)
+        goto cleanup;
+
+    if (macIdx >= 0 && (err = virNetlinkBatchGetError(batch, macIdx))) {
+        virReportSystemError(err, _("Cannot set interface MAC on '%s'"),
+                             ifname);
+        goto cleanup;
+    }
+
+    if (mtuIdx >= 0 && (err = virNetlinkBatchGetError(batch, mtuIdx))) {
+        virReportSystemError(err, _("Cannot set interface MTU on '%s'"),
+                             ifname);
+        goto cleanup;
+    }
+
+    virNetlinkBatchFree(batch);
+    if (!(batch = virNetlinkBatchNew()))
+        goto cleanup;
+
+    if (brname && virNetDevSetMasterWorks != 0) {
+        if (!(nl_msg = virNetDevSetLinkMsg(ifname)))
+            goto cleanup;
+        if (nla_put_u32(nl_msg, IFLA_MASTER, brindex) < 0)
+            goto buffer_too_small;
+        if ((masterIdx = virNetlinkBatchAdd(batch, nl_msg)) < 0)
+            goto cleanup;
+    }
+
+    if (online != VIR_TRISTATE_BOOL_ABSENT) {
+        struct ifinfomsg *ifinfo;
+
+        if (!(nl_msg = virNetDevSetLinkMsg(ifname)))
+            goto cleanup;
+        ifinfo = nlmsg_data(nlmsg_hdr(nl_msg));
+        ifinfo->ifi_change = IFF_UP;
+        if (online == VIR_TRISTATE_BOOL_YES)
+            ifinfo->ifi_flags = IFF_UP;
+        if ((onlineIdx = virNetlinkBatchAdd(batch, nl_msg)) < 0)
+            goto cleanup;
+    }
+
+    if (virNetlinkBatchSubmit(batch) < 0)
+        goto cleanup;
+
+    if (masterIdx >= 0 && (err = virNetlinkBatchGetError(batch, masterIdx))) {
+        virReportSystemError(err, _("Unable to add bridge %s port %s"),
+                             brname, ifname);
+        goto cleanup;
+    }
+
+    if (onlineIdx >= 0 && (err = virNetlinkBatchGetError(batch, onlineIdx))) {
+        virReportSystemError(err, _("Cannot set interface flags on '%s'"),
+                             ifname);
+        goto cleanup;
+    }
+
+    if (brname) {
+        if (virNetDevSetMasterWorks < 0 &&
+            virNetDevCheckMaster(ifname, brindex) < 0)
+            goto cleanup;
+
+        if (!virNetDevSetMasterWorks &&
+            virNetDevBridgeAddPort(brname, ifname) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    /* Even on failure, some of the changes may have been made; adding
+     * a port changes the bridge too */
+    virNetDevLinkCacheInvalidate(ifname);
+    if (brname)
+        virNetDevLinkCacheInvalidate(brname);
+    virNetlinkBatchFree(batch);
+    return ret;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    nlmsg_free(nl_msg);
+    goto cleanup;
+}
+
+#else /* defined(__linux__) && defined(HAVE_LIBNL) */
+
+int
+virNetDevSetLinkConfig(const char *ifname,
+                       const virMacAddr *macaddr,
+                       int mtu,
+                       const char *brname,
+                       virTristateBool online)
+{
+    if (macaddr && virNetDevSetMAC(ifname, macaddr) < 0)
+        return -1;
+
+    if (mtu > 0 && virNetDevSetMTU(ifname, mtu) < 0)
+        return -1;
+
+    if (brname && virNetDevBridgeAddPort(brname, ifname) < 0)
+        return -1;
+
+    if (online != VIR_TRISTATE_BOOL_ABSENT &&
+        virNetDevSetOnline(ifname, online == VIR_TRISTATE_BOOL_YES) < 0)
+        return -1;
+
+    return 0;
+}
+
+#endif /* defined(__linux__) && defined(HAVE_LIBNL) */
+
 #ifdef __linux__
 int
 virNetDevGetLinkInfo(const char *ifname,
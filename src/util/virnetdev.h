@@ -29,6 +29,7 @@
 # include "virnetlink.h"
 # include "virmacaddr.h"
 # include "virpci.h"
+# include "virutil.h"
 # include "device_conf.h"
 
 # ifdef HAVE_STRUCT_IFREQ
@@ -132,6 +133,12 @@ int virNetDevSetMTUFromDevice(const char *ifname,
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 int virNetDevGetMTU(const char *ifname)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetDevSetLinkConfig(const char *ifname,
+                           const virMacAddr *macaddr,
+                           int mtu,
+                           const char *brname,
+                           virTristateBool online)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetDevSetNamespace(const char *ifname, pid_t pidInNs)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetDevSetName(const char *ifname, const char *newifname)
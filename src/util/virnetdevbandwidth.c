@@ -28,6 +28,18 @@
 #include "virerror.h"
 #include "virstring.h"
 
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <arpa/inet.h>
+# include <linux/if_ether.h>
+# include <linux/pkt_cls.h>
+# include <linux/pkt_sched.h>
+# include <linux/rtnetlink.h>
+
+# include "virlog.h"
+# include "virnetdev.h"
+# include "virnetlink.h"
+#endif
+
 #define VIR_FROM_THIS VIR_FROM_NONE
 
 void
@@ -36,27 +48,983 @@ virNetDevBandwidthFree(virNetDevBandwidthPtr def)
     if (!def)
         return;
 
-    VIR_FREE(def->in);
-    VIR_FREE(def->out);
-    VIR_FREE(def);
-}
+    VIR_FREE(def->in);
+    VIR_FREE(def->out);
+    VIR_FREE(def);
+}
+
+/*
+ * virNetDevBandwidthCopy:
+ * @dest: destination
+ * @src:  source (may be NULL)
+ *
+ * Returns -1 on OOM error (which gets reported),
+ * 0 otherwise.
+ */
+int
+virNetDevBandwidthCopy(virNetDevBandwidthPtr *dest,
+                       const virNetDevBandwidth *src)
+{
+    int ret = -1;
+
+    *dest = NULL;
+    if (!src) {
+        /* nothing to be copied */
+        return 0;
+    }
+
+    if (VIR_ALLOC(*dest) < 0)
+        goto cleanup;
+
+    if (src->in) {
+        if (VIR_ALLOC((*dest)->in) < 0)
+            goto cleanup;
+        memcpy((*dest)->in, src->in, sizeof(*src->in));
+    }
+
+    if (src->out) {
+        if (VIR_ALLOC((*dest)->out) < 0) {
+            VIR_FREE((*dest)->in);
+            goto cleanup;
+        }
+        memcpy((*dest)->out, src->out, sizeof(*src->out));
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        virNetDevBandwidthFree(*dest);
+        *dest = NULL;
+    }
+    return ret;
+}
+
+bool
+virNetDevBandwidthEqual(virNetDevBandwidthPtr a,
+                        virNetDevBandwidthPtr b)
+{
+    if (!a && !b)
+        return true;
+
+    if (!a || !b)
+        return false;
+
+    /* in */
+    if (a->in) {
+        if (!b->in)
+            return false;
+
+        if (a->in->average != b->in->average ||
+            a->in->peak != b->in->peak ||
+            a->in->floor != b->in->floor ||
+            a->in->burst != b->in->burst)
+            return false;
+    } else if (b->in) {
+        return false;
+    }
+
+    /*out*/
+    if (a->out) {
+        if (!b->out)
+            return false;
+
+        if (a->out->average != b->out->average ||
+            a->out->peak != b->out->peak ||
+            a->out->floor != b->out->floor ||
+            a->out->burst != b->out->burst)
+            return false;
+    } else if (b->out) {
+        return false;
+    }
+
+    return true;
+}
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+/* Traffic control is set up by talking rtnetlink to the kernel
+ * directly, the same messages tc(8) would send. Each of the public
+ * functions below builds all the messages it needs into a batch
+ * first, and only then hands them over to the kernel one after
+ * another, so that failing to build a message never leaves a half
+ * configured interface behind. */
+
+VIR_LOG_INIT("util.netdevbandwidth");
+
+/* Packet scheduler clock, in ticks per second. It has been running
+ * at 64ns resolution (PSCHED_SHIFT) since Linux 2.6.31, this is what
+ * tc computes from /proc/net/psched too. */
+# define VIR_NETDEV_BANDWIDTH_TICKS_PER_SEC (1000000000ULL >> 6)
+
+/* Burst allowed when the definition specifies none: a single
+ * full-sized packet, which is tc's default too */
+# define VIR_NETDEV_BANDWIDTH_MTU 1600
+
+/* Largest packet the HTB rate tables are computed for */
+# define VIR_NETDEV_BANDWIDTH_HTB_MTU 2047
+
+/* Largest packet the ingress policer lets through */
+# define VIR_NETDEV_BANDWIDTH_POLICE_MTU (64 * 1024)
+
+# define VIR_NETDEV_BANDWIDTH_RTAB_CELLS (TC_RTAB_SIZE / sizeof(uint32_t))
+
+/* Handle of the root HTB qdisc ('1:') and of its classes ('1:n') */
+# define HTB_HANDLE(minor) TC_H_MAKE(1 << 16, minor)
+
+typedef struct _virNetDevBandwidthBatch virNetDevBandwidthBatch;
+typedef virNetDevBandwidthBatch *virNetDevBandwidthBatchPtr;
+struct _virNetDevBandwidthBatch {
+    const char *ifname;
+    int ifindex;
+
+    size_t nmsgs;
+    struct nl_msg **msgs;
+};
+
+static int
+virNetDevBandwidthBatchInit(virNetDevBandwidthBatchPtr batch,
+                            const char *ifname)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->ifname = ifname;
+
+    return virNetDevGetIndex(ifname, &batch->ifindex);
+}
+
+static void
+virNetDevBandwidthBatchClear(virNetDevBandwidthBatchPtr batch)
+{
+    size_t i;
+
+    for (i = 0; i < batch->nmsgs; i++)
+        nlmsg_free(batch->msgs[i]);
+    VIR_FREE(batch->msgs);
+    batch->nmsgs = 0;
+}
+
+/**
+ * virNetDevBandwidthBatchAdd:
+ * @batch: batch to append to
+ * @type: RTM_NEWQDISC, RTM_DELTCLASS, ...
+ * @flags: NLM_F_CREATE, NLM_F_EXCL, ...
+ * @parent: handle of the parent qdisc or class
+ * @handle: handle of the object itself
+ * @info: priority and protocol of a filter
+ * @kind: name of the qdisc, class or filter (may be NULL)
+ *
+ * Queue a traffic control message for the interface of @batch.
+ *
+ * Returns the message so that the caller can fill in the
+ * options, or NULL on error.
+ */
+static struct nl_msg *
+virNetDevBandwidthBatchAdd(virNetDevBandwidthBatchPtr batch,
+                           int type,
+                           int flags,
+                           uint32_t parent,
+                           uint32_t handle,
+                           uint32_t info,
+                           const char *kind)
+{
+    struct nl_msg *nl_msg;
+    struct tcmsg tcm = {
+        .tcm_family = AF_UNSPEC,
+        .tcm_ifindex = batch->ifindex,
+        .tcm_handle = handle,
+        .tcm_parent = parent,
+        .tcm_info = info,
+    };
+
+    nl_msg = nlmsg_alloc_simple(type, NLM_F_REQUEST | NLM_F_ACK | flags);
+    if (!nl_msg) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(nl_msg, &tcm, sizeof(tcm), NLMSG_ALIGNTO) < 0 ||
+        (kind && nla_put_string(nl_msg, TCA_KIND, kind) < 0)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        nlmsg_free(nl_msg);
+        return NULL;
+    }
+
+    if (VIR_APPEND_ELEMENT_COPY(batch->msgs, batch->nmsgs, nl_msg) < 0) {
+        nlmsg_free(nl_msg);
+        return NULL;
+    }
+
+    return nl_msg;
+}
+
+static void
+virNetDevBandwidthReportError(int error,
+                              int type,
+                              const char *ifname)
+{
+    switch (type) {
+    case RTM_NEWQDISC:
+        virReportSystemError(error,
+                             _("Unable to set qdisc on interface '%s'"),
+                             ifname);
+        break;
+    case RTM_NEWTCLASS:
+        virReportSystemError(error,
+                             _("Unable to set class on interface '%s'"),
+                             ifname);
+        break;
+    case RTM_NEWTFILTER:
+        virReportSystemError(error,
+                             _("Unable to set filter on interface '%s'"),
+                             ifname);
+        break;
+    default:
+        virReportSystemError(error,
+                             _("Unable to change traffic control "
+                               "settings of interface '%s'"),
+                             ifname);
+        break;
+    }
+}
+
+/**
+ * virNetDevBandwidthBatchSubmit:
+ * @batch: messages to send
+ * @ignoreErrors: whether to go on when the kernel refuses a message
+ *
+ * Send the queued messages to the kernel in order. Unless
+ * @ignoreErrors is true, the first message refused by the kernel
+ * stops the submission.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+virNetDevBandwidthBatchSubmit(virNetDevBandwidthBatchPtr batch,
+                              bool ignoreErrors)
+{
+    int ret = -1;
+    struct nlmsghdr *resp = NULL;
+    struct nlmsgerr *err;
+    unsigned int recvbuflen = 0;
+    size_t i;
+
+    for (i = 0; i < batch->nmsgs; i++) {
+        int type = nlmsg_hdr(batch->msgs[i])->nlmsg_type;
+
+        VIR_FREE(resp);
+        if (virNetlinkCommand(batch->msgs[i], &resp, &recvbuflen, 0, 0,
+                              NETLINK_ROUTE, 0) < 0)
+            goto cleanup;
+
+        if (recvbuflen < NLMSG_LENGTH(0) || resp == NULL ||
+            resp->nlmsg_type != NLMSG_ERROR)
+            goto malformed_resp;
+
+        err = (struct nlmsgerr *)NLMSG_DATA(resp);
+        if (resp->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+            goto malformed_resp;
+
+        if (!err->error)
+            continue;
+
+        if (!ignoreErrors) {
+            virNetDevBandwidthReportError(-err->error, type, batch->ifname);
+            goto cleanup;
+        }
+
+        VIR_DEBUG("Ignoring error %d of message type %d on interface %s",
+                  err->error, type, batch->ifname);
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(resp);
+    return ret;
+
+ malformed_resp:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("malformed netlink response message"));
+    goto cleanup;
+}
+
+/* Rates in the definition are in kilobytes per second, which tc
+ * turns into 1000 bytes per second. The kernel takes 32 bit rates
+ * (64 bit ones need newer attributes), so cap them at 4GB/s. */
+static uint32_t
+virNetDevBandwidthBytesPerSec(unsigned long long kbps)
+{
+    if (kbps > UINT32_MAX / 1000)
+        return UINT32_MAX;
+    return kbps * 1000;
+}
+
+/* Time it takes to send @size bytes at @rate bytes per second, in
+ * packet scheduler ticks */
+static uint32_t
+virNetDevBandwidthXmitTime(uint32_t rate,
+                           unsigned long long size)
+{
+    unsigned long long ticks;
+
+    if (!rate)
+        return 0;
+
+    if (size > ULLONG_MAX / VIR_NETDEV_BANDWIDTH_TICKS_PER_SEC)
+        return UINT32_MAX;
+
+    ticks = size * VIR_NETDEV_BANDWIDTH_TICKS_PER_SEC / rate;
+    return MIN(ticks, UINT32_MAX);
+}
+
+/* Fill in the rate table of @rate the way tc does: the time it takes
+ * to send a packet of each size up to @mtu, in 256 cells. */
+static void
+virNetDevBandwidthRateTable(struct tc_ratespec *rate,
+                            uint32_t *rtab,
+                            unsigned int mtu)
+{
+    unsigned int cell_log = 0;
+    size_t i;
+
+    while ((mtu >> cell_log) >= VIR_NETDEV_BANDWIDTH_RTAB_CELLS)
+        cell_log++;
+
+    for (i = 0; i < VIR_NETDEV_BANDWIDTH_RTAB_CELLS; i++)
+        rtab[i] = virNetDevBandwidthXmitTime(rate->rate,
+                                             (i + 1) << cell_log);
+
+    rate->cell_log = cell_log;
+    rate->cell_align = -1;
+}
+
+static int
+virNetDevBandwidthAddHTBQdisc(virNetDevBandwidthBatchPtr batch,
+                              uint32_t defcls)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+    struct tc_htb_glob glob = {
+        .version = TC_HTB_PROTOVER,
+        .rate2quantum = 10,
+        .defcls = defcls,
+    };
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWQDISC,
+                                              NLM_F_CREATE | NLM_F_EXCL,
+                                              TC_H_ROOT, HTB_HANDLE(0),
+                                              0, "htb")))
+        return -1;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_HTB_INIT, sizeof(glob), &glob) < 0)
+        goto buffer_too_small;
+
+    nla_nest_end(nl_msg, opts);
+    return 0;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+/**
+ * virNetDevBandwidthAddHTBClass:
+ * @batch: batch to append to
+ * @flags: NLM_F_CREATE | NLM_F_EXCL to add the class, 0 to change it
+ * @parent: handle of the parent class (may be 0 when changing)
+ * @classid: handle of the class
+ * @rate: guaranteed rate in kilobytes per second
+ * @ceil: maximum rate in kilobytes per second (0 means @rate)
+ * @burst: size of the burst in kilobytes (0 means the default)
+ *
+ * Queue an HTB class setup.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+virNetDevBandwidthAddHTBClass(virNetDevBandwidthBatchPtr batch,
+                              int flags,
+                              uint32_t parent,
+                              uint32_t classid,
+                              unsigned long long rate,
+                              unsigned long long ceil,
+                              unsigned long long burst)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+    struct tc_htb_opt opt;
+    uint32_t rtab[VIR_NETDEV_BANDWIDTH_RTAB_CELLS];
+    uint32_t ctab[VIR_NETDEV_BANDWIDTH_RTAB_CELLS];
+
+    memset(&opt, 0, sizeof(opt));
+    opt.rate.rate = virNetDevBandwidthBytesPerSec(rate);
+    opt.ceil.rate = ceil ? virNetDevBandwidthBytesPerSec(ceil) : opt.rate.rate;
+    opt.buffer = virNetDevBandwidthXmitTime(opt.rate.rate,
+                                            burst ? burst * 1024 :
+                                            VIR_NETDEV_BANDWIDTH_MTU);
+    opt.cbuffer = virNetDevBandwidthXmitTime(opt.ceil.rate,
+                                             VIR_NETDEV_BANDWIDTH_MTU);
+    virNetDevBandwidthRateTable(&opt.rate, rtab,
+                                VIR_NETDEV_BANDWIDTH_HTB_MTU);
+    virNetDevBandwidthRateTable(&opt.ceil, ctab,
+                                VIR_NETDEV_BANDWIDTH_HTB_MTU);
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWTCLASS, flags,
+                                              parent, classid, 0, "htb")))
+        return -1;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_HTB_PARMS, sizeof(opt), &opt) < 0 ||
+        nla_put(nl_msg, TCA_HTB_RTAB, sizeof(rtab), rtab) < 0 ||
+        nla_put(nl_msg, TCA_HTB_CTAB, sizeof(ctab), ctab) < 0)
+        goto buffer_too_small;
+
+    nla_nest_end(nl_msg, opts);
+    return 0;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+static int
+virNetDevBandwidthAddSFQQdisc(virNetDevBandwidthBatchPtr batch,
+                              uint32_t parent,
+                              uint32_t handle)
+{
+    struct nl_msg *nl_msg;
+    struct tc_sfq_qopt opt = {
+        .perturb_period = 10,
+    };
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWQDISC,
+                                              NLM_F_CREATE | NLM_F_EXCL,
+                                              parent, handle, 0, "sfq")))
+        return -1;
+
+    /* Unlike most others, sfq options are not nested */
+    if (nla_put(nl_msg, TCA_OPTIONS, sizeof(opt), &opt) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+virNetDevBandwidthAddFwFilter(virNetDevBandwidthBatchPtr batch,
+                              uint32_t parent,
+                              uint32_t handle,
+                              uint32_t classid)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWTFILTER,
+                                              NLM_F_CREATE | NLM_F_EXCL,
+                                              parent, handle,
+                                              TC_H_MAKE(0, htons(ETH_P_ALL)),
+                                              "fw")))
+        return -1;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put_u32(nl_msg, TCA_FW_CLASSID, classid) < 0)
+        goto buffer_too_small;
+
+    nla_nest_end(nl_msg, opts);
+    return 0;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+# define VIR_NETDEV_BANDWIDTH_U32_MAX_KEYS 3
+
+/**
+ * virNetDevBandwidthAddU32Filter:
+ * @batch: batch to append to
+ * @parent: handle of the qdisc to attach the filter to
+ * @prio: priority of the filter (0 lets the kernel choose one)
+ * @protocol: ethernet protocol matched, in host byte order
+ * @keys: 32 bit words to match, in network byte order
+ * @nkeys: number of @keys
+ * @classid: class to put the matching packets in
+ * @average: policing rate in kilobytes per second (0 for no policing)
+ * @burst: policing burst in kilobytes
+ *
+ * Queue a u32 filter.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+virNetDevBandwidthAddU32Filter(virNetDevBandwidthBatchPtr batch,
+                               uint32_t parent,
+                               uint32_t prio,
+                               uint16_t protocol,
+                               const struct tc_u32_key *keys,
+                               size_t nkeys,
+                               uint32_t classid,
+                               unsigned long long average,
+                               unsigned long long burst)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+    struct nlattr *police;
+    struct {
+        struct tc_u32_sel sel;
+        struct tc_u32_key keys[VIR_NETDEV_BANDWIDTH_U32_MAX_KEYS];
+    } sel;
+    struct tc_police tbf;
+    uint32_t rtab[VIR_NETDEV_BANDWIDTH_RTAB_CELLS];
+
+    sa_assert(nkeys <= VIR_NETDEV_BANDWIDTH_U32_MAX_KEYS);
+
+    memset(&sel, 0, sizeof(sel));
+    sel.sel.flags = TC_U32_TERMINAL;
+    sel.sel.nkeys = nkeys;
+    memcpy(sel.keys, keys, nkeys * sizeof(*keys));
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWTFILTER,
+                                              NLM_F_CREATE | NLM_F_EXCL,
+                                              parent, 0,
+                                              TC_H_MAKE(prio << 16,
+                                                        htons(protocol)),
+                                              "u32")))
+        return -1;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put_u32(nl_msg, TCA_U32_CLASSID, classid) < 0 ||
+        nla_put(nl_msg, TCA_U32_SEL,
+                sizeof(sel.sel) + nkeys * sizeof(*keys), &sel) < 0)
+        goto buffer_too_small;
+
+    if (average) {
+        memset(&tbf, 0, sizeof(tbf));
+        tbf.action = TC_POLICE_SHOT;
+        tbf.mtu = VIR_NETDEV_BANDWIDTH_POLICE_MTU;
+        tbf.rate.rate = virNetDevBandwidthBytesPerSec(average);
+        tbf.burst = virNetDevBandwidthXmitTime(tbf.rate.rate, burst * 1024);
+        virNetDevBandwidthRateTable(&tbf.rate, rtab, tbf.mtu);
+
+        if (!(police = nla_nest_start(nl_msg, TCA_U32_POLICE)) ||
+            nla_put(nl_msg, TCA_POLICE_TBF, sizeof(tbf), &tbf) < 0 ||
+            nla_put(nl_msg, TCA_POLICE_RATE, sizeof(rtab), rtab) < 0)
+            goto buffer_too_small;
+
+        nla_nest_end(nl_msg, police);
+    }
+
+    nla_nest_end(nl_msg, opts);
+    return 0;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+/**
+ * virNetDevBandwidthSet:
+ * @ifname: on which interface
+ * @bandwidth: rates to set (may be NULL)
+ * @hierarchical_class: whether to create hierarchical class
+ *
+ * This function enables QoS on specified interface
+ * and set given traffic limits for both, incoming
+ * and outgoing traffic. Any previous setting get
+ * overwritten. If @hierarchical_class is TRUE, create
+ * hierarchical class. It is used to guarantee minimal
+ * throughput ('floor' attribute in NIC).
+ *
+ * Return 0 on success, -1 otherwise.
+ */
+int
+virNetDevBandwidthSet(const char *ifname,
+                      virNetDevBandwidthPtr bandwidth,
+                      bool hierarchical_class)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+    virErrorPtr orig_err;
+
+    if (!bandwidth) {
+        /* nothing to be enabled */
+        return 0;
+    }
+
+    virNetDevBandwidthClear(ifname);
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        return -1;
+
+    if (bandwidth->in && bandwidth->in->average) {
+        uint32_t defcls = hierarchical_class ? 2 : 1;
+
+        if (virNetDevBandwidthAddHTBQdisc(&batch, defcls) < 0)
+            goto cleanup;
+
+        /* If we are creating a hierarchical class, all non guaranteed traffic
+         * goes to the 1:2 class which will adjust 'rate' dynamically as NICs
+         * with guaranteed throughput are plugged and unplugged. Class 1:1
+         * exists so we don't exceed the maximum limit for the network. For each
+         * NIC with guaranteed throughput a separate classid will be created.
+         * NB '1:' is just a shorter notation of '1:0'.
+         *
+         * To get a picture how this works:
+         *
+         * +-----+     +---------+     +-----------+      +-----------+     +-----+
+         * |     |     |  qdisc  |     | class 1:1 |      | class 1:2 |     |     |
+         * | NIC |     | def 1:2 |     |   rate    |      |   rate    |     | sfq |
+         * |     | --> |         | --> |   peak    | -+-> |   peak    | --> |     |
+         * +-----+     +---------+     +-----------+  |   +-----------+     +-----+
+         *                                            |
+         *                                            |   +-----------+     +-----+
+         *                                            |   | class 1:3 |     |     |
+         *                                            |   |   rate    |     | sfq |
+         *                                            +-> |   peak    | --> |     |
+         *                                            |   +-----------+     +-----+
+         *                                           ...
+         *                                            |   +-----------+     +-----+
+         *                                            |   | class 1:n |     |     |
+         *                                            |   |   rate    |     | sfq |
+         *                                            +-> |   peak    | --> |     |
+         *                                                +-----------+     +-----+
+         *
+         * After the routing decision, when is it clear a packet is to be sent
+         * via a particular NIC, it is sent to the root qdisc (queueing
+         * discipline). In this case HTB (Hierarchical Token Bucket). It has
+         * only one direct child class (with id 1:1) which shapes the overall
+         * rate that is sent through the NIC.  This class has at least one child
+         * (1:2) which is meant for all non-privileged (non guaranteed) traffic
+         * from all domains. Then, for each interface with guaranteed
+         * throughput, a separate class (1:n) is created. Imagine a class is a
+         * box. Whenever a packet ends up in a class it is stored in this box
+         * until the kernel sends it, then it is removed from box. Packets are
+         * placed into boxes based on rules (filters) - e.g. depending on
+         * destination IP/MAC address. If there is no rule to be applied, the
+         * root qdisc has a default where such packets go (1:2 in this case).
+         * Packets come in over and over again and boxes get filled more and
+         * more. Imagine that kernel sends packets just once a second. So it
+         * starts to traverse through this tree. It starts with the root qdisc
+         * and through 1:1 it gets to 1:2. It sends packets up to 1:2's 'rate'.
+         * Then it moves to 1:3 and again sends packets up to 1:3's 'rate'.  The
+         * whole process is repeated until 1:n is processed. So now we have
+         * ensured each class its guaranteed bandwidth. If the sum of sent data
+         * doesn't exceed the 'rate' in 1:1 class, we can go further and send
+         * more packets. The rest of available bandwidth is distributed to the
+         * 1:2,1:3...1:n classes by ratio of their 'rate'. As soon as the root
+         * 'rate' limit is reached or there are no more packets to send, we stop
+         * sending and wait another second. Each class has an SFQ qdisc which
+         * shuffles packets in boxes stochastically, so one sender cannot
+         * starve others.
+         *
+         * Therefore, whenever we want to plug in a new guaranteed interface, we
+         * need to create a new class and adjust the 'rate' of the 1:2 class.
+         * When unplugging we do the exact opposite - remove the associated
+         * class, and adjust the 'rate'.
+         *
+         * This description is rather long, but it is still a good idea to read
+         * it before you dig into the code.
+         */
+        if (hierarchical_class &&
+            virNetDevBandwidthAddHTBClass(&batch, NLM_F_CREATE | NLM_F_EXCL,
+                                          HTB_HANDLE(0), HTB_HANDLE(1),
+                                          bandwidth->in->average,
+                                          bandwidth->in->peak, 0) < 0)
+            goto cleanup;
+
+        if (virNetDevBandwidthAddHTBClass(&batch, NLM_F_CREATE | NLM_F_EXCL,
+                                          HTB_HANDLE(defcls - 1),
+                                          HTB_HANDLE(defcls),
+                                          bandwidth->in->average,
+                                          bandwidth->in->peak,
+                                          bandwidth->in->burst) < 0)
+            goto cleanup;
+
+        if (virNetDevBandwidthAddSFQQdisc(&batch, HTB_HANDLE(defcls),
+                                          TC_H_MAKE(2 << 16, 0)) < 0)
+            goto cleanup;
+
+        if (virNetDevBandwidthAddFwFilter(&batch, HTB_HANDLE(0), 1, 1) < 0)
+            goto cleanup;
+    }
+
+    if (bandwidth->out) {
+        /* Set filter to match all ingress traffic */
+        struct tc_u32_key any = { 0 };
+
+        if (!virNetDevBandwidthBatchAdd(&batch, RTM_NEWQDISC,
+                                        NLM_F_CREATE | NLM_F_EXCL,
+                                        TC_H_INGRESS,
+                                        TC_H_MAKE(TC_H_INGRESS, 0),
+                                        0, "ingress"))
+            goto cleanup;
+
+        if (virNetDevBandwidthAddU32Filter(&batch, TC_H_MAKE(TC_H_INGRESS, 0),
+                                           0, ETH_P_ALL, &any, 1, 1,
+                                           bandwidth->out->average,
+                                           bandwidth->out->burst ?
+                                           bandwidth->out->burst :
+                                           bandwidth->out->average) < 0)
+            goto cleanup;
+    }
+
+    if (virNetDevBandwidthBatchSubmit(&batch, false) < 0) {
+        /* Don't leave the part that went through behind */
+        orig_err = virSaveLastError();
+        virNetDevBandwidthClear(ifname);
+        if (orig_err) {
+            virSetError(orig_err);
+            virFreeError(orig_err);
+        }
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virNetDevBandwidthBatchClear(&batch);
+    return ret;
+}
+
+/**
+ * virNetDevBandwidthClear:
+ * @ifname: on which interface
+ *
+ * This function tries to disable QoS on specified interface
+ * by deleting root and ingress qdisc. However, this may fail
+ * if we try to remove the default one.
+ *
+ * Return 0 on success, -1 otherwise.
+ */
+int
+virNetDevBandwidthClear(const char *ifname)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        return -1;
+
+    if (!virNetDevBandwidthBatchAdd(&batch, RTM_DELQDISC, 0,
+                                    TC_H_ROOT, 0, 0, NULL) ||
+        !virNetDevBandwidthBatchAdd(&batch, RTM_DELQDISC, 0,
+                                    TC_H_INGRESS, 0, 0, NULL))
+        goto cleanup;
+
+    /* There might be nothing to delete */
+    ret = virNetDevBandwidthBatchSubmit(&batch, true);
+
+ cleanup:
+    virNetDevBandwidthBatchClear(&batch);
+    return ret;
+}
+
+/*
+ * virNetDevBandwidthPlug:
+ * @brname: name of the bridge
+ * @net_bandwidth: QoS settings on @brname
+ * @ifmac: MAC of interface
+ * @bandwidth: QoS settings for interface
+ * @id: unique ID (MUST be greater than 2)
+ *
+ * Set bridge part of interface QoS settings, e.g. guaranteed
+ * bandwidth.  @id is an unique ID (among @brname) from which
+ * other identifiers for class, qdisc and filter are derived.
+ * However, two classes were already set up (by
+ * virNetDevBandwidthSet). That's why this @id MUST be greater
+ * than 2. You may want to keep passed @id, as it is used later
+ * by virNetDevBandwidthUnplug.
+ *
+ * Returns:
+ * 0 if QoS set successfully
+ * -1 otherwise.
+ */
+int
+virNetDevBandwidthPlug(const char *brname,
+                       virNetDevBandwidthPtr net_bandwidth,
+                       const virMacAddr *ifmac_ptr,
+                       virNetDevBandwidthPtr bandwidth,
+                       unsigned int id)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+    unsigned char ifmac[VIR_MAC_BUFLEN];
+    char ifmacStr[VIR_MAC_STRING_BUFLEN];
+    struct tc_u32_key keys[3];
+
+    if (id <= 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, _("Invalid class ID %d"), id);
+        return -1;
+    }
+
+    virMacAddrGetRaw(ifmac_ptr, ifmac);
+    virMacAddrFormat(ifmac_ptr, ifmacStr);
+
+    if (!net_bandwidth || !net_bandwidth->in) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("Bridge '%s' has no QoS set, therefore "
+                         "unable to set 'floor' on '%s'"),
+                       brname, ifmacStr);
+        return -1;
+    }
+
+    if (virNetDevBandwidthBatchInit(&batch, brname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthAddHTBClass(&batch, NLM_F_CREATE | NLM_F_EXCL,
+                                      HTB_HANDLE(1),
+                                      HTB_HANDLE(id),
+                                      bandwidth->in->floor,
+                                      net_bandwidth->in->peak ?
+                                      net_bandwidth->in->peak :
+                                      net_bandwidth->in->average, 0) < 0)
+        goto cleanup;
+
+    if (virNetDevBandwidthAddSFQQdisc(&batch,
+                                      HTB_HANDLE(id),
+                                      TC_H_MAKE(id << 16, 0)) < 0)
+        goto cleanup;
+
+    /* Okay, this not nice. But since libvirt does not know anything about
+     * interface IP address(es), and tc fw filter simply refuse to use ebtables
+     * marks, we need to use u32 selector to match MAC address.
+     * If libvirt will ever know something, remove this FIXME
+     *
+     * The offsets are relative to the IP header and u32 matches whole
+     * aligned words: the ethertype is the low half of the word at -4,
+     * the destination MAC spans the low half of the word at -16 and
+     * the whole word at -12.
+     */
+    memset(keys, 0, sizeof(keys));
+    keys[0].mask = htonl(0xffff);
+    keys[0].val = htonl(ETH_P_IP);
+    keys[0].off = -4;
+    keys[1].mask = htonl(0xffffffff);
+    keys[1].val = htonl(((uint32_t)ifmac[2] << 24) | (ifmac[3] << 16) |
+                        (ifmac[4] << 8) | ifmac[5]);
+    keys[1].off = -12;
+    keys[2].mask = htonl(0xffff);
+    keys[2].val = htonl((ifmac[0] << 8) | ifmac[1]);
+    keys[2].off = -16;
+
+    if (virNetDevBandwidthAddU32Filter(&batch, 0, id, ETH_P_IP,
+                                       keys, ARRAY_CARDINALITY(keys),
+                                       HTB_HANDLE(id),
+                                       0, 0) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchSubmit(&batch, false);
+
+ cleanup:
+    virNetDevBandwidthBatchClear(&batch);
+    return ret;
+}
+
+/*
+ * virNetDevBandwidthUnplug:
+ * @brname: from which bridge are we unplugging
+ * @id: unique identifier (MUST be greater than 2)
+ *
+ * Remove QoS settings from bridge.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+virNetDevBandwidthUnplug(const char *brname,
+                         unsigned int id)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+
+    if (id <= 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, _("Invalid class ID %d"), id);
+        return -1;
+    }
+
+    if (virNetDevBandwidthBatchInit(&batch, brname) < 0)
+        return -1;
+
+    if (!virNetDevBandwidthBatchAdd(&batch, RTM_DELQDISC, 0,
+                                    HTB_HANDLE(id),
+                                    TC_H_MAKE(id << 16, 0), 0, NULL) ||
+        !virNetDevBandwidthBatchAdd(&batch, RTM_DELTFILTER, 0,
+                                    0, 0, TC_H_MAKE(id << 16, 0), NULL) ||
+        !virNetDevBandwidthBatchAdd(&batch, RTM_DELTCLASS, 0,
+                                    0, HTB_HANDLE(id),
+                                    0, NULL))
+        goto cleanup;
+
+    /* Don't threat kernel errors as fatal, but
+     * try to remove as much as possible */
+    ret = virNetDevBandwidthBatchSubmit(&batch, true);
 
+ cleanup:
+    virNetDevBandwidthBatchClear(&batch);
+    return ret;
+}
 
 /**
- * virNetDevBandwidthSet:
- * @ifname: on which interface
- * @bandwidth: rates to set (may be NULL)
- * @hierarchical_class: whether to create hierarchical class
+ * virNetDevBandwidthUpdateRate:
+ * @ifname: interface name
+ * @classid: ID of class to update
+ * @new_rate: new rate
  *
- * This function enables QoS on specified interface
- * and set given traffic limits for both, incoming
- * and outgoing traffic. Any previous setting get
- * overwritten. If @hierarchical_class is TRUE, create
- * hierarchical class. It is used to guarantee minimal
- * throughput ('floor' attribute in NIC).
+ * This function updates the 'rate' attribute of HTB class.
+ * It can be used whenever a new interface is plugged to a
+ * bridge to adjust average throughput of non guaranteed
+ * NICs.
  *
- * Return 0 on success, -1 otherwise.
+ * Returns 0 on success, -1 otherwise.
  */
+int
+virNetDevBandwidthUpdateRate(const char *ifname,
+                             const char *class_id,
+                             virNetDevBandwidthPtr bandwidth,
+                             unsigned long long new_rate)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+    unsigned int major;
+    unsigned int minor;
+    char *sep;
+
+    if (virStrToLong_ui(class_id, &sep, 16, &major) < 0 || *sep != ':' ||
+        virStrToLong_ui(sep + 1, NULL, 16, &minor) < 0 ||
+        major > 0xffff || minor > 0xffff) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid class ID '%s'"), class_id);
+        return -1;
+    }
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthAddHTBClass(&batch, 0, 0,
+                                      TC_H_MAKE(major << 16, minor),
+                                      new_rate,
+                                      bandwidth->in->peak ?
+                                      bandwidth->in->peak :
+                                      bandwidth->in->average, 0) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchSubmit(&batch, false);
+
+ cleanup:
+    virNetDevBandwidthBatchClear(&batch);
+    return ret;
+}
+
+#else /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
+
+/* Without libnl, fall back to running tc(8) */
+
 int
 virNetDevBandwidthSet(const char *ifname,
                       virNetDevBandwidthPtr bandwidth,
@@ -93,69 +1061,7 @@ virNetDevBandwidthSet(const char *ifname,
         if (virCommandRun(cmd, NULL) < 0)
             goto cleanup;
 
-        /* If we are creating a hierarchical class, all non guaranteed traffic
-         * goes to the 1:2 class which will adjust 'rate' dynamically as NICs
-         * with guaranteed throughput are plugged and unplugged. Class 1:1
-         * exists so we don't exceed the maximum limit for the network. For each
-         * NIC with guaranteed throughput a separate classid will be created.
-         * NB '1:' is just a shorter notation of '1:0'.
-         *
-         * To get a picture how this works:
-         *
-         * +-----+     +---------+     +-----------+      +-----------+     +-----+
-         * |     |     |  qdisc  |     | class 1:1 |      | class 1:2 |     |     |
-         * | NIC |     | def 1:2 |     |   rate    |      |   rate    |     | sfq |
-         * |     | --> |         | --> |   peak    | -+-> |   peak    | --> |     |
-         * +-----+     +---------+     +-----------+  |   +-----------+     +-----+
-         *                                            |
-         *                                            |   +-----------+     +-----+
-         *                                            |   | class 1:3 |     |     |
-         *                                            |   |   rate    |     | sfq |
-         *                                            +-> |   peak    | --> |     |
-         *                                            |   +-----------+     +-----+
-         *                                           ...
-         *                                            |   +-----------+     +-----+
-         *                                            |   | class 1:n |     |     |
-         *                                            |   |   rate    |     | sfq |
-         *                                            +-> |   peak    | --> |     |
-         *                                                +-----------+     +-----+
-         *
-         * After the routing decision, when is it clear a packet is to be sent
-         * via a particular NIC, it is sent to the root qdisc (queueing
-         * discipline). In this case HTB (Hierarchical Token Bucket). It has
-         * only one direct child class (with id 1:1) which shapes the overall
-         * rate that is sent through the NIC.  This class has at least one child
-         * (1:2) which is meant for all non-privileged (non guaranteed) traffic
-         * from all domains. Then, for each interface with guaranteed
-         * throughput, a separate class (1:n) is created. Imagine a class is a
-         * box. Whenever a packet ends up in a class it is stored in this box
-         * until the kernel sends it, then it is removed from box. Packets are
-         * placed into boxes based on rules (filters) - e.g. depending on
-         * destination IP/MAC address. If there is no rule to be applied, the
-         * root qdisc has a default where such packets go (1:2 in this case).
-         * Packets come in over and over again and boxes get filled more and
-         * more. Imagine that kernel sends packets just once a second. So it
-         * starts to traverse through this tree. It starts with the root qdisc
-         * and through 1:1 it gets to 1:2. It sends packets up to 1:2's 'rate'.
-         * Then it moves to 1:3 and again sends packets up to 1:3's 'rate'.  The
-         * whole process is repeated until 1:n is processed. So now we have
-         * ensured each class its guaranteed bandwidth. If the sum of sent data
-         * doesn't exceed the 'rate' in 1:1 class, we can go further and send
-         * more packets. The rest of available bandwidth is distributed to the
-         * 1:2,1:3...1:n classes by ratio of their 'rate'. As soon as the root
-         * 'rate' limit is reached or there are no more packets to send, we stop
-         * sending and wait another second. Each class has an SFQ qdisc which
-         * shuffles packets in boxes stochastically, so one sender cannot
-         * starve others.
-         *
-         * Therefore, whenever we want to plug in a new guaranteed interface, we
-         * need to create a new class and adjust the 'rate' of the 1:2 class.
-         * When unplugging we do the exact opposite - remove the associated
-         * class, and adjust the 'rate'.
-         *
-         * This description is rather long, but it is still a good idea to read
-         * it before you dig into the code.
-         */
+        /* See the netlink implementation for how the classes fit together */
         if (hierarchical_class) {
             virCommandFree(cmd);
             cmd = virCommandNew(TC);
@@ -242,16 +1148,6 @@ virNetDevBandwidthSet(const char *ifname,
     return ret;
 }
 
-/**
- * virNetDevBandwidthClear:
- * @ifname: on which interface
- *
- * This function tries to disable QoS on specified interface
- * by deleting root and ingress qdisc. However, this may fail
- * if we try to remove the default one.
- *
- * Return 0 on success, -1 otherwise.
- */
 int
 virNetDevBandwidthClear(const char *ifname)
 {
@@ -278,114 +1174,6 @@ virNetDevBandwidthClear(const char *ifname)
     return ret;
 }
 
-/*
- * virNetDevBandwidthCopy:
- * @dest: destination
- * @src:  source (may be NULL)
- *
- * Returns -1 on OOM error (which gets reported),
- * 0 otherwise.
- */
-int
-virNetDevBandwidthCopy(virNetDevBandwidthPtr *dest,
-                       const virNetDevBandwidth *src)
-{
-    int ret = -1;
-
-    *dest = NULL;
-    if (!src) {
-        /* nothing to be copied */
-        return 0;
-    }
-
-    if (VIR_ALLOC(*dest) < 0)
-        goto cleanup;
-
-    if (src->in) {
-        if (VIR_ALLOC((*dest)->in) < 0)
-            goto cleanup;
-        memcpy((*dest)->in, src->in, sizeof(*src->in));
-    }
-
-    if (src->out) {
-        if (VIR_ALLOC((*dest)->out) < 0) {
-            VIR_FREE((*dest)->in);
-            goto cleanup;
-        }
-        memcpy((*dest)->out, src->out, sizeof(*src->out));
-    }
-
-    ret = 0;
-
- cleanup:
-    if (ret < 0) {
-        virNetDevBandwidthFree(*dest);
-        *dest = NULL;
-    }
-    return ret;
-}
-
-bool
-virNetDevBandwidthEqual(virNetDevBandwidthPtr a,
-                        virNetDevBandwidthPtr b)
-{
-    if (!a && !b)
-        return true;
-
-    if (!a || !b)
-        return false;
-
-    /* in */
-    if (a->in) {
-        if (!b->in)
-            return false;
-
-        if (a->in->average != b->in->average ||
-            a->in->peak != b->in->peak ||
-            a->in->floor != b->in->floor ||
-            a->in->burst != b->in->burst)
-            return false;
-    } else if (b->in) {
-        return false;
-    }
-
-    /*out*/
-    if (a->out) {
-        if (!b->out)
-            return false;
-
-        if (a->out->average != b->out->average ||
-            a->out->peak != b->out->peak ||
-            a->out->floor != b->out->floor ||
-            a->out->burst != b->out->burst)
-            return false;
-    } else if (b->out) {
-        return false;
-    }
-
-    return true;
-}
-
-/*
- * virNetDevBandwidthPlug:
- * @brname: name of the bridge
- * @net_bandwidth: QoS settings on @brname
- * @ifmac: MAC of interface
- * @bandwidth: QoS settings for interface
- * @id: unique ID (MUST be greater than 2)
- *
- * Set bridge part of interface QoS settings, e.g. guaranteed
- * bandwidth.  @id is an unique ID (among @brname) from which
- * other identifiers for class, qdisc and filter are derived.
- * However, two classes were already set up (by
- * virNetDevBandwidthSet). That's why this @id MUST be greater
- * than 2. You may want to keep passed @id, as it is used later
- * by virNetDevBandwidthUnplug.
- *
- * Returns:
- * 0 if QoS set successfully
- * -1 otherwise.
- */
 int
 virNetDevBandwidthPlug(const char *brname,
                        virNetDevBandwidthPtr net_bandwidth,
@@ -480,15 +1268,6 @@ virNetDevBandwidthPlug(const char *brname,
     return ret;
 }
 
-/*
- * virNetDevBandwidthUnplug:
- * @brname: from which bridge are we unplugging
- * @id: unique identifier (MUST be greater than 2)
- *
- * Remove QoS settings from bridge.
- *
- * Returns 0 on success, -1 otherwise.
- */
 int
 virNetDevBandwidthUnplug(const char *brname,
                          unsigned int id)
@@ -545,19 +1324,6 @@ virNetDevBandwidthUnplug(const char *brname,
     return ret;
 }
 
-/**
- * virNetDevBandwidthUpdateRate:
- * @ifname: interface name
- * @classid: ID of class to update
- * @new_rate: new rate
- *
- * This function updates the 'rate' attribute of HTB class.
- * It can be used whenever a new interface is plugged to a
- * bridge to adjust average throughput of non guaranteed
- * NICs.
- *
- * Returns 0 on success, -1 otherwise.
- */
 int
 virNetDevBandwidthUpdateRate(const char *ifname,
                              const char *class_id,
@@ -591,3 +1357,5 @@ virNetDevBandwidthUpdateRate(const char *ifname,
     VIR_FREE(ceil);
     return ret;
 }
+
+#endif /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
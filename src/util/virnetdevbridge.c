@@ -24,6 +24,7 @@
 
 #include "virnetdevbridge.h"
 #include "virnetdev.h"
+#include "virnetdevlinkcache.h"
 #include "virerror.h"
 #include "virutil.h"
 #include "virfile.h"
@@ -243,6 +244,7 @@ int virNetDevBridgeCreate(const char *brname)
         goto cleanup;
     }
 
+    virNetDevLinkCacheInvalidate(brname);
     ret = 0;
 
  cleanup:
@@ -306,6 +308,7 @@ int virNetDevBridgeDelete(const char *brname)
         goto cleanup;
     }
 
+    virNetDevLinkCacheInvalidate(brname);
     ret = 0;
 
  cleanup:
@@ -375,6 +378,9 @@ int virNetDevBridgeAddPort(const char *brname,
         goto cleanup;
     }
 
+    /* The port's master and the bridge's own state both change */
+    virNetDevLinkCacheInvalidate(ifname);
+    virNetDevLinkCacheInvalidate(brname);
     ret = 0;
  cleanup:
     VIR_FORCE_CLOSE(fd);
@@ -445,6 +451,9 @@ int virNetDevBridgeRemovePort(const char *brname,
         goto cleanup;
     }
 
+    /* The port's master and the bridge's own state both change */
+    virNetDevLinkCacheInvalidate(ifname);
+    virNetDevLinkCacheInvalidate(brname);
     ret = 0;
  cleanup:
     VIR_FORCE_CLOSE(fd);
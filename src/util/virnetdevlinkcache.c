@@ -0,0 +1,355 @@
+/*
+ * virnetdevlinkcache.c: cache of the state of network devices
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+
+#include "virnetdevlinkcache.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virhash.h"
+#include "virlog.h"
+#include "virnetlink.h"
+#include "virthread.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <net/if.h>
+# include <linux/rtnetlink.h>
+#endif
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.netdevlinkcache");
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+/*
+ * The state of the devices looked up so far, by name. It is only kept
+ * by the process running the NETLINK_ROUTE event service, which tells
+ * about every change of a device so its entry can be dropped.
+ *
+ * Notifications only ever invalidate entries, they don't update them:
+ * one still queued from before this process changed a device would
+ * otherwise put the old state back. The next lookup asks the kernel
+ * again instead. Likewise, changes made by this process invalidate the
+ * device right away rather than when their notification comes in.
+ */
+static virMutex linkCacheLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr linkCache;
+static pid_t linkCachePid;
+/* Bumped for every invalidation, so that an entry fetched from the
+ * kernel meanwhile isn't added as it may already be stale */
+static unsigned long long linkCacheSerial;
+static int linkCacheOverruns;
+static virNetDevLinkCacheStats linkCacheStats;
+
+# define VIR_NETDEV_LINK_CACHE_SIZE 64
+
+
+static int
+virNetDevLinkCacheMatchIndex(const void *payload,
+                             const void *name ATTRIBUTE_UNUSED,
+                             const void *opaque)
+{
+    const virNetDevLinkCacheEntry *entry = payload;
+    const int *ifindex = opaque;
+
+    return entry->ifindex == *ifindex;
+}
+
+
+static void
+virNetDevLinkCacheHandleEvent(struct nlmsghdr *hdr,
+                              unsigned int length,
+                              struct sockaddr_nl *peer,
+                              bool *handled ATTRIBUTE_UNUSED,
+                              void *opaque ATTRIBUTE_UNUSED)
+{
+    struct ifinfomsg *ifinfo;
+    ssize_t removed;
+
+    if (peer->nl_pid != 0 ||
+        length < NLMSG_LENGTH(sizeof(*ifinfo)) ||
+        (hdr->nlmsg_type != RTM_NEWLINK && hdr->nlmsg_type != RTM_DELLINK))
+        return;
+
+    ifinfo = NLMSG_DATA(hdr);
+
+    virMutexLock(&linkCacheLock);
+    if (linkCache) {
+        /* Matching by index covers renames too */
+        linkCacheSerial++;
+        if ((removed = virHashRemoveSet(linkCache,
+                                        virNetDevLinkCacheMatchIndex,
+                                        &ifinfo->ifi_index)) > 0)
+            linkCacheStats.invalidations += removed;
+    }
+    virMutexUnlock(&linkCacheLock);
+}
+
+
+static void
+virNetDevLinkCacheRemove(int watch ATTRIBUTE_UNUSED,
+                         const virMacAddr *macaddr ATTRIBUTE_UNUSED,
+                         void *opaque ATTRIBUTE_UNUSED)
+{
+    virMutexLock(&linkCacheLock);
+    VIR_DEBUG("Stopping link cache: %llu hits, %llu misses, "
+              "%llu invalidations", linkCacheStats.hits,
+              linkCacheStats.misses, linkCacheStats.invalidations);
+    virHashFree(linkCache);
+    linkCache = NULL;
+    virMutexUnlock(&linkCacheLock);
+}
+
+
+/**
+ * virNetDevLinkCacheStart:
+ *
+ * Start caching the state of network devices in this process, which
+ * must be running the NETLINK_ROUTE event service.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNetDevLinkCacheStart(void)
+{
+    virHashTablePtr table;
+    bool running;
+
+    virMutexLock(&linkCacheLock);
+    running = linkCache != NULL;
+    virMutexUnlock(&linkCacheLock);
+    if (running)
+        return 0;
+
+    if (!virNetlinkEventServiceIsRunning(NETLINK_ROUTE)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("netlink event service not running"));
+        return -1;
+    }
+
+    if (!(table = virHashCreate(VIR_NETDEV_LINK_CACHE_SIZE,
+                                virHashValueFree)))
+        return -1;
+
+    if (virNetlinkEventServiceJoinGroup(NETLINK_ROUTE, RTNLGRP_LINK) < 0 ||
+        virNetlinkEventAddClient(virNetDevLinkCacheHandleEvent,
+                                 virNetDevLinkCacheRemove,
+                                 NULL, NULL, NETLINK_ROUTE) < 0) {
+        virHashFree(table);
+        return -1;
+    }
+
+    /* Notifications may come in from now on, only start filling the
+     * cache once nothing can be missed anymore */
+    virMutexLock(&linkCacheLock);
+    virHashFree(linkCache);
+    linkCache = table;
+    linkCachePid = getpid();
+    linkCacheOverruns = virNetlinkEventServiceOverruns(NETLINK_ROUTE);
+    virMutexUnlock(&linkCacheLock);
+
+    return 0;
+}
+
+
+/* Get the state of @ifname from the kernel. Returns 1 on success, 0
+ * if it is unknown, or -1 on error. */
+static int
+virNetDevLinkCacheFetch(const char *ifname,
+                        virNetDevLinkCacheEntryPtr entry)
+{
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nlattr *tb[IFLA_MAX + 1];
+    struct nlmsghdr *resp = NULL;
+    unsigned int recvbuflen = 0;
+    struct nl_msg *nl_msg;
+    struct ifinfomsg *info;
+    int ret = -1;
+
+    if (!(nl_msg = nlmsg_alloc_simple(RTM_GETLINK, NLM_F_REQUEST))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put(nl_msg, IFLA_IFNAME, strlen(ifname) + 1, ifname) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        goto cleanup;
+    }
+
+    if (virNetlinkCommand(nl_msg, &resp, &recvbuflen,
+                          0, 0, NETLINK_ROUTE, 0) < 0)
+        goto cleanup;
+
+    /* An error most likely means there is no such device, which the
+     * caller finds out about itself */
+    if (!resp || recvbuflen < NLMSG_LENGTH(sizeof(*info)) ||
+        resp->nlmsg_type != RTM_NEWLINK ||
+        nlmsg_parse(resp, sizeof(*info), tb, IFLA_MAX, NULL) < 0 ||
+        !tb[IFLA_MTU]) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    info = NLMSG_DATA(resp);
+    memset(entry, 0, sizeof(*entry));
+    entry->ifindex = info->ifi_index;
+    entry->flags = info->ifi_flags;
+    entry->mtu = nla_get_u32(tb[IFLA_MTU]);
+    if (tb[IFLA_ADDRESS] && nla_len(tb[IFLA_ADDRESS]) == VIR_MAC_BUFLEN) {
+        virMacAddrSetRaw(&entry->mac, nla_data(tb[IFLA_ADDRESS]));
+        entry->hasMAC = true;
+    }
+
+    ret = 1;
+
+ cleanup:
+    nlmsg_free(nl_msg);
+    VIR_FREE(resp);
+    return ret;
+}
+
+
+/**
+ * virNetDevLinkCacheLookup:
+ * @ifname: name of the device
+ * @entry: filled with the state of the device
+ *
+ * Look up the state of @ifname in the cache, or in the kernel if it
+ * isn't there yet. Failures aren't reported: the caller is expected
+ * to find out the state on its own then, and report any error.
+ *
+ * Returns 1 if @entry was filled, 0 otherwise.
+ */
+int
+virNetDevLinkCacheLookup(const char *ifname,
+                         virNetDevLinkCacheEntryPtr entry)
+{
+    virNetDevLinkCacheEntryPtr cached;
+    unsigned long long serial;
+    int overruns;
+
+    virMutexLock(&linkCacheLock);
+
+    /* A child process doesn't get the notifications */
+    if (!linkCache || linkCachePid != getpid()) {
+        virMutexUnlock(&linkCacheLock);
+        return 0;
+    }
+
+    /* Some notifications were lost, nothing can be trusted anymore */
+    overruns = virNetlinkEventServiceOverruns(NETLINK_ROUTE);
+    if (overruns != linkCacheOverruns) {
+        linkCacheStats.invalidations += virHashRemoveAll(linkCache);
+        linkCacheOverruns = overruns;
+        linkCacheSerial++;
+    }
+
+    if ((cached = virHashLookup(linkCache, ifname))) {
+        *entry = *cached;
+        linkCacheStats.hits++;
+        virMutexUnlock(&linkCacheLock);
+        return 1;
+    }
+
+    linkCacheStats.misses++;
+    serial = linkCacheSerial;
+    virMutexUnlock(&linkCacheLock);
+
+    if (virNetDevLinkCacheFetch(ifname, entry) <= 0)
+        return 0;
+
+    virMutexLock(&linkCacheLock);
+    if (linkCache && serial == linkCacheSerial &&
+        VIR_ALLOC_QUIET(cached) == 0) {
+        *cached = *entry;
+        if (virHashUpdateEntry(linkCache, ifname, cached) < 0)
+            VIR_FREE(cached);
+    }
+    virMutexUnlock(&linkCacheLock);
+
+    return 1;
+}
+
+
+/**
+ * virNetDevLinkCacheInvalidate:
+ * @ifname: name of the device
+ *
+ * Forget about the state of @ifname, which has to be called right
+ * after changing it or deleting the device.
+ */
+void
+virNetDevLinkCacheInvalidate(const char *ifname)
+{
+    virMutexLock(&linkCacheLock);
+    if (linkCache) {
+        linkCacheSerial++;
+        if (virHashRemoveEntry(linkCache, ifname) == 0)
+            linkCacheStats.invalidations++;
+    }
+    virMutexUnlock(&linkCacheLock);
+}
+
+
+/**
+ * virNetDevLinkCacheGetStats:
+ * @stats: filled with the statistics
+ *
+ * Get how well the cache has been doing so far.
+ */
+void
+virNetDevLinkCacheGetStats(virNetDevLinkCacheStatsPtr stats)
+{
+    virMutexLock(&linkCacheLock);
+    *stats = linkCacheStats;
+    virMutexUnlock(&linkCacheLock);
+}
+
+#else /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
+
+int
+virNetDevLinkCacheStart(void)
+{
+    VIR_DEBUG("Network device state can't be cached on this platform");
+    return 0;
+}
+
+int
+virNetDevLinkCacheLookup(const char *ifname ATTRIBUTE_UNUSED,
+                         virNetDevLinkCacheEntryPtr entry ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+void
+virNetDevLinkCacheInvalidate(const char *ifname ATTRIBUTE_UNUSED)
+{
+}
+
+void
+virNetDevLinkCacheGetStats(virNetDevLinkCacheStatsPtr stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+#endif /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
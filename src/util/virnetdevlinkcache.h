@@ -0,0 +1,55 @@
+/*
+ * virnetdevlinkcache.h: cache of the state of network devices
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_NETDEV_LINK_CACHE_H__
+# define __VIR_NETDEV_LINK_CACHE_H__
+
+# include "internal.h"
+# include "virmacaddr.h"
+
+typedef struct _virNetDevLinkCacheEntry virNetDevLinkCacheEntry;
+typedef virNetDevLinkCacheEntry *virNetDevLinkCacheEntryPtr;
+struct _virNetDevLinkCacheEntry {
+    int ifindex;
+    unsigned int flags;         /* IFF_* */
+    int mtu;
+    bool hasMAC;                /* some devices don't have one */
+    virMacAddr mac;
+};
+
+typedef struct _virNetDevLinkCacheStats virNetDevLinkCacheStats;
+typedef virNetDevLinkCacheStats *virNetDevLinkCacheStatsPtr;
+struct _virNetDevLinkCacheStats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long invalidations;
+};
+
+int virNetDevLinkCacheStart(void);
+
+int virNetDevLinkCacheLookup(const char *ifname,
+                             virNetDevLinkCacheEntryPtr entry)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+void virNetDevLinkCacheInvalidate(const char *ifname)
+    ATTRIBUTE_NONNULL(1);
+
+void virNetDevLinkCacheGetStats(virNetDevLinkCacheStatsPtr stats)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_NETDEV_LINK_CACHE_H__ */
@@ -63,6 +63,7 @@ VIR_ENUM_IMPL(virNetDevMacVLanMode, VIR_NETDEV_MACVLAN_MODE_LAST,
 # include "virfile.h"
 # include "virnetlink.h"
 # include "virnetdev.h"
+# include "virnetdevlinkcache.h"
 # include "virpidfile.h"
 
 VIR_LOG_INIT("util.netdevmacvlan");
@@ -190,6 +191,7 @@ virNetDevMacVLanCreate(const char *ifname,
         goto malformed_resp;
     }
 
+    virNetDevLinkCacheInvalidate(ifname);
     rc = 0;
  cleanup:
     nlmsg_free(nl_msg);
@@ -267,6 +269,7 @@ int virNetDevMacVLanDelete(const char *ifname)
         goto malformed_resp;
     }
 
+    virNetDevLinkCacheInvalidate(ifname);
     rc = 0;
  cleanup:
     nlmsg_free(nl_msg);
@@ -505,7 +508,11 @@ virNetDevMacVLanVPortProfileCallback(struct nlmsghdr *hdr,
 
     data = nlmsg_data(hdr);
 
-    /* Quickly decide if we want this or not */
+    /* Quickly decide if we want this or not, before reading any pid
+     * file: the link notifications of the kernel come by here too */
+
+    if (hdr->nlmsg_type != RTM_SETLINK)
+        return; /* we only care for RTM_SETLINK */
 
     if (virPidFileReadPath(LLDPAD_PID_FILE, &lldpad_pid) < 0)
         return;
@@ -514,8 +521,6 @@ virNetDevMacVLanVPortProfileCallback(struct nlmsghdr *hdr,
 
     if (hdr->nlmsg_pid != lldpad_pid && hdr->nlmsg_pid != virip_pid)
         return; /* we only care for lldpad and virip messages */
-    if (hdr->nlmsg_type != RTM_SETLINK)
-        return; /* we only care for RTM_SETLINK */
     if (*handled)
         return; /* if it has been handled - dont handle again */
 
@@ -822,7 +827,7 @@ int virNetDevMacVLanCreateWithVPortProfile(const char *tgifname,
         MACVTAP_NAME_PATTERN : MACVLAN_NAME_PATTERN;
     int c, rc;
     char ifname[IFNAMSIZ];
-    int retries, do_retry = 0;
+    int do_retry = 0;
     uint32_t macvtapMode;
     const char *cr_ifname = NULL;
     int ret;
@@ -865,31 +870,30 @@ int virNetDevMacVLanCreateWithVPortProfile(const char *tgifname,
             return -1;
     } else {
  create_name:
-        retries = 5;
         virMutexLock(&virNetDevMacVLanCreateMutex);
+        /* Rather than checking first whether a name is free, just
+         * try it and move on to the next one if it is taken */
         for (c = 0; c < 8192; c++) {
             snprintf(ifname, sizeof(ifname), pattern, c);
-            if ((ret = virNetDevExists(ifname)) < 0) {
-                virMutexUnlock(&virNetDevMacVLanCreateMutex);
-                return -1;
+            rc = virNetDevMacVLanCreate(ifname, type, macaddress, linkdev,
+                                        macvtapMode, &do_retry);
+            if (rc == 0) {
+                cr_ifname = ifname;
+                break;
             }
-            if (!ret) {
-                rc = virNetDevMacVLanCreate(ifname, type, macaddress, linkdev,
-                                            macvtapMode, &do_retry);
-                if (rc == 0) {
-                    cr_ifname = ifname;
-                    break;
-                }
 
-                if (do_retry && --retries)
-                    continue;
+            if (!do_retry)
                 break;
-            }
         }
 
         virMutexUnlock(&virNetDevMacVLanCreateMutex);
-        if (!cr_ifname)
+        if (!cr_ifname) {
+            if (do_retry)
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unable to find a free name for %s device"),
+                               type);
             return -1;
+        }
     }
 
     if (virNetDevVPortProfileAssociate(cr_ifname,
@@ -29,23 +29,21 @@
 #include "viralloc.h"
 #include "virerror.h"
 #include "virmacaddr.h"
+#include "virovsdb.h"
 #include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
-/**
- * virNetDevOpenvswitchAddPort:
- * @brname: the bridge name
- * @ifname: the network interface name
- * @macaddr: the mac address of the virtual interface
- * @vmuuid: the Domain UUID that has this interface
- * @ovsport: the ovs specific fields
- *
- * Add an interface to the OVS bridge
- *
- * Returns 0 in case of success or -1 in case of failure.
+/* How long to wait for ovs-vswitchd to apply a change, like the
+ * --timeout=5 ovs-vsctl is run with */
+#define VIR_NETDEV_OVS_CFG_TIMEOUT_MS (5 * 1000)
+
+/*
+ * virNetDevOpenvswitchAddPort with ovs-vsctl, for when the database
+ * server can't be talked to directly.
  */
-int virNetDevOpenvswitchAddPort(const char *brname, const char *ifname,
+static int
+virNetDevOpenvswitchAddPortCommand(const char *brname, const char *ifname,
                                    const virMacAddr *macaddr,
                                    const unsigned char *vmuuid,
                                    virNetDevVPortProfilePtr ovsport,
@@ -164,31 +162,577 @@ int virNetDevOpenvswitchAddPort(const char *brname, const char *ifname,
     return ret;
 }
 
+/* virNetDevOpenvswitchRemovePort with ovs-vsctl */
+static int
+virNetDevOpenvswitchRemovePortCommand(const char *ifname)
+{
+    int ret = -1;
+    virCommandPtr cmd = NULL;
+
+    cmd = virCommandNew(OVSVSCTL);
+    virCommandAddArgList(cmd, "--timeout=5", "--", "--if-exists", "del-port", ifname, NULL);
+
+    if (virCommandRun(cmd, NULL) < 0) {
+        virReportSystemError(VIR_ERR_INTERNAL_ERROR,
+                             _("Unable to delete port %s from OVS"), ifname);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCommandFree(cmd);
+    return ret;
+}
+
+/* [@key, @value], an entry of a map */
+static virJSONValuePtr
+virNetDevOpenvswitchMapEntry(const char *key, const char *value)
+{
+    return virOVSDBNewArray(2,
+                            virJSONValueNewString(key),
+                            virJSONValueNewString(value));
+}
+
+/* [@type, @value], the way OVSDB encodes sets, maps and UUIDs */
+static virJSONValuePtr
+virNetDevOpenvswitchTagged(const char *type, virJSONValuePtr value)
+{
+    return virOVSDBNewArray(2, virJSONValueNewString(type), value);
+}
+
+/* Reference to the row inserted as @name by the same transaction */
+static virJSONValuePtr
+virNetDevOpenvswitchNamedUUID(const char *name)
+{
+    return virNetDevOpenvswitchTagged("named-uuid",
+                                      virJSONValueNewString(name));
+}
+
+/* Condition matching the rows named @name */
+static virJSONValuePtr
+virNetDevOpenvswitchWhereName(const char *name)
+{
+    return virOVSDBNewArray(1,
+                            virOVSDBNewArray(3,
+                                             virJSONValueNewString("name"),
+                                             virJSONValueNewString("=="),
+                                             virJSONValueNewString(name)));
+}
+
+/* Operation looking up the rows of @table named @name */
+static virJSONValuePtr
+virNetDevOpenvswitchSelect(const char *table, const char *name)
+{
+    return virOVSDBNewObject("op", virJSONValueNewString("select"),
+                             "table", virJSONValueNewString(table),
+                             "where", virNetDevOpenvswitchWhereName(name),
+                             "columns",
+                             virOVSDBNewArray(1, virJSONValueNewString("_uuid")),
+                             NULL);
+}
+
+/* Operation inserting @row into @table, as @name for the rest of the
+ * transaction */
+static virJSONValuePtr
+virNetDevOpenvswitchInsert(const char *table, virJSONValuePtr row,
+                           const char *name)
+{
+    return virOVSDBNewObject("op", virJSONValueNewString("insert"),
+                             "table", virJSONValueNewString(table),
+                             "row", row,
+                             "uuid-name", virJSONValueNewString(name),
+                             NULL);
+}
+
+/* Operation applying @mutator and @value to @column of the rows of
+ * @table matching @where */
+static virJSONValuePtr
+virNetDevOpenvswitchMutate(const char *table, virJSONValuePtr where,
+                           const char *column, const char *mutator,
+                           virJSONValuePtr value)
+{
+    virJSONValuePtr mutation = virOVSDBNewArray(3,
+                                                virJSONValueNewString(column),
+                                                virJSONValueNewString(mutator),
+                                                value);
+
+    return virOVSDBNewObject("op", virJSONValueNewString("mutate"),
+                             "table", virJSONValueNewString(table),
+                             "where", where,
+                             "mutations", virOVSDBNewArray(1, mutation),
+                             NULL);
+}
+
+/* Operation adding or removing (depending on @mutator) @ports to or
+ * from the bridges matching @where */
+static virJSONValuePtr
+virNetDevOpenvswitchMutatePorts(virJSONValuePtr where,
+                                const char *mutator,
+                                virJSONValuePtr ports)
+{
+    return virNetDevOpenvswitchMutate("Bridge", where, "ports", mutator,
+                                      ports);
+}
+
+/*
+ * Take the UUIDs of the rows found by the select operation with the
+ * given @result, as an OVSDB set of them, whose size is stored in
+ * @count.
+ */
+static virJSONValuePtr
+virNetDevOpenvswitchTakeUUIDs(virJSONValuePtr result, size_t *count)
+{
+    virJSONValuePtr rows = virJSONValueObjectGet(result, "rows");
+    virJSONValuePtr uuids;
+    size_t i;
+
+    if (!rows || !virJSONValueIsArray(rows)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed reply from OVSDB"));
+        return NULL;
+    }
+
+    if (!(uuids = virJSONValueNewArray()))
+        return NULL;
+
+    for (i = 0; i < virJSONValueArraySize(rows); i++) {
+        virJSONValuePtr uuid = NULL;
+
+        if (virJSONValueObjectRemoveKey(virJSONValueArrayGet(rows, i),
+                                        "_uuid", &uuid) <= 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed reply from OVSDB"));
+            virJSONValueFree(uuids);
+            return NULL;
+        }
+
+        if (virJSONValueArrayAppend(uuids, uuid) < 0) {
+            virJSONValueFree(uuid);
+            virJSONValueFree(uuids);
+            return NULL;
+        }
+    }
+
+    *count = virJSONValueArraySize(uuids);
+    return virNetDevOpenvswitchTagged("set", uuids);
+}
+
+/*
+ * Operation making the transaction fail, rather than wait, unless the
+ * rows of @table named @name are still exactly those in the OVSDB set
+ * @uuids, as returned by virNetDevOpenvswitchTakeUUIDs.
+ */
+static virJSONValuePtr
+virNetDevOpenvswitchWaitRows(const char *table, const char *name,
+                             virJSONValuePtr uuids)
+{
+    virJSONValuePtr list = virJSONValueArrayGet(uuids, 1);
+    virJSONValuePtr rows;
+    size_t i;
+
+    if (!(rows = virJSONValueNewArray()))
+        return NULL;
+
+    for (i = 0; i < virJSONValueArraySize(list); i++) {
+        virJSONValuePtr uuid = virJSONValueArrayGet(list, i);
+        const char *str = virJSONValueGetString(virJSONValueArrayGet(uuid, 1));
+        virJSONValuePtr row;
+
+        row = virOVSDBNewObject("_uuid",
+                                virNetDevOpenvswitchTagged("uuid",
+                                                           virJSONValueNewString(str)),
+                                NULL);
+        if (!row || virJSONValueArrayAppend(rows, row) < 0) {
+            virJSONValueFree(row);
+            virJSONValueFree(rows);
+            return NULL;
+        }
+    }
+
+    return virOVSDBNewObject("op", virJSONValueNewString("wait"),
+                             "timeout", virJSONValueNewNumberInt(0),
+                             "table", virJSONValueNewString(table),
+                             "where", virNetDevOpenvswitchWhereName(name),
+                             "columns",
+                             virOVSDBNewArray(1, virJSONValueNewString("_uuid")),
+                             "until", virJSONValueNewString("=="),
+                             "rows", rows,
+                             NULL);
+}
+
+/* Operation reading next_cfg of the single Open_vSwitch row */
+static virJSONValuePtr
+virNetDevOpenvswitchSelectNextCfg(void)
+{
+    return virOVSDBNewObject("op", virJSONValueNewString("select"),
+                             "table", virJSONValueNewString("Open_vSwitch"),
+                             "where", virJSONValueNewArray(),
+                             "columns",
+                             virOVSDBNewArray(1, virJSONValueNewString("next_cfg")),
+                             NULL);
+}
+
+/* Get next_cfg from the result of virNetDevOpenvswitchSelectNextCfg */
+static int
+virNetDevOpenvswitchGetNextCfg(virJSONValuePtr result, long long *cfg)
+{
+    virJSONValuePtr rows = virJSONValueObjectGet(result, "rows");
+
+    if (!rows || !virJSONValueIsArray(rows) ||
+        virJSONValueArraySize(rows) != 1 ||
+        virJSONValueObjectGetNumberLong(virJSONValueArrayGet(rows, 0),
+                                        "next_cfg", cfg) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed reply from OVSDB"));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * virOVSDBMonitorFunc telling whether ovs-vswitchd applied the
+ * configuration @opaque points to, which it reports by copying
+ * next_cfg to cur_cfg.
+ */
+static int
+virNetDevOpenvswitchCheckCfg(virJSONValuePtr rows, void *opaque)
+{
+    long long *cfg = opaque;
+    long long cur;
+    int nrows = virJSONValueObjectKeysNumber(rows);
+    int i;
+
+    for (i = 0; i < nrows; i++) {
+        virJSONValuePtr row = virJSONValueObjectGetValue(rows, i);
+
+        if ((row = virJSONValueObjectGet(row, "new")) &&
+            virJSONValueObjectGetNumberLong(row, "cur_cfg", &cur) == 0 &&
+            cur >= *cfg)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Append @value to @array, taking it over. A NULL @value is the
+ * failure of whatever was to create it. */
+static int
+virNetDevOpenvswitchAppend(virJSONValuePtr array, virJSONValuePtr value)
+{
+    if (!value)
+        return -1;
+
+    if (virJSONValueArrayAppend(array, value) < 0) {
+        virJSONValueFree(value);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The external_ids of the Interface row for a domain's interface */
+static virJSONValuePtr
+virNetDevOpenvswitchExternalIDs(const virMacAddr *macaddr,
+                                const unsigned char *vmuuid,
+                                virNetDevVPortProfilePtr ovsport)
+{
+    char macaddrstr[VIR_MAC_STRING_BUFLEN];
+    char ifuuidstr[VIR_UUID_STRING_BUFLEN];
+    char vmuuidstr[VIR_UUID_STRING_BUFLEN];
+    virJSONValuePtr extids;
+
+    virMacAddrFormat(macaddr, macaddrstr);
+    virUUIDFormat(ovsport->interfaceID, ifuuidstr);
+    virUUIDFormat(vmuuid, vmuuidstr);
+
+    extids = virOVSDBNewArray(4,
+                              virNetDevOpenvswitchMapEntry("attached-mac",
+                                                           macaddrstr),
+                              virNetDevOpenvswitchMapEntry("iface-id",
+                                                           ifuuidstr),
+                              virNetDevOpenvswitchMapEntry("vm-id",
+                                                           vmuuidstr),
+                              virNetDevOpenvswitchMapEntry("iface-status",
+                                                           "active"));
+    if (!extids)
+        return NULL;
+
+    if (ovsport->profileID[0] != '\0' &&
+        virNetDevOpenvswitchAppend(extids,
+                                   virNetDevOpenvswitchMapEntry("port-profile",
+                                                                ovsport->profileID)) < 0) {
+        virJSONValueFree(extids);
+        return NULL;
+    }
+
+    return virNetDevOpenvswitchTagged("map", extids);
+}
+
+/* The Port row for @ifname, with the VLAN settings of @virtVlan */
+static virJSONValuePtr
+virNetDevOpenvswitchPortRow(const char *ifname, virNetDevVlanPtr virtVlan)
+{
+    virJSONValuePtr port;
+    virJSONValuePtr trunks;
+    int tag = -1;
+    size_t i;
+
+    if (!(port = virOVSDBNewObject("name", virJSONValueNewString(ifname),
+                                   "interfaces",
+                                   virNetDevOpenvswitchNamedUUID("iface"),
+                                   NULL)))
+        return NULL;
+
+    if (!virtVlan || virtVlan->nTags == 0)
+        return port;
+
+    switch (virtVlan->nativeMode) {
+    case VIR_NATIVE_VLAN_MODE_TAGGED:
+        if (virJSONValueObjectAppendString(port, "vlan_mode",
+                                           "native-tagged") < 0)
+            goto error;
+        tag = virtVlan->nativeTag;
+        break;
+    case VIR_NATIVE_VLAN_MODE_UNTAGGED:
+        if (virJSONValueObjectAppendString(port, "vlan_mode",
+                                           "native-untagged") < 0)
+            goto error;
+        tag = virtVlan->nativeTag;
+        break;
+    case VIR_NATIVE_VLAN_MODE_DEFAULT:
+    default:
+        break;
+    }
+
+    if (virtVlan->trunk) {
+        if (!(trunks = virJSONValueNewArray()))
+            goto error;
+
+        for (i = 0; i < virtVlan->nTags; i++) {
+            if (virNetDevOpenvswitchAppend(trunks,
+                                           virJSONValueNewNumberUint(virtVlan->tag[i])) < 0) {
+                virJSONValueFree(trunks);
+                goto error;
+            }
+        }
+
+        if (!(trunks = virNetDevOpenvswitchTagged("set", trunks)) ||
+            virJSONValueObjectAppend(port, "trunks", trunks) < 0) {
+            virJSONValueFree(trunks);
+            goto error;
+        }
+    } else {
+        tag = virtVlan->tag[0];
+    }
+
+    if (tag >= 0 &&
+        virJSONValueObjectAppendNumberInt(port, "tag", tag) < 0)
+        goto error;
+
+    return port;
+
+ error:
+    virJSONValueFree(port);
+    return NULL;
+}
+
+/**
+ * virNetDevOpenvswitchAddPort:
+ * @brname: the bridge name
+ * @ifname: the network interface name
+ * @macaddr: the mac address of the virtual interface
+ * @vmuuid: the Domain UUID that has this interface
+ * @ovsport: the ovs specific fields
+ *
+ * Add an interface to the OVS bridge, replacing any port of the same
+ * name. This is done in a single transaction over the connection to
+ * the database server, falling back to ovs-vsctl if there is none.
+ * Like ovs-vsctl, it then waits up to 5 seconds for ovs-vswitchd to
+ * pick up the change.
+ *
+ * Returns 0 in case of success or -1 in case of failure.
+ */
+int virNetDevOpenvswitchAddPort(const char *brname, const char *ifname,
+                                const virMacAddr *macaddr,
+                                const unsigned char *vmuuid,
+                                virNetDevVPortProfilePtr ovsport,
+                                virNetDevVlanPtr virtVlan)
+{
+    virJSONValuePtr ops = NULL;
+    virJSONValuePtr results = NULL;
+    virJSONValuePtr oldports = NULL;
+    virJSONValuePtr bridges = NULL;
+    virJSONValuePtr op;
+    virJSONValuePtr iface;
+    virJSONValuePtr port;
+    virJSONValuePtr newports;
+    size_t noldports = 0;
+    size_t nbridges = 0;
+    size_t insertIdx;
+    long long count;
+    long long cfg;
+    int ret = -1;
+
+    if (!virOVSDBAvailable())
+        return virNetDevOpenvswitchAddPortCommand(brname, ifname, macaddr,
+                                                  vmuuid, ovsport, virtVlan);
+
+    /* The port being replaced, if any, has to be found by its UUID */
+    ops = virOVSDBNewArray(2,
+                           virNetDevOpenvswitchSelect("Port", ifname),
+                           virNetDevOpenvswitchSelect("Bridge", brname));
+    if (!ops || virOVSDBTransact(ops, &results) < 0) {
+        ops = NULL;
+        goto cleanup;
+    }
+    ops = NULL;
+
+    if (!(oldports = virNetDevOpenvswitchTakeUUIDs(virJSONValueArrayGet(results, 0),
+                                                   &noldports)) ||
+        !(bridges = virNetDevOpenvswitchTakeUUIDs(virJSONValueArrayGet(results, 1),
+                                                  &nbridges)))
+        goto cleanup;
+
+    if (nbridges == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to add port %s to OVS bridge %s: "
+                         "no such bridge"), ifname, brname);
+        goto cleanup;
+    }
+
+    if (!(ops = virJSONValueNewArray()))
+        goto cleanup;
+
+    /* Don't replace a port some other client added or replaced since
+     * it was looked up */
+    op = virNetDevOpenvswitchWaitRows("Port", ifname, oldports);
+    if (virNetDevOpenvswitchAppend(ops, op) < 0)
+        goto cleanup;
+
+    if (noldports > 0) {
+        op = virNetDevOpenvswitchMutatePorts(virJSONValueNewArray(),
+                                             "delete", oldports);
+        oldports = NULL;
+        if (virNetDevOpenvswitchAppend(ops, op) < 0)
+            goto cleanup;
+    }
+
+    iface = virOVSDBNewObject("name", virJSONValueNewString(ifname),
+                              "external_ids",
+                              virNetDevOpenvswitchExternalIDs(macaddr, vmuuid,
+                                                              ovsport),
+                              NULL);
+    op = virNetDevOpenvswitchInsert("Interface", iface, "iface");
+    if (virNetDevOpenvswitchAppend(ops, op) < 0)
+        goto cleanup;
+
+    port = virNetDevOpenvswitchPortRow(ifname, virtVlan);
+    op = virNetDevOpenvswitchInsert("Port", port, "port");
+    if (virNetDevOpenvswitchAppend(ops, op) < 0)
+        goto cleanup;
+
+    newports = virOVSDBNewArray(1, virNetDevOpenvswitchNamedUUID("port"));
+    op = virNetDevOpenvswitchMutatePorts(virNetDevOpenvswitchWhereName(brname),
+                                         "insert",
+                                         virNetDevOpenvswitchTagged("set",
+                                                                    newports));
+    if (virNetDevOpenvswitchAppend(ops, op) < 0)
+        goto cleanup;
+    insertIdx = virJSONValueArraySize(ops) - 1;
+
+    /* Ask ovs-vswitchd to reconfigure, and learn what it'll report
+     * once it did */
+    op = virNetDevOpenvswitchMutate("Open_vSwitch", virJSONValueNewArray(),
+                                    "next_cfg", "+=",
+                                    virJSONValueNewNumberInt(1));
+    if (virNetDevOpenvswitchAppend(ops, op) < 0 ||
+        virNetDevOpenvswitchAppend(ops, virNetDevOpenvswitchSelectNextCfg()) < 0)
+        goto cleanup;
+
+    virJSONValueFree(results);
+    if (virOVSDBTransact(ops, &results) < 0) {
+        ops = NULL;
+        goto cleanup;
+    }
+    ops = NULL;
+
+    /* The bridge went away since it was looked up */
+    if (virJSONValueObjectGetNumberLong(virJSONValueArrayGet(results, insertIdx),
+                                        "count", &count) < 0 ||
+        count != 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to add port %s to OVS bridge %s"),
+                       ifname, brname);
+        goto cleanup;
+    }
+
+    if (virNetDevOpenvswitchGetNextCfg(virJSONValueArrayGet(results, insertIdx + 2),
+                                       &cfg) < 0)
+        goto cleanup;
+
+    /* Rather than polling cur_cfg, get told when ovs-vswitchd updates it */
+    if (virOVSDBMonitor("Open_vSwitch", "cur_cfg",
+                        VIR_NETDEV_OVS_CFG_TIMEOUT_MS,
+                        virNetDevOpenvswitchCheckCfg, &cfg) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virJSONValueFree(ops);
+    virJSONValueFree(results);
+    virJSONValueFree(oldports);
+    virJSONValueFree(bridges);
+    return ret;
+}
+
 /**
  * virNetDevOpenvswitchRemovePort:
  * @ifname: the network interface name
  *
- * Deletes an interface from a OVS bridge
+ * Deletes an interface from a OVS bridge, if it is there
  *
  * Returns 0 in case of success or -1 in case of failure.
  */
 int virNetDevOpenvswitchRemovePort(const char *brname ATTRIBUTE_UNUSED, const char *ifname)
 {
+    virJSONValuePtr ops;
+    virJSONValuePtr results = NULL;
+    virJSONValuePtr ports = NULL;
+    size_t nports = 0;
     int ret = -1;
-    virCommandPtr cmd = NULL;
 
-    cmd = virCommandNew(OVSVSCTL);
-    virCommandAddArgList(cmd, "--timeout=5", "--", "--if-exists", "del-port", ifname, NULL);
+    if (!virOVSDBAvailable())
+        return virNetDevOpenvswitchRemovePortCommand(ifname);
 
-    if (virCommandRun(cmd, NULL) < 0) {
-        virReportSystemError(VIR_ERR_INTERNAL_ERROR,
-                             _("Unable to delete port %s from OVS"), ifname);
+    if (!(ops = virOVSDBNewArray(1, virNetDevOpenvswitchSelect("Port", ifname))) ||
+        virOVSDBTransact(ops, &results) < 0)
+        goto cleanup;
+
+    if (!(ports = virNetDevOpenvswitchTakeUUIDs(virJSONValueArrayGet(results, 0),
+                                                &nports)))
+        goto cleanup;
+
+    if (nports == 0) {
+        ret = 0;
         goto cleanup;
     }
 
+    /* Removed from whichever bridge it is on, the port and its
+     * interface are then garbage collected by the server */
+    virJSONValueFree(results);
+    results = NULL;
+    ops = virOVSDBNewArray(1,
+                           virNetDevOpenvswitchMutatePorts(virJSONValueNewArray(),
+                                                           "delete", ports));
+    ports = NULL;
+    if (!ops || virOVSDBTransact(ops, &results) < 0)
+        goto cleanup;
+
     ret = 0;
  cleanup:
-    virCommandFree(cmd);
+    virJSONValueFree(results);
+    virJSONValueFree(ports);
     return ret;
 }
 
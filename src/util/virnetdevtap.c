@@ -26,6 +26,7 @@
 #include "virnetdevtap.h"
 #include "virnetdev.h"
 #include "virnetdevbridge.h"
+#include "virnetdevlinkcache.h"
 #include "virnetdevopenvswitch.h"
 #include "virerror.h"
 #include "virfile.h"
@@ -297,6 +298,7 @@ int virNetDevTapCreate(char **ifname,
             VIR_FREE(*ifname);
             if (VIR_STRDUP(*ifname, ifr.ifr_name) < 0)
                 goto cleanup;
+            virNetDevLinkCacheInvalidate(*ifname);
         }
 
         if ((flags & VIR_NETDEV_TAP_CREATE_PERSIST) &&
@@ -364,7 +366,10 @@ int virNetDevTapDelete(const char *ifname,
     ret = 0;
 
  cleanup:
+    /* The device goes away with the last file descriptor */
     VIR_FORCE_CLOSE(fd);
+    if (ret == 0)
+        virNetDevLinkCacheInvalidate(ifname);
     return ret;
 }
 #elif defined(SIOCIFCREATE2) && defined(SIOCIFDESTROY) && defined(IF_MAXUNIT)
@@ -543,6 +548,9 @@ int virNetDevTapCreateInBridgePort(const char *brname,
 {
     virMacAddr tapmac;
     char macaddrstr[VIR_MAC_STRING_BUFLEN];
+    virTristateBool online = (flags & VIR_NETDEV_TAP_CREATE_IFUP) ?
+        VIR_TRISTATE_BOOL_YES : VIR_TRISTATE_BOOL_NO;
+    int mtu;
     size_t i;
 
     if (virNetDevTapCreate(ifname, tunpath, tapfd, tapfdSize, flags) < 0)
@@ -571,29 +579,31 @@ int virNetDevTapCreateInBridgePort(const char *brname,
         tapmac.addr[0] = 0xFE; /* Discourage bridge from using TAP dev MAC */
     }
 
-    if (virNetDevSetMAC(*ifname, &tapmac) < 0)
-        goto error;
-
     /* We need to set the interface MTU before adding it
      * to the bridge, because the bridge will have its
      * MTU adjusted automatically when we add the new interface.
      */
-    if (virNetDevSetMTUFromDevice(*ifname, brname) < 0)
+    if ((mtu = virNetDevGetMTU(brname)) < 0)
         goto error;
 
     if (virtPortProfile) {
+        if (virNetDevSetLinkConfig(*ifname, &tapmac, mtu, NULL,
+                                   VIR_TRISTATE_BOOL_ABSENT) < 0)
+            goto error;
+
         if (virNetDevOpenvswitchAddPort(brname, *ifname, macaddr, vmuuid,
                                         virtPortProfile, virtVlan) < 0) {
             goto error;
         }
+
+        if (virNetDevSetOnline(*ifname, !!(flags & VIR_NETDEV_TAP_CREATE_IFUP)) < 0)
+            goto error;
     } else {
-        if (virNetDevBridgeAddPort(brname, *ifname) < 0)
+        /* MAC, MTU, bridge and link state in one batch of requests */
+        if (virNetDevSetLinkConfig(*ifname, &tapmac, mtu, brname, online) < 0)
             goto error;
     }
 
-    if (virNetDevSetOnline(*ifname, !!(flags & VIR_NETDEV_TAP_CREATE_IFUP)) < 0)
-        goto error;
-
     return 0;
 
  error:
@@ -34,6 +34,13 @@
 #include "virstring.h"
 #include "virutil.h"
 #include "virnetdev.h"
+#include "virnetdevlinkcache.h"
+#include "virnetlink.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <linux/rtnetlink.h>
+# include <linux/veth.h>
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -83,18 +90,155 @@ static int virNetDevVethGetFreeNum(int startDev)
     return -1;
 }
 
+#if defined(__linux__) && defined(HAVE_LIBNL)
+/*
+ * Create the veth pair @veth1/@veth2 with a RTM_NEWLINK request, the
+ * same one "ip link add @veth1 type veth peer name @veth2" sends.
+ *
+ * Returns 0 on success, 1 if one of the names is taken already and
+ * -1 on other errors.
+ */
+static int
+virNetDevVethCreateLink(const char *veth1, const char *veth2)
+{
+    int rc = -1;
+    struct nlmsghdr *resp = NULL;
+    struct nlmsgerr *err;
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    unsigned int recvbuflen;
+    struct nl_msg *nl_msg;
+    struct nlattr *linkinfo, *info_data, *peer;
+
+    nl_msg = nlmsg_alloc_simple(RTM_NEWLINK,
+                                NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL);
+    if (!nl_msg) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0)
+        goto buffer_too_small;
+
+    if (nla_put(nl_msg, IFLA_IFNAME, strlen(veth1) + 1, veth1) < 0)
+        goto buffer_too_small;
+
+    if (!(linkinfo = nla_nest_start(nl_msg, IFLA_LINKINFO)))
+        goto buffer_too_small;
+
+    if (nla_put(nl_msg, IFLA_INFO_KIND, strlen("veth"), "veth") < 0)
+        goto buffer_too_small;
+
+    if (!(info_data = nla_nest_start(nl_msg, IFLA_INFO_DATA)))
+        goto buffer_too_small;
+
+    /* The peer is described by an ifinfomsg and its own attributes */
+    if (!(peer = nla_nest_start(nl_msg, VETH_INFO_PEER)))
+        goto buffer_too_small;
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0)
+        goto buffer_too_small;
+
+    if (nla_put(nl_msg, IFLA_IFNAME, strlen(veth2) + 1, veth2) < 0)
+        goto buffer_too_small;
+
+    nla_nest_end(nl_msg, peer);
+    nla_nest_end(nl_msg, info_data);
+    nla_nest_end(nl_msg, linkinfo);
+
+    if (virNetlinkCommand(nl_msg, &resp, &recvbuflen, 0, 0,
+                          NETLINK_ROUTE, 0) < 0)
+        goto cleanup;
+
+    if (recvbuflen < NLMSG_LENGTH(0) || resp == NULL)
+        goto malformed_resp;
+
+    switch (resp->nlmsg_type) {
+    case NLMSG_ERROR:
+        err = (struct nlmsgerr *)NLMSG_DATA(resp);
+        if (resp->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+            goto malformed_resp;
+
+        switch (err->error) {
+        case 0:
+            break;
+
+        case -EEXIST:
+            rc = 1;
+            goto cleanup;
+
+        default:
+            virReportSystemError(-err->error,
+                                 _("Failed to create veth host: %s guest: %s"),
+                                 veth1, veth2);
+            goto cleanup;
+        }
+        break;
+
+    case NLMSG_DONE:
+        break;
+
+    default:
+        goto malformed_resp;
+    }
+
+    rc = 0;
+ cleanup:
+    nlmsg_free(nl_msg);
+    VIR_FREE(resp);
+    return rc;
+
+ malformed_resp:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("malformed netlink response message"));
+    goto cleanup;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    goto cleanup;
+}
+#else /* defined(__linux__) && defined(HAVE_LIBNL) */
+static int
+virNetDevVethCreateLink(const char *veth1, const char *veth2)
+{
+    virCommandPtr cmd;
+    int status;
+    int rc = -1;
+
+    cmd = virCommandNewArgList("ip", "link", "add", veth1,
+                               "type", "veth", "peer", "name", veth2,
+                               NULL);
+
+    if (virCommandRun(cmd, &status) < 0)
+        goto cleanup;
+
+    /* Not knowing why it failed, let the caller try other names */
+    if (status != 0) {
+        VIR_DEBUG("Failed to create veth host: %s guest: %s: %d",
+                  veth1, veth2, status);
+        rc = 1;
+        goto cleanup;
+    }
+
+    rc = 0;
+ cleanup:
+    virCommandFree(cmd);
+    return rc;
+}
+#endif /* defined(__linux__) && defined(HAVE_LIBNL) */
+
 /**
  * virNetDevVethCreate:
  * @veth1: pointer to name for parent end of veth pair
  * @veth2: pointer to return name for container end of veth pair
  *
- * Creates a veth device pair using the ip command:
+ * Creates a veth device pair, like the ip command does with:
  * ip link add veth1 type veth peer name veth2
  * If veth1 points to NULL on entry, it will be a valid interface on
  * return.  veth2 should point to NULL on entry.
  *
- * NOTE: If veth1 and veth2 names are not specified, ip will auto assign
- *       names.  There seems to be two problems here -
+ * NOTE: If veth1 and veth2 names are not specified, the kernel will assign
+ *       them.  There seems to be two problems here -
  *       1) There doesn't seem to be a way to determine the names of the
  *          devices that it creates.  They show up in ip link show and
  *          under /sys/class/net/ however there is no guarantee that they
@@ -103,7 +247,7 @@ static int virNetDevVethGetFreeNum(int startDev)
  *          is no longer visible in the parent namespace.  This seems to
  *          confuse the name assignment causing it to fail with File exists.
  *       Because of these issues, this function currently allocates names
- *       prior to using the ip command, and returns any allocated names
+ *       prior to creating the devices, and returns any allocated names
  *       to the caller.
  *
  * Returns 0 on success or -1 in case of error
@@ -114,7 +258,7 @@ int virNetDevVethCreate(char** veth1, char** veth2)
     char *veth1auto = NULL;
     char *veth2auto = NULL;
     int vethNum = 0;
-    virCommandPtr cmd = NULL;
+    int rc;
     size_t i;
 
     /*
@@ -125,7 +269,6 @@ int virNetDevVethCreate(char** veth1, char** veth2)
 #define MAX_VETH_RETRIES 10
 
     for (i = 0; i < MAX_VETH_RETRIES; i++) {
-        int status;
         if (!*veth1) {
             int veth1num;
             if ((veth1num = virNetDevVethGetFreeNum(vethNum)) < 0)
@@ -145,17 +288,12 @@ int virNetDevVethCreate(char** veth1, char** veth2)
             vethNum = veth2num + 1;
         }
 
-        cmd = virCommandNew("ip");
-        virCommandAddArgList(cmd, "link", "add",
-                             *veth1 ? *veth1 : veth1auto,
-                             "type", "veth", "peer", "name",
-                             *veth2 ? *veth2 : veth2auto,
-                             NULL);
-
-        if (virCommandRun(cmd, &status) < 0)
+        rc = virNetDevVethCreateLink(*veth1 ? *veth1 : veth1auto,
+                                     *veth2 ? *veth2 : veth2auto);
+        if (rc < 0)
             goto cleanup;
 
-        if (status == 0) {
+        if (rc == 0) {
             if (veth1auto) {
                 *veth1 = veth1auto;
                 veth1auto = NULL;
@@ -164,19 +302,18 @@ int virNetDevVethCreate(char** veth1, char** veth2)
                 *veth2 = veth2auto;
                 veth2auto = NULL;
             }
+            virNetDevLinkCacheInvalidate(*veth1);
+            virNetDevLinkCacheInvalidate(*veth2);
             VIR_DEBUG("Create Host: %s guest: %s", *veth1, *veth2);
             ret = 0;
             goto cleanup;
         }
 
-        VIR_DEBUG("Failed to create veth host: %s guest: %s: %d",
+        VIR_DEBUG("Failed to create veth host: %s guest: %s: name taken",
                   *veth1 ? *veth1 : veth1auto,
-                  *veth2 ? *veth2 : veth2auto,
-                  status);
+                  *veth2 ? *veth2 : veth2auto);
         VIR_FREE(veth1auto);
         VIR_FREE(veth2auto);
-        virCommandFree(cmd);
-        cmd = NULL;
     }
 
     virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -185,7 +322,6 @@ int virNetDevVethCreate(char** veth1, char** veth2)
 
  cleanup:
     virMutexUnlock(&virNetDevVethCreateMutex);
-    virCommandFree(cmd);
     VIR_FREE(veth1auto);
     VIR_FREE(veth2auto);
     return ret;
@@ -211,6 +347,8 @@ int virNetDevVethDelete(const char *veth)
     if (virCommandRun(cmd, &status) < 0)
         goto cleanup;
 
+    virNetDevLinkCacheInvalidate(veth);
+
     if (status != 0) {
         if (!virNetDevExists(veth)) {
             VIR_DEBUG("Device %s already deleted (by kernel namespace cleanup)", veth);
@@ -38,6 +38,7 @@
 #include "virnetlink.h"
 #include "virlog.h"
 #include "viralloc.h"
+#include "viratomic.h"
 #include "virthread.h"
 #include "virmacaddr.h"
 #include "virerror.h"
@@ -78,6 +79,7 @@ typedef virNetlinkEventSrvPrivate *virNetlinkEventSrvPrivatePtr;
 struct _virNetlinkEventSrvPrivate {
     /*Server*/
     virMutex lock;
+    unsigned int protocol;
     int eventwatch;
     int netlinkfd;
     virNetlinkHandle *netlinknh;
@@ -103,8 +105,38 @@ static int nextWatch = 1;
 /* Linux kernel supports up to MAX_LINKS (32 at the time) individual
  * netlink protocols. */
 static virNetlinkEventSrvPrivatePtr server[MAX_LINKS] = {NULL};
+
+/* How many times each event service lost messages, see
+ * virNetlinkEventServiceOverruns */
+static int overruns[MAX_LINKS];
 static virNetlinkHandle *placeholder_nlhandle;
 
+/* See virNetlinkSetDryRun for description for these variables */
+static virNetlinkDryRunCallback dryRunCallback;
+static void *dryRunOpaque;
+
+/* Requests to the kernel's NETLINK_ROUTE are sent over sockets kept
+ * open between calls instead of a new one each time. Each request
+ * takes a socket out of the pool for the whole exchange, so requests
+ * of different threads don't wait for each other; up to
+ * NETLINK_ROUTE_HANDLES_MAX idle sockets are kept. Sockets inherited
+ * over fork() or clone() are never reused, as the child may live in
+ * a different network namespace: routePid records the process the
+ * pooled sockets belong to. */
+# define NETLINK_ROUTE_HANDLES_MAX 4
+
+static virMutex routeLock = VIR_MUTEX_INITIALIZER;
+static virNetlinkHandle *routeHandles[NETLINK_ROUTE_HANDLES_MAX];
+static size_t nRouteHandles;
+static pid_t routePid;
+static uint32_t routeSeq;
+
+struct _virNetlinkBatch {
+    size_t nmsgs;
+    struct nl_msg **msgs;
+    int *errors;
+};
+
 /* Function definitions */
 
 /**
@@ -158,6 +190,233 @@ virNetlinkShutdown(void)
         virNetlinkFree(placeholder_nlhandle);
         placeholder_nlhandle = NULL;
     }
+
+    virMutexLock(&routeLock);
+    while (nRouteHandles)
+        virNetlinkFree(routeHandles[--nRouteHandles]);
+    virMutexUnlock(&routeLock);
+}
+
+/*
+ * Hand the message over to the dry run callback instead of the
+ * kernel and turn its verdict into the acknowledgement the kernel
+ * would have sent back.
+ */
+static int
+virNetlinkCommandDryRun(struct nl_msg *nl_msg,
+                        struct nlmsghdr **resp, unsigned int *respbuflen)
+{
+    struct nlmsghdr *nlmsg = nlmsg_hdr(nl_msg);
+    struct nlmsgerr *err;
+    char *buf;
+    int error;
+
+    error = dryRunCallback(nlmsg, dryRunOpaque);
+
+    if (VIR_ALLOC_N(buf, NLMSG_SPACE(sizeof(*err))) < 0)
+        return -1;
+
+    *resp = (struct nlmsghdr *)buf;
+    (*resp)->nlmsg_len = NLMSG_LENGTH(sizeof(*err));
+    (*resp)->nlmsg_type = NLMSG_ERROR;
+    (*resp)->nlmsg_seq = nlmsg->nlmsg_seq;
+
+    err = NLMSG_DATA(*resp);
+    err->error = -error;
+    err->msg = *nlmsg;
+
+    *respbuflen = (*resp)->nlmsg_len;
+    return 0;
+}
+
+/*
+ * Wait for the next datagram on @nlhandle and read it into a newly
+ * allocated *@buf. Returns its length or -1 on error.
+ */
+static int
+virNetlinkRecv(virNetlinkHandle *nlhandle, unsigned char **buf)
+{
+    struct sockaddr_nl nladdr;
+    struct pollfd fds[1];
+    int n;
+    int len;
+
+    memset(fds, 0, sizeof(fds));
+    fds[0].fd = nl_socket_get_fd(nlhandle);
+    fds[0].events = POLLIN;
+
+    n = poll(fds, ARRAY_CARDINALITY(fds), NETLINK_ACK_TIMEOUT_S);
+    if (n <= 0) {
+        if (n < 0)
+            virReportSystemError(errno, "%s",
+                                 _("error in poll call"));
+        if (n == 0)
+            virReportSystemError(ETIMEDOUT, "%s",
+                                 _("no valid netlink response was received"));
+        return -1;
+    }
+
+    len = nl_recv(nlhandle, &nladdr, buf, NULL);
+    if (len == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("nl_recv failed - returned 0 bytes"));
+        return -1;
+    }
+    if (len < 0) {
+        virReportSystemError(errno, "%s", _("nl_recv failed"));
+        return -1;
+    }
+
+    return len;
+}
+
+/*
+ * Take a route socket out of the pool, opening a new one if none is
+ * left. The caller has it to itself until it hands it back with
+ * virNetlinkRouteHandlePut or closes it with virNetlinkRouteHandleDrop.
+ */
+static virNetlinkHandle *
+virNetlinkRouteHandleGet(void)
+{
+    virNetlinkHandle *nlhandle = NULL;
+
+    virMutexLock(&routeLock);
+    if (routePid != getpid()) {
+        /* Inherited from the parent, close our copies */
+        while (nRouteHandles)
+            virNetlinkFree(routeHandles[--nRouteHandles]);
+        routePid = getpid();
+    }
+    if (nRouteHandles)
+        nlhandle = routeHandles[--nRouteHandles];
+    virMutexUnlock(&routeLock);
+
+    if (nlhandle)
+        return nlhandle;
+
+    if (!(nlhandle = virNetlinkAlloc())) {
+        virReportSystemError(errno,
+                             "%s", _("cannot allocate nlhandle for netlink"));
+        return NULL;
+    }
+
+    if (nl_connect(nlhandle, NETLINK_ROUTE) < 0) {
+        virReportSystemError(errno,
+                        _("cannot connect to netlink socket with protocol %d"),
+                             NETLINK_ROUTE);
+        virNetlinkFree(nlhandle);
+        return NULL;
+    }
+
+    return nlhandle;
+}
+
+/*
+ * Return a route socket to the pool after a completed exchange.
+ */
+static void
+virNetlinkRouteHandlePut(virNetlinkHandle *nlhandle)
+{
+    virMutexLock(&routeLock);
+    if (routePid == getpid() && nRouteHandles < NETLINK_ROUTE_HANDLES_MAX) {
+        routeHandles[nRouteHandles++] = nlhandle;
+        nlhandle = NULL;
+    }
+    virMutexUnlock(&routeLock);
+
+    if (nlhandle)
+        virNetlinkFree(nlhandle);
+}
+
+/*
+ * Close a route socket after a failed exchange instead of returning it
+ * to the pool, so that whatever is left queued on it can't confuse
+ * the next request.
+ */
+static void
+virNetlinkRouteHandleDrop(virNetlinkHandle *nlhandle)
+{
+    virNetlinkFree(nlhandle);
+}
+
+static uint32_t
+virNetlinkRouteNextSeq(void)
+{
+    uint32_t seq;
+
+    virMutexLock(&routeLock);
+    /* 0 would let libnl pick the sequence number itself */
+    if (++routeSeq == 0)
+        routeSeq = 1;
+    seq = routeSeq;
+    virMutexUnlock(&routeLock);
+
+    return seq;
+}
+
+/*
+ * virNetlinkCommand for requests to the kernel on NETLINK_ROUTE, which
+ * go over the route socket. Replies to earlier requests may still be
+ * queued there (acknowledgements nobody waited for, or answers which
+ * arrived after their request timed out), so the response is picked
+ * by its sequence number.
+ */
+static int
+virNetlinkRouteCommand(struct nl_msg *nl_msg,
+                       struct nlmsghdr **resp, unsigned int *respbuflen)
+{
+    struct sockaddr_nl nladdr = {
+            .nl_family = AF_NETLINK,
+            .nl_pid    = 0,
+            .nl_groups = 0,
+    };
+    struct nlmsghdr *nlmsg = nlmsg_hdr(nl_msg);
+    virNetlinkHandle *nlhandle;
+    unsigned char *buf = NULL;
+    int len;
+    int ret = -1;
+
+    if (!(nlhandle = virNetlinkRouteHandleGet()))
+        goto cleanup;
+
+    nlmsg_set_dst(nl_msg, &nladdr);
+
+    nlmsg->nlmsg_pid = getpid();
+    nlmsg->nlmsg_seq = virNetlinkRouteNextSeq();
+
+    if (nl_send_auto_complete(nlhandle, nl_msg) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot send to netlink socket"));
+        goto error;
+    }
+
+    for (;;) {
+        if ((len = virNetlinkRecv(nlhandle, &buf)) < 0)
+            goto error;
+
+        if (len >= NLMSG_HDRLEN &&
+            ((struct nlmsghdr *)buf)->nlmsg_seq == nlmsg->nlmsg_seq)
+            break;
+
+        VIR_DEBUG("discarding stale netlink message");
+        VIR_FREE(buf);
+    }
+
+    *resp = (struct nlmsghdr *)buf;
+    *respbuflen = len;
+    virNetlinkRouteHandlePut(nlhandle);
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        *resp = NULL;
+        *respbuflen = 0;
+    }
+    return ret;
+
+ error:
+    virNetlinkRouteHandleDrop(nlhandle);
+    goto cleanup;
 }
 
 /**
@@ -172,6 +431,8 @@ virNetlinkShutdown(void)
  * @groups: the group identifier
  *
  * Send the given message to the netlink layer and receive response.
+ * Plain NETLINK_ROUTE requests to the kernel reuse a socket kept
+ * open for the whole process, anything else gets a socket of its own.
  * Returns 0 on success, -1 on error. In case of error, no response
  * buffer will be returned.
  */
@@ -187,9 +448,7 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
             .nl_groups = 0,
     };
     ssize_t nbytes;
-    struct pollfd fds[1];
     int fd;
-    int n;
     struct nlmsghdr *nlmsg = nlmsg_hdr(nl_msg);
     virNetlinkHandle *nlhandle = NULL;
     int len = 0;
@@ -200,6 +459,12 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
         goto cleanup;
     }
 
+    if (dryRunCallback)
+        return virNetlinkCommandDryRun(nl_msg, resp, respbuflen);
+
+    if (protocol == NETLINK_ROUTE && !src_pid && !dst_pid && !groups)
+        return virNetlinkRouteCommand(nl_msg, resp, respbuflen);
+
     nlhandle = virNetlinkAlloc();
     if (!nlhandle) {
         virReportSystemError(errno,
@@ -238,31 +503,8 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
         goto cleanup;
     }
 
-    memset(fds, 0, sizeof(fds));
-    fds[0].fd = fd;
-    fds[0].events = POLLIN;
-
-    n = poll(fds, ARRAY_CARDINALITY(fds), NETLINK_ACK_TIMEOUT_S);
-    if (n <= 0) {
-        if (n < 0)
-            virReportSystemError(errno, "%s",
-                                 _("error in poll call"));
-        if (n == 0)
-            virReportSystemError(ETIMEDOUT, "%s",
-                                 _("no valid netlink response was received"));
-        goto cleanup;
-    }
-
-    len = nl_recv(nlhandle, &nladdr, (unsigned char **)resp, NULL);
-    if (len == 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("nl_recv failed - returned 0 bytes"));
+    if ((len = virNetlinkRecv(nlhandle, (unsigned char **)resp)) < 0)
         goto cleanup;
-    }
-    if (len < 0) {
-        virReportSystemError(errno, "%s", _("nl_recv failed"));
-        goto cleanup;
-    }
 
     ret = 0;
     *respbuflen = len;
@@ -276,6 +518,332 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
     return ret;
 }
 
+/**
+ * virNetlinkBatchNew:
+ *
+ * Create an empty batch of NETLINK_ROUTE requests to the kernel,
+ * see virNetlinkBatchSubmit.
+ *
+ * Returns the batch or NULL on error.
+ */
+virNetlinkBatchPtr
+virNetlinkBatchNew(void)
+{
+    virNetlinkBatchPtr batch;
+
+    ignore_value(VIR_ALLOC(batch));
+    return batch;
+}
+
+/**
+ * virNetlinkBatchAdd:
+ * @batch: the batch
+ * @nl_msg: the request to queue
+ *
+ * Queue @nl_msg in @batch. The batch owns the message afterwards,
+ * even when this fails.
+ *
+ * Returns the index of the request in @batch, or -1 on error.
+ */
+int
+virNetlinkBatchAdd(virNetlinkBatchPtr batch,
+                   struct nl_msg *nl_msg)
+{
+    if (VIR_APPEND_ELEMENT(batch->msgs, batch->nmsgs, nl_msg) < 0) {
+        nlmsg_free(nl_msg);
+        return -1;
+    }
+
+    return batch->nmsgs - 1;
+}
+
+/**
+ * virNetlinkBatchSubmit:
+ * @batch: the batch
+ *
+ * Send all the requests queued in @batch to the kernel in a single
+ * write over the route socket and wait for all of them to be
+ * acknowledged. The kernel carries on with the remaining requests
+ * when one of them fails, so they shouldn't depend on each other;
+ * virNetlinkBatchGetError tells how each of them went. Only requests
+ * answered with an acknowledgement alone belong in a batch, any
+ * other reply is thrown away.
+ *
+ * Returns 0 once every request was acknowledged, whether it
+ * succeeded or not, or -1 with an error reported.
+ */
+int
+virNetlinkBatchSubmit(virNetlinkBatchPtr batch)
+{
+    struct sockaddr_nl nladdr = {
+            .nl_family = AF_NETLINK,
+            .nl_pid    = 0,
+            .nl_groups = 0,
+    };
+    struct msghdr msg;
+    struct iovec *iov = NULL;
+    virNetlinkHandle *nlhandle;
+    unsigned char *buf = NULL;
+    size_t pending;
+    size_t i;
+    int ret = -1;
+
+    VIR_FREE(batch->errors);
+    if (batch->nmsgs == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(batch->errors, batch->nmsgs) < 0)
+        return -1;
+
+    if (dryRunCallback) {
+        for (i = 0; i < batch->nmsgs; i++)
+            batch->errors[i] = dryRunCallback(nlmsg_hdr(batch->msgs[i]),
+                                              dryRunOpaque);
+        return 0;
+    }
+
+    if (VIR_ALLOC_N(iov, batch->nmsgs) < 0)
+        return -1;
+
+    if (!(nlhandle = virNetlinkRouteHandleGet()))
+        goto cleanup;
+
+    for (i = 0; i < batch->nmsgs; i++) {
+        struct nlmsghdr *nlmsg = nlmsg_hdr(batch->msgs[i]);
+
+        nlmsg->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+        nlmsg->nlmsg_pid = getpid();
+        nlmsg->nlmsg_seq = virNetlinkRouteNextSeq();
+
+        iov[i].iov_base = nlmsg;
+        iov[i].iov_len = NLMSG_ALIGN(nlmsg->nlmsg_len);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &nladdr;
+    msg.msg_namelen = sizeof(nladdr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = batch->nmsgs;
+
+    if (sendmsg(nl_socket_get_fd(nlhandle), &msg, 0) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot send to netlink socket"));
+        goto error;
+    }
+
+    pending = batch->nmsgs;
+    while (pending) {
+        struct nlmsghdr *nlmsg;
+        int len;
+
+        if ((len = virNetlinkRecv(nlhandle, &buf)) < 0)
+            goto error;
+
+        for (nlmsg = (struct nlmsghdr *)buf; NLMSG_OK(nlmsg, len);
+             nlmsg = NLMSG_NEXT(nlmsg, len)) {
+            struct nlmsgerr *err = NLMSG_DATA(nlmsg);
+
+            if (nlmsg->nlmsg_type != NLMSG_ERROR ||
+                nlmsg->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+                continue;
+
+            for (i = 0; i < batch->nmsgs; i++) {
+                if (nlmsg_hdr(batch->msgs[i])->nlmsg_seq == nlmsg->nlmsg_seq) {
+                    batch->errors[i] = -err->error;
+                    pending--;
+                    break;
+                }
+            }
+        }
+
+        VIR_FREE(buf);
+    }
+
+    virNetlinkRouteHandlePut(nlhandle);
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(iov);
+    return ret;
+
+ error:
+    virNetlinkRouteHandleDrop(nlhandle);
+    goto cleanup;
+}
+
+/**
+ * virNetlinkBatchGetError:
+ * @batch: a submitted batch
+ * @idx: index of the request as returned by virNetlinkBatchAdd
+ *
+ * Returns 0 if the request succeeded or the errno value the kernel
+ * refused it with.
+ */
+int
+virNetlinkBatchGetError(virNetlinkBatchPtr batch,
+                        size_t idx)
+{
+    if (!batch->errors || idx >= batch->nmsgs)
+        return EINVAL;
+
+    return batch->errors[idx];
+}
+
+/**
+ * virNetlinkBatchFree:
+ * @batch: the batch
+ *
+ * Free @batch along with the requests queued in it.
+ */
+void
+virNetlinkBatchFree(virNetlinkBatchPtr batch)
+{
+    size_t i;
+
+    if (!batch)
+        return;
+
+    for (i = 0; i < batch->nmsgs; i++)
+        nlmsg_free(batch->msgs[i]);
+    VIR_FREE(batch->msgs);
+    VIR_FREE(batch->errors);
+    VIR_FREE(batch);
+}
+
+/**
+ * virNetlinkDumpCommand:
+ * @nl_msg: the dump request
+ * @callback: called for each message of the answer
+ * @opaque: data passed to @callback
+ *
+ * Send the NETLINK_ROUTE dump request @nl_msg to the kernel over the
+ * route socket and hand every message of the answer, which may span
+ * many datagrams, to @callback until the kernel says it is done. The
+ * callback returns -1 with an error reported to abort the dump.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNetlinkDumpCommand(struct nl_msg *nl_msg,
+                      virNetlinkDumpCallback callback,
+                      void *opaque)
+{
+    struct sockaddr_nl nladdr = {
+            .nl_family = AF_NETLINK,
+            .nl_pid    = 0,
+            .nl_groups = 0,
+    };
+    struct nlmsghdr *nlmsg = nlmsg_hdr(nl_msg);
+    virNetlinkHandle *nlhandle;
+    unsigned char *buf = NULL;
+    bool done = false;
+    int ret = -1;
+    int error;
+
+    nlmsg->nlmsg_flags |= NLM_F_REQUEST | NLM_F_DUMP;
+
+    if (dryRunCallback) {
+        /* Nothing to dump, but the request may still be refused */
+        if ((error = dryRunCallback(nlmsg, dryRunOpaque)) != 0) {
+            virReportSystemError(error, "%s", _("netlink dump failed"));
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!(nlhandle = virNetlinkRouteHandleGet()))
+        goto cleanup;
+
+    nlmsg_set_dst(nl_msg, &nladdr);
+
+    nlmsg->nlmsg_pid = getpid();
+    nlmsg->nlmsg_seq = virNetlinkRouteNextSeq();
+
+    if (nl_send_auto_complete(nlhandle, nl_msg) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot send to netlink socket"));
+        goto error;
+    }
+
+    while (!done) {
+        struct nlmsghdr *msg;
+        int len;
+
+        if ((len = virNetlinkRecv(nlhandle, &buf)) < 0)
+            goto error;
+
+        for (msg = (struct nlmsghdr *)buf; NLMSG_OK(msg, len);
+             msg = NLMSG_NEXT(msg, len)) {
+            struct nlmsgerr *err = NLMSG_DATA(msg);
+
+            if (msg->nlmsg_seq != nlmsg->nlmsg_seq) {
+                VIR_DEBUG("discarding stale netlink message");
+                continue;
+            }
+
+            if (msg->nlmsg_type == NLMSG_DONE) {
+                done = true;
+                break;
+            }
+
+            if (msg->nlmsg_type == NLMSG_ERROR) {
+                /* The dump ends with the error, nothing else follows */
+                if (msg->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+                    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                   _("malformed netlink response message"));
+                    goto error;
+                }
+                if (err->error) {
+                    virReportSystemError(-err->error, "%s",
+                                         _("netlink dump failed"));
+                    virNetlinkRouteHandlePut(nlhandle);
+                    goto cleanup;
+                }
+                done = true;
+                break;
+            }
+
+            /* The rest of the dump is still queued on the socket */
+            if (callback(msg, opaque) < 0)
+                goto error;
+        }
+
+        VIR_FREE(buf);
+    }
+
+    virNetlinkRouteHandlePut(nlhandle);
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
+
+ error:
+    virNetlinkRouteHandleDrop(nlhandle);
+    goto cleanup;
+}
+
+/**
+ * virNetlinkSetDryRun:
+ * @cb: callback to process the messages
+ * @opaque: data passed to @cb
+ *
+ * Like virCommandSetDryRun, but for netlink: once set, every
+ * message passed to virNetlinkCommand is handed to @cb instead of
+ * being sent to the kernel. The callback returns 0 to have the
+ * message acknowledged, or an errno value which is reported back
+ * the way the kernel would do it. This is meant for unit testing.
+ *
+ * To cancel this effect pass NULL for @cb.
+ */
+void
+virNetlinkSetDryRun(virNetlinkDryRunCallback cb,
+                    void *opaque)
+{
+    dryRunCallback = cb;
+    dryRunOpaque = opaque;
+}
+
 static void
 virNetlinkEventServerLock(virNetlinkEventSrvPrivatePtr driver)
 {
@@ -338,6 +906,12 @@ virNetlinkEventCallback(int watch,
 
     if (length == 0)
         return;
+    if (length < 0 && errno == ENOBUFS) {
+        VIR_WARN("netlink event socket with protocol %u overrun, "
+                 "messages were lost", srv->protocol);
+        virAtomicIntInc(&overruns[srv->protocol]);
+        return;
+    }
     if (length < 0) {
         virReportSystemError(errno,
                              "%s", _("nl_recv returned with error"));
@@ -492,6 +1066,65 @@ int virNetlinkEventServiceLocalPid(unsigned int protocol)
 }
 
 
+/**
+ * virNetlinkEventServiceJoinGroup:
+ *
+ * @protocol: netlink protocol
+ * @group: broadcast group to join in
+ *
+ * Have a running event service also receive the messages sent to
+ * @group, on top of those of the groups it was started with.
+ *
+ * Returns -1 on error, 0 on success.
+ */
+int
+virNetlinkEventServiceJoinGroup(unsigned int protocol, unsigned int group)
+{
+    virNetlinkEventSrvPrivatePtr srv;
+    int ret = -1;
+
+    if (protocol >= MAX_LINKS || !(srv = server[protocol])) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("netlink event service not running"));
+        return -1;
+    }
+
+    virNetlinkEventServerLock(srv);
+    if (nl_socket_add_membership(srv->netlinknh, group) < 0) {
+        virReportSystemError(errno,
+                             _("cannot add netlink membership %u"), group);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetlinkEventServerUnlock(srv);
+    return ret;
+}
+
+/**
+ * virNetlinkEventServiceOverruns:
+ *
+ * @protocol: netlink protocol
+ *
+ * Messages which don't fit in the receive buffer of the event
+ * service's socket are dropped by the kernel. Clients keeping state
+ * from the messages they get can compare this count over time to
+ * learn that they missed some and have to start over. It doesn't
+ * take any lock, so it can be called from within a client's callback.
+ *
+ * Returns how many times messages were lost so far.
+ */
+int
+virNetlinkEventServiceOverruns(unsigned int protocol)
+{
+    if (protocol >= MAX_LINKS)
+        return 0;
+
+    return virAtomicIntGet(&overruns[protocol]);
+}
+
+
 /**
  * virNetlinkEventServiceStart:
  *
@@ -528,6 +1161,7 @@ virNetlinkEventServiceStart(unsigned int protocol, unsigned int groups)
         return -1;
     }
 
+    srv->protocol = protocol;
     virNetlinkEventServerLock(srv);
 
     /* Allocate a new socket and get fd */
@@ -762,6 +1396,57 @@ int virNetlinkCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
     return -1;
 }
 
+virNetlinkBatchPtr
+virNetlinkBatchNew(void)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return NULL;
+}
+
+int
+virNetlinkBatchAdd(virNetlinkBatchPtr batch ATTRIBUTE_UNUSED,
+                   struct nl_msg *nl_msg ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+int
+virNetlinkBatchSubmit(virNetlinkBatchPtr batch ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+int
+virNetlinkBatchGetError(virNetlinkBatchPtr batch ATTRIBUTE_UNUSED,
+                        size_t idx ATTRIBUTE_UNUSED)
+{
+    return ENOSYS;
+}
+
+void
+virNetlinkBatchFree(virNetlinkBatchPtr batch ATTRIBUTE_UNUSED)
+{
+    return;
+}
+
+int
+virNetlinkDumpCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
+                      virNetlinkDumpCallback callback ATTRIBUTE_UNUSED,
+                      void *opaque ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+void
+virNetlinkSetDryRun(virNetlinkDryRunCallback cb ATTRIBUTE_UNUSED,
+                    void *opaque ATTRIBUTE_UNUSED)
+{
+    return;
+}
+
 /**
  * stopNetlinkEventServer: stop the monitor to receive netlink
  * messages for libvirtd
@@ -809,6 +1494,18 @@ int virNetlinkEventServiceLocalPid(unsigned int protocol ATTRIBUTE_UNUSED)
     return -1;
 }
 
+int virNetlinkEventServiceJoinGroup(unsigned int protocol ATTRIBUTE_UNUSED,
+                                    unsigned int group ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+int virNetlinkEventServiceOverruns(unsigned int protocol ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
 /**
  * virNetlinkEventAddClient: register a callback for handling of
  * netlink messages
@@ -52,6 +52,31 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
                       uint32_t src_pid, uint32_t dst_pid,
                       unsigned int protocol, unsigned int groups);
 
+typedef struct _virNetlinkBatch virNetlinkBatch;
+typedef virNetlinkBatch *virNetlinkBatchPtr;
+
+virNetlinkBatchPtr virNetlinkBatchNew(void);
+int virNetlinkBatchAdd(virNetlinkBatchPtr batch, struct nl_msg *nl_msg)
+    ATTRIBUTE_NONNULL(1);
+int virNetlinkBatchSubmit(virNetlinkBatchPtr batch)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetlinkBatchGetError(virNetlinkBatchPtr batch, size_t idx)
+    ATTRIBUTE_NONNULL(1);
+void virNetlinkBatchFree(virNetlinkBatchPtr batch);
+
+typedef int (*virNetlinkDumpCallback)(struct nlmsghdr *msg,
+                                      void *opaque);
+
+int virNetlinkDumpCommand(struct nl_msg *nl_msg,
+                          virNetlinkDumpCallback callback,
+                          void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
+typedef int (*virNetlinkDryRunCallback)(struct nlmsghdr *msg,
+                                        void *opaque);
+
+void virNetlinkSetDryRun(virNetlinkDryRunCallback cb, void *opaque);
+
 typedef void (*virNetlinkEventHandleCallback)(struct nlmsghdr *,
                                               unsigned int length,
                                               struct sockaddr_nl *peer,
@@ -87,6 +112,16 @@ bool virNetlinkEventServiceIsRunning(unsigned int protocol);
  */
 int virNetlinkEventServiceLocalPid(unsigned int protocol);
 
+/**
+ * virNetlinkEventServiceJoinGroup: have a running monitor receive the messages of one more broadcast group
+ */
+int virNetlinkEventServiceJoinGroup(unsigned int protocol, unsigned int group);
+
+/**
+ * virNetlinkEventServiceOverruns: returns how many times the monitor lost messages
+ */
+int virNetlinkEventServiceOverruns(unsigned int protocol);
+
 /**
  * virNetlinkEventAddClient: register a callback for handling of netlink messages
  */
@@ -0,0 +1,775 @@
+/*
+ * virovsdb.c: minimal client for the Open vSwitch database
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Notes:
+ * The protocol is JSON-RPC over a stream socket, described in RFC 7047.
+ * Only the "transact", "monitor" and "monitor_cancel" methods are
+ * used, and "echo" requests from the server are answered.
+ */
+
+#include <config.h>
+
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "virovsdb.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.ovsdb");
+
+#define OVSDB_SOCKET LOCALSTATEDIR "/run/openvswitch/db.sock"
+#define OVSDB_DATABASE "Open_vSwitch"
+
+/* The --timeout=5 ovs-vsctl used to be run with */
+#define OVSDB_TIMEOUT_MS (5 * 1000)
+
+/* All requests share one connection, opened on first use and kept for
+ * the life of the process. A child process inherits the descriptor but
+ * must not talk over it, ovsdbPid tells whose connection it is. */
+static virMutex ovsdbLock = VIR_MUTEX_INITIALIZER;
+static char *ovsdbSocket;
+static int ovsdbFD = -1;
+static pid_t ovsdbPid;
+static unsigned long long ovsdbSerial;
+
+/* Data received but not processed yet */
+static char *ovsdbBuf;
+static size_t ovsdbBufLen;
+static size_t ovsdbBufAlloc;
+
+
+/**
+ * virOVSDBNewArray:
+ * @n: number of elements
+ * @...: the elements
+ *
+ * Create a JSON array of the @n given values, for instance one of the
+ * ["uuid", ...] or ["set", [...]] pairs OVSDB encodes its values
+ * with. The values are taken over, even on failure. One of them being
+ * NULL, as left behind by a failed allocation, makes this fail too, so
+ * that calls can be nested without checking each of them.
+ *
+ * Returns the array or NULL on error.
+ */
+virJSONValuePtr
+virOVSDBNewArray(size_t n, ...)
+{
+    virJSONValuePtr array = virJSONValueNewArray();
+    va_list args;
+    size_t i;
+
+    va_start(args, n);
+    for (i = 0; i < n; i++) {
+        virJSONValuePtr value = va_arg(args, virJSONValuePtr);
+
+        if (!array || !value || virJSONValueArrayAppend(array, value) < 0) {
+            virJSONValueFree(value);
+            virJSONValueFree(array);
+            array = NULL;
+        }
+    }
+    va_end(args);
+
+    return array;
+}
+
+
+/**
+ * virOVSDBNewObject:
+ * @key: name of the first member
+ * @...: its value, followed by more name and value pairs, terminated
+ *       by NULL
+ *
+ * Create a JSON object with the given members. Like virOVSDBNewArray,
+ * the values are taken over even on failure and a NULL value makes
+ * this fail.
+ *
+ * Returns the object or NULL on error.
+ */
+virJSONValuePtr
+virOVSDBNewObject(const char *key, ...)
+{
+    virJSONValuePtr object = virJSONValueNewObject();
+    va_list args;
+
+    va_start(args, key);
+    while (key) {
+        virJSONValuePtr value = va_arg(args, virJSONValuePtr);
+
+        if (!object || !value ||
+            virJSONValueObjectAppend(object, key, value) < 0) {
+            virJSONValueFree(value);
+            virJSONValueFree(object);
+            object = NULL;
+        }
+
+        key = va_arg(args, const char *);
+    }
+    va_end(args);
+
+    return object;
+}
+
+
+/* Must be called with ovsdbLock held */
+static void
+virOVSDBClose(void)
+{
+    VIR_FORCE_CLOSE(ovsdbFD);
+    VIR_FREE(ovsdbBuf);
+    ovsdbBufLen = ovsdbBufAlloc = 0;
+}
+
+
+/*
+ * Make sure this process is connected to the database server. With
+ * @quiet, failing to connect is not reported as an error.
+ *
+ * Must be called with ovsdbLock held.
+ */
+static int
+virOVSDBConnect(bool quiet)
+{
+    const char *path = ovsdbSocket ? ovsdbSocket : OVSDB_SOCKET;
+    struct sockaddr_un addr;
+
+    if (ovsdbFD >= 0 && ovsdbPid == getpid())
+        return 0;
+
+    /* Inherited from the parent, close our copy */
+    if (ovsdbFD >= 0)
+        virOVSDBClose();
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (virStrcpyStatic(addr.sun_path, path) == NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("OVSDB socket path '%s' too long"), path);
+        return -1;
+    }
+
+    if ((ovsdbFD = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to create socket"));
+        return -1;
+    }
+
+    if (virSetCloseExec(ovsdbFD) < 0 ||
+        connect(ovsdbFD, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if (quiet)
+            VIR_DEBUG("Unable to connect to OVSDB at '%s': %d", path, errno);
+        else
+            virReportSystemError(errno,
+                                 _("Unable to connect to OVSDB at '%s'"),
+                                 path);
+        VIR_FORCE_CLOSE(ovsdbFD);
+        return -1;
+    }
+
+    VIR_DEBUG("Connected to OVSDB at '%s'", path);
+    ovsdbPid = getpid();
+    return 0;
+}
+
+
+/* Must be called with ovsdbLock held */
+static int
+virOVSDBSend(virJSONValuePtr msg)
+{
+    char *str;
+    int ret = -1;
+
+    if (!(str = virJSONValueToString(msg, false)))
+        return -1;
+
+    VIR_DEBUG("Send OVSDB message %s", str);
+
+    /* The protocol doesn't need the newline, it only helps reading
+     * the stream when debugging */
+    if (safewrite(ovsdbFD, str, strlen(str)) < 0 ||
+        safewrite(ovsdbFD, "\n", 1) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to send request to OVSDB"));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/*
+ * Returns the length of the JSON value at the start of @buf, or 0 if
+ * the @len bytes there don't hold all of it yet.
+ */
+static size_t
+virOVSDBMessageLength(const char *buf, size_t len)
+{
+    size_t depth = 0;
+    bool string = false;
+    bool escape = false;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (string) {
+            if (escape)
+                escape = false;
+            else if (buf[i] == '\\')
+                escape = true;
+            else if (buf[i] == '"')
+                string = false;
+            continue;
+        }
+
+        switch (buf[i]) {
+        case '"':
+            string = true;
+            break;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (depth > 0 && --depth == 0)
+                return i + 1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Answer an "echo" request from the server, which it uses to check
+ * that the client is still alive. */
+static int
+virOVSDBEcho(virJSONValuePtr request)
+{
+    virJSONValuePtr id = NULL;
+    virJSONValuePtr params = NULL;
+    virJSONValuePtr reply;
+    int ret;
+
+    if (virJSONValueObjectRemoveKey(request, "id", &id) <= 0 ||
+        virJSONValueObjectRemoveKey(request, "params", &params) <= 0) {
+        virJSONValueFree(id);
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed echo request from OVSDB"));
+        return -1;
+    }
+
+    if (!(reply = virOVSDBNewObject("id", id,
+                                    "result", params,
+                                    "error", virJSONValueNewNull(),
+                                    NULL)))
+        return -1;
+
+    ret = virOVSDBSend(reply);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+/*
+ * Wait until @deadline for the next message from the server, other
+ * than an echo request, which gets answered. @eof is set if the
+ * server closed the connection.
+ *
+ * Must be called with ovsdbLock held.
+ */
+static virJSONValuePtr
+virOVSDBRecv(unsigned long long deadline, bool *eof)
+{
+    *eof = false;
+
+    for (;;) {
+        struct pollfd fds[1];
+        unsigned long long now;
+        size_t len;
+        ssize_t got;
+        int n;
+
+        if ((len = virOVSDBMessageLength(ovsdbBuf, ovsdbBufLen)) > 0) {
+            virJSONValuePtr msg;
+            const char *method;
+            char *str;
+
+            if (VIR_STRNDUP(str, ovsdbBuf, len) < 0)
+                return NULL;
+
+            memmove(ovsdbBuf, ovsdbBuf + len, ovsdbBufLen - len);
+            ovsdbBufLen -= len;
+
+            VIR_DEBUG("Received OVSDB message %s", str);
+            msg = virJSONValueFromString(str);
+            VIR_FREE(str);
+
+            if (!msg ||
+                !(method = virJSONValueObjectGetString(msg, "method")) ||
+                STRNEQ(method, "echo"))
+                return msg;
+
+            n = virOVSDBEcho(msg);
+            virJSONValueFree(msg);
+            if (n < 0)
+                return NULL;
+            continue;
+        }
+
+        if (virTimeMillisNow(&now) < 0)
+            return NULL;
+
+        memset(fds, 0, sizeof(fds));
+        fds[0].fd = ovsdbFD;
+        fds[0].events = POLLIN;
+
+        if ((n = poll(fds, ARRAY_CARDINALITY(fds),
+                      now < deadline ? deadline - now : 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            virReportSystemError(errno, "%s", _("error in poll call"));
+            return NULL;
+        }
+
+        if (n == 0) {
+            virReportSystemError(ETIMEDOUT, "%s",
+                                 _("timed out waiting for OVSDB"));
+            return NULL;
+        }
+
+        if (VIR_RESIZE_N(ovsdbBuf, ovsdbBufAlloc, ovsdbBufLen, 1024) < 0)
+            return NULL;
+
+        if ((got = read(ovsdbFD, ovsdbBuf + ovsdbBufLen,
+                        ovsdbBufAlloc - ovsdbBufLen)) < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            virReportSystemError(errno, "%s",
+                                 _("Unable to read reply from OVSDB"));
+            return NULL;
+        }
+
+        if (got == 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("OVSDB closed the connection"));
+            *eof = true;
+            return NULL;
+        }
+
+        ovsdbBufLen += got;
+    }
+}
+
+
+/* Whether @msg is the reply to request @id */
+static bool
+virOVSDBIsReply(virJSONValuePtr msg, unsigned long long id)
+{
+    unsigned long long msgId;
+
+    return !virJSONValueObjectHasKey(msg, "method") &&
+        virJSONValueObjectGetNumberUlong(msg, "id", &msgId) == 0 &&
+        msgId == id;
+}
+
+
+/* Request calling @method with @params, which are taken over */
+static virJSONValuePtr
+virOVSDBNewRequest(const char *method,
+                   virJSONValuePtr params,
+                   unsigned long long id)
+{
+    return virOVSDBNewObject("method", virJSONValueNewString(method),
+                             "params", params,
+                             "id", virJSONValueNewNumberUlong(id),
+                             NULL);
+}
+
+
+/* Take the result out of @reply, unless the server reported an error */
+static int
+virOVSDBTakeResult(virJSONValuePtr reply, virJSONValuePtr *result)
+{
+    virJSONValuePtr error;
+
+    if ((error = virJSONValueObjectGet(reply, "error")) &&
+        !virJSONValueIsNull(error)) {
+        char *str = virJSONValueToString(error, false);
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("OVSDB request failed: %s"), NULLSTR(str));
+        VIR_FREE(str);
+        return -1;
+    }
+
+    if (virJSONValueObjectRemoveKey(reply, "result", result) <= 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed reply from OVSDB"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Check the result of each operation of a transaction, and the extra
+ * element the server appends when committing it failed.
+ */
+static int
+virOVSDBCheckResults(virJSONValuePtr results)
+{
+    size_t i;
+
+    for (i = 0; i < virJSONValueArraySize(results); i++) {
+        virJSONValuePtr result = virJSONValueArrayGet(results, i);
+        const char *error = virJSONValueObjectGetString(result, "error");
+        const char *details = virJSONValueObjectGetString(result, "details");
+
+        if (error && details) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("OVSDB transaction failed: %s: %s"),
+                           error, details);
+            return -1;
+        } else if (error) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("OVSDB transaction failed: %s"), error);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * virOVSDBTransact:
+ * @ops: array of the operations making up the transaction
+ * @results: filled in with the array of their results
+ *
+ * Run the operations in @ops (see RFC 7047, section 5.2) on the
+ * Open_vSwitch database as a single transaction, and wait for it to
+ * be committed. @ops is taken over, even on failure.
+ *
+ * Returns 0 on success, -1 on error, including any of the operations
+ * failing.
+ */
+int
+virOVSDBTransact(virJSONValuePtr ops,
+                 virJSONValuePtr *results)
+{
+    virJSONValuePtr params;
+    virJSONValuePtr request = NULL;
+    virJSONValuePtr reply = NULL;
+    unsigned long long deadline;
+    unsigned long long id;
+    bool reused;
+    bool retried = false;
+    bool eof;
+    int ret = -1;
+
+    *results = NULL;
+
+    /* The parameters are the database name followed by the operations */
+    if (!(params = virOVSDBNewArray(1, virJSONValueNewString(OVSDB_DATABASE)))) {
+        virJSONValueFree(ops);
+        return -1;
+    }
+
+    while (virJSONValueArraySize(ops) > 0) {
+        if (virJSONValueArrayAppend(params, virJSONValueArraySteal(ops, 0)) < 0) {
+            virJSONValueFree(ops);
+            virJSONValueFree(params);
+            return -1;
+        }
+    }
+    virJSONValueFree(ops);
+
+    virMutexLock(&ovsdbLock);
+
+    id = ++ovsdbSerial;
+    if (!(request = virOVSDBNewRequest("transact", params, id)))
+        goto cleanup;
+
+ retry:
+    reused = ovsdbFD >= 0 && ovsdbPid == getpid();
+
+    if (virOVSDBConnect(false) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&deadline) < 0)
+        goto cleanup;
+    deadline += OVSDB_TIMEOUT_MS;
+
+    if (virOVSDBSend(request) < 0)
+        goto error;
+
+    for (;;) {
+        if (!(reply = virOVSDBRecv(deadline, &eof))) {
+            /* The server went away since the connection was last used,
+             * most likely it was restarted */
+            if (eof && reused && !retried) {
+                virResetLastError();
+                virOVSDBClose();
+                retried = true;
+                goto retry;
+            }
+            goto error;
+        }
+
+        if (virOVSDBIsReply(reply, id))
+            break;
+
+        VIR_DEBUG("Discarding stale OVSDB message");
+        virJSONValueFree(reply);
+        reply = NULL;
+    }
+
+    if (virOVSDBTakeResult(reply, results) < 0)
+        goto cleanup;
+
+    if (!virJSONValueIsArray(*results)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed reply from OVSDB"));
+        goto cleanup;
+    }
+
+    if (virOVSDBCheckResults(*results) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&ovsdbLock);
+    if (ret < 0) {
+        virJSONValueFree(*results);
+        *results = NULL;
+    }
+    virJSONValueFree(request);
+    virJSONValueFree(reply);
+    return ret;
+
+ error:
+    /* Whatever is still in flight would get in the way of the next
+     * request, start over with a new connection then */
+    virOVSDBClose();
+    goto cleanup;
+}
+
+
+/* Hand the changes to @table among the table-updates object @updates
+ * over to @cb */
+static int
+virOVSDBMonitorUpdate(virJSONValuePtr updates,
+                      const char *table,
+                      virOVSDBMonitorFunc cb,
+                      void *opaque)
+{
+    virJSONValuePtr rows;
+
+    if (!updates || !(rows = virJSONValueObjectGet(updates, table)))
+        return 0;
+
+    return cb(rows, opaque);
+}
+
+
+/**
+ * virOVSDBMonitor:
+ * @table: the table to watch
+ * @column: the column of @table to watch
+ * @timeout: how long to wait for @cb to be satisfied, in milliseconds
+ * @cb: called with the contents of @column
+ * @opaque: passed to @cb
+ *
+ * Watch @column of the rows of @table (see RFC 7047, section 4.1.5).
+ * @cb is called with the current contents of the rows, then again
+ * each time the server notifies a change, until it returns 1, or -1
+ * on error. It gets an object mapping the UUIDs of the rows that
+ * changed to their "old" and "new" contents.
+ *
+ * Returns 0 once @cb returned 1, -1 on error, including @cb failing
+ * and @timeout passing first.
+ */
+int
+virOVSDBMonitor(const char *table,
+                const char *column,
+                int timeout,
+                virOVSDBMonitorFunc cb,
+                void *opaque)
+{
+    virJSONValuePtr columns;
+    virJSONValuePtr params;
+    virJSONValuePtr request = NULL;
+    virJSONValuePtr msg = NULL;
+    virJSONValuePtr result = NULL;
+    unsigned long long deadline;
+    unsigned long long id;
+    unsigned long long cancelId = 0;
+    unsigned long long msgId;
+    bool eof;
+    int rc = 0;
+    int ret = -1;
+
+    virMutexLock(&ovsdbLock);
+
+    /* The monitor is named after the request setting it up */
+    id = ++ovsdbSerial;
+    columns = virOVSDBNewArray(1, virJSONValueNewString(column));
+    params = virOVSDBNewArray(3,
+                              virJSONValueNewString(OVSDB_DATABASE),
+                              virJSONValueNewNumberUlong(id),
+                              virOVSDBNewObject(table,
+                                                virOVSDBNewObject("columns",
+                                                                  columns,
+                                                                  NULL),
+                                                NULL));
+    if (!(request = virOVSDBNewRequest("monitor", params, id)))
+        goto cleanup;
+
+    if (virOVSDBConnect(false) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&deadline) < 0)
+        goto cleanup;
+    deadline += timeout;
+
+    if (virOVSDBSend(request) < 0)
+        goto error;
+
+    /* The reply carries the current contents, changes are then
+     * notified in "update" requests until the monitor is cancelled */
+    for (;;) {
+        virJSONValuePtr args;
+
+        if (!(msg = virOVSDBRecv(deadline, &eof)))
+            goto error;
+
+        args = virJSONValueObjectGet(msg, "params");
+
+        if (cancelId > 0) {
+            if (virOVSDBIsReply(msg, cancelId))
+                break;
+        } else if (virOVSDBIsReply(msg, id)) {
+            if (virOVSDBTakeResult(msg, &result) < 0)
+                goto cleanup;
+            rc = virOVSDBMonitorUpdate(result, table, cb, opaque);
+        } else if (STREQ_NULLABLE(virJSONValueObjectGetString(msg, "method"),
+                                  "update") &&
+                   args &&
+                   virJSONValueGetNumberUlong(virJSONValueArrayGet(args, 0),
+                                              &msgId) == 0 &&
+                   msgId == id) {
+            rc = virOVSDBMonitorUpdate(virJSONValueArrayGet(args, 1),
+                                       table, cb, opaque);
+        } else {
+            VIR_DEBUG("Discarding stale OVSDB message");
+        }
+
+        virJSONValueFree(msg);
+        msg = NULL;
+
+        /* Stop the notifications before the connection is used for
+         * anything else */
+        if (rc != 0 && cancelId == 0) {
+            cancelId = ++ovsdbSerial;
+            virJSONValueFree(request);
+            params = virOVSDBNewArray(1, virJSONValueNewNumberUlong(id));
+            if (!(request = virOVSDBNewRequest("monitor_cancel", params,
+                                               cancelId)) ||
+                virTimeMillisNow(&deadline) < 0 ||
+                virOVSDBSend(request) < 0)
+                goto error;
+            deadline += OVSDB_TIMEOUT_MS;
+        }
+    }
+
+    if (rc < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&ovsdbLock);
+    virJSONValueFree(request);
+    virJSONValueFree(msg);
+    virJSONValueFree(result);
+    return ret;
+
+ error:
+    /* The monitor goes away with the connection */
+    virOVSDBClose();
+    goto cleanup;
+}
+
+
+/**
+ * virOVSDBAvailable:
+ *
+ * Returns true if the database server can be talked to.
+ */
+bool
+virOVSDBAvailable(void)
+{
+    bool ret;
+
+    virMutexLock(&ovsdbLock);
+    ret = virOVSDBConnect(true) == 0;
+    virMutexUnlock(&ovsdbLock);
+
+    return ret;
+}
+
+
+/**
+ * virOVSDBSetSocket:
+ * @path: path of the server's socket, NULL for the default one
+ *
+ * Talk to the database server at @path from now on, which is meant
+ * for testing.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virOVSDBSetSocket(const char *path)
+{
+    char *tmp;
+
+    if (VIR_STRDUP(tmp, path) < 0)
+        return -1;
+
+    virMutexLock(&ovsdbLock);
+    VIR_FREE(ovsdbSocket);
+    ovsdbSocket = tmp;
+    virOVSDBClose();
+    virMutexUnlock(&ovsdbLock);
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * virovsdb.h: minimal client for the Open vSwitch database
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_OVSDB_H__
+# define __VIR_OVSDB_H__
+
+# include "internal.h"
+# include "virjson.h"
+
+virJSONValuePtr virOVSDBNewArray(size_t n, ...);
+virJSONValuePtr virOVSDBNewObject(const char *key, ...)
+    ATTRIBUTE_SENTINEL;
+
+bool virOVSDBAvailable(void);
+
+int virOVSDBTransact(virJSONValuePtr ops,
+                     virJSONValuePtr *results)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
+typedef int (*virOVSDBMonitorFunc)(virJSONValuePtr rows,
+                                   void *opaque);
+
+int virOVSDBMonitor(const char *table,
+                    const char *column,
+                    int timeout,
+                    virOVSDBMonitorFunc cb,
+                    void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
+
+int virOVSDBSetSocket(const char *path);
+
+#endif /* __VIR_OVSDB_H__ */
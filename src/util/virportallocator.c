@@ -32,13 +32,26 @@
 #include "virerror.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+/* How long ports bound by other processes are skipped without
+ * checking them again */
+#define VIR_PORT_ALLOCATOR_FOREIGN_TTL_MS (10 * 1000)
+
 struct _virPortAllocator {
     virObjectLockable parent;
     virBitmapPtr bitmap;
 
+    /* no port below this offset is free in @bitmap */
+    size_t lowest;
+
+    /* ports found to be in use by other processes, and when to
+     * check them again */
+    virBitmapPtr foreign;
+    unsigned long long foreignExpire;
+
     char *name;
 
     unsigned short start;
@@ -55,6 +68,7 @@ virPortAllocatorDispose(void *obj)
     virPortAllocatorPtr pa = obj;
 
     virBitmapFree(pa->bitmap);
+    virBitmapFree(pa->foreign);
     VIR_FREE(pa->name);
 }
 
@@ -95,6 +109,7 @@ virPortAllocatorPtr virPortAllocatorNew(const char *name,
     pa->end = end;
 
     if (!(pa->bitmap = virBitmapNew((end-start)+1)) ||
+        !(pa->foreign = virBitmapNew((end-start)+1)) ||
         VIR_STRDUP(pa->name, name) < 0) {
         virObjectUnref(pa);
         return NULL;
@@ -172,22 +187,55 @@ static int virPortAllocatorBindToPort(bool *used,
     return ret;
 }
 
+/* Forget about the ports of other processes once they may have been
+ * released, so that they are checked again */
+static void virPortAllocatorExpireForeign(virPortAllocatorPtr pa)
+{
+    unsigned long long now;
+
+    if (!pa->foreignExpire)
+        return;
+
+    if (virTimeMillisNowRaw(&now) < 0 || now >= pa->foreignExpire) {
+        virBitmapClearAll(pa->foreign);
+        pa->foreignExpire = 0;
+    }
+}
+
+static void virPortAllocatorSetForeign(virPortAllocatorPtr pa,
+                                       size_t offset)
+{
+    unsigned long long now;
+
+    /* without a clock the port is just checked again next time */
+    if (virTimeMillisNowRaw(&now) < 0)
+        return;
+
+    ignore_value(virBitmapSetBit(pa->foreign, offset));
+    if (!pa->foreignExpire)
+        pa->foreignExpire = now + VIR_PORT_ALLOCATOR_FOREIGN_TTL_MS;
+}
+
 int virPortAllocatorAcquire(virPortAllocatorPtr pa,
                             unsigned short *port)
 {
     int ret = -1;
-    size_t i;
+    ssize_t i;
 
     *port = 0;
     virObjectLock(pa);
 
-    for (i = pa->start; i <= pa->end && !*port; i++) {
+    virPortAllocatorExpireForeign(pa);
+
+    for (i = virBitmapNextClearBit(pa->bitmap, (ssize_t)pa->lowest - 1);
+         i >= 0;
+         i = virBitmapNextClearBit(pa->bitmap, i)) {
         bool used = false, v6used = false;
+        size_t p = pa->start + i;
 
-        if (virBitmapGetBit(pa->bitmap,
-                            i - pa->start, &used) < 0) {
+        if (virBitmapGetBit(pa->foreign, i, &used) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Failed to query port %zu"), i);
+                           _("Failed to query port %zu"), p);
             goto cleanup;
         }
 
@@ -195,22 +243,29 @@ int virPortAllocatorAcquire(virPortAllocatorPtr pa,
             continue;
 
         if (!(pa->flags & VIR_PORT_ALLOCATOR_SKIP_BIND_CHECK)) {
-            if (virPortAllocatorBindToPort(&v6used, i, AF_INET6) < 0 ||
-                virPortAllocatorBindToPort(&used, i, AF_INET) < 0)
+            if (virPortAllocatorBindToPort(&v6used, p, AF_INET6) < 0 ||
+                virPortAllocatorBindToPort(&used, p, AF_INET) < 0)
                 goto cleanup;
         }
 
-        if (!used && !v6used) {
-            /* Add port to bitmap of reserved ports */
-            if (virBitmapSetBit(pa->bitmap,
-                                i - pa->start) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Failed to reserve port %zu"), i);
-                goto cleanup;
-            }
-            *port = i;
-            ret = 0;
+        if (used || v6used) {
+            virPortAllocatorSetForeign(pa, i);
+            continue;
         }
+
+        /* Add port to bitmap of reserved ports */
+        if (virBitmapSetBit(pa->bitmap, i) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Failed to reserve port %zu"), p);
+            goto cleanup;
+        }
+
+        if ((size_t)i <= pa->lowest)
+            pa->lowest = i + 1;
+
+        *port = p;
+        ret = 0;
+        break;
     }
 
     if (*port == 0) {
@@ -248,6 +303,9 @@ int virPortAllocatorRelease(virPortAllocatorPtr pa,
         goto cleanup;
     }
 
+    if ((size_t)(port - pa->start) < pa->lowest)
+        pa->lowest = port - pa->start;
+
     ret = 0;
  cleanup:
     virObjectUnlock(pa);
@@ -287,6 +345,9 @@ int virPortAllocatorSetUsed(virPortAllocatorPtr pa,
                            port);
             goto cleanup;
         }
+
+        if ((size_t)(port - pa->start) < pa->lowest)
+            pa->lowest = port - pa->start;
     }
 
     ret = 0;
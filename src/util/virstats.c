@@ -29,7 +29,9 @@
 #include <unistd.h>
 #include <regex.h>
 
-#if defined(HAVE_GETIFADDRS) && defined(AF_LINK)
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <linux/rtnetlink.h>
+#elif defined(HAVE_GETIFADDRS) && defined(AF_LINK)
 # include <net/if.h>
 # include <ifaddrs.h>
 #endif
@@ -39,6 +41,8 @@
 #include "virstats.h"
 #include "viralloc.h"
 #include "virfile.h"
+#include "virhash.h"
+#include "virnetlink.h"
 
 #define VIR_FROM_THIS VIR_FROM_STATS_LINUX
 
@@ -48,7 +52,190 @@
  * NB. Caller must check that libvirt user is trying to query
  * the interface of a domain they own.  We do no such checking.
  */
-#ifdef __linux__
+struct _virNetInterfaceStatsTable {
+    /* name -> virDomainInterfaceStats, NULL when interfaces can
+     * only be looked up one by one on this platform */
+    virHashTablePtr ifaces;
+};
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+/* Fill @stats from the counters of the RTM_NEWLINK message @tb was
+ * parsed from. Returns 0 on success, -1 if it has none. */
+static int
+virNetInterfaceStatsFromLink(struct nlattr **tb,
+                             virDomainInterfaceStatsPtr stats)
+{
+    struct rtnl_link_stats64 link;
+    struct rtnl_link_stats *link32;
+
+    if (tb[IFLA_STATS64] &&
+        nla_len(tb[IFLA_STATS64]) >= (int) sizeof(link)) {
+        /* Not necessarily aligned for 64 bit access */
+        memcpy(&link, nla_data(tb[IFLA_STATS64]), sizeof(link));
+    } else if (tb[IFLA_STATS] &&
+               nla_len(tb[IFLA_STATS]) >= (int) sizeof(*link32)) {
+        /* Kernels before 2.6.35 only have 32 bit counters */
+        link32 = nla_data(tb[IFLA_STATS]);
+        memset(&link, 0, sizeof(link));
+        link.rx_bytes = link32->rx_bytes;
+        link.rx_packets = link32->rx_packets;
+        link.rx_errors = link32->rx_errors;
+        link.rx_dropped = link32->rx_dropped;
+        link.rx_missed_errors = link32->rx_missed_errors;
+        link.tx_bytes = link32->tx_bytes;
+        link.tx_packets = link32->tx_packets;
+        link.tx_errors = link32->tx_errors;
+        link.tx_dropped = link32->tx_dropped;
+    } else {
+        return -1;
+    }
+
+    /* These are the counters of the host side of the interface,
+     * hence TX and RX swapped as for /proc/net/dev. The dropped
+     * count adds up the same as there too. */
+    stats->rx_bytes = link.tx_bytes;
+    stats->rx_packets = link.tx_packets;
+    stats->rx_errs = link.tx_errors;
+    stats->rx_drop = link.tx_dropped;
+    stats->tx_bytes = link.rx_bytes;
+    stats->tx_packets = link.rx_packets;
+    stats->tx_errs = link.rx_errors;
+    stats->tx_drop = link.rx_dropped + link.rx_missed_errors;
+
+    return 0;
+}
+
+int
+virNetInterfaceStats(const char *path,
+                     virDomainInterfaceStatsPtr stats)
+{
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nlattr *tb[IFLA_MAX + 1];
+    struct nlmsghdr *resp = NULL;
+    unsigned int recvbuflen = 0;
+    struct nl_msg *nl_msg;
+    struct nlmsgerr *err;
+    int ret = -1;
+
+    if (!(nl_msg = nlmsg_alloc_simple(RTM_GETLINK, NLM_F_REQUEST))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put(nl_msg, IFLA_IFNAME, strlen(path) + 1, path) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        goto cleanup;
+    }
+
+    if (virNetlinkCommand(nl_msg, &resp, &recvbuflen,
+                          0, 0, NETLINK_ROUTE, 0) < 0)
+        goto cleanup;
+
+    if (recvbuflen < NLMSG_LENGTH(0) || resp == NULL)
+        goto malformed_resp;
+
+    switch (resp->nlmsg_type) {
+    case NLMSG_ERROR:
+        err = (struct nlmsgerr *)NLMSG_DATA(resp);
+        if (resp->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+            goto malformed_resp;
+
+        virReportSystemError(-err->error,
+                             _("Unable to get statistics of interface %s"),
+                             path);
+        goto cleanup;
+
+    case RTM_NEWLINK:
+        if (nlmsg_parse(resp, sizeof(ifinfo), tb, IFLA_MAX, NULL) < 0)
+            goto malformed_resp;
+
+        if (virNetInterfaceStatsFromLink(tb, stats) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Interface %s has no statistics"), path);
+            goto cleanup;
+        }
+        break;
+
+    default:
+        goto malformed_resp;
+    }
+
+    ret = 0;
+
+ cleanup:
+    nlmsg_free(nl_msg);
+    VIR_FREE(resp);
+    return ret;
+
+ malformed_resp:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("malformed netlink response message"));
+    goto cleanup;
+}
+
+static int
+virNetInterfaceStatsTableAddLink(struct nlmsghdr *msg,
+                                 void *opaque)
+{
+    virHashTablePtr ifaces = opaque;
+    struct nlattr *tb[IFLA_MAX + 1];
+    virDomainInterfaceStatsPtr stats;
+
+    if (msg->nlmsg_type != RTM_NEWLINK ||
+        nlmsg_parse(msg, sizeof(struct ifinfomsg), tb, IFLA_MAX, NULL) < 0 ||
+        !tb[IFLA_IFNAME])
+        return 0;
+
+    if (VIR_ALLOC(stats) < 0)
+        return -1;
+
+    if (virNetInterfaceStatsFromLink(tb, stats) < 0) {
+        VIR_FREE(stats);
+        return 0;
+    }
+
+    if (virHashUpdateEntry(ifaces, nla_get_string(tb[IFLA_IFNAME]),
+                           stats) < 0) {
+        VIR_FREE(stats);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Read the counters of all the interfaces of the host into @ifaces
+ * with a single RTM_GETLINK dump */
+static int
+virNetInterfaceStatsTableFill(virHashTablePtr ifaces)
+{
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+    int ret = -1;
+
+    if (!(nl_msg = nlmsg_alloc_simple(RTM_GETLINK, NLM_F_DUMP))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        goto cleanup;
+    }
+
+    if (virNetlinkDumpCommand(nl_msg, virNetInterfaceStatsTableAddLink,
+                              ifaces) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    nlmsg_free(nl_msg);
+    return ret;
+}
+#elif defined(__linux__)
 int
 virNetInterfaceStats(const char *path,
                      virDomainInterfaceStatsPtr stats)
@@ -176,3 +363,68 @@ virNetInterfaceStats(const char *path ATTRIBUTE_UNUSED,
 }
 
 #endif /* __linux__ */
+
+/**
+ * virNetInterfaceStatsTableNew:
+ *
+ * Read the statistics of all the interfaces of the host at once, for
+ * callers about to query a lot of them: on Linux this takes a single
+ * netlink dump however many interfaces there are, rather than a
+ * request for each. Elsewhere the interfaces are still looked up one
+ * at a time by virNetInterfaceStatsTableGet.
+ *
+ * Returns the table, or NULL on error.
+ */
+virNetInterfaceStatsTablePtr
+virNetInterfaceStatsTableNew(void)
+{
+    virNetInterfaceStatsTablePtr table;
+
+    if (VIR_ALLOC(table) < 0)
+        return NULL;
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+    if (!(table->ifaces = virHashCreate(64, virHashValueFree)) ||
+        virNetInterfaceStatsTableFill(table->ifaces) < 0) {
+        virNetInterfaceStatsTableFree(table);
+        return NULL;
+    }
+#endif
+
+    return table;
+}
+
+/**
+ * virNetInterfaceStatsTableGet:
+ * @table: the statistics read by virNetInterfaceStatsTableNew
+ * @path: name of the interface
+ * @stats: filled with the statistics of @path
+ *
+ * Like virNetInterfaceStats, but from @table. An interface which
+ * showed up after @table was read is looked up on its own.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNetInterfaceStatsTableGet(virNetInterfaceStatsTablePtr table,
+                             const char *path,
+                             virDomainInterfaceStatsPtr stats)
+{
+    virDomainInterfaceStatsPtr found;
+
+    if (!table->ifaces || !(found = virHashLookup(table->ifaces, path)))
+        return virNetInterfaceStats(path, stats);
+
+    *stats = *found;
+    return 0;
+}
+
+void
+virNetInterfaceStatsTableFree(virNetInterfaceStatsTablePtr table)
+{
+    if (!table)
+        return;
+
+    virHashFree(table->ifaces);
+    VIR_FREE(table);
+}
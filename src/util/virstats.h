@@ -28,4 +28,14 @@
 extern int virNetInterfaceStats(const char *path,
                                 virDomainInterfaceStatsPtr stats);
 
+typedef struct _virNetInterfaceStatsTable virNetInterfaceStatsTable;
+typedef virNetInterfaceStatsTable *virNetInterfaceStatsTablePtr;
+
+extern virNetInterfaceStatsTablePtr virNetInterfaceStatsTableNew(void);
+extern int virNetInterfaceStatsTableGet(virNetInterfaceStatsTablePtr table,
+                                        const char *path,
+                                        virDomainInterfaceStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+extern void virNetInterfaceStatsTableFree(virNetInterfaceStatsTablePtr table);
+
 #endif /* __STATS_LINUX_H__ */
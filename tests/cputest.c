@@ -38,7 +38,9 @@
 #include "cpu_conf.h"
 #include "cpu/cpu.h"
 #include "cpu/cpu_map.h"
+#include "cpu/cpu_x86.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_CPU
 
@@ -53,7 +55,8 @@ enum api {
     API_GUEST_DATA,
     API_BASELINE,
     API_UPDATE,
-    API_HAS_FEATURE
+    API_HAS_FEATURE,
+    API_CACHE
 };
 
 static const char *apis[] = {
@@ -61,7 +64,8 @@ static const char *apis[] = {
     "guest data",
     "baseline",
     "update",
-    "has feature"
+    "has feature",
+    "cache"
 };
 
 struct data {
@@ -454,12 +458,124 @@ cpuTestHasFeature(const void *arg)
 }
 
 
+/* Compares @cpu with @host and decodes the resulting guest data the way
+ * QEMU driver does when starting a domain, formatting the outcome. */
+static char *
+cpuTestCacheRound(const struct data *data,
+                  virCPUDefPtr host,
+                  virCPUDefPtr cpu)
+{
+    virCPUDataPtr guestData = NULL;
+    virCPUDefPtr guest = NULL;
+    virCPUCompareResult cmp;
+    char *message = NULL;
+    char *xml = NULL;
+    char *ret = NULL;
+
+    cmp = cpuGuestData(host, cpu, &guestData, &message);
+    if (cmp == VIR_CPU_COMPARE_ERROR ||
+        cmp == VIR_CPU_COMPARE_INCOMPATIBLE)
+        goto cleanup;
+
+    if (VIR_ALLOC(guest) < 0)
+        goto cleanup;
+
+    guest->arch = host->arch;
+    guest->type = VIR_CPU_TYPE_GUEST;
+    guest->match = VIR_CPU_MATCH_EXACT;
+    guest->fallback = cpu->fallback;
+    if (cpuDecode(guest, guestData, data->models,
+                  data->nmodels, data->preferred) < 0)
+        goto cleanup;
+
+    if (!(xml = virCPUDefFormat(guest, 0)))
+        goto cleanup;
+
+    ignore_value(virAsprintf(&ret, "%s\n%s\n%s",
+                             cpuTestCompResStr(cmp),
+                             NULLSTR(message), xml));
+
+ cleanup:
+    cpuDataFree(guestData);
+    virCPUDefFree(guest);
+    VIR_FREE(message);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+#define CPU_TEST_CACHE_ROUNDS 500
+
+static int
+cpuTestCache(const void *arg)
+{
+    const struct data *data = arg;
+    virCPUDefPtr host = NULL;
+    virCPUDefPtr cpu = NULL;
+    char *expected = NULL;
+    char *actual = NULL;
+    unsigned long long start;
+    unsigned long long cold = 0;
+    unsigned long long warm = 0;
+    unsigned long long now;
+    size_t i;
+    int ret = -1;
+
+    if (!(host = cpuTestLoadXML(data->arch, data->host)) ||
+        !(cpu = cpuTestLoadXML(data->arch, data->name)))
+        goto cleanup;
+
+    virCPUx86CacheFlush();
+    if (!(expected = cpuTestCacheRound(data, host, cpu)))
+        goto cleanup;
+
+    /* Every result must be the same regardless of being computed from
+     * scratch or taken from the cache */
+    for (i = 0; i < 2 * CPU_TEST_CACHE_ROUNDS; i++) {
+        bool flush = i < CPU_TEST_CACHE_ROUNDS;
+
+        if (flush)
+            virCPUx86CacheFlush();
+
+        if (virTimeMillisNow(&start) < 0 ||
+            !(actual = cpuTestCacheRound(data, host, cpu)) ||
+            virTimeMillisNow(&now) < 0)
+            goto cleanup;
+
+        if (flush)
+            cold += now - start;
+        else
+            warm += now - start;
+
+        if (STRNEQ(expected, actual)) {
+            virtTestDifference(stderr, expected, actual);
+            goto cleanup;
+        }
+        VIR_FREE(actual);
+    }
+
+    if (virTestGetVerbose())
+        fprintf(stderr, "\n%d rounds: %llu ms computed, %llu ms cached\n%74s",
+                CPU_TEST_CACHE_ROUNDS, cold, warm, "... ");
+
+    ret = 0;
+
+ cleanup:
+    virCPUDefFree(host);
+    virCPUDefFree(cpu);
+    VIR_FREE(expected);
+    VIR_FREE(actual);
+    return ret;
+}
+
+
 static int (*cpuTest[])(const void *) = {
     cpuTestCompare,
     cpuTestGuestData,
     cpuTestBaseline,
     cpuTestUpdate,
-    cpuTestHasFeature
+    cpuTestHasFeature,
+    cpuTestCache
 };
 
 
@@ -555,6 +671,13 @@ mymain(void)
             models == NULL ? 0 : sizeof(models) / sizeof(char *),       \
             preferred, 0, result)
 
+#define DO_TEST_CACHE(arch, host, cpu, models, preferred)               \
+    DO_TEST(arch, API_CACHE,                                            \
+            host "/" cpu " (" #models ", pref=" #preferred ")",         \
+            host, cpu, models,                                          \
+            models == NULL ? 0 : sizeof(models) / sizeof(char *),       \
+            preferred, 0, 0)
+
     /* host to host comparison */
     DO_TEST_COMPARE("x86", "host", "host", VIR_CPU_COMPARE_IDENTICAL);
     DO_TEST_COMPARE("x86", "host", "host-better", VIR_CPU_COMPARE_INCOMPATIBLE);
@@ -645,6 +768,12 @@ mymain(void)
     DO_TEST_GUESTDATA("ppc64", "host", "guest", ppc_models, NULL, 0);
     DO_TEST_GUESTDATA("ppc64", "host", "guest-nofallback", ppc_models, "POWER7_v2.1", -1);
 
+    /* memoized comparison and decoding */
+    DO_TEST_CACHE("x86", "host", "guest", NULL, NULL);
+    DO_TEST_CACHE("x86", "host", "guest", models, "Penryn");
+    DO_TEST_CACHE("x86", "host-better", "pentium3", NULL, "core2duo");
+    DO_TEST_CACHE("x86", "host", "nehalem-force", NULL, NULL);
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
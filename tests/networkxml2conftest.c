@@ -49,6 +49,8 @@ testCompareXMLToConfFiles(const char *inxml, const char *outconf, dnsmasqCapsPtr
     if (dctx == NULL)
         goto fail;
 
+    dctx->hostsdir = dnsmasqCapsGet(caps, DNSMASQ_CAPS_DHCP_HOSTSDIR);
+
     if (networkDnsmasqConfContents(obj, pidfile, &actual,
                         dctx, caps) < 0)
         goto fail;
@@ -120,6 +122,8 @@ mymain(void)
         = dnsmasqCapsNewFromBuffer("Dnsmasq version 2.63\n--bind-dynamic", DNSMASQ);
     dnsmasqCapsPtr dhcpv6
         = dnsmasqCapsNewFromBuffer("Dnsmasq version 2.64\n--bind-dynamic", DNSMASQ);
+    dnsmasqCapsPtr hostsdir
+        = dnsmasqCapsNewFromBuffer("Dnsmasq version 2.73\n--bind-dynamic", DNSMASQ);
 
     networkDnsmasqLeaseFileName = testDnsmasqLeaseFileName;
 
@@ -149,6 +153,7 @@ mymain(void)
     DO_TEST("dhcp6-network", dhcpv6);
     DO_TEST("dhcp6-nat-network", dhcpv6);
     DO_TEST("dhcp6host-routed-network", dhcpv6);
+    DO_TEST("nat-network-hostsdir", hostsdir);
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -51,10 +51,11 @@ static int testCompareXMLToArgvFiles(const char *xml,
     int len;
     char *actualargv = NULL;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virtTestFirewallDryRunData dryRun = { &buf, true };
     virNetworkDefPtr def = NULL;
     int ret = -1;
 
-    virCommandSetDryRun(&buf, NULL, NULL);
+    virCommandSetDryRun(NULL, virtTestFirewallDryRun, &dryRun);
 
     if (!(def = virNetworkDefParseFile(xml)))
         goto cleanup;
@@ -140,6 +141,10 @@ mymain(void)
         goto cleanup;
     }
 
+    /* Go through the batched code path whether or not the host has
+     * *tables-restore, the expected output is the same either way */
+    virFirewallSetRestore(VIR_FIREWALL_RESTORE_ENABLED);
+
     DO_TEST("nat-default");
     DO_TEST("nat-tftp");
     DO_TEST("nat-many-ips");
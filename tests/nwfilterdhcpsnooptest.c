@@ -0,0 +1,360 @@
+/*
+ * nwfilterdhcpsnooptest.c: test the DHCP snooping packet capture
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#if defined(__linux__) && defined(HAVE_LIBPCAP)
+
+# include <sys/socket.h>
+# include <linux/if_packet.h>
+# include <net/ethernet.h>
+# include <netinet/in.h>
+
+# include "viralloc.h"
+# include "virbuffer.h"
+# include "virerror.h"
+# include "virfile.h"
+# include "virhash.h"
+# include "virstring.h"
+
+# define __NWFILTER_DHCPSNOOP_PRIV_H_ALLOW__
+# include "nwfilter/nwfilter_dhcpsnooppriv.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+# define TEST_FRAME_MAX 2048
+
+struct testFilterInfo {
+    const char *name;
+    uint16_t ethertype;
+    uint8_t ihl;                /* IPv4 header length in 32 bit words */
+    uint8_t proto;
+    uint16_t frag;              /* flags and fragment offset */
+    uint16_t sport;
+    uint16_t dport;
+    size_t payload;
+    bool pass;
+};
+
+/*
+ * Build an Ethernet frame carrying an IPv4 packet as described by
+ * @info into @frame, and return its length.
+ */
+static size_t
+testFilterBuildFrame(const struct testFilterInfo *info,
+                     unsigned char *frame)
+{
+    unsigned char *ip = frame + 14;
+    unsigned char *l4 = ip + info->ihl * 4;
+    size_t len = 14 + info->ihl * 4 + 8 + info->payload;
+
+    memset(frame, 0, TEST_FRAME_MAX);
+    memset(frame, 0xff, 6);     /* broadcast */
+    frame[6] = 0x52;            /* 52:54:00:12:34:56 */
+    frame[7] = 0x54;
+    frame[9] = 0x12;
+    frame[10] = 0x34;
+    frame[11] = 0x56;
+    frame[12] = info->ethertype >> 8;
+    frame[13] = info->ethertype & 0xff;
+
+    ip[0] = 0x40 | info->ihl;
+    ip[2] = (len - 14) >> 8;
+    ip[3] = (len - 14) & 0xff;
+    ip[6] = info->frag >> 8;
+    ip[7] = info->frag & 0xff;
+    ip[8] = 64;
+    ip[9] = info->proto;
+
+    l4[0] = info->sport >> 8;
+    l4[1] = info->sport & 0xff;
+    l4[2] = info->dport >> 8;
+    l4[3] = info->dport & 0xff;
+
+    return len;
+}
+
+/*
+ * Run the DHCP filter on a frame, letting the kernel do it: the
+ * filter is attached to one end of a datagram socket pair, which gets
+ * what the filter returns of the frames sent by the other end.
+ */
+static int
+testFilter(const void *opaque)
+{
+    const struct testFilterInfo *info = opaque;
+    struct sock_fprog prog;
+    unsigned char frame[TEST_FRAME_MAX];
+    unsigned char buf[TEST_FRAME_MAX];
+    char ebuf[1024];
+    size_t len = testFilterBuildFrame(info, frame);
+    size_t expect = MIN(len, PCAP_PBUFSIZE);
+    ssize_t got;
+    int fds[2] = { -1, -1 };
+    int ret = -1;
+
+    virNWFilterSnoopDHCPFilterProgram(&prog);
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0 ||
+        setsockopt(fds[1], SOL_SOCKET, SO_ATTACH_FILTER,
+                   &prog, sizeof(prog)) < 0) {
+        fprintf(stderr, "Cannot set up filtered socket: %s\n",
+                virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto cleanup;
+    }
+
+    if (safewrite(fds[0], frame, len) != len) {
+        fprintf(stderr, "Cannot send frame\n");
+        goto cleanup;
+    }
+
+    got = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+
+    if (!info->pass) {
+        if (got >= 0) {
+            fprintf(stderr, "Frame passed the filter\n");
+            goto cleanup;
+        }
+    } else if (got < 0) {
+        fprintf(stderr, "Frame did not pass the filter\n");
+        goto cleanup;
+    } else if (got != expect || memcmp(buf, frame, expect) != 0) {
+        fprintf(stderr, "Expected the first %zu bytes of the frame, got %zd\n",
+                expect, got);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(fds[0]);
+    VIR_FORCE_CLOSE(fds[1]);
+    return ret;
+}
+
+
+/* A block of the fake capture ring, as TPACKET_V3 lays it out */
+# define TEST_RING_BLOCK_SIZE 4096
+# define TEST_RING_BLOCK_NR 3
+
+/*
+ * Append a packet of @len bytes, all set to @marker, seen on interface
+ * @ifindex with packet type @pkttype, to ring @block.
+ */
+static void
+testRingAddPacket(unsigned char *block, int ifindex,
+                  unsigned char pkttype, unsigned char marker,
+                  unsigned int len)
+{
+    struct tpacket_block_desc *desc;
+    struct tpacket3_hdr *hdr;
+    struct sockaddr_ll *sll;
+    size_t offset;
+    size_t i;
+
+    VIR_WARNINGS_NO_CAST_ALIGN
+    desc = (struct tpacket_block_desc *)block;
+
+    if (desc->hdr.bh1.num_pkts == 0)
+        desc->hdr.bh1.offset_to_first_pkt =
+            TPACKET_ALIGN(sizeof(struct tpacket_block_desc));
+
+    offset = desc->hdr.bh1.offset_to_first_pkt;
+    for (i = 0; i < desc->hdr.bh1.num_pkts; i++)
+        offset += ((struct tpacket3_hdr *)(block + offset))->tp_next_offset;
+
+    hdr = (struct tpacket3_hdr *)(block + offset);
+    sll = (struct sockaddr_ll *)((char *)hdr + TPACKET_ALIGN(sizeof(*hdr)));
+    VIR_WARNINGS_RESET
+
+    hdr->tp_mac = TPACKET_ALIGN(TPACKET_ALIGN(sizeof(*hdr)) + sizeof(*sll));
+    hdr->tp_snaplen = len;
+    hdr->tp_len = len;
+    hdr->tp_next_offset = TPACKET_ALIGN(hdr->tp_mac + len);
+    sll->sll_family = AF_PACKET;
+    sll->sll_ifindex = ifindex;
+    sll->sll_pkttype = pkttype;
+    memset((char *)hdr + hdr->tp_mac, marker, len);
+
+    desc->hdr.bh1.num_pkts++;
+    desc->hdr.bh1.block_status = TP_STATUS_USER;
+}
+
+/* virNWFilterSnoopRingFunc logging the packets it gets */
+static void
+testRingLog(void *payload, bool toVM, unsigned char *frame,
+            unsigned int len, void *opaque)
+{
+    virBufferPtr log = opaque;
+
+    virBufferAsprintf(log, "%s %s %c %u\n", (const char *)payload,
+                      toVM ? "to" : "from", frame[0], len);
+}
+
+static int
+testRing(const void *opaque ATTRIBUTE_UNUSED)
+{
+    const char *expect =
+        "vnet0 from a 342\n"
+        "vnet1 to b 60\n"
+        "vnet0 to d 590\n"
+        "vnet2 from f 342\n";
+    unsigned char *ring = NULL;
+    virHashTablePtr routes = NULL;
+    virBuffer log = VIR_BUFFER_INITIALIZER;
+    char vnet0[] = "vnet0";
+    char vnet1[] = "vnet1";
+    char vnet2[] = "vnet2";
+    char stale[] = "stale";
+    char *actual = NULL;
+    size_t nread = 0;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(ring, TEST_RING_BLOCK_SIZE * TEST_RING_BLOCK_NR) < 0 ||
+        !(routes = virHashCreate(0, NULL)))
+        goto cleanup;
+
+    /* vnet2 took over the interface index of a removed interface,
+     * which must not take the route along when it goes away */
+    if (virNWFilterSnoopRouteAdd(routes, 2, vnet0) < 0 ||
+        virNWFilterSnoopRouteAdd(routes, 7, vnet1) < 0 ||
+        virNWFilterSnoopRouteAdd(routes, 9, stale) < 0 ||
+        virNWFilterSnoopRouteAdd(routes, 9, vnet2) < 0)
+        goto cleanup;
+    virNWFilterSnoopRouteRemove(routes, 9, stale);
+    /* and nothing is routed to a removed interface */
+    if (virNWFilterSnoopRouteAdd(routes, 11, stale) < 0)
+        goto cleanup;
+    virNWFilterSnoopRouteRemove(routes, 11, stale);
+
+    testRingAddPacket(ring, 2, PACKET_HOST, 'a', 342);
+    testRingAddPacket(ring, 7, PACKET_OUTGOING, 'b', 60);
+    testRingAddPacket(ring, 3, PACKET_HOST, 'c', 342);
+    testRingAddPacket(ring + TEST_RING_BLOCK_SIZE, 2, PACKET_OUTGOING,
+                      'd', 590);
+    testRingAddPacket(ring + TEST_RING_BLOCK_SIZE, 11, PACKET_HOST,
+                      'e', 342);
+    testRingAddPacket(ring + TEST_RING_BLOCK_SIZE, 9, PACKET_BROADCAST,
+                      'f', 342);
+
+    /* the third block still belongs to the kernel */
+    for (i = 0; i < TEST_RING_BLOCK_NR; i++) {
+        if (!virNWFilterSnoopRingReadBlock(ring + i * TEST_RING_BLOCK_SIZE,
+                                           routes, testRingLog, &log))
+            break;
+        nread++;
+    }
+
+    if (nread != 2) {
+        fprintf(stderr, "Expected 2 blocks to be read, got %zu\n", nread);
+        goto cleanup;
+    }
+
+    for (i = 0; i < nread; i++) {
+        struct tpacket_block_desc *desc;
+
+        VIR_WARNINGS_NO_CAST_ALIGN
+        desc = (struct tpacket_block_desc *)(ring + i * TEST_RING_BLOCK_SIZE);
+        VIR_WARNINGS_RESET
+
+        if (desc->hdr.bh1.block_status != TP_STATUS_KERNEL) {
+            fprintf(stderr, "Block %zu was not given back\n", i);
+            goto cleanup;
+        }
+    }
+
+    if (virBufferCheckError(&log) < 0 ||
+        !(actual = virBufferContentAndReset(&log)))
+        goto cleanup;
+
+    if (STRNEQ(expect, actual)) {
+        virtTestDifference(stderr, expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&log);
+    VIR_FREE(actual);
+    virHashFree(routes);
+    VIR_FREE(ring);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+# define DO_TEST_FILTER(name, ethertype, ihl, proto, frag,               \
+                        sport, dport, payload, pass)                     \
+    do {                                                                 \
+        static struct testFilterInfo info = {                            \
+            name, ethertype, ihl, proto, frag, sport, dport, payload,    \
+            pass,                                                        \
+        };                                                               \
+        if (virtTestRun("DHCP filter " name, testFilter, &info) < 0)    \
+            ret = -1;                                                    \
+    } while (0)
+
+    DO_TEST_FILTER("client to server", ETHERTYPE_IP, 5, IPPROTO_UDP, 0,
+                   68, 67, 300, true);
+    DO_TEST_FILTER("server to client", ETHERTYPE_IP, 5, IPPROTO_UDP, 0,
+                   67, 68, 300, true);
+    DO_TEST_FILTER("truncated", ETHERTYPE_IP, 5, IPPROTO_UDP, 0,
+                   67, 68, 1200, true);
+    DO_TEST_FILTER("IP options", ETHERTYPE_IP, 7, IPPROTO_UDP, 0,
+                   68, 67, 300, true);
+    DO_TEST_FILTER("first fragment", ETHERTYPE_IP, 5, IPPROTO_UDP, 0x2000,
+                   67, 68, 300, true);
+    DO_TEST_FILTER("later fragment", ETHERTYPE_IP, 5, IPPROTO_UDP, 0x2010,
+                   67, 68, 300, false);
+    DO_TEST_FILTER("client to client", ETHERTYPE_IP, 5, IPPROTO_UDP, 0,
+                   68, 68, 300, false);
+    DO_TEST_FILTER("server to server", ETHERTYPE_IP, 5, IPPROTO_UDP, 0,
+                   67, 67, 300, false);
+    DO_TEST_FILTER("DNS", ETHERTYPE_IP, 5, IPPROTO_UDP, 0,
+                   53, 53, 100, false);
+    DO_TEST_FILTER("TCP", ETHERTYPE_IP, 5, IPPROTO_TCP, 0,
+                   68, 67, 300, false);
+    DO_TEST_FILTER("ARP", ETHERTYPE_ARP, 5, IPPROTO_UDP, 0,
+                   68, 67, 300, false);
+
+    if (virtTestRun("capture ring routing", testRing, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else /* !(defined(__linux__) && defined(HAVE_LIBPCAP)) */
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* !(defined(__linux__) && defined(HAVE_LIBPCAP)) */
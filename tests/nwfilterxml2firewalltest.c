@@ -376,13 +376,14 @@ static int testCompareXMLToArgvFiles(const char *xml,
     int len;
     char *actualargv = NULL;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virtTestFirewallDryRunData dryRun = { &buf, false };
     virNWFilterHashTablePtr vars = virNWFilterHashTableCreate(0);
     virNWFilterInst inst;
     int ret = -1;
 
     memset(&inst, 0, sizeof(inst));
 
-    virCommandSetDryRun(&buf, NULL, NULL);
+    virCommandSetDryRun(NULL, virtTestFirewallDryRun, &dryRun);
 
     if (!vars)
         goto cleanup;
@@ -479,6 +480,10 @@ mymain(void)
         goto cleanup;
     }
 
+    /* Go through the batched code path whether or not the host has
+     * *tables-restore, the expected output is the same either way */
+    virFirewallSetRestore(VIR_FIREWALL_RESTORE_ENABLED);
+
     DO_TEST("ah");
     DO_TEST("ah-ipv6");
     DO_TEST("all");
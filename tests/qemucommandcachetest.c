@@ -0,0 +1,267 @@
+/*
+ * qemucommandcachetest.c: check that memoized parts of the QEMU command
+ * line match what would be built from scratch, and time mass builds
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+
+#ifdef WITH_QEMU
+
+# include "internal.h"
+# include "viralloc.h"
+# include "virhash.h"
+# include "virstring.h"
+# include "virtime.h"
+# include "datatypes.h"
+# include "qemu/qemu_capabilities.h"
+# include "qemu/qemu_command.h"
+# include "qemu/qemu_domain.h"
+
+# include "testutilsqemu.h"
+
+# define VIR_FROM_THIS VIR_FROM_QEMU
+
+/* How many domains a single test pretends to start */
+# define TEST_COMMAND_CACHE_ROUNDS 200
+
+static virQEMUDriver driver;
+
+struct testInfo {
+    const char *name;
+    virQEMUCapsPtr qemuCaps;
+};
+
+static char *
+testBuildCommandLine(virConnectPtr conn,
+                     virDomainDefPtr def,
+                     virQEMUCapsPtr qemuCaps)
+{
+    virDomainChrSourceDef monitor_chr;
+    virCommandPtr cmd = NULL;
+    char *ret = NULL;
+
+    memset(&monitor_chr, 0, sizeof(monitor_chr));
+    monitor_chr.type = VIR_DOMAIN_CHR_TYPE_UNIX;
+    monitor_chr.data.nix.path = (char *)"/tmp/test-monitor";
+    monitor_chr.data.nix.listen = true;
+
+    if ((cmd = qemuBuildCommandLine(conn, &driver, def, &monitor_chr,
+                                    false, qemuCaps, NULL, -1, NULL,
+                                    VIR_NETDEV_VPORT_PROFILE_OP_NO_OP,
+                                    &testCallbacks, false, false)))
+        ret = virCommandToString(cmd);
+
+    virCommandFree(cmd);
+    return ret;
+}
+
+/* Builds the command line for @def TEST_COMMAND_CACHE_ROUNDS times,
+ * checking every result against @expect. Like domain starts, every
+ * round works on a fresh copy of @qemuCaps. Returns the time it took
+ * in milliseconds or -1 on error. */
+static long long
+testBuildCommandLineRounds(virConnectPtr conn,
+                           virDomainDefPtr def,
+                           virQEMUCapsPtr qemuCaps,
+                           const char *expect)
+{
+    unsigned long long start;
+    unsigned long long end;
+    virQEMUCapsPtr copy;
+    char *actual = NULL;
+    size_t i;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+
+    for (i = 0; i < TEST_COMMAND_CACHE_ROUNDS; i++) {
+        if (!(copy = virQEMUCapsNewCopy(qemuCaps)))
+            return -1;
+        actual = testBuildCommandLine(conn, def, copy);
+        virObjectUnref(copy);
+        if (!actual)
+            return -1;
+
+        if (STRNEQ(expect, actual)) {
+            virtTestDifference(stderr, expect, actual);
+            VIR_FREE(actual);
+            return -1;
+        }
+        VIR_FREE(actual);
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        return -1;
+
+    return end - start;
+}
+
+static int
+testCommandCache(const void *opaque)
+{
+    const struct testInfo *info = opaque;
+    virConnectPtr conn = NULL;
+    virDomainDefPtr def = NULL;
+    virQEMUCapsPtr copy = NULL;
+    virCapsPtr caps = NULL;
+    char *xml = NULL;
+    char *expect = NULL;
+    char *model = NULL;
+    bool hasHwVirt;
+    long long uncached;
+    long long cached;
+    int ret = -1;
+
+    if (!(conn = virGetConnect()))
+        goto cleanup;
+
+    if (virAsprintf(&xml, "%s/qemuxml2argvdata/qemuxml2argv-%s.xml",
+                    abs_srcdir, info->name) < 0)
+        goto cleanup;
+
+    if (!(def = virDomainDefParseFile(xml, driver.caps, driver.xmlopt,
+                                      QEMU_EXPECTED_VIRT_TYPES,
+                                      VIR_DOMAIN_XML_INACTIVE)))
+        goto cleanup;
+    def->id = -1;
+
+    /* The reference is built without any memoization */
+    if (!(expect = testBuildCommandLine(conn, def, info->qemuCaps)))
+        goto cleanup;
+
+    if ((uncached = testBuildCommandLineRounds(conn, def, info->qemuCaps,
+                                               expect)) < 0)
+        goto cleanup;
+
+    if (!(driver.cpuModelCache = qemuCPUModelCacheNew()))
+        goto cleanup;
+
+    if ((cached = testBuildCommandLineRounds(conn, def, info->qemuCaps,
+                                             expect)) < 0)
+        goto cleanup;
+
+    if (def->cpu && virHashSize(driver.cpuModelCache) != 1) {
+        fprintf(stderr, "expected one cached CPU model, got %zd\n",
+                virHashSize(driver.cpuModelCache));
+        goto cleanup;
+    }
+
+    /* The one entry has to be found for the next domain start too,
+     * which comes with yet another copy of the capabilities */
+    if (def->cpu && virHashSize(driver.cpuModelCache) == 1) {
+        virHashKeyValuePairPtr entries;
+        int rc;
+
+        if (!(copy = virQEMUCapsNewCopy(info->qemuCaps)) ||
+            !(caps = virQEMUDriverGetCapabilities(&driver, false)) ||
+            !(entries = virHashGetItems(driver.cpuModelCache, NULL)))
+            goto cleanup;
+
+        rc = qemuCPUModelCacheLookup(&driver, entries[0].key, caps, copy,
+                                     &model, &hasHwVirt);
+        VIR_FREE(entries);
+        if (rc != 1) {
+            fprintf(stderr, "cached CPU model not found for a copy "
+                    "of the emulator capabilities\n");
+            goto cleanup;
+        }
+    }
+
+    if (virTestGetVerbose())
+        fprintf(stderr, "\n%s: %d command lines in %lld ms, "
+                "%lld ms with memoization\n", info->name,
+                TEST_COMMAND_CACHE_ROUNDS, uncached, cached);
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(driver.cpuModelCache);
+    driver.cpuModelCache = NULL;
+    virObjectUnref(copy);
+    virObjectUnref(caps);
+    VIR_FREE(model);
+    virDomainDefFree(def);
+    virObjectUnref(conn);
+    VIR_FREE(xml);
+    VIR_FREE(expect);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    const char *models[] = {
+        "Opteron_G3", "Opteron_G2", "Opteron_G1",
+        "Nehalem", "Penryn", "Conroe", "qemu64",
+    };
+    size_t i;
+
+    if (!(driver.config = virQEMUDriverConfigNew(false)) ||
+        !(driver.caps = testQemuCapsInit()) ||
+        !(driver.xmlopt = virQEMUDriverCreateXMLConf(&driver)))
+        return EXIT_FAILURE;
+
+# define DO_TEST(name, ...)                                             \
+    do {                                                                \
+        struct testInfo info = { name, NULL };                          \
+        if (!(info.qemuCaps = virQEMUCapsNew()))                        \
+            return EXIT_FAILURE;                                        \
+        for (i = 0; i < ARRAY_CARDINALITY(models); i++) {               \
+            if (virQEMUCapsAddCPUDefinition(info.qemuCaps,              \
+                                            models[i]) < 0)             \
+                return EXIT_FAILURE;                                    \
+        }                                                               \
+        virQEMUCapsSetList(info.qemuCaps, __VA_ARGS__, QEMU_CAPS_LAST); \
+        if (virtTestRun("QEMU command cache " name,                     \
+                        testCommandCache, &info) < 0)                   \
+            ret = -1;                                                   \
+        virObjectUnref(info.qemuCaps);                                  \
+    } while (0)
+
+# define NONE QEMU_CAPS_LAST
+
+    DO_TEST("minimal", NONE);
+    DO_TEST("cpu-minimum1", QEMU_CAPS_KVM);
+    DO_TEST("cpu-exact1", QEMU_CAPS_KVM);
+    DO_TEST("cpu-strict1", QEMU_CAPS_KVM);
+    DO_TEST("cpu-host-model", NONE);
+
+    virObjectUnref(driver.config);
+    virObjectUnref(driver.caps);
+    virObjectUnref(driver.xmlopt);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
@@ -149,6 +149,7 @@ testQemuHotplugUpdate(virDomainObjPtr vm,
                       virDomainDeviceDefPtr dev)
 {
     int ret = -1;
+    int idx;
 
     /* XXX Ideally, we would call qemuDomainUpdateDeviceLive here.  But that
      * would require us to provide virConnectPtr and virDomainPtr (they're used
@@ -159,6 +160,16 @@ testQemuHotplugUpdate(virDomainObjPtr vm,
     case VIR_DOMAIN_DEVICE_GRAPHICS:
         ret = qemuDomainChangeGraphics(&driver, vm, dev->data.graphics);
         break;
+    case VIR_DOMAIN_DEVICE_DISK:
+        if ((idx = virDomainDiskIndexByName(vm->def,
+                                            dev->data.disk->dst, false)) < 0)
+            break;
+        ret = qemuDomainChangeEjectableMedia(&driver, NULL, vm,
+                                             vm->def->disks[idx],
+                                             dev->data.disk->src, false);
+        if (ret == 0)
+            dev->data.disk->src = NULL;
+        break;
     default:
         if (virTestGetVerbose())
             fprintf(stderr, "device type '%s' cannot be updated\n",
@@ -365,6 +376,8 @@ mymain(void)
 
     /* wait only 100ms for DEVICE_DELETED event */
     qemuDomainRemoveDeviceWaitTime = 100;
+    /* and for DEVICE_TRAY_MOVED, less than media change used to poll for */
+    qemuDomainChangeMediaWaitTime = 100;
 
 #define DO_TEST(file, ACTION, dev, event, fial, kep, ...)                   \
     do {                                                                    \
@@ -413,6 +426,19 @@ mymain(void)
     "    }"                                                 \
     "}\r\n"
 
+#define QMP_TRAY_MOVED(dev) \
+    "{"                                                     \
+    "    \"timestamp\": {"                                  \
+    "        \"seconds\": 1374137171,"                      \
+    "        \"microseconds\": 2659"                        \
+    "    },"                                                \
+    "    \"event\": \"DEVICE_TRAY_MOVED\","                 \
+    "    \"data\": {"                                       \
+    "        \"device\": \"" dev "\","                      \
+    "        \"tray-open\": true"                           \
+    "    }"                                                 \
+    "}"
+
     DO_TEST_UPDATE("graphics-spice", "graphics-spice-nochange", false, false, NULL);
     DO_TEST_UPDATE("graphics-spice-timeout", "graphics-spice-timeout-nochange", false, false,
                    "set_password", QMP_OK, "expire_password", QMP_OK);
@@ -421,9 +447,22 @@ mymain(void)
     DO_TEST_UPDATE("graphics-spice", "graphics-spice-listen", true, false, NULL);
     DO_TEST_UPDATE("graphics-spice-listen-network", "graphics-spice-listen-network", false, false,
                    "set_password", QMP_OK, "expire_password", QMP_OK);
-    /* Strange huh? Currently, only graphics can be updated :-P */
+    /* Only the media of removable disks can be changed */
     DO_TEST_UPDATE("disk-cdrom", "disk-cdrom-nochange", true, false, NULL);
 
+    /* The tray opening wakes up the media change right away, whether
+     * QEMU reports it before or after replying to eject; without the
+     * event the change fails once the wait time runs out */
+    DO_TEST_UPDATE("disk-cdrom", "disk-cdrom-change", false, false,
+                   "eject", QMP_TRAY_MOVED("drive-ide0-1-0") "\r\n" QMP_OK,
+                   "change", QMP_OK);
+    DO_TEST_UPDATE("disk-cdrom", "disk-cdrom-change", false, false,
+                   "eject", QMP_OK "\r\n" QMP_TRAY_MOVED("drive-ide0-1-0"),
+                   "change", QMP_OK);
+    DO_TEST_UPDATE("disk-cdrom", "disk-cdrom-change", true, false,
+                   "eject", QMP_OK,
+                   "change", QMP_OK);
+
     DO_TEST_ATTACH("console-compat-2", "console-virtio", false, true,
                    "chardev-add", "{\"return\": {\"pty\": \"/dev/pts/26\"}}",
                    "device_add", QMP_OK);
@@ -0,0 +1,252 @@
+/*
+ * qemumonitorstarttest.c: check that the monitor connects to a freshly
+ * started QEMU as soon as it listens, rather than on the next tick of a
+ * fixed retry period
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#ifdef WITH_QEMU
+
+# include <sys/socket.h>
+# include <sys/un.h>
+
+# include "internal.h"
+# include "viralloc.h"
+# include "virfile.h"
+# include "virstring.h"
+# include "virthread.h"
+# include "virtime.h"
+# include "qemu/qemu_conf.h"
+# include "qemu/qemu_monitor.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+/* The longest the monitor may take to connect once the socket is
+ * listening. Retrying every 200 ms, as was done before, takes 100 ms
+ * on average; without file notifications connecting still falls back
+ * to polling with backoff up to that period. */
+# if HAVE_SYS_INOTIFY_H
+#  define TEST_CONNECT_LATENCY_MAX 50
+# else
+#  define TEST_CONNECT_LATENCY_MAX 250
+# endif
+
+static virDomainXMLOptionPtr xmlopt;
+
+/* Stands in for QEMU: creates and listens on the monitor socket once
+ * it is done "starting up", the way QEMU does after parsing its
+ * command line and initializing devices. */
+typedef struct _testFakeQEMU testFakeQEMU;
+struct _testFakeQEMU {
+    const char *name;
+    char *path;
+    int delay;                  /* ms of startup before listening */
+    bool stale;                 /* a dead socket is left behind */
+
+    int fd;
+    unsigned long long listening; /* when connecting became possible */
+};
+
+static int
+testFakeQEMUBind(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (virStrcpyStatic(addr.sun_path, path) == NULL ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        VIR_FORCE_CLOSE(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void
+testFakeQEMUThread(void *opaque)
+{
+    testFakeQEMU *qemu = opaque;
+
+    usleep(qemu->delay * 1000);
+
+    if (qemu->stale)
+        unlink(qemu->path);
+
+    if ((qemu->fd = testFakeQEMUBind(qemu->path)) < 0 ||
+        listen(qemu->fd, 1) < 0 ||
+        virTimeMillisNow(&qemu->listening) < 0)
+        VIR_FORCE_CLOSE(qemu->fd);
+}
+
+static void
+testMonitorEOFNotify(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
+                     virDomainObjPtr vm ATTRIBUTE_UNUSED,
+                     void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+static void
+testMonitorErrorNotify(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
+                       virDomainObjPtr vm ATTRIBUTE_UNUSED,
+                       void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+static qemuMonitorCallbacks testMonitorCallbacks = {
+    .eofNotify = testMonitorEOFNotify,
+    .errorNotify = testMonitorErrorNotify,
+};
+
+static int
+testMonitorStart(const void *opaque)
+{
+    const testFakeQEMU *data = opaque;
+    testFakeQEMU qemu = *data;
+    char *tmpdir = NULL;
+    virDomainObjPtr vm = NULL;
+    virDomainChrSourceDef src;
+    qemuMonitorPtr mon = NULL;
+    virThread thread;
+    bool started = false;
+    unsigned long long connected;
+    unsigned long long latency;
+    int fd;
+    int ret = -1;
+
+    qemu.path = NULL;
+    qemu.fd = -1;
+    memset(&src, 0, sizeof(src));
+
+    if (VIR_STRDUP(tmpdir, "/tmp/libvirt_XXXXXX") < 0)
+        goto cleanup;
+
+    if (!mkdtemp(tmpdir)) {
+        VIR_FREE(tmpdir);
+        goto cleanup;
+    }
+
+    if (virAsprintf(&qemu.path, "%s/monitor.sock", tmpdir) < 0)
+        goto cleanup;
+
+    /* What a previous QEMU which got killed leaves behind */
+    if (qemu.stale) {
+        if ((fd = testFakeQEMUBind(qemu.path)) < 0)
+            goto cleanup;
+        VIR_FORCE_CLOSE(fd);
+    }
+
+    if (!(vm = virDomainObjNew(xmlopt)))
+        goto cleanup;
+
+    src.type = VIR_DOMAIN_CHR_TYPE_UNIX;
+    src.data.nix.path = qemu.path;
+
+    if (virThreadCreate(&thread, true, testFakeQEMUThread, &qemu) < 0)
+        goto cleanup;
+    started = true;
+
+    mon = qemuMonitorOpen(vm, &src, false, &testMonitorCallbacks, NULL);
+
+    if (virTimeMillisNow(&connected) < 0)
+        goto cleanup;
+
+    virThreadJoin(&thread);
+    started = false;
+
+    if (!mon || qemu.fd < 0)
+        goto cleanup;
+
+    latency = connected - MIN(connected, qemu.listening);
+    if (latency > TEST_CONNECT_LATENCY_MAX) {
+        fprintf(stderr, "%s: connected %llu ms after the socket started "
+                "listening, expected at most %d ms\n", qemu.name,
+                latency, TEST_CONNECT_LATENCY_MAX);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (started)
+        virThreadJoin(&thread);
+    if (mon)
+        qemuMonitorClose(mon);
+    virObjectUnref(vm);
+    VIR_FORCE_CLOSE(qemu.fd);
+    if (qemu.path)
+        unlink(qemu.path);
+    if (tmpdir)
+        rmdir(tmpdir);
+    VIR_FREE(qemu.path);
+    VIR_FREE(tmpdir);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virThreadInitialize() < 0 ||
+        !(xmlopt = virQEMUDriverCreateXMLConf(NULL)))
+        return EXIT_FAILURE;
+
+    virEventRegisterDefaultImpl();
+
+# define DO_TEST(name, delay, stale)                                     \
+    do {                                                                \
+        testFakeQEMU qemu = { name, NULL, delay, stale, -1, 0 };         \
+        if (virtTestRun("monitor start " name,                         \
+                        testMonitorStart, &qemu) < 0)                   \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("immediate", 0, false);
+    DO_TEST("fast", 20, false);
+    DO_TEST("slow", 700, false);
+    DO_TEST("stale socket", 20, true);
+    DO_TEST("stale socket slow", 700, true);
+
+    virObjectUnref(xmlopt);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
@@ -739,6 +739,7 @@ static qemuMonitorCallbacks qemuMonitorTestCallbacks = {
     .eofNotify = qemuMonitorTestEOFNotify,
     .errorNotify = qemuMonitorTestErrorNotify,
     .domainDeviceDeleted = qemuProcessHandleDeviceDeleted,
+    .domainTrayChange = qemuProcessHandleTrayChange,
 };
 
 
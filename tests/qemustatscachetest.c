@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "qemu/qemu_conf.h"
+#include "qemu/qemu_command.h"
+#include "qemu/qemu_domain.h"
+#include "qemu/qemu_driverpriv.h"
+#include "qemumonitortestutils.h"
+#include "testutils.h"
+#include "testutilsqemu.h"
+#include "datatypes.h"
+#include "virerror.h"
+#include "virstring.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static virQEMUDriver driver;
+
+#define TEST_STATS (VIR_DOMAIN_STATS_STATE | \
+                    VIR_DOMAIN_STATS_BALLOON | \
+                    VIR_DOMAIN_STATS_BLOCK)
+
+static const char *testBlockStatsReply =
+    "{"
+    "    \"return\": ["
+    "        {"
+    "            \"device\": \"drive-virtio-disk0\","
+    "            \"stats\": {"
+    "                \"flush_total_time_ns\": 0,"
+    "                \"wr_highest_offset\": 10406001664,"
+    "                \"wr_total_time_ns\": 530699221,"
+    "                \"wr_bytes\": 2845696,"
+    "                \"rd_total_time_ns\": 640616474,"
+    "                \"flush_operations\": 0,"
+    "                \"wr_operations\": 174,"
+    "                \"rd_bytes\": 28505088,"
+    "                \"rd_operations\": 1279"
+    "            }"
+    "        }"
+    "    ]"
+    "}";
+
+static const char *testBlockReply =
+    "{"
+    "    \"return\": []"
+    "}";
+
+
+static void
+testStatsRecordFree(virDomainStatsRecordPtr record)
+{
+    if (!record)
+        return;
+
+    virTypedParamsFree(record->params, record->nparams);
+    virObjectUnref(record->dom);
+    VIR_FREE(record);
+}
+
+
+static int
+testStatsRecordCompare(virDomainStatsRecordPtr live,
+                       virDomainStatsRecordPtr cached)
+{
+    size_t i;
+
+    if (live->nparams != cached->nparams) {
+        fprintf(stderr, "Expected %d cached params, got %d\n",
+                live->nparams, cached->nparams);
+        return -1;
+    }
+
+    for (i = 0; i < live->nparams; i++) {
+        virTypedParameterPtr a = &live->params[i];
+        virTypedParameterPtr b = &cached->params[i];
+
+        if (STRNEQ(a->field, b->field) || a->type != b->type ||
+            (a->type == VIR_TYPED_PARAM_STRING ?
+             STRNEQ(a->value.s, b->value.s) :
+             memcmp(&a->value, &b->value, sizeof(a->value)) != 0)) {
+            fprintf(stderr, "Cached param '%s' differs from live '%s'\n",
+                    b->field, a->field);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+testStatsCacheConfig(const void *data ATTRIBUTE_UNUSED)
+{
+    virQEMUDriverConfigPtr cfg = NULL;
+    char *path = NULL;
+    int ret = -1;
+
+    if (!(cfg = virQEMUDriverConfigNew(false)))
+        goto cleanup;
+
+    if (cfg->statsSampleInterval != 0) {
+        fprintf(stderr, "Stats sampling must be off by default\n");
+        goto cleanup;
+    }
+
+    if (virAsprintf(&path, "%s/qemustatscachetestdata/qemu.conf",
+                    abs_srcdir) < 0 ||
+        virQEMUDriverConfigLoadFile(cfg, path) < 0)
+        goto cleanup;
+
+    if (cfg->statsSampleInterval != 5) {
+        fprintf(stderr, "Expected stats_sample_interval 5, got %u\n",
+                cfg->statsSampleInterval);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(path);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+static int
+testStatsCacheSample(const void *data ATTRIBUTE_UNUSED)
+{
+    virConnectPtr conn = NULL;
+    virDomainObjPtr vm = NULL;
+    qemuDomainObjPrivatePtr priv = NULL;
+    qemuMonitorTestPtr test = NULL;
+    virDomainStatsRecordPtr live = NULL;
+    virDomainStatsRecordPtr cached = NULL;
+    char *filename = NULL;
+    char *xml = NULL;
+    int rc;
+    int ret = -1;
+
+    if (virAsprintf(&filename, "%s/qemuxml2argvdata/qemuxml2argv-disk-virtio.xml",
+                    abs_srcdir) < 0 ||
+        virtTestLoadFile(filename, &xml) < 0)
+        goto cleanup;
+
+    if (!(conn = virGetConnect()))
+        goto cleanup;
+    conn->privateData = &driver;
+
+    if (!(vm = virDomainObjNew(driver.xmlopt)))
+        goto cleanup;
+
+    if (!(vm->def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                            QEMU_EXPECTED_VIRT_TYPES,
+                                            VIR_DOMAIN_XML_INACTIVE)))
+        goto cleanup;
+
+    priv = vm->privateData;
+    if (!(priv->qemuCaps = virQEMUCapsNew()))
+        goto cleanup;
+    virQEMUCapsSet(priv->qemuCaps, QEMU_CAPS_DRIVE);
+    virQEMUCapsSet(priv->qemuCaps, QEMU_CAPS_DEVICE);
+
+    if (qemuAssignDeviceAliases(vm->def, priv->qemuCaps) < 0)
+        goto cleanup;
+
+    vm->def->id = 1;
+    virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_BOOTED);
+
+    /* one round for the sampler and one for the live query */
+    if (!(test = qemuMonitorTestNew(true, driver.xmlopt, vm, &driver, NULL)) ||
+        qemuMonitorTestAddItem(test, "query-blockstats",
+                               testBlockStatsReply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-block", testBlockReply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-blockstats",
+                               testBlockStatsReply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-block", testBlockReply) < 0)
+        goto cleanup;
+
+    priv->mon = qemuMonitorTestGetMonitor(test);
+    priv->monJSON = true;
+    /* qemuDomainObjEnterMonitor locks the monitor by itself */
+    virObjectUnlock(priv->mon);
+
+    if ((rc = qemuDomainGetStatsCached(conn, vm, TEST_STATS, &cached)) != 0) {
+        fprintf(stderr, "Expected a cache miss before sampling, got %d\n", rc);
+        goto cleanup;
+    }
+
+    qemuDomainStatsSampleOne(&driver, vm, NULL);
+
+    if (!priv->statsCache ||
+        !(priv->statsCache->stats & VIR_DOMAIN_STATS_BALLOON) ||
+        !(priv->statsCache->stats & VIR_DOMAIN_STATS_BLOCK)) {
+        fprintf(stderr, "The sampler did not fill the cache\n");
+        goto cleanup;
+    }
+
+    if ((rc = qemuDomainGetStatsCached(conn, vm, TEST_STATS, &cached)) != 1) {
+        fprintf(stderr, "Expected a cache hit after sampling, got %d\n", rc);
+        goto cleanup;
+    }
+
+    if (qemuDomainObjBeginQueryJob(&driver, vm, QEMU_JOB_WAIT_QUERY) < 0)
+        goto cleanup;
+    rc = qemuDomainGetStats(conn, vm, TEST_STATS, &live, NULL,
+                            QEMU_DOMAIN_STATS_HAVE_JOB);
+    ignore_value(qemuDomainObjEndQueryJob(&driver, vm));
+    if (rc < 0)
+        goto cleanup;
+
+    if (testStatsRecordCompare(live, cached) < 0)
+        goto cleanup;
+
+    testStatsRecordFree(cached);
+    cached = NULL;
+
+    /* no sample is served once sampling is turned off */
+    driver.config->statsSampleInterval = 0;
+    if ((rc = qemuDomainGetStatsCached(conn, vm, TEST_STATS, &cached)) != 0) {
+        fprintf(stderr, "Expected a cache miss with sampling off, got %d\n",
+                rc);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    driver.config->statsSampleInterval = 5;
+    /* don't dispose test monitor with VM */
+    if (priv)
+        priv->mon = NULL;
+    virObjectUnref(vm);
+    qemuMonitorTestFree(test);
+    testStatsRecordFree(live);
+    testStatsRecordFree(cached);
+    virObjectUnref(conn);
+    VIR_FREE(filename);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#if !WITH_YAJL
+    fputs("libvirt not compiled with yajl, skipping this test\n", stderr);
+    return EXIT_AM_SKIP;
+#endif
+
+    if (virThreadInitialize() < 0 ||
+        !(driver.caps = testQemuCapsInit()) ||
+        !(driver.xmlopt = virQEMUDriverCreateXMLConf(&driver)) ||
+        !(driver.config = virQEMUDriverConfigNew(false)))
+        return EXIT_FAILURE;
+
+    virEventRegisterDefaultImpl();
+
+    driver.config->statsSampleInterval = 5;
+
+    if (virtTestRun("stats_sample_interval", testStatsCacheConfig, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("sampled stats", testStatsCacheSample, NULL) < 0)
+        ret = -1;
+
+    virObjectUnref(driver.caps);
+    virObjectUnref(driver.xmlopt);
+    virObjectUnref(driver.config);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
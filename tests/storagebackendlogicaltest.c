@@ -0,0 +1,222 @@
+/*
+ * storagebackendlogicaltest.c: test parsing of lvs reports
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "storage/storage_backend_logical.h"
+#include "virbuffer.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static char *poolxml;
+
+static virStoragePoolObjPtr
+testLogicalPoolNew(void)
+{
+    virStoragePoolObjPtr pool = NULL;
+    char *poolXmlData = NULL;
+
+    if (virtTestLoadFile(poolxml, &poolXmlData) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC(pool) < 0)
+        goto cleanup;
+
+    if (!(pool->def = virStoragePoolDefParseString(poolXmlData))) {
+        VIR_FREE(pool);
+        goto cleanup;
+    }
+
+    /* The report carries the real figures */
+    pool->def->capacity = pool->def->allocation = pool->def->available = 0;
+
+ cleanup:
+    VIR_FREE(poolXmlData);
+    return pool;
+}
+
+static void
+testLogicalPoolFree(virStoragePoolObjPtr pool)
+{
+    if (!pool)
+        return;
+    virStoragePoolObjClearVols(pool);
+    virStoragePoolDefFree(pool->def);
+    VIR_FREE(pool);
+}
+
+static char *
+testLogicalFormatPool(virStoragePoolObjPtr pool)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i, j;
+
+    virBufferAsprintf(&buf, "pool capacity=%llu allocation=%llu available=%llu\n",
+                      pool->def->capacity, pool->def->allocation,
+                      pool->def->available);
+
+    for (i = 0; i < pool->volumes.count; i++) {
+        virStorageVolDefPtr vol = pool->volumes.objs[i];
+
+        virBufferAsprintf(&buf, "volume %s key=%s allocation=%llu sparse=%s\n",
+                          vol->name, vol->key, vol->target.allocation,
+                          vol->target.sparse ? "yes" : "no");
+        virBufferAsprintf(&buf, "  path %s\n", vol->target.path);
+        if (vol->target.backingStore)
+            virBufferAsprintf(&buf, "  backing %s\n",
+                              vol->target.backingStore->path);
+        for (j = 0; j < vol->source.nextent; j++)
+            virBufferAsprintf(&buf, "  extent %s %llu %llu\n",
+                              vol->source.extents[j].path,
+                              vol->source.extents[j].start,
+                              vol->source.extents[j].end);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+static int
+testLogicalParseReport(const void *opaque)
+{
+    const char *name = opaque;
+    char *reportFile = NULL;
+    char *expectFile = NULL;
+    char *report = NULL;
+    char *expect = NULL;
+    char *actual = NULL;
+    virStoragePoolObjPtr pool = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&reportFile, "%s/storagebackendlogicaldata/%s.lvs",
+                    abs_srcdir, name) < 0 ||
+        virAsprintf(&expectFile, "%s/storagebackendlogicaldata/%s.out",
+                    abs_srcdir, name) < 0)
+        goto cleanup;
+
+    if (virtTestLoadFile(reportFile, &report) < 0 ||
+        virtTestLoadFile(expectFile, &expect) < 0)
+        goto cleanup;
+
+    if (!(pool = testLogicalPoolNew()))
+        goto cleanup;
+
+    if (virStorageBackendLogicalParseLVs(pool, NULL, report) <= 0)
+        goto cleanup;
+
+    if (!(actual = testLogicalFormatPool(pool)))
+        goto cleanup;
+
+    if (STRNEQ(expect, actual)) {
+        virtTestDifference(stderr, expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(reportFile);
+    VIR_FREE(expectFile);
+    VIR_FREE(report);
+    VIR_FREE(expect);
+    VIR_FREE(actual);
+    testLogicalPoolFree(pool);
+    return ret;
+}
+
+static int
+testLogicalParseMalformed(const void *opaque)
+{
+    const char *report = opaque;
+    char *output = NULL;
+    virStoragePoolObjPtr pool = NULL;
+    int ret = -1;
+
+    if (!(pool = testLogicalPoolNew()))
+        goto cleanup;
+
+    if (VIR_STRDUP(output, report) < 0)
+        goto cleanup;
+
+    if (virStorageBackendLogicalParseLVs(pool, NULL, output) != -1)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(output);
+    testLogicalPoolFree(pool);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    const char *malformed[] = {
+        "  LVM2_LV_NAME='Root' LVM2_LV_UUID='abc",
+        "  LVM2_LV_NAME",
+        "  LVM2_LV_NAME='Root' LVM2_LV_UUID='abc' LVM2_DEVICES='/dev/sda2' "
+        "LVM2_SEGTYPE='linear' LVM2_STRIPES='1' LVM2_SEG_SIZE='1' "
+        "LVM2_VG_EXTENT_SIZE='1' LVM2_LV_SIZE='1' LVM2_LV_ATTR='-wi-a-----'",
+        "  LVM2_LV_NAME='Root' LVM2_LV_UUID='abc' LVM2_DEVICES='/dev/sda2(0)' "
+        "LVM2_SEGTYPE='striped' LVM2_STRIPES='2' LVM2_SEG_SIZE='1' "
+        "LVM2_VG_EXTENT_SIZE='1' LVM2_LV_SIZE='1' LVM2_LV_ATTR='-wi-a-----'",
+        "  LVM2_LV_NAME='Root' LVM2_LV_UUID='abc' LVM2_DEVICES='/dev/sda2(0)' "
+        "LVM2_SEGTYPE='linear' LVM2_STRIPES='1' LVM2_SEG_SIZE='x' "
+        "LVM2_VG_EXTENT_SIZE='1' LVM2_LV_SIZE='1' LVM2_LV_ATTR='-wi-a-----'",
+    };
+    size_t i;
+
+    if (virAsprintf(&poolxml, "%s/storagepoolxml2xmlin/pool-logical.xml",
+                    abs_srcdir) < 0)
+        return EXIT_FAILURE;
+
+#define DO_TEST(name)                                               \
+    if (virtTestRun("lvs report " name, testLogicalParseReport,     \
+                    name) < 0)                                      \
+        ret = -1
+
+    DO_TEST("linear");
+    DO_TEST("striped");
+    DO_TEST("snapshot");
+
+    for (i = 0; i < ARRAY_CARDINALITY(malformed); i++) {
+        if (virtTestRun("lvs report malformed", testLogicalParseMalformed,
+                        malformed[i]) < 0)
+            ret = -1;
+    }
+
+    VIR_FREE(poolxml);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -905,6 +905,121 @@ void virtTestClearCommandPath(char *cmdset)
     cmdset[offset] = '\0';
 }
 
+/*
+ * Expands the @input of a *tables-restore run back into one @bin
+ * command per rule, the way the rules would have been run without
+ * batching. Like *tables-restore, only double quotes around whole
+ * arguments are understood; virfirewalltest checks the input itself.
+ */
+static void
+virtTestFirewallExpandRestore(virBufferPtr buf,
+                              const char *bin,
+                              const char *input,
+                              bool explicitTable)
+{
+    char **lines = virStringSplit(input, "\n", 0);
+    const char *table = "filter";
+    char *token = NULL;
+    size_t i;
+
+    for (i = 0; lines && lines[i]; i++) {
+        const char *cur = lines[i];
+
+        if (*cur == '*') {
+            table = cur + 1;
+            continue;
+        }
+        if (!*cur || *cur == '#' || STREQ(cur, "COMMIT"))
+            continue;
+
+        if (VIR_ALLOC_N(token, strlen(cur) + 1) < 0)
+            break;
+
+        virBufferAdd(buf, bin, -1);
+        if (explicitTable || STRNEQ(table, "filter")) {
+            virBufferAddLit(buf, " --table ");
+            virBufferEscapeShell(buf, table);
+        }
+
+        while (*cur) {
+            size_t len = 0;
+
+            if (*cur == ' ') {
+                cur++;
+                continue;
+            }
+
+            if (*cur == '"') {
+                for (cur++; *cur && *cur != '"'; cur++)
+                    token[len++] = *cur;
+                if (*cur)
+                    cur++;
+            } else {
+                while (*cur && *cur != ' ')
+                    token[len++] = *cur++;
+            }
+            token[len] = '\0';
+
+            virBufferAddChar(buf, ' ');
+            virBufferEscapeShell(buf, token);
+        }
+        virBufferAddChar(buf, '\n');
+        VIR_FREE(token);
+    }
+
+    VIR_FREE(token);
+    virStringFreeList(lines);
+}
+
+/*
+ * Dry run callback recording commands in the same format as a dry
+ * run buffer, except that batches of rules applied through
+ * iptables-restore or ip6tables-restore are recorded as the
+ * individual iptables or ip6tables commands they stand for, so
+ * expected output does not depend on whether rules were batched.
+ * @opaque is a virtTestFirewallDryRunData.
+ */
+void virtTestFirewallDryRun(const char *const*args,
+                            const char *const*env,
+                            const char *input,
+                            char **output ATTRIBUTE_UNUSED,
+                            char **error ATTRIBUTE_UNUSED,
+                            int *status ATTRIBUTE_UNUSED,
+                            void *opaque)
+{
+    virtTestFirewallDryRunData *data = opaque;
+    size_t i;
+
+    if (STREQ(args[0], IPTABLES_RESTORE_PATH) && input) {
+        virtTestFirewallExpandRestore(data->buf, IPTABLES_PATH, input,
+                                      data->explicitTable);
+        return;
+    }
+    if (STREQ(args[0], IP6TABLES_RESTORE_PATH) && input) {
+        virtTestFirewallExpandRestore(data->buf, IP6TABLES_PATH, input,
+                                      data->explicitTable);
+        return;
+    }
+
+    for (i = 0; env && env[i]; i++) {
+        const char *eq = strchr(env[i], '=');
+
+        if (!eq)
+            continue;
+        eq++;
+        virBufferAdd(data->buf, env[i], eq - env[i]);
+        virBufferEscapeShell(data->buf, eq);
+        virBufferAddChar(data->buf, ' ');
+    }
+
+    virBufferEscapeShell(data->buf, args[0]);
+    for (i = 1; args[i]; i++) {
+        virBufferAddChar(data->buf, ' ');
+        virBufferEscapeShell(data->buf, args[i]);
+    }
+    virBufferAddChar(data->buf, '\n');
+}
+
 
 virCapsPtr virTestGenericCapsInit(void)
 {
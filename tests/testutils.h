@@ -27,6 +27,7 @@
 # include "viralloc.h"
 # include "virfile.h"
 # include "virstring.h"
+# include "virbuffer.h"
 # include "capabilities.h"
 # include "domain_conf.h"
 
@@ -61,6 +62,20 @@ int virtTestClearLineRegex(const char *pattern,
 
 void virtTestClearCommandPath(char *cmdset);
 
+typedef struct _virtTestFirewallDryRunData virtTestFirewallDryRunData;
+struct _virtTestFirewallDryRunData {
+    virBufferPtr buf;
+    bool explicitTable; /* rules name their table even if it is 'filter' */
+};
+
+void virtTestFirewallDryRun(const char *const*args,
+                            const char *const*env,
+                            const char *input,
+                            char **output,
+                            char **error,
+                            int *status,
+                            void *opaque);
+
 int virtTestDifference(FILE *stream,
                        const char *expect,
                        const char *actual);
@@ -1124,6 +1124,163 @@ testFirewallQuery(const void *opaque ATTRIBUTE_UNUSED)
     return ret;
 }
 
+/* Records commands like a dry run buffer, followed by their input */
+static void
+testFirewallBatchHook(const char *const*args,
+                      const char *const*env ATTRIBUTE_UNUSED,
+                      const char *input,
+                      char **output ATTRIBUTE_UNUSED,
+                      char **error ATTRIBUTE_UNUSED,
+                      int *status ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    virBufferPtr buf = opaque;
+    size_t i;
+
+    virBufferEscapeShell(buf, args[0]);
+    for (i = 1; args[i]; i++) {
+        virBufferAddChar(buf, ' ');
+        virBufferEscapeShell(buf, args[i]);
+    }
+    virBufferAddChar(buf, '\n');
+    if (input)
+        virBufferAdd(buf, input, -1);
+}
+
+static int
+testFirewallBatchApply(virFirewallRestore restore,
+                       const char *expected)
+{
+    virBuffer cmdbuf = VIR_BUFFER_INITIALIZER;
+    virFirewallPtr fw = NULL;
+    int ret = -1;
+    const char *actual = NULL;
+
+    virFirewallSetRestore(restore);
+    virCommandSetDryRun(NULL, testFirewallBatchHook, &cmdbuf);
+
+    fw = virFirewallNew();
+
+    virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_BATCH);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "nat",
+                       "-A", "POSTROUTING",
+                       "--source", "192.168.122.0/24",
+                       "--jump", "MASQUERADE", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "-m", "comment",
+                       "--comment", "libvirt network #1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "-m", "comment",
+                       "--comment", "say \"hi\" to me",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV6,
+                       "-A", "INPUT",
+                       "--source-host", "::1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-A", "INPUT",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRuleFull(fw, VIR_FIREWALL_LAYER_IPV4,
+                           true, NULL, NULL,
+                           "-D", "INPUT",
+                           "--jump", "REJECT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "FORWARD",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "OUTPUT",
+                       "--jump", "ACCEPT", NULL);
+
+    if (virFirewallApply(fw) < 0)
+        goto cleanup;
+
+    if (virBufferError(&cmdbuf))
+        goto cleanup;
+
+    actual = virBufferCurrentContent(&cmdbuf);
+
+    if (STRNEQ_NULLABLE(expected, actual)) {
+        fprintf(stderr, "Unexected command execution\n");
+        virtTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&cmdbuf);
+    virCommandSetDryRun(NULL, NULL, NULL);
+    virFirewallSetRestore(VIR_FIREWALL_RESTORE_AUTOMATIC);
+    virFirewallFree(fw);
+    return ret;
+}
+
+static int
+testFirewallBatch(const void *opaque)
+{
+    /* Rules are batched until one can't be: the quotes of the second
+     * comment can't be passed through iptables-restore, the ebtables
+     * rule has no *tables-restore, and errors of the -D rule are
+     * ignored. A batch of one is run as a plain command. */
+    const char *batched =
+        IPTABLES_RESTORE_PATH " --noflush\n"
+        "*filter\n"
+        "-A INPUT --source-host 192.168.122.1 --jump ACCEPT\n"
+        "COMMIT\n"
+        "*nat\n"
+        "-A POSTROUTING --source 192.168.122.0/24 --jump MASQUERADE\n"
+        "COMMIT\n"
+        "*filter\n"
+        "-A INPUT -m comment --comment \"libvirt network #1\" --jump ACCEPT\n"
+        "COMMIT\n"
+        IPTABLES_PATH " -A INPUT -m comment --comment 'say \"hi\" to me' --jump ACCEPT\n"
+        IP6TABLES_PATH " -A INPUT --source-host ::1 --jump ACCEPT\n"
+        EBTABLES_PATH " -A INPUT --jump ACCEPT\n"
+        IPTABLES_PATH " -D INPUT --jump REJECT\n"
+        IPTABLES_RESTORE_PATH " --noflush\n"
+        "*filter\n"
+        "-A FORWARD --jump REJECT\n"
+        "-A OUTPUT --jump ACCEPT\n"
+        "COMMIT\n";
+    const char *unbatched =
+        IPTABLES_PATH " -A INPUT --source-host 192.168.122.1 --jump ACCEPT\n"
+        IPTABLES_PATH " --table nat -A POSTROUTING --source 192.168.122.0/24 --jump MASQUERADE\n"
+        IPTABLES_PATH " -A INPUT -m comment --comment 'libvirt network #1' --jump ACCEPT\n"
+        IPTABLES_PATH " -A INPUT -m comment --comment 'say \"hi\" to me' --jump ACCEPT\n"
+        IP6TABLES_PATH " -A INPUT --source-host ::1 --jump ACCEPT\n"
+        EBTABLES_PATH " -A INPUT --jump ACCEPT\n"
+        IPTABLES_PATH " -D INPUT --jump REJECT\n"
+        IPTABLES_PATH " -A FORWARD --jump REJECT\n"
+        IPTABLES_PATH " -A OUTPUT --jump ACCEPT\n";
+    const struct testFirewallData *data = opaque;
+
+    fwDisabled = data->fwDisabled;
+    if (virFirewallSetBackend(data->tryBackend) < 0)
+        return -1;
+
+    if (testFirewallBatchApply(VIR_FIREWALL_RESTORE_ENABLED, batched) < 0 ||
+        testFirewallBatchApply(VIR_FIREWALL_RESTORE_DISABLED, unbatched) < 0)
+        return -1;
+
+    return 0;
+}
+
 static int
 mymain(void)
 {
@@ -1178,6 +1335,7 @@ mymain(void)
     RUN_TEST("many rollback", testFirewallManyRollback);
     RUN_TEST("chained rollback", testFirewallChainedRollback);
     RUN_TEST("query transaction", testFirewallQuery);
+    RUN_TEST_DIRECT("batch transaction", testFirewallBatch);
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
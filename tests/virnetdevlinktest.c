@@ -0,0 +1,403 @@
+/*
+ * virnetdevlinktest.c: check that setting up interfaces in one batch of
+ * netlink requests matches doing it step by step, and time both; check
+ * that the cache of their state follows changes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+# include <sched.h>
+
+# include "internal.h"
+# include "viralloc.h"
+# include "vircommand.h"
+# include "virnetdev.h"
+# include "virnetdevbridge.h"
+# include "virnetdevlinkcache.h"
+# include "virnetdevveth.h"
+# include "virnetlink.h"
+# include "virstring.h"
+# include "virtime.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+/* The test runs in a network namespace of its own, so these can't
+ * clash with anything on the host */
+# define TEST_BRIDGE "testbr0"
+# define TEST_LINKS 50
+# define TEST_MTU 1400
+
+struct testInfo {
+    const char *name;
+    const char *prefix;
+    bool batched;
+};
+
+static void
+testLinkMAC(virMacAddrPtr mac, size_t i)
+{
+    unsigned char raw[VIR_MAC_BUFLEN] = { 0x52, 0x54, 0x00, 0x12, 0, 0 };
+
+    raw[4] = i >> 8;
+    raw[5] = i & 0xff;
+    virMacAddrSetRaw(mac, raw);
+}
+
+/* What virNetDevTapCreateInBridgePort used to do */
+static int
+testLinkSetupSteps(const char *ifname, const virMacAddr *mac)
+{
+    if (virNetDevSetMAC(ifname, mac) < 0 ||
+        virNetDevSetMTU(ifname, TEST_MTU) < 0 ||
+        virNetDevBridgeAddPort(TEST_BRIDGE, ifname) < 0 ||
+        virNetDevSetOnline(ifname, true) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+testLinkCheck(const char *ifname, const virMacAddr *mac, int brindex)
+{
+    struct nlattr *tb[IFLA_MAX + 1] = { NULL, };
+    void *nlData = NULL;
+    virMacAddr actual;
+    bool online;
+    int ret = -1;
+
+    if (virNetDevGetMAC(ifname, &actual) < 0 ||
+        virNetDevIsOnline(ifname, &online) < 0 ||
+        virNetDevLinkDump(ifname, -1, &nlData, tb, 0, 0) < 0)
+        goto cleanup;
+
+    if (virMacAddrCmp(mac, &actual) != 0) {
+        fprintf(stderr, "%s: unexpected MAC address\n", ifname);
+        goto cleanup;
+    }
+
+    if (virNetDevGetMTU(ifname) != TEST_MTU) {
+        fprintf(stderr, "%s: unexpected MTU\n", ifname);
+        goto cleanup;
+    }
+
+    if (!tb[IFLA_MASTER] || (int)nla_get_u32(tb[IFLA_MASTER]) != brindex) {
+        fprintf(stderr, "%s: not attached to %s\n", ifname, TEST_BRIDGE);
+        goto cleanup;
+    }
+
+    if (!online) {
+        fprintf(stderr, "%s: not online\n", ifname);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(nlData);
+    return ret;
+}
+
+static int
+testLinkSetup(const void *opaque)
+{
+    const struct testInfo *info = opaque;
+    char *names[TEST_LINKS] = { NULL, };
+    char *peer = NULL;
+    virMacAddr mac;
+    unsigned long long start;
+    unsigned long long end;
+    int brindex;
+    size_t i;
+    int ret = -1;
+
+    if (virNetDevGetIndex(TEST_BRIDGE, &brindex) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_LINKS; i++) {
+        if (virAsprintf(&names[i], "%sa%zu", info->prefix, i) < 0 ||
+            virAsprintf(&peer, "%sb%zu", info->prefix, i) < 0 ||
+            virNetDevVethCreate(&names[i], &peer) < 0)
+            goto cleanup;
+        VIR_FREE(peer);
+    }
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_LINKS; i++) {
+        testLinkMAC(&mac, i);
+
+        if (info->batched) {
+            if (virNetDevSetLinkConfig(names[i], &mac, TEST_MTU, TEST_BRIDGE,
+                                       VIR_TRISTATE_BOOL_YES) < 0)
+                goto cleanup;
+        } else {
+            if (testLinkSetupSteps(names[i], &mac) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_LINKS; i++) {
+        testLinkMAC(&mac, i);
+        if (testLinkCheck(names[i], &mac, brindex) < 0)
+            goto cleanup;
+    }
+
+    if (virTestGetVerbose())
+        fprintf(stderr, "\n%s: %d interfaces set up in %llu ms\n",
+                info->name, TEST_LINKS, end - start);
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < TEST_LINKS; i++) {
+        if (names[i])
+            ignore_value(virNetDevVethDelete(names[i]));
+        VIR_FREE(names[i]);
+    }
+    VIR_FREE(peer);
+    return ret;
+}
+
+static int
+testLinkSetupFail(const void *opaque ATTRIBUTE_UNUSED)
+{
+    char *veth1 = (char *)"faila";
+    char *veth2 = (char *)"failb";
+    bool online;
+    int ret = -1;
+
+    if (virNetDevVethCreate(&veth1, &veth2) < 0)
+        return -1;
+
+    /* Too small an MTU for any device */
+    if (virNetDevSetLinkConfig(veth1, NULL, 10, NULL,
+                               VIR_TRISTATE_BOOL_YES) == 0) {
+        fprintf(stderr, "an MTU of 10 was accepted\n");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    /* Nor is the half configured interface brought up */
+    if (virNetDevIsOnline(veth1, &online) < 0)
+        goto cleanup;
+    if (online) {
+        fprintf(stderr, "interface up despite the failed MTU\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    ignore_value(virNetDevVethDelete(veth1));
+    return ret;
+}
+
+static void
+testLinkCacheTimeout(int timer ATTRIBUTE_UNUSED,
+                     void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+/* Run the event loop until the cache learns about a change made by
+ * another process, for at most about 5 seconds */
+static int
+testLinkCacheWait(unsigned long long invalidations)
+{
+    virNetDevLinkCacheStats stats;
+    int timer;
+    size_t i;
+    int ret = -1;
+
+    if ((timer = virEventAddTimeout(100, testLinkCacheTimeout,
+                                    NULL, NULL)) < 0)
+        return -1;
+
+    for (i = 0; i < 50; i++) {
+        if (virEventRunDefaultImpl() < 0)
+            goto cleanup;
+
+        virNetDevLinkCacheGetStats(&stats);
+        if (stats.invalidations > invalidations) {
+            ret = 0;
+            goto cleanup;
+        }
+    }
+
+    fprintf(stderr, "no link notification received\n");
+
+ cleanup:
+    virEventRemoveTimeout(timer);
+    return ret;
+}
+
+static int
+testLinkCache(const void *opaque ATTRIBUTE_UNUSED)
+{
+    char *veth1 = (char *)"cachea";
+    char *veth2 = (char *)"cacheb";
+    virNetDevLinkCacheStats before;
+    virNetDevLinkCacheStats after;
+    virCommandPtr cmd = NULL;
+    int ifindex;
+    int mtu;
+    int ret = -1;
+
+    if (virNetDevVethCreate(&veth1, &veth2) < 0)
+        return -1;
+
+    virNetDevLinkCacheGetStats(&before);
+
+    /* The first lookup asks the kernel, the next ones don't */
+    if (virNetDevGetIndex(veth1, &ifindex) < 0 ||
+        (mtu = virNetDevGetMTU(veth1)) < 0)
+        goto cleanup;
+
+    virNetDevLinkCacheGetStats(&after);
+    if (after.misses != before.misses + 1 ||
+        after.hits != before.hits + 1) {
+        fprintf(stderr, "expected 1 miss and 1 hit, got %llu and %llu\n",
+                after.misses - before.misses, after.hits - before.hits);
+        goto cleanup;
+    }
+
+    /* Changes made by this process show right away */
+    if (virNetDevSetMTU(veth1, TEST_MTU) < 0)
+        goto cleanup;
+
+    if ((mtu = virNetDevGetMTU(veth1)) != TEST_MTU) {
+        fprintf(stderr, "MTU %d after setting it to %d\n", mtu, TEST_MTU);
+        goto cleanup;
+    }
+
+    /* Others once their notification is in */
+    virNetDevLinkCacheGetStats(&before);
+    cmd = virCommandNewArgList("ip", "link", "set", veth1,
+                               "mtu", "1300", NULL);
+    if (virCommandRun(cmd, NULL) < 0 ||
+        testLinkCacheWait(before.invalidations) < 0)
+        goto cleanup;
+
+    if ((mtu = virNetDevGetMTU(veth1)) != 1300) {
+        fprintf(stderr, "MTU %d after setting it to 1300\n", mtu);
+        goto cleanup;
+    }
+
+    /* A new port may change the bridge too, both are forgotten */
+    if (virNetDevGetMTU(TEST_BRIDGE) < 0)
+        goto cleanup;
+
+    virNetDevLinkCacheGetStats(&before);
+    if (virNetDevBridgeAddPort(TEST_BRIDGE, veth1) < 0)
+        goto cleanup;
+
+    virNetDevLinkCacheGetStats(&after);
+    if (after.invalidations != before.invalidations + 2) {
+        fprintf(stderr, "expected 2 invalidations, got %llu\n",
+                after.invalidations - before.invalidations);
+        goto cleanup;
+    }
+
+    if (virNetDevVethDelete(veth1) < 0)
+        goto cleanup;
+    veth1 = NULL;
+
+    if (virNetDevExists("cachea") != 0 || virNetDevExists(veth2) != 0) {
+        fprintf(stderr, "veth pair still exists\n");
+        goto cleanup;
+    }
+
+    if (virTestGetVerbose()) {
+        virNetDevLinkCacheGetStats(&after);
+        fprintf(stderr, "\nlink cache: %llu hits, %llu misses, "
+                "%llu invalidations\n", after.hits, after.misses,
+                after.invalidations);
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (veth1)
+        ignore_value(virNetDevVethDelete(veth1));
+    virCommandFree(cmd);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    /* Needs privileges, and must not touch the host's interfaces */
+    if (unshare(CLONE_NEWNET) < 0)
+        return EXIT_AM_SKIP;
+
+    if (virNetDevBridgeCreate(TEST_BRIDGE) < 0)
+        return EXIT_AM_SKIP;
+
+# define DO_TEST(name, prefix, batched)                                 \
+    do {                                                                \
+        struct testInfo info = { name, prefix, batched };               \
+        if (virtTestRun("link setup " name,                             \
+                        testLinkSetup, &info) < 0)                      \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("step by step", "step", false);
+    DO_TEST("batched", "batch", true);
+
+    if (virtTestRun("link setup failure", testLinkSetupFail, NULL) < 0)
+        ret = -1;
+
+    /* The same as in libvirtd */
+    if (virEventRegisterDefaultImpl() < 0 ||
+        virNetlinkEventServiceStart(NETLINK_ROUTE, 0) < 0 ||
+        virNetDevLinkCacheStart() < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("link cache", testLinkCache, NULL) < 0)
+        ret = -1;
+
+    virNetlinkEventServiceStopAll();
+
+    ignore_value(virNetDevBridgeDelete(TEST_BRIDGE));
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* defined(__linux__) && defined(HAVE_LIBNL) */
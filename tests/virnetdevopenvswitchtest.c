@@ -0,0 +1,588 @@
+/*
+ * virnetdevopenvswitchtest.c: check the transactions sent to the Open
+ * vSwitch database when adding and removing ports
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#ifndef WIN32
+
+# include <sys/socket.h>
+# include <sys/un.h>
+
+# include "internal.h"
+# include "viralloc.h"
+# include "virbuffer.h"
+# include "virfile.h"
+# include "virjson.h"
+# include "virnetdevopenvswitch.h"
+# include "virovsdb.h"
+# include "virstring.h"
+# include "virthread.h"
+# include "viruuid.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Stands in for ovsdb-server: answers the transactions of a single
+ * client connection, keeping track of whether the bridge and the port
+ * exist, and logging the operations it got one transaction per line.
+ * It plays ovs-vswitchd as well, which applies a new configuration
+ * only once the client watches for it to be applied. */
+typedef struct _testOVSDB testOVSDB;
+struct _testOVSDB {
+    int listenfd;
+    int fd;
+    bool bridge;
+    bool port;
+    bool echoed;                /* an echo request was sent */
+    bool echoReplied;           /* and answered */
+    int nextCfg;
+    int curCfg;
+    virBuffer log;
+};
+
+# define TEST_OVSDB_ROOT_UUID "2ab6d8a1-0c4b-4b7e-9f0e-54f4a1e1c7d3"
+# define TEST_OVSDB_BRIDGE_UUID "8e2f25a8-ba2b-4a83-a7b5-b2bd3f5c3e20"
+# define TEST_OVSDB_PORT_UUID "c5a2c7f5-4c0a-4f5e-9df6-1d3bd1e0e0a1"
+# define TEST_OVSDB_NEW_UUID "0a6fd2a8-5a1b-4f8c-8c43-4f4a8f1d4b6e"
+
+static testOVSDB db = { -1, -1, false, false, false, false, 0, 0,
+                        VIR_BUFFER_INITIALIZER };
+
+static int
+testOVSDBSend(virJSONValuePtr msg)
+{
+    char *str;
+    int ret = -1;
+
+    if (!(str = virJSONValueToString(msg, false)))
+        return -1;
+
+    if (safewrite(db.fd, str, strlen(str)) >= 0 &&
+        safewrite(db.fd, "\n", 1) >= 0)
+        ret = 0;
+
+    VIR_FREE(str);
+    return ret;
+}
+
+static char *
+testOVSDBReadLine(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char c;
+
+    for (;;) {
+        if (saferead(db.fd, &c, 1) != 1) {
+            virBufferFreeAndReset(&buf);
+            return NULL;
+        }
+        if (c == '\n')
+            break;
+        virBufferAddChar(&buf, c);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+static virJSONValuePtr
+testOVSDBRows(bool exists, const char *uuid)
+{
+    virJSONValuePtr rows;
+    virJSONValuePtr row;
+
+    if (!(rows = virJSONValueNewArray()))
+        return NULL;
+
+    if (exists) {
+        row = virOVSDBNewObject("_uuid",
+                                virOVSDBNewArray(2,
+                                                 virJSONValueNewString("uuid"),
+                                                 virJSONValueNewString(uuid)),
+                                NULL);
+        if (!row || virJSONValueArrayAppend(rows, row) < 0) {
+            virJSONValueFree(row);
+            virJSONValueFree(rows);
+            return NULL;
+        }
+    }
+
+    return virOVSDBNewObject("rows", rows, NULL);
+}
+
+static virJSONValuePtr
+testOVSDBNextCfg(void)
+{
+    virJSONValuePtr row;
+
+    row = virOVSDBNewObject("next_cfg", virJSONValueNewNumberInt(db.nextCfg),
+                            NULL);
+
+    return virOVSDBNewObject("rows", virOVSDBNewArray(1, row), NULL);
+}
+
+static virJSONValuePtr
+testOVSDBCurCfgRow(int cfg)
+{
+    return virOVSDBNewObject("cur_cfg", virJSONValueNewNumberInt(cfg), NULL);
+}
+
+/* The table-updates for cur_cfg going from @old to @cur, or being
+ * @cur in the first place if @old is negative */
+static virJSONValuePtr
+testOVSDBCurCfg(int old, int cur)
+{
+    virJSONValuePtr row;
+
+    if (old >= 0)
+        row = virOVSDBNewObject("old", testOVSDBCurCfgRow(old),
+                                "new", testOVSDBCurCfgRow(cur),
+                                NULL);
+    else
+        row = virOVSDBNewObject("new", testOVSDBCurCfgRow(cur), NULL);
+
+    return virOVSDBNewObject("Open_vSwitch",
+                             virOVSDBNewObject(TEST_OVSDB_ROOT_UUID, row, NULL),
+                             NULL);
+}
+
+static virJSONValuePtr
+testOVSDBOp(virJSONValuePtr op)
+{
+    const char *name = virJSONValueObjectGetString(op, "op");
+    const char *table = virJSONValueObjectGetString(op, "table");
+    virJSONValuePtr mutation;
+    char *row;
+
+    if (!name || !table)
+        return NULL;
+
+    virBufferAsprintf(&db.log, "%s %s", name, table);
+
+    if (STREQ(name, "wait")) {
+        /* Nothing changes behind the client's back here */
+        if (virJSONValueArraySize(virJSONValueObjectGet(op, "rows")) !=
+            (db.port ? 1 : 0))
+            return virOVSDBNewObject("error",
+                                     virJSONValueNewString("timed out"),
+                                     NULL);
+        return virJSONValueNewObject();
+    }
+
+    if (STREQ(name, "select")) {
+        if (STREQ(table, "Open_vSwitch"))
+            return testOVSDBNextCfg();
+        if (STREQ(table, "Bridge"))
+            return testOVSDBRows(db.bridge, TEST_OVSDB_BRIDGE_UUID);
+        return testOVSDBRows(db.port, TEST_OVSDB_PORT_UUID);
+    }
+
+    if (STREQ(name, "insert")) {
+        if (STREQ(table, "Port")) {
+            if (!(row = virJSONValueToString(virJSONValueObjectGet(op, "row"),
+                                             false)))
+                return NULL;
+            virBufferAsprintf(&db.log, " %s", row);
+            VIR_FREE(row);
+            db.port = true;
+        }
+        return virOVSDBNewObject("uuid",
+                                 virOVSDBNewArray(2,
+                                                  virJSONValueNewString("uuid"),
+                                                  virJSONValueNewString(TEST_OVSDB_NEW_UUID)),
+                                 NULL);
+    }
+
+    if (STREQ(name, "mutate")) {
+        if (!(mutation = virJSONValueArrayGet(virJSONValueObjectGet(op, "mutations"), 0)))
+            return NULL;
+        virBufferAsprintf(&db.log, " %s",
+                          virJSONValueGetString(virJSONValueArrayGet(mutation, 1)));
+        if (STREQ(table, "Open_vSwitch")) {
+            db.nextCfg++;
+            return virOVSDBNewObject("count", virJSONValueNewNumberInt(1),
+                                     NULL);
+        }
+        if (STREQ_NULLABLE(virJSONValueGetString(virJSONValueArrayGet(mutation, 1)),
+                           "delete"))
+            db.port = false;
+        return virOVSDBNewObject("count",
+                                 virJSONValueNewNumberInt(db.bridge ? 1 : 0),
+                                 NULL);
+    }
+
+    return NULL;
+}
+
+/* Run the operations of a "transact" request */
+static virJSONValuePtr
+testOVSDBTransact(virJSONValuePtr params)
+{
+    virJSONValuePtr results;
+    size_t i;
+
+    if (STRNEQ_NULLABLE(virJSONValueGetString(virJSONValueArrayGet(params, 0)),
+                        "Open_vSwitch") ||
+        !(results = virJSONValueNewArray()))
+        return NULL;
+
+    for (i = 1; i < virJSONValueArraySize(params); i++) {
+        virJSONValuePtr result;
+
+        if (i > 1)
+            virBufferAddLit(&db.log, ", ");
+        if (!(result = testOVSDBOp(virJSONValueArrayGet(params, i))) ||
+            virJSONValueArrayAppend(results, result) < 0) {
+            virJSONValueFree(result);
+            virJSONValueFree(results);
+            return NULL;
+        }
+    }
+    virBufferAddLit(&db.log, "\n");
+
+    return results;
+}
+
+/* Answer a "monitor" request with the current cur_cfg. If there is a
+ * new configuration, it is then applied and @update set to the
+ * notification about it. */
+static virJSONValuePtr
+testOVSDBMonitor(virJSONValuePtr params, virJSONValuePtr *update)
+{
+    virJSONValuePtr requests = virJSONValueArrayGet(params, 2);
+    virJSONValuePtr result;
+    virJSONValuePtr monitor;
+    virJSONValuePtr changes;
+
+    if (!requests || virJSONValueObjectKeysNumber(requests) != 1)
+        return NULL;
+
+    virBufferAsprintf(&db.log, "monitor %s\n",
+                      virJSONValueObjectGetKey(requests, 0));
+
+    if (!(result = testOVSDBCurCfg(-1, db.curCfg)))
+        return NULL;
+
+    if (db.curCfg != db.nextCfg) {
+        monitor = virJSONValueArraySteal(params, 1);
+        changes = testOVSDBCurCfg(db.curCfg, db.nextCfg);
+        if (!(*update = virOVSDBNewObject("method",
+                                          virJSONValueNewString("update"),
+                                          "params",
+                                          virOVSDBNewArray(2, monitor, changes),
+                                          "id", virJSONValueNewNull(),
+                                          NULL))) {
+            virJSONValueFree(result);
+            return NULL;
+        }
+        db.curCfg = db.nextCfg;
+    }
+
+    return result;
+}
+
+static int
+testOVSDBHandle(const char *line)
+{
+    virJSONValuePtr request;
+    virJSONValuePtr params;
+    virJSONValuePtr result = NULL;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr update = NULL;
+    virJSONValuePtr id = NULL;
+    virJSONValuePtr echo = NULL;
+    const char *method;
+    int ret = -1;
+
+    if (!(request = virJSONValueFromString(line)))
+        return -1;
+
+    /* The answer to our echo request */
+    if (!(method = virJSONValueObjectGetString(request, "method"))) {
+        db.echoReplied = true;
+        ret = 0;
+        goto cleanup;
+    }
+
+    /* The server may ask whether the client is still there at any
+     * time, make sure it gets answered in the middle of a transaction */
+    if (!db.echoed) {
+        if (!(echo = virOVSDBNewObject("method", virJSONValueNewString("echo"),
+                                       "params", virJSONValueNewArray(),
+                                       "id", virJSONValueNewString("echo"),
+                                       NULL)) ||
+            testOVSDBSend(echo) < 0)
+            goto cleanup;
+        db.echoed = true;
+    }
+
+    if (!(params = virJSONValueObjectGet(request, "params")))
+        goto cleanup;
+
+    if (STREQ(method, "monitor")) {
+        result = testOVSDBMonitor(params, &update);
+    } else if (STREQ(method, "monitor_cancel")) {
+        virBufferAddLit(&db.log, "monitor_cancel\n");
+        result = virJSONValueNewObject();
+    } else if (STREQ(method, "transact")) {
+        result = testOVSDBTransact(params);
+    }
+
+    if (!result ||
+        virJSONValueObjectRemoveKey(request, "id", &id) <= 0)
+        goto cleanup;
+
+    reply = virOVSDBNewObject("id", id,
+                              "result", result,
+                              "error", virJSONValueNewNull(),
+                              NULL);
+    result = NULL;
+    if (!reply || testOVSDBSend(reply) < 0)
+        goto cleanup;
+
+    if (update && testOVSDBSend(update) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(request);
+    virJSONValueFree(result);
+    virJSONValueFree(reply);
+    virJSONValueFree(update);
+    virJSONValueFree(echo);
+    return ret;
+}
+
+static void
+testOVSDBThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    char *line;
+
+    /* Any further connection would never be accepted, making the
+     * client time out */
+    if ((db.fd = accept(db.listenfd, NULL, NULL)) < 0)
+        return;
+
+    while ((line = testOVSDBReadLine())) {
+        int rc = testOVSDBHandle(line);
+
+        VIR_FREE(line);
+        if (rc < 0)
+            break;
+    }
+
+    VIR_FORCE_CLOSE(db.fd);
+}
+
+static int
+testOVSDBListen(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if ((db.listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (virStrcpyStatic(addr.sun_path, path) == NULL ||
+        bind(db.listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(db.listenfd, 1) < 0) {
+        VIR_FORCE_CLOSE(db.listenfd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+struct testInfo {
+    const char *name;
+    bool remove;
+    bool bridge;
+    bool port;
+    virNetDevVlanPtr vlan;
+    bool fail;
+    const char *expect;
+};
+
+static int
+testOVSDBPort(const void *opaque)
+{
+    const struct testInfo *info = opaque;
+    virNetDevVPortProfile ovsport;
+    unsigned char vmuuid[VIR_UUID_BUFLEN];
+    virMacAddr mac;
+    char *actual = NULL;
+    int rc;
+    int ret = -1;
+
+    memset(&ovsport, 0, sizeof(ovsport));
+    if (virUUIDParse("c7a5fdbd-edaf-9455-926a-d65c16db1809", vmuuid) < 0 ||
+        virUUIDParse("ad3c1c3d-6e3c-4bd8-a5fd-b1b0a2e4a9f5",
+                     ovsport.interfaceID) < 0 ||
+        virMacAddrParse("52:54:00:12:34:56", &mac) < 0)
+        return -1;
+
+    virBufferFreeAndReset(&db.log);
+    db.bridge = info->bridge;
+    db.port = info->port;
+
+    if (info->remove)
+        rc = virNetDevOpenvswitchRemovePort("br0", "vnet0");
+    else
+        rc = virNetDevOpenvswitchAddPort("br0", "vnet0", &mac, vmuuid,
+                                         &ovsport, info->vlan);
+
+    if ((rc < 0) != info->fail) {
+        fprintf(stderr, "%s unexpectedly\n", info->fail ? "succeeded" : "failed");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    if (!(actual = virBufferContentAndReset(&db.log)))
+        goto cleanup;
+
+    if (STRNEQ(info->expect, actual)) {
+        virtTestDifference(stderr, info->expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char *tmpdir = NULL;
+    char *path = NULL;
+    virThread thread;
+    bool started = false;
+    unsigned int tags[] = { 42, 43 };
+    virNetDevVlan trunk = { true, ARRAY_CARDINALITY(tags), tags,
+                            VIR_NATIVE_VLAN_MODE_UNTAGGED, 42 };
+
+    if (virThreadInitialize() < 0)
+        return EXIT_FAILURE;
+
+    if (VIR_STRDUP(tmpdir, "/tmp/libvirt_XXXXXX") < 0)
+        return EXIT_FAILURE;
+
+    if (!mkdtemp(tmpdir)) {
+        VIR_FREE(tmpdir);
+        return EXIT_FAILURE;
+    }
+
+    if (virAsprintf(&path, "%s/db.sock", tmpdir) < 0 ||
+        testOVSDBListen(path) < 0 ||
+        virOVSDBSetSocket(path) < 0 ||
+        virThreadCreate(&thread, true, testOVSDBThread, NULL) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    started = true;
+
+# define DO_TEST(name, remove, bridge, port, vlan, fail, expect)        \
+    do {                                                                \
+        struct testInfo info = { name, remove, bridge, port, vlan,      \
+                                 fail, expect };                        \
+        if (virtTestRun("OVSDB " name, testOVSDBPort, &info) < 0)       \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("add port", false, true, false, NULL, false,
+            "select Port, select Bridge\n"
+            "wait Port, insert Interface, insert Port "
+            "{\"name\":\"vnet0\",\"interfaces\":[\"named-uuid\",\"iface\"]}, "
+            "mutate Bridge insert, mutate Open_vSwitch +=, "
+            "select Open_vSwitch\n"
+            "monitor Open_vSwitch\n"
+            "monitor_cancel\n");
+    DO_TEST("replace port with vlan trunk", false, true, true, &trunk, false,
+            "select Port, select Bridge\n"
+            "wait Port, mutate Bridge delete, insert Interface, insert Port "
+            "{\"name\":\"vnet0\",\"interfaces\":[\"named-uuid\",\"iface\"],"
+            "\"vlan_mode\":\"native-untagged\","
+            "\"trunks\":[\"set\",[42,43]],\"tag\":42}, "
+            "mutate Bridge insert, mutate Open_vSwitch +=, "
+            "select Open_vSwitch\n"
+            "monitor Open_vSwitch\n"
+            "monitor_cancel\n");
+    DO_TEST("add port to missing bridge", false, false, false, NULL, true,
+            "select Port, select Bridge\n");
+    DO_TEST("remove port", true, true, true, NULL, false,
+            "select Port\n"
+            "mutate Bridge delete\n");
+    DO_TEST("remove missing port", true, true, false, NULL, false,
+            "select Port\n");
+
+    /* Dropping the connection makes the server finish, and checks
+     * that all of the above went over a single one */
+    if (virOVSDBSetSocket(NULL) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    virThreadJoin(&thread);
+    started = false;
+
+    if (!db.echoReplied) {
+        fprintf(stderr, "echo request was not answered\n");
+        ret = -1;
+    }
+
+ cleanup:
+    if (started) {
+        ignore_value(virOVSDBSetSocket(NULL));
+        virThreadJoin(&thread);
+    }
+    VIR_FORCE_CLOSE(db.listenfd);
+    virBufferFreeAndReset(&db.log);
+    if (path)
+        unlink(path);
+    if (tmpdir)
+        rmdir(tmpdir);
+    VIR_FREE(path);
+    VIR_FREE(tmpdir);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WIN32 */
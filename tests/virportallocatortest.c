@@ -115,6 +115,7 @@ int bind(int sockfd ATTRIBUTE_UNUSED,
 #  include "virlog.h"
 #  include "virportallocator.h"
 #  include "virstring.h"
+#  include "virtime.h"
 
 #  define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -242,6 +243,58 @@ static int testAllocReuse(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
+/* Acquires and releases ports with all but a few of a large range in
+ * use; the port released last must be handed out again */
+static int testAllocBusy(const void *args ATTRIBUTE_UNUSED)
+{
+    virPortAllocatorPtr alloc;
+    unsigned short start = 5900, end = 65000;
+    unsigned short port, p;
+    unsigned long long then, now;
+    size_t nports = end - start + 1;
+    size_t i;
+    int ret = -1;
+
+    if (!(alloc = virPortAllocatorNew("test", start, end,
+                                      VIR_PORT_ALLOCATOR_SKIP_BIND_CHECK)))
+        return -1;
+
+    if (virTimeMillisNow(&then) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nports - nports / 100; i++) {
+        if (virPortAllocatorAcquire(alloc, &port) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < 100000; i++) {
+        p = start + (i * 7919) % (nports - nports / 100);
+
+        if (virPortAllocatorRelease(alloc, p) < 0 ||
+            virPortAllocatorAcquire(alloc, &port) < 0)
+            goto cleanup;
+
+        if (port != p) {
+            if (virTestGetDebug())
+                fprintf(stderr, "Expected %d, got %d\n", p, port);
+            goto cleanup;
+        }
+    }
+
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+
+    if (virTestGetVerbose())
+        fprintf(stderr, "\n%zu ports acquired and %zu released and "
+                "reacquired in %llu ms\n", nports - nports / 100, i,
+                now - then);
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(alloc);
+    return ret;
+}
+
 
 static int
 mymain(void)
@@ -254,6 +307,9 @@ mymain(void)
     if (virtTestRun("Test alloc reuse", testAllocReuse, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Test alloc busy range", testAllocBusy, NULL) < 0)
+        ret = -1;
+
     setenv("LIBVIRT_TEST_IPV4ONLY", "really", 1);
 
     if (virtTestRun("Test IPv4-only alloc all", testAllocAll, NULL) < 0)
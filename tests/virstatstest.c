@@ -0,0 +1,330 @@
+/*
+ * virstatstest.c: check that interface statistics read over netlink
+ * match /proc/net/dev, and time reading them one by one against all
+ * at once
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+# include <sched.h>
+# include <unistd.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+
+# include "internal.h"
+# include "viralloc.h"
+# include "virfile.h"
+# include "virnetdev.h"
+# include "virnetdevveth.h"
+# include "virstats.h"
+# include "virstring.h"
+# include "virtime.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+/* The test runs in a network namespace of its own, so these can't
+ * clash with anything on the host */
+# define TEST_LINKS 100
+# define TEST_ROUNDS 10
+# define TEST_PACKETS 20
+
+/* Both ends of the veth pairs, then lo */
+static char *names[2 * TEST_LINKS + 1];
+
+/* What virNetInterfaceStats used to do */
+static int
+testProcNetDevStats(const char *path,
+                    virDomainInterfaceStatsPtr stats)
+{
+    size_t path_len = strlen(path);
+    FILE *fp;
+    char line[256], *colon;
+    int ret = -1;
+
+    if (!(fp = fopen("/proc/net/dev", "r")))
+        return -1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        long long dummy;
+
+        if (!(colon = strchr(line, ':')))
+            continue;
+        *colon = '\0';
+        if (colon - path_len < line || STRNEQ(colon - path_len, path))
+            continue;
+
+        if (sscanf(colon + 1,
+                   "%lld %lld %lld %lld %lld %lld %lld %lld "
+                   "%lld %lld %lld %lld %lld %lld %lld %lld",
+                   &stats->tx_bytes, &stats->tx_packets,
+                   &stats->tx_errs, &stats->tx_drop,
+                   &dummy, &dummy, &dummy, &dummy,
+                   &stats->rx_bytes, &stats->rx_packets,
+                   &stats->rx_errs, &stats->rx_drop,
+                   &dummy, &dummy, &dummy, &dummy) == 16)
+            ret = 0;
+        break;
+    }
+
+    VIR_FORCE_FCLOSE(fp);
+    return ret;
+}
+
+static int
+testStatsCompare(const char *path,
+                 const char *what,
+                 virDomainInterfaceStatsPtr expect,
+                 virDomainInterfaceStatsPtr actual)
+{
+    if (memcmp(expect, actual, sizeof(*expect)) == 0)
+        return 0;
+
+    fprintf(stderr,
+            "%s: %s: rx %lld/%lld/%lld/%lld tx %lld/%lld/%lld/%lld, "
+            "expected rx %lld/%lld/%lld/%lld tx %lld/%lld/%lld/%lld\n",
+            path, what,
+            actual->rx_bytes, actual->rx_packets,
+            actual->rx_errs, actual->rx_drop,
+            actual->tx_bytes, actual->tx_packets,
+            actual->tx_errs, actual->tx_drop,
+            expect->rx_bytes, expect->rx_packets,
+            expect->rx_errs, expect->rx_drop,
+            expect->tx_bytes, expect->tx_packets,
+            expect->tx_errs, expect->tx_drop);
+    return -1;
+}
+
+/* Have some traffic on lo, which nothing else in the namespace
+ * touches, so its counters are non-zero but don't change anymore */
+static int
+testStatsTraffic(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    char buf[64] = "";
+    int rfd = -1;
+    int wfd = -1;
+    size_t i;
+    int ret = -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((rfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+        (wfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+        bind(rfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(rfd, (struct sockaddr *)&addr, &addrlen) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_PACKETS; i++) {
+        if (sendto(wfd, buf, sizeof(buf), 0,
+                   (struct sockaddr *)&addr, addrlen) < 0 ||
+            recv(rfd, buf, sizeof(buf), 0) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(rfd);
+    VIR_FORCE_CLOSE(wfd);
+    return ret;
+}
+
+static int
+testStatsMatch(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetInterfaceStatsTablePtr table = NULL;
+    struct _virDomainInterfaceStats expect;
+    struct _virDomainInterfaceStats actual;
+    size_t i;
+    int ret = -1;
+
+    if (!(table = virNetInterfaceStatsTableNew()))
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(names); i++) {
+        memset(&expect, 0, sizeof(expect));
+        if (testProcNetDevStats(names[i], &expect) < 0) {
+            fprintf(stderr, "%s: missing from /proc/net/dev\n", names[i]);
+            goto cleanup;
+        }
+
+        memset(&actual, 0, sizeof(actual));
+        if (virNetInterfaceStats(names[i], &actual) < 0 ||
+            testStatsCompare(names[i], "one by one", &expect, &actual) < 0)
+            goto cleanup;
+
+        memset(&actual, 0, sizeof(actual));
+        if (virNetInterfaceStatsTableGet(table, names[i], &actual) < 0 ||
+            testStatsCompare(names[i], "all at once", &expect, &actual) < 0)
+            goto cleanup;
+    }
+
+    if (expect.rx_packets != TEST_PACKETS ||
+        expect.tx_packets != TEST_PACKETS) {
+        fprintf(stderr, "lo: traffic not accounted for\n");
+        goto cleanup;
+    }
+
+    if (virNetInterfaceStats("nosuchnet0", &actual) == 0 ||
+        virNetInterfaceStatsTableGet(table, "nosuchnet0", &actual) == 0) {
+        fprintf(stderr, "nosuchnet0: unexpected statistics\n");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    ret = 0;
+
+ cleanup:
+    virNetInterfaceStatsTableFree(table);
+    return ret;
+}
+
+static int
+testStatsTime(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetInterfaceStatsTablePtr table = NULL;
+    struct _virDomainInterfaceStats stats;
+    unsigned long long start;
+    unsigned long long proc;
+    unsigned long long single;
+    unsigned long long batch;
+    size_t round;
+    size_t i;
+    int ret = -1;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        for (i = 0; i < ARRAY_CARDINALITY(names); i++) {
+            if (testProcNetDevStats(names[i], &stats) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (virTimeMillisNow(&proc) < 0)
+        goto cleanup;
+
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        for (i = 0; i < ARRAY_CARDINALITY(names); i++) {
+            if (virNetInterfaceStats(names[i], &stats) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (virTimeMillisNow(&single) < 0)
+        goto cleanup;
+
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        if (!(table = virNetInterfaceStatsTableNew()))
+            goto cleanup;
+        for (i = 0; i < ARRAY_CARDINALITY(names); i++) {
+            if (virNetInterfaceStatsTableGet(table, names[i], &stats) < 0)
+                goto cleanup;
+        }
+        virNetInterfaceStatsTableFree(table);
+        table = NULL;
+    }
+
+    if (virTimeMillisNow(&batch) < 0)
+        goto cleanup;
+
+    if (virTestGetVerbose())
+        fprintf(stderr,
+                "\n%zu x %zu interfaces: /proc/net/dev %llu ms, "
+                "netlink one by one %llu ms, netlink all at once %llu ms\n",
+                (size_t) TEST_ROUNDS, ARRAY_CARDINALITY(names),
+                proc - start, single - proc, batch - single);
+
+    ret = 0;
+
+ cleanup:
+    virNetInterfaceStatsTableFree(table);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    char *peer = NULL;
+    size_t i;
+    int ret = 0;
+
+    /* Needs privileges, and must not touch the host's interfaces */
+    if (unshare(CLONE_NEWNET) < 0)
+        return EXIT_AM_SKIP;
+
+    if (virNetDevSetOnline("lo", true) < 0)
+        return EXIT_AM_SKIP;
+
+    for (i = 0; i < TEST_LINKS; i++) {
+        if (virAsprintf(&names[2 * i], "statsa%zu", i) < 0 ||
+            virAsprintf(&peer, "statsb%zu", i) < 0 ||
+            virNetDevVethCreate(&names[2 * i], &peer) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+        names[2 * i + 1] = peer;
+        peer = NULL;
+    }
+
+    /* Last, so the checks end with its counters */
+    if (VIR_STRDUP(names[2 * TEST_LINKS], "lo") < 0 ||
+        testStatsTraffic() < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (virtTestRun("interface stats match", testStatsMatch, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("interface stats time", testStatsTime, NULL) < 0)
+        ret = -1;
+
+ cleanup:
+    for (i = 0; i < TEST_LINKS; i++) {
+        if (names[2 * i])
+            ignore_value(virNetDevVethDelete(names[2 * i]));
+    }
+    for (i = 0; i < ARRAY_CARDINALITY(names); i++)
+        VIR_FREE(names[i]);
+    VIR_FREE(peer);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* defined(__linux__) && defined(HAVE_LIBNL) */
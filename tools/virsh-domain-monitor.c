@@ -2032,6 +2032,10 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("enforce requested stats parameters"),
     },
+    {.name = "cached",
+     .type = VSH_OT_BOOL,
+     .help = N_("allow statistics sampled in the background"),
+    },
     {.name = "domain",
      .type = VSH_OT_ARGV,
      .flags = VSH_OFLAG_NONE,
@@ -2125,6 +2129,9 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "enforce"))
         flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS;
 
+    if (vshCommandOptBool(cmd, "cached"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED;
+
     if (vshCommandOptBool(cmd, "domain")) {
         if (VIR_ALLOC_N(domlist, 1) < 0)
             goto cleanup;
@@ -595,6 +595,10 @@ static const vshCmdOptDef opts_pool_refresh[] = {
      .flags = VSH_OFLAG_REQ,
      .help = N_("pool name or uuid")
     },
+    {.name = "list-only",
+     .type = VSH_OT_BOOL,
+     .help = N_("only list volumes, look up their details on demand")
+    },
     {.name = NULL}
 };
 
@@ -604,11 +608,15 @@ cmdPoolRefresh(vshControl *ctl, const vshCmd *cmd)
     virStoragePoolPtr pool;
     bool ret = true;
     const char *name;
+    unsigned int flags = 0;
+
+    if (vshCommandOptBool(cmd, "list-only"))
+        flags |= VIR_STORAGE_POOL_REFRESH_LIST_ONLY;
 
     if (!(pool = vshCommandOptPool(ctl, cmd, "pool", &name)))
         return false;
 
-    if (virStoragePoolRefresh(pool, 0) == 0) {
+    if (virStoragePoolRefresh(pool, flags) == 0) {
         vshPrint(ctl, _("Pool %s refreshed\n"), name);
     } else {
         vshError(ctl, _("Failed to refresh pool %s"), name);
@@ -1550,6 +1558,69 @@ cmdPoolInfo(vshControl *ctl, const vshCmd *cmd)
     return ret;
 }
 
+/*
+ * "pool-job-info" command
+ */
+static const vshCmdInfo info_pool_job_info[] = {
+    {.name = "help",
+     .data = N_("show the job of a storage pool")
+    },
+    {.name = "desc",
+     .data = N_("Show the pool level operation, such as a refresh, in "
+                "progress on a storage pool.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_pool_job_info[] = {
+    {.name = "pool",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("pool name or uuid")
+    },
+    {.name = NULL}
+};
+
+VIR_ENUM_DECL(vshStoragePoolJob)
+VIR_ENUM_IMPL(vshStoragePoolJob,
+              VIR_STORAGE_POOL_JOB_LAST,
+              N_("None"),
+              N_("Start"),
+              N_("Build"),
+              N_("Refresh"),
+              N_("Destroy"),
+              N_("Delete"))
+
+static bool
+cmdPoolJobInfo(vshControl *ctl, const vshCmd *cmd)
+{
+    virStoragePoolJobInfo info;
+    virStoragePoolPtr pool;
+    const char *type;
+    bool ret = false;
+
+    if (!(pool = vshCommandOptPool(ctl, cmd, "pool", NULL)))
+        return false;
+
+    if (virStoragePoolGetJobInfo(pool, &info, 0) < 0)
+        goto cleanup;
+
+    if (!(type = vshStoragePoolJobTypeToString(info.type)))
+        type = N_("unknown");
+
+    vshPrint(ctl, "%-15s %s\n", _("Job type:"), _(type));
+    if (info.type != VIR_STORAGE_POOL_JOB_NONE)
+        vshPrint(ctl, "%-15s %llu ms\n", _("Time elapsed:"),
+                 info.timeElapsed);
+    vshPrint(ctl, "%-15s %u\n", _("Volume jobs:"), info.volJobs);
+
+    ret = true;
+
+ cleanup:
+    virStoragePoolFree(pool);
+    return ret;
+}
+
 /*
  * "pool-name" command
  */
@@ -1862,6 +1933,12 @@ const vshCmdDef storagePoolCmds[] = {
      .info = info_pool_info,
      .flags = 0
     },
+    {.name = "pool-job-info",
+     .handler = cmdPoolJobInfo,
+     .opts = opts_pool_job_info,
+     .info = info_pool_job_info,
+     .flags = 0
+    },
     {.name = "pool-list",
      .handler = cmdPoolList,
      .opts = opts_pool_list,
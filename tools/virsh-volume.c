@@ -178,6 +178,10 @@ static const vshCmdOptDef opts_vol_create_as[] = {
      .type = VSH_OT_BOOL,
      .help = N_("preallocate metadata (for qcow2 instead of full allocation)")
     },
+    {.name = "background",
+     .type = VSH_OT_BOOL,
+     .help = N_("allocate the volume in a background job")
+    },
     {.name = NULL}
 };
 
@@ -204,6 +208,8 @@ cmdVolCreateAs(vshControl *ctl, const vshCmd *cmd)
 
     if (vshCommandOptBool(cmd, "prealloc-metadata"))
         flags |= VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA;
+    if (vshCommandOptBool(cmd, "background"))
+        flags |= VIR_STORAGE_VOL_CREATE_BACKGROUND;
     if (!(pool = vshCommandOptPool(ctl, cmd, "pool", NULL)))
         return false;
 
@@ -363,6 +369,10 @@ static const vshCmdOptDef opts_vol_create[] = {
      .type = VSH_OT_BOOL,
      .help = N_("preallocate metadata (for qcow2 instead of full allocation)")
     },
+    {.name = "background",
+     .type = VSH_OT_BOOL,
+     .help = N_("allocate the volume in a background job")
+    },
     {.name = NULL}
 };
 
@@ -378,6 +388,8 @@ cmdVolCreate(vshControl *ctl, const vshCmd *cmd)
 
     if (vshCommandOptBool(cmd, "prealloc-metadata"))
         flags |= VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA;
+    if (vshCommandOptBool(cmd, "background"))
+        flags |= VIR_STORAGE_VOL_CREATE_BACKGROUND;
     if (!(pool = vshCommandOptPool(ctl, cmd, "pool", NULL)))
         return false;
 
@@ -976,6 +988,194 @@ cmdVolWipe(vshControl *ctl, const vshCmd *cmd)
     return ret;
 }
 
+/*
+ * "vol-job-info" command
+ */
+static const vshCmdInfo info_vol_job_info[] = {
+    {.name = "help",
+     .data = N_("show the job of a vol")
+    },
+    {.name = "desc",
+     .data = N_("Show progress of the long running operation, such as a "
+                "wipe, active on a volume.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_vol_job_info[] = {
+    {.name = "vol",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("vol name, key or path")
+    },
+    {.name = "pool",
+     .type = VSH_OT_STRING,
+     .help = N_("pool name or uuid")
+    },
+    {.name = NULL}
+};
+
+VIR_ENUM_DECL(vshStorageVolJob)
+VIR_ENUM_IMPL(vshStorageVolJob,
+              VIR_STORAGE_VOL_JOB_TYPE_LAST,
+              N_("Unknown"),
+              N_("Wipe"),
+              N_("Build"))
+
+static bool
+cmdVolJobInfo(vshControl *ctl, const vshCmd *cmd)
+{
+    virStorageVolJobInfo info;
+    virStorageVolPtr vol;
+    const char *name;
+    const char *type;
+    bool ret = false;
+    int rc;
+
+    if (!(vol = vshCommandOptVol(ctl, cmd, "vol", "pool", &name)))
+        return false;
+
+    if ((rc = virStorageVolGetJobInfo(vol, &info, 0)) < 0)
+        goto cleanup;
+
+    if (rc == 0) {
+        vshPrint(ctl, _("No current job for vol %s\n"), name);
+        ret = true;
+        goto cleanup;
+    }
+
+    if (!(type = vshStorageVolJobTypeToString(info.type)))
+        type = vshStorageVolJobTypeToString(VIR_STORAGE_VOL_JOB_TYPE_UNKNOWN);
+
+    vshPrint(ctl, "%-15s %s\n", _("Job type:"), _(type));
+    vshPrint(ctl, "%-15s %llu\n", _("Processed:"), info.cur);
+    vshPrint(ctl, "%-15s %llu\n", _("Total:"), info.end);
+    if (info.end)
+        vshPrint(ctl, "%-15s %d %%\n", _("Progress:"),
+                 (int)(100.0 * info.cur / info.end));
+    if (info.bandwidth)
+        vshPrint(ctl, "%-15s %llu bytes/s\n", _("Bandwidth:"),
+                 info.bandwidth);
+
+    ret = true;
+
+ cleanup:
+    virStorageVolFree(vol);
+    return ret;
+}
+
+/*
+ * "vol-job-speed" command
+ */
+static const vshCmdInfo info_vol_job_speed[] = {
+    {.name = "help",
+     .data = N_("limit the bandwidth of the job of a vol")
+    },
+    {.name = "desc",
+     .data = N_("Set the maximum rate at which the long running operation "
+                "on a volume may write, 0 for no limit. When no job is "
+                "active, the limit applies to the next one.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_vol_job_speed[] = {
+    {.name = "vol",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("vol name, key or path")
+    },
+    {.name = "bandwidth",
+     .type = VSH_OT_INT,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("bandwidth limit in bytes/s")
+    },
+    {.name = "pool",
+     .type = VSH_OT_STRING,
+     .help = N_("pool name or uuid")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdVolJobSpeed(vshControl *ctl, const vshCmd *cmd)
+{
+    virStorageVolPtr vol;
+    unsigned long long bandwidth = 0;
+    const char *name;
+    bool ret = false;
+
+    if (!(vol = vshCommandOptVol(ctl, cmd, "vol", "pool", &name)))
+        return false;
+
+    if (vshCommandOptULongLong(cmd, "bandwidth", &bandwidth) < 0) {
+        vshError(ctl, "%s", _("Unable to parse bandwidth value"));
+        goto cleanup;
+    }
+
+    if (virStorageVolJobSetSpeed(vol, bandwidth, 0) < 0) {
+        vshError(ctl, _("Failed to set bandwidth of vol %s"), name);
+        goto cleanup;
+    }
+
+    vshPrint(ctl, _("Bandwidth of vol %s set to %llu bytes/s\n"),
+             name, bandwidth);
+    ret = true;
+
+ cleanup:
+    virStorageVolFree(vol);
+    return ret;
+}
+
+/*
+ * "vol-job-abort" command
+ */
+static const vshCmdInfo info_vol_job_abort[] = {
+    {.name = "help",
+     .data = N_("abort the job of a vol")
+    },
+    {.name = "desc",
+     .data = N_("Cancel the long running operation active on a volume.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_vol_job_abort[] = {
+    {.name = "vol",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("vol name, key or path")
+    },
+    {.name = "pool",
+     .type = VSH_OT_STRING,
+     .help = N_("pool name or uuid")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdVolJobAbort(vshControl *ctl, const vshCmd *cmd)
+{
+    virStorageVolPtr vol;
+    const char *name;
+    bool ret = false;
+
+    if (!(vol = vshCommandOptVol(ctl, cmd, "vol", "pool", &name)))
+        return false;
+
+    if (virStorageVolJobAbort(vol, 0) < 0) {
+        vshError(ctl, _("Failed to abort job of vol %s"), name);
+        goto cleanup;
+    }
+
+    vshPrint(ctl, _("Job of vol %s aborted\n"), name);
+    ret = true;
+
+ cleanup:
+    virStorageVolFree(vol);
+    return ret;
+}
+
 
 VIR_ENUM_DECL(vshStorageVol)
 VIR_ENUM_IMPL(vshStorageVol,
@@ -1805,6 +2005,24 @@ const vshCmdDef storageVolCmds[] = {
      .info = info_vol_info,
      .flags = 0
     },
+    {.name = "vol-job-abort",
+     .handler = cmdVolJobAbort,
+     .opts = opts_vol_job_abort,
+     .info = info_vol_job_abort,
+     .flags = 0
+    },
+    {.name = "vol-job-info",
+     .handler = cmdVolJobInfo,
+     .opts = opts_vol_job_info,
+     .info = info_vol_job_info,
+     .flags = 0
+    },
+    {.name = "vol-job-speed",
+     .handler = cmdVolJobSpeed,
+     .opts = opts_vol_job_speed,
+     .info = info_vol_job_speed,
+     .flags = 0
+    },
     {.name = "vol-key",
      .handler = cmdVolKey,
      .opts = opts_vol_key,